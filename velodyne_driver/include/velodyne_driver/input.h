@@ -25,6 +25,9 @@
  *     velodyne::InputSocket -- derived class reads live data from the
  *                      device via a UDP socket
  *
+ *     velodyne::InputPacketRing -- derived class reads live data
+ *                      from a memory-mapped PACKET_MMAP receive ring
+ *
  *     velodyne::InputPCAP -- derived class provides a similar interface
  *                      from a PCAP dump file
  */
@@ -34,16 +37,85 @@
 
 #include <unistd.h>
 #include <stdio.h>
-#include <pcap.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <vector>
 
 #include <ros/ros.h>
 #include <velodyne_msgs/VelodynePacket.h>
+#include <velodyne_driver/pcap_file.h>
 
 namespace velodyne_driver
 {
   static uint16_t DATA_PORT_NUMBER = 2368;     // default data port
 
+  /** @brief Locate the UDP payload of a captured Ethernet frame.
+   *
+   *  Skips up to two 802.1Q/802.1ad VLAN tags and rejects anything
+   *  but unfragmented IPv4/UDP.
+   *
+   *  @param frame first byte of the Ethernet header
+   *  @param len captured frame length in bytes
+   *  @param payload returns the first UDP payload byte
+   *  @param payload_len returns the UDP payload length in bytes
+   *  @param src_addr returns the IPv4 source address (network order)
+   *  @param dst_port returns the UDP destination port (host order)
+   *  @returns true if a UDP payload was found
+   */
+  bool parseUdpFrame(const uint8_t *frame, size_t len,
+                     const uint8_t **payload, size_t *payload_len,
+                     uint32_t *src_addr, uint16_t *dst_port);
+
+  /** @brief Time stamp of a packet received at a time.
+   *
+   *  Marks the first firing of the packet: the time the device takes
+   *  to accumulate it is subtracted, and time_offset added.
+   */
+  ros::Time packetStamp(const ros::Time &received, double time_offset);
+
+  /** @brief recvmmsg() buffers for batches of UDP datagrams.
+   *
+   *  Receives datagrams into caller supplied buffers with their
+   *  sender addresses and kernel receive times.  The socket must
+   *  have SO_TIMESTAMPNS enabled for those.
+   */
+  class PacketBatch
+  {
+  public:
+    PacketBatch() {}
+
+    /** @brief Set the largest batch. */
+    void resize(int size);
+    int size() const { return msgs_.size(); }
+
+    /** @brief Receive datagram i of the next batch into a packet buffer. */
+    void setBuffer(int i, uint8_t *data);
+
+    /** @brief Read up to count queued datagrams, without blocking.
+     *
+     *  @returns number of datagrams read, or -1 with errno set
+     */
+    int receive(int fd, int count);
+
+    /** @returns true if datagram i is one whole Velodyne packet */
+    bool complete(int i) const;
+    size_t length(int i) const { return msgs_[i].msg_len; }
+    const sockaddr_in &sender(int i) const { return senders_[i]; }
+
+    /** @brief Packet stamp of datagram i, see packetStamp().
+     *
+     *  Kernel receive times are wall clock times.  With simulated
+     *  time, or without one, the datagram counts as received now.
+     */
+    ros::Time stamp(int i, const ros::Time &now, double time_offset);
+
+  private:
+    std::vector<mmsghdr> msgs_;
+    std::vector<iovec> iovecs_;
+    std::vector<sockaddr_in> senders_;
+    std::vector<char> cmsg_buf_;        ///< SCM_TIMESTAMPNS control data
+  };
+
   /** @brief Velodyne input base class */
   class Input
   {
@@ -62,10 +134,36 @@ namespace velodyne_driver
     virtual int getPacket(velodyne_msgs::VelodynePacket *pkt,
                           const double time_offset) = 0;
 
+    /** @brief Read a batch of Velodyne packets.
+     *
+     * Fills between one and @a max_packets consecutive packet
+     * messages.  The default implementation reads a single packet
+     * using getPacket().
+     *
+     * @param pkts points to an array of at least max_packets messages
+     * @param max_packets maximum number of packets to read
+     * @param npackets returns the number of packets actually read
+     *
+     * @returns same values as getPacket()
+     */
+    virtual int getPackets(velodyne_msgs::VelodynePacket *pkts,
+                           int max_packets, int *npackets,
+                           const double time_offset);
+
+    /** @brief Limit how long a live input waits for packets.
+     *
+     * A read that times out returns 1, so the caller may publish
+     * what it has.  Files are not affected.
+     *
+     * @param timeout_ms maximum wait [ms], one second by default
+     */
+    void setTimeout(int timeout_ms) { timeout_ms_ = timeout_ms; }
+
   protected:
     ros::NodeHandle private_nh_;
     uint16_t port_;
     std::string devip_str_;
+    int timeout_ms_;                    ///< live input wait limit [ms]
   };
 
   /** @brief Live Velodyne input from socket. */
@@ -78,23 +176,75 @@ namespace velodyne_driver
 
     virtual int getPacket(velodyne_msgs::VelodynePacket *pkt, 
                           const double time_offset);
+    virtual int getPackets(velodyne_msgs::VelodynePacket *pkts,
+                           int max_packets, int *npackets,
+                           const double time_offset);
     void setDeviceIP( const std::string& ip );
   private:
 
+    int waitForData(void);
+    bool acceptPacket(const sockaddr_in &sender, ssize_t nbytes) const;
+
   private:
     int sockfd_;
     in_addr devip_;
+
+    // recvmmsg() batch buffers, only used when recv_batch > 1
+    int batch_size_;                    ///< max datagrams per recvmmsg()
+    PacketBatch batch_;
   };
 
 
+  /** @brief Live Velodyne input from a PACKET_MMAP receive ring.
+   *
+   *  Frames are captured from a network interface into a TPACKET_V3
+   *  ring shared with the kernel.  Reading a packet only copies its
+   *  UDP payload; the kernel is only entered when the ring is empty.
+   *  Requires the CAP_NET_RAW capability.
+   */
+  class InputPacketRing: public Input
+  {
+  public:
+    InputPacketRing(ros::NodeHandle private_nh,
+                    const std::string &interface,
+                    uint16_t port = DATA_PORT_NUMBER);
+    virtual ~InputPacketRing();
+
+    virtual int getPacket(velodyne_msgs::VelodynePacket *pkt,
+                          const double time_offset);
+    virtual int getPackets(velodyne_msgs::VelodynePacket *pkts,
+                           int max_packets, int *npackets,
+                           const double time_offset);
+
+  private:
+    int waitForBlock(void);
+    bool nextPacket(velodyne_msgs::VelodynePacket *pkt,
+                    const double time_offset);
+    void releaseBlock(void);
+
+    int fd_;
+    uint8_t *ring_;                     ///< mmap()ed ring memory
+    size_t ring_size_;
+    size_t block_size_;
+    int nblocks_;
+    int block_;                         ///< current ring block
+    uint8_t *frame_;                    ///< next frame in current block
+    uint32_t frames_left_;              ///< frames left in current block
+    in_addr devip_;
+  };
+
   /** @brief Velodyne input from PCAP dump file.
    *
    * Dump files can be grabbed by libpcap, Velodyne's DSR software,
-   * ethereal, wireshark, tcpdump, or the \ref vdump_command.
+   * ethereal, wireshark, tcpdump, or the \ref vdump_command.  They
+   * are memory-mapped and replayed with the capture timing, scaled
+   * by replay_rate, or as fast as possible.
    */
   class InputPCAP: public Input
   {
   public:
+    /** @param packet_rate unused, kept for source compatibility:
+     *         replay follows the capture timing */
     InputPCAP(ros::NodeHandle private_nh,
               uint16_t port = DATA_PORT_NUMBER,
               double packet_rate = 0.0,
@@ -102,22 +252,40 @@ namespace velodyne_driver
               bool read_once=false,
               bool read_fast=false,
               double repeat_delay=0.0);
-    virtual ~InputPCAP();
+    virtual ~InputPCAP() {}
 
     virtual int getPacket(velodyne_msgs::VelodynePacket *pkt, 
                           const double time_offset);
-    void setDeviceIP( const std::string& ip );
+
+    /** @brief Continue replay at a capture time.
+     *
+     *  @param offset seconds after the first packet
+     *  @returns false if no packet is that late
+     */
+    bool seekTime(double offset);
+
+    /** @brief Continue replay at a device revolution.
+     *
+     *  @param revolution count of azimuth wraps after the first packet
+     *  @returns false if there are not that many
+     */
+    bool seekRevolution(size_t revolution);
 
   private:
-    ros::Rate packet_rate_;
+    void pace(uint64_t stamp);
+
     std::string filename_;
-    pcap_t *pcap_;
-    bpf_program pcap_packet_filter_;
-    char errbuf_[PCAP_ERRBUF_SIZE];
-    bool empty_;
+    PcapFile file_;
+    PcapFile::Position start_;          ///< replay start, for repeating
     bool read_once_;
-    bool read_fast_;
+    double replay_rate_;                ///< capture time multiple, 0 for fast
     double repeat_delay_;
+
+    // replay timing: packet stamps map to wall time from a base
+    bool paced_;                        ///< have a base
+    ros::WallTime base_time_;
+    uint64_t base_stamp_;               ///< [ns]
+    uint64_t last_stamp_;               ///< [ns]
   };
 
 } // velodyne_driver namespace
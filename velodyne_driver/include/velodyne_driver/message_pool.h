@@ -0,0 +1,85 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (C) 2015, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  Preallocated messages for the Velodyne device threads.
+ */
+
+#ifndef __VELODYNE_MESSAGE_POOL_H
+#define __VELODYNE_MESSAGE_POOL_H
+
+#include <stdint.h>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+namespace velodyne_driver
+{
+  /** \brief A ring of messages reused once every subscriber has
+   *         released them.
+   *
+   *  Published messages are shared with nodelets and must not change,
+   *  so a message is only handed out again when the pool holds its
+   *  last reference.  Only one thread may use a pool.
+   */
+  template <class M>
+  class MessagePool
+  {
+  public:
+
+    typedef boost::shared_ptr<M> Ptr;
+
+    /** @param size number of messages to allocate now */
+    explicit MessagePool(size_t size = 0):
+      next_(0),
+      misses_(0)
+    {
+      resize(size);
+    }
+
+    /** @brief Allocate messages until the pool holds size of them. */
+    void resize(size_t size)
+    {
+      while (messages_.size() < size)
+        messages_.push_back(Ptr(new M));
+    }
+
+    size_t size() const { return messages_.size(); }
+
+    /** pooled message, for preparing it in advance */
+    M &operator[](size_t i) { return *messages_[i]; }
+
+    /** @returns a message no one else holds, its contents left from
+     *           its last use, or a new one if all are in use */
+    Ptr get()
+    {
+      for (size_t n = 0; n < messages_.size(); ++n)
+        {
+          const Ptr &msg = messages_[next_];
+          next_ = (next_ + 1) % messages_.size();
+          if (msg.unique())
+            return msg;
+        }
+      ++misses_;
+      return Ptr(new M);
+    }
+
+    /** @returns messages allocated because the pool was in use */
+    uint64_t misses() const { return misses_; }
+
+  private:
+
+    std::vector<Ptr> messages_;
+    size_t next_;                       ///< next message to try
+    uint64_t misses_;
+  };
+
+} // velodyne_driver namespace
+
+#endif // __VELODYNE_MESSAGE_POOL_H
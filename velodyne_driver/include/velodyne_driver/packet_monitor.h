@@ -0,0 +1,119 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (C) 2015, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  Packet loss and reordering checks for the Velodyne 3D LIDARs.
+ *
+ *  Successive packets of a device advance its time stamp (microseconds
+ *  past the hour, in the last bytes of each packet) by one packet
+ *  interval, and its azimuth by the angle it turns in that time.  A
+ *  larger step means packets were lost; an earlier time stamp, a
+ *  packet arriving out of order.  The original HDL-64E has no packet
+ *  time stamp, so only its azimuths are checked.
+ */
+
+#ifndef __VELODYNE_PACKET_MONITOR_H
+#define __VELODYNE_PACKET_MONITOR_H
+
+#include <stdint.h>
+#include <deque>
+
+#include <diagnostic_updater/diagnostic_updater.h>
+#include <velodyne_msgs/VelodyneScan.h>
+#include <velodyne_msgs/VelodyneScanStatus.h>
+
+namespace velodyne_driver
+{
+  /** @brief Azimuth of a packet, taken from its first firing block.
+   *
+   *  @returns rotation in hundredths of a degree
+   */
+  inline int packetAzimuth(const velodyne_msgs::VelodynePacket &pkt)
+  {
+    // bytes 0-1 are the block header, 2-3 the little-endian rotation
+    return pkt.data[2] | (pkt.data[3] << 8);
+  }
+
+  /** @returns device time stamp of a packet [µs past the hour] */
+  inline uint32_t packetDeviceTime(const velodyne_msgs::VelodynePacket &pkt)
+  {
+    // bytes 1200-1203, little-endian, before the two status bytes
+    return pkt.data[1200] | (pkt.data[1201] << 8)
+      | (pkt.data[1202] << 16) | ((uint32_t) pkt.data[1203] << 24);
+  }
+
+  /** \brief Detects lost and reordered packets across scans. */
+  class PacketMonitor
+  {
+  public:
+
+    PacketMonitor();
+
+    /** @param packet_rate expected packets per second
+     *  @param rpm device rotation rate
+     *  @param device_time packets carry a device time stamp */
+    void configure(double packet_rate, double rpm, bool device_time);
+
+    /** @brief Check the packets of a scan, continuing from the last one.
+     *
+     *  A packet arriving out of order is no longer counted lost, and
+     *  the missing sector it falls in shrinks or is split in two,
+     *  also when it was reported with an earlier scan.  With device
+     *  time stamps, packets out of order are sorted back into place.
+     *
+     *  @param scan packets just read
+     *  @param status returns the packet counts and missing sectors
+     */
+    void check(velodyne_msgs::VelodyneScan &scan,
+               velodyne_msgs::VelodyneScanStatus &status);
+
+    /** count a scan published incomplete at its deadline */
+    void countDeadline() { ++deadline_scans_; ++period_deadline_; }
+
+    /** Diagnostic task: packets lost or reordered since the last report. */
+    void report(diagnostic_updater::DiagnosticStatusWrapper &status);
+
+  private:
+
+    /** \brief Packets missing between two received ones.
+     *
+     *  Positions are device time [µs] since the first packet, or its
+     *  azimuth [1/100 degree] unwrapped across revolutions without
+     *  device time stamps.
+     */
+    struct Gap
+    {
+      int64_t start, end;               ///< positions of the packets around
+      int64_t lost;                     ///< packets still missing
+      double first_azimuth;             ///< of the first one [1/100 degree]
+      int end_azimuth;                  ///< of the packet after
+      bool current;                     ///< found in the scan being checked
+    };
+
+    void fill(int64_t position, int azimuth,
+              velodyne_msgs::VelodyneScanStatus &status);
+
+    bool device_time_;
+    double interval_;                   ///< packet interval [µs]
+    double azimuth_step_;               ///< per packet [1/100 degree]
+    bool started_;                      ///< a packet was checked
+    uint32_t last_time_;                ///< latest device time [µs]
+    int last_azimuth_;                  ///< of that packet [1/100 degree]
+    int64_t position_;                  ///< of that packet, see Gap
+    std::deque<Gap> gaps_;              ///< recent gaps, oldest first
+
+    // totals, and since the last report
+    uint64_t lost_, reordered_, deadline_scans_, sectors_;
+    uint64_t period_lost_, period_reordered_, period_deadline_;
+  };
+
+} // velodyne_driver namespace
+
+#endif // __VELODYNE_PACKET_MONITOR_H
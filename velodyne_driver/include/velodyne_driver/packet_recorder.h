@@ -0,0 +1,127 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (C) 2009, 2010 Austin Robot Technology, Jack O'Quin
+ *  Copyright (C) 2015, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  Raw packet recorder for the Velodyne 3D LIDARs.
+ *
+ *  The driver pushes each packet it reads into a lock-free single
+ *  producer, single consumer ring.  A writer thread drains the ring
+ *  into classic pcap files (nanosecond time stamps) that InputPCAP
+ *  and the usual tools can read, so recording never makes the driver
+ *  wait for the disk.
+ *
+ *  Each packet is written behind synthetic Ethernet, IPv4 and UDP
+ *  headers.  Records are assembled in a large page-aligned buffer
+ *  written a whole number of pages at a time, optionally with
+ *  O_DIRECT.  Files are named prefix-YYYYMMDD-HHMMSS-NNNN.pcap from
+ *  the UTC time of their first packet, and a new one is started
+ *  when the current one reaches a size or duration limit.
+ */
+
+#ifndef __VELODYNE_PACKET_RECORDER_H
+#define __VELODYNE_PACKET_RECORDER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <boost/atomic.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/thread.hpp>
+
+namespace velodyne_driver
+{
+  /** Velodyne packet payload bytes */
+  static const size_t RECORDER_PAYLOAD_SIZE = 1206;
+
+  /** \brief Background pcap writer for raw packets. */
+  class PacketRecorder
+  {
+  public:
+
+    /** @brief Start the writer thread.
+     *
+     *  @param prefix path and name prefix of the capture files
+     *  @param port UDP destination port written in the headers
+     *  @param src_addr device IPv4 address written in the headers
+     *                  (network order), 0 for the factory default
+     *  @param max_file_size start a new file before this many bytes,
+     *                       0 for no limit
+     *  @param max_file_duration start a new file after this many
+     *                           seconds of packets, 0 for no limit
+     *  @param direct_io write with O_DIRECT, bypassing the page cache
+     *  @param capacity ring size in packets
+     */
+    PacketRecorder(const std::string &prefix, uint16_t port,
+                   uint32_t src_addr, uint64_t max_file_size,
+                   double max_file_duration, bool direct_io,
+                   size_t capacity = 16384);
+
+    /** Write all pending packets, then close the current file. */
+    ~PacketRecorder();
+
+    /** @brief Queue a packet, never blocking.
+     *
+     *  Only one thread may record.  The packet is dropped if the
+     *  ring is full.
+     *
+     *  @param data RECORDER_PAYLOAD_SIZE bytes of packet data
+     *  @param stamp packet time [ns since the epoch]
+     */
+    void record(const uint8_t *data, uint64_t stamp);
+
+    /** @returns number of packets dropped so far */
+    uint64_t dropped() const { return dropped_; }
+
+    /** @returns packets waiting in the ring; only the recording
+     *           thread may ask */
+    size_t queued() const { return capacity_ - queue_.write_available(); }
+
+  private:
+
+    struct Packet
+    {
+      uint64_t stamp;
+      uint8_t data[RECORDER_PAYLOAD_SIZE];
+    };
+
+    void writer();
+    void append(const Packet &packet);
+    bool openFile(uint64_t stamp);
+    void closeFile();
+    void flush(bool all);
+
+    boost::lockfree::spsc_queue<Packet> queue_;
+    size_t capacity_;                   ///< ring size in packets
+    boost::atomic<uint64_t> dropped_;
+    boost::atomic<bool> running_;
+
+    // settings
+    std::string prefix_;
+    uint64_t max_file_size_;
+    uint64_t max_file_duration_;        ///< [ns]
+    bool direct_io_;
+    uint8_t frame_header_[42];          ///< Ethernet, IPv4 and UDP
+
+    // used by the writer thread only
+    int fd_;                            ///< current file, or -1
+    bool direct_;                       ///< fd_ opened with O_DIRECT
+    unsigned files_;                    ///< files opened so far
+    uint64_t file_bytes_;               ///< bytes in the current file
+    uint64_t file_stamp_;               ///< first packet in the file
+    uint8_t *buffer_;                   ///< page-aligned write buffer
+    size_t used_;                       ///< bytes pending in buffer_
+
+    boost::thread thread_;
+  };
+
+} // velodyne_driver namespace
+
+#endif // __VELODYNE_PACKET_RECORDER_H
@@ -0,0 +1,180 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (C) 2009, 2010 Austin Robot Technology, Jack O'Quin
+ *  Copyright (C) 2015, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  Memory-mapped reader of Velodyne packet capture files.
+ *
+ *  Reads classic pcap (microsecond or nanosecond time stamps, either
+ *  byte order) and pcapng files of Ethernet frames, without libpcap.
+ *  Opening a file indexes it in one pass over the record headers, so
+ *  replay can seek to a capture time or a revolution of the device
+ *  without reading from the start.
+ */
+
+#ifndef __VELODYNE_PCAP_FILE_H
+#define __VELODYNE_PCAP_FILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace velodyne_driver
+{
+  /** \brief Velodyne packet payload in a capture file. */
+  struct PcapPacket
+  {
+    const uint8_t *data;                ///< UDP payload, in the mapped file
+    size_t len;                         ///< payload length in bytes
+    uint64_t stamp;                     ///< capture time [ns since the epoch]
+  };
+
+  /** \brief Indexed, memory-mapped capture file. */
+  class PcapFile
+  {
+  public:
+
+    /** \brief Place of a record in the file. */
+    struct Position
+    {
+      size_t offset;                    ///< file offset of the record
+      size_t section;                   ///< pcapng section of the record
+      uint64_t stamp;                   ///< capture time [ns]
+    };
+
+    PcapFile();
+    ~PcapFile();
+
+    /** @brief Map and index a capture file.
+     *
+     *  Only UDP payloads of payload_size bytes sent to port, and from
+     *  src_addr unless that is zero, count as packets.
+     *
+     *  @param filename capture file name
+     *  @param port UDP destination port
+     *  @param src_addr IPv4 source address (network order), or 0
+     *  @param payload_size Velodyne packet size
+     *  @param error returns the reason of a failure
+     *  @returns true if successful
+     */
+    bool open(const std::string &filename, uint16_t port, uint32_t src_addr,
+              size_t payload_size, std::string *error);
+    void close();
+    bool isOpen() const { return base_ != NULL; }
+
+    /** @brief Read the next packet.
+     *
+     *  @param packet returns the packet, valid until close()
+     *  @returns false at the end of the file
+     */
+    bool next(PcapPacket *packet);
+
+    /** @brief Read the packet at a position, without moving the
+     *         cursor.
+     *
+     *  Several threads may read the open file at once, each from its
+     *  own position.
+     *
+     *  @param position where to read, returns the next position
+     *  @param packet returns the packet, valid until close()
+     *  @returns false at the end of the file
+     */
+    bool read(Position &position, PcapPacket *packet) const;
+
+    /** @returns position of the next packet to read */
+    const Position &tell() const { return cursor_; }
+
+    /** continue reading at a position from tell() or the index */
+    void seek(const Position &position) { cursor_ = position; }
+
+    /** @brief Continue reading at the first packet captured at or
+     *         after stamp.
+     *
+     *  @returns false if there is none
+     */
+    bool seekTime(uint64_t stamp);
+
+    /** @brief Continue reading at the first packet of a revolution.
+     *
+     *  Revolution 0 starts with the first packet, and each one after
+     *  it with a packet whose first azimuth is below the previous
+     *  packet's.
+     *
+     *  @returns false if there are not that many
+     */
+    bool seekRevolution(size_t revolution);
+
+    size_t packets() const { return packets_; }
+    size_t revolutions() const { return revolutions_.size(); }
+
+    /** @returns position of the first packet of a revolution */
+    const Position &revolution(size_t revolution) const
+    {
+      return revolutions_[revolution];
+    }
+    uint64_t startTime() const { return start_.stamp; }
+    uint64_t endTime() const { return end_stamp_; }
+
+  private:
+
+    /** Time stamp format and link type of a capture interface. */
+    struct Interface
+    {
+      uint16_t linktype;
+      uint64_t ticks_per_second;
+    };
+
+    /** Byte order and interfaces of a pcapng section, or of a
+     *  classic pcap file. */
+    struct Section
+    {
+      bool swapped;
+      std::vector<Interface> interfaces;
+    };
+
+    /** frame read from a record */
+    struct Frame
+    {
+      const uint8_t *data;
+      size_t len;
+      uint64_t stamp;
+    };
+
+    enum { BLOCK_END = -1, BLOCK_OTHER = 0, BLOCK_FRAME = 1 };
+    int readBlock(Position &position, Frame *frame,
+                  std::vector<Section> *sections) const;
+    bool payload(const Frame &frame, PcapPacket *packet) const;
+    bool buildIndex(std::string *error);
+    uint16_t get16(const uint8_t *p, bool swapped) const;
+    uint32_t get32(const uint8_t *p, bool swapped) const;
+
+    const uint8_t *base_;               ///< mapped file, or NULL
+    size_t size_;                       ///< mapped file size
+    bool pcapng_;
+    std::vector<Section> sections_;
+
+    // packet filter
+    uint16_t port_;
+    uint32_t src_addr_;
+    size_t payload_size_;
+
+    // index
+    Position cursor_;                   ///< next record to read
+    Position start_;                    ///< first packet
+    std::vector<Position> checkpoints_; ///< every PCAP_INDEX_STRIDE packets
+    std::vector<Position> revolutions_; ///< first packet of each revolution
+    size_t packets_;
+    uint64_t end_stamp_;
+  };
+
+} // velodyne_driver namespace
+
+#endif // __VELODYNE_PCAP_FILE_H
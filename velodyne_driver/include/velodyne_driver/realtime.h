@@ -0,0 +1,49 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (C) 2015, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  Real-time execution of the Velodyne device threads.
+ *
+ *  Live packets are stamped when the receiving thread gets them, so
+ *  any delay in scheduling that thread shows up as time stamp jitter.
+ *  These options pin it to chosen CPUs, give it a real-time priority
+ *  and lock the process memory, so that it is neither preempted by
+ *  other nodelets nor stalled by page faults.
+ */
+
+#ifndef __VELODYNE_REALTIME_H
+#define __VELODYNE_REALTIME_H
+
+#include <ros/ros.h>
+
+namespace velodyne_driver
+{
+  /** @brief Apply the real-time parameters to the calling thread.
+   *
+   *  Parameters, all optional:
+   *
+   *   - ~cpu_affinity (int list): CPUs to run on (default: any)
+   *   - ~sched_policy (string): "fifo", "rr" or "other" (default)
+   *   - ~sched_priority (int): real-time priority, 1 to 99 (default: 10)
+   *   - ~lock_memory (bool): lock all current and future pages of
+   *     the process in memory (default: false)
+   *
+   *  Failures, usually missing privileges (CAP_SYS_NICE and
+   *  CAP_IPC_LOCK, or the rtprio and memlock limits), are logged and
+   *  the thread runs on without that option.
+   *
+   *  @param private_nh parameters of the driver
+   *  @returns 0 if successful, else the number of options that failed
+   */
+  int setRealtime(ros::NodeHandle private_nh);
+
+} // velodyne_driver namespace
+
+#endif // __VELODYNE_REALTIME_H
@@ -0,0 +1,194 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (C) 2015, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  Low overhead timing statistics for the Velodyne nodes.
+ *
+ *  Each stage of a node (reading a scan, unpacking, publishing...)
+ *  records its durations or latencies in a lock-free histogram, which
+ *  any thread may update.  Counters and gauges track messages and
+ *  queue depths the same way.  Once per diagnostic period they are
+ *  summarized in a diagnostic_updater task and, optionally, published
+ *  as a VelodyneTiming message on ~timing, so a late cloud can be
+ *  traced to the network, the driver or the conversion.
+ */
+
+#ifndef __VELODYNE_TIMING_H
+#define __VELODYNE_TIMING_H
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <ros/ros.h>
+#include <diagnostic_updater/diagnostic_updater.h>
+#include <velodyne_msgs/VelodyneScan.h>
+#include <velodyne_msgs/VelodyneTiming.h>
+
+namespace velodyne_driver
+{
+  /** @returns monotonic clock time [µs] */
+  inline uint64_t monotonicUsec()
+  {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+  }
+
+  /** @returns microseconds since a ROS time, 0 if it is later */
+  inline uint64_t usecSince(const ros::Time &stamp)
+  {
+    double seconds = (ros::Time::now() - stamp).toSec();
+    return seconds > 0.0? (uint64_t) (seconds * 1.0e6): 0;
+  }
+
+  /** \brief Lock-free histogram of durations.
+   *
+   *  Values are counted in 8 buckets per power of two microseconds,
+   *  so summaries are within 1/8 of the true value.
+   */
+  class LatencyHistogram
+  {
+  public:
+
+    enum
+      {
+        SUB_BUCKETS = 8,
+        BUCKETS = SUB_BUCKETS * 30      ///< up to 2^32 µs
+      };
+
+    struct Summary
+    {
+      uint64_t count;
+      double mean;                      ///< [µs]
+      double p50;
+      double p90;
+      double p99;
+      double max;
+    };
+
+    LatencyHistogram();
+
+    /** @brief Count a value; any thread may call this. */
+    void record(uint64_t usec)
+    {
+      counts_[bucket(usec)].fetch_add(1, boost::memory_order_relaxed);
+      sum_.fetch_add(usec, boost::memory_order_relaxed);
+      uint64_t max = max_.load(boost::memory_order_relaxed);
+      while (usec > max
+             && !max_.compare_exchange_weak(max, usec,
+                                            boost::memory_order_relaxed))
+        ;
+    }
+
+    /** @brief Summarize the values counted since the last call.
+     *
+     *  Only one thread may call this.
+     */
+    Summary take();
+
+  private:
+
+    static int bucket(uint64_t value);
+    static double bucketValue(int bucket);
+
+    boost::atomic<uint64_t> counts_[BUCKETS];
+    boost::atomic<uint64_t> sum_;
+    boost::atomic<uint64_t> max_;       ///< since the last take()
+
+    // totals at the last take()
+    uint64_t taken_[BUCKETS];
+    uint64_t taken_sum_;
+  };
+
+  /** \brief Timing statistics of one node. */
+  class PipelineTiming
+  {
+  public:
+
+    /** @param name diagnostic task name */
+    PipelineTiming(const std::string &name);
+
+    /** @brief Add the statistics, before recording any.
+     *
+     *  @returns index to record them by
+     */
+    int addStage(const std::string &name);
+    int addCounter(const std::string &name);
+    int addGauge(const std::string &name);
+
+    /** @brief Report through a diagnostic updater.
+     *
+     *  Each report is also published on ~timing if the timing_topic
+     *  parameter is set.
+     */
+    void advertise(diagnostic_updater::Updater &diagnostics,
+                   ros::NodeHandle private_nh);
+
+    /** record a stage duration or latency [µs] */
+    void record(int stage, uint64_t usec) { stages_[stage]->record(usec); }
+
+    /** record the time since a monotonicUsec() start of a stage */
+    void recordSince(int stage, uint64_t start)
+    {
+      stages_[stage]->record(monotonicUsec() - start);
+    }
+
+    void count(int counter, uint64_t n = 1)
+    {
+      counters_[counter]->fetch_add(n, boost::memory_order_relaxed);
+    }
+
+    void setGauge(int gauge, uint64_t value);
+
+  private:
+
+    struct Gauge
+    {
+      Gauge(): value(0), max(0) {}
+      boost::atomic<uint64_t> value;
+      boost::atomic<uint64_t> max;      ///< since the last report
+    };
+
+    void report(diagnostic_updater::DiagnosticStatusWrapper &status);
+
+    std::string name_;
+    std::string node_;
+    std::vector<std::string> stage_names_;
+    std::vector<boost::shared_ptr<LatencyHistogram> > stages_;
+    std::vector<std::string> counter_names_;
+    std::vector<boost::shared_ptr<boost::atomic<uint64_t> > > counters_;
+    std::vector<std::string> gauge_names_;
+    std::vector<boost::shared_ptr<Gauge> > gauges_;
+    ros::Publisher output_;             ///< ~timing, if enabled
+  };
+
+  /** \brief Estimates the scans a subscriber missed from gaps
+   *         between their packet times. */
+  class ScanGapDetector
+  {
+  public:
+
+    ScanGapDetector() {}
+
+    /** @returns whole scans missing before this one */
+    uint64_t missed(const velodyne_msgs::VelodyneScan &scan);
+
+  private:
+
+    ros::Time last_;                    ///< last packet of the previous scan
+  };
+
+} // velodyne_driver namespace
+
+#endif // __VELODYNE_TIMING_H
@@ -13,6 +13,8 @@
  */
 
 #include <string>
+#include <algorithm>
+#include <arpa/inet.h>
 #include <cmath>
 
 #include <ros/ros.h>
@@ -24,45 +26,109 @@
 namespace velodyne_driver
 {
 
-VelodyneDriver::VelodyneDriver(ros::NodeHandle node,
-                               ros::NodeHandle private_nh)
+/** maximum number of packets requested from the input per call
+ *  when cutting scans at an azimuth */
+static const int CUT_READ_BATCH = 32;
+
+/** @brief Does the rotation from last to azimuth pass the cut angle?
+ *
+ *  All angles are in hundredths of a degree.  The device rotates
+ *  towards larger azimuths, so a decrease means it wrapped past 360.
+ */
+static inline bool crossesCut(int last, int azimuth, int cut)
 {
-  // use private node handle to get parameters
-  private_nh.param("frame_id", config_.frame_id, std::string("velodyne"));
-  std::string tf_prefix = tf::getPrefixParam(private_nh);
-  ROS_DEBUG_STREAM("tf_prefix: " << tf_prefix);
-  config_.frame_id = tf::resolve(tf_prefix, config_.frame_id);
+  if (azimuth >= last)
+    return (last < cut && cut <= azimuth);
+  else                                  // wrapped around
+    return (cut <= azimuth || last < cut);
+}
 
-  // get model name, validate string, determine packet rate
-  private_nh.param("model", config_.model, std::string("64E"));
+/** @brief Get the single return packet rate of a Velodyne model.
+ *
+ *  @param model device model name
+ *  @param full_name returns the full device name
+ *  @returns packet frequency (Hz)
+ */
+double modelPacketRate(const std::string &model, std::string *full_name)
+{
   double packet_rate;                   // packet frequency (Hz)
-  std::string model_full_name;
-  if ((config_.model == "64E_S2") || 
-      (config_.model == "64E_S2.1"))    // generates 1333312 points per second
+  if ((model == "64E_S2") || 
+      (model == "64E_S2.1"))            // generates 1333312 points per second
     {                                   // 1 packet holds 384 points
       packet_rate = 3472.17;            // 1333312 / 384
-      model_full_name = std::string("HDL-") + config_.model;
+      *full_name = std::string("HDL-") + model;
     }
-  else if (config_.model == "64E")
+  else if (model == "64E")
     {
       packet_rate = 2600.0;
-      model_full_name = std::string("HDL-") + config_.model;
+      *full_name = std::string("HDL-") + model;
     }
-  else if (config_.model == "32E")
+  else if (model == "32E")
     {
       packet_rate = 1808.0;
-      model_full_name = std::string("HDL-") + config_.model;
+      *full_name = std::string("HDL-") + model;
     }
-  else if (config_.model == "VLP16")
+  else if (model == "VLP16")
     {
       packet_rate = 754;             // 754 Packets/Second for Last or Strongest mode 1508 for dual (VLP-16 User Manual)
-      model_full_name = "VLP-16";
+      *full_name = "VLP-16";
     }
   else
     {
-      ROS_ERROR_STREAM("unknown Velodyne LIDAR model: " << config_.model);
+      ROS_ERROR_STREAM("unknown Velodyne LIDAR model: " << model);
       packet_rate = 2600.0;
     }
+  return packet_rate;
+}
+
+/** @brief Create a raw packet recorder, if the ~record parameter
+ *         names a file prefix.
+ *
+ *  @param private_nh parameters of the device
+ *  @param port UDP port of its packets
+ *  @param devip its address, 0 if unknown
+ *  @returns the recorder, or NULL when not recording
+ */
+boost::shared_ptr<PacketRecorder> makeRecorder(ros::NodeHandle private_nh,
+                                               uint16_t port,
+                                               const in_addr &devip)
+{
+  boost::shared_ptr<PacketRecorder> recorder;
+  std::string prefix;
+  private_nh.param("record", prefix, std::string(""));
+  if (prefix.empty())
+    return recorder;
+
+  double max_size, max_duration;
+  bool direct;
+  int queue;
+  private_nh.param("record_max_size", max_size, 1024.0); // [MB]
+  private_nh.param("record_max_duration", max_duration, 0.0);
+  private_nh.param("record_direct", direct, false);
+  private_nh.param("record_queue", queue, 16384);
+  recorder.reset(new PacketRecorder(prefix, port, devip.s_addr,
+                                    (uint64_t) (max_size * 1024 * 1024),
+                                    max_duration, direct,
+                                    std::max(queue, 1)));
+  return recorder;
+}
+
+VelodyneDriver::VelodyneDriver(ros::NodeHandle node,
+                               ros::NodeHandle private_nh):
+  timing_("Velodyne driver timing"),
+  recorder_dropped_(0),
+  pool_misses_(0)
+{
+  // use private node handle to get parameters
+  private_nh.param("frame_id", config_.frame_id, std::string("velodyne"));
+  std::string tf_prefix = tf::getPrefixParam(private_nh);
+  ROS_DEBUG_STREAM("tf_prefix: " << tf_prefix);
+  config_.frame_id = tf::resolve(tf_prefix, config_.frame_id);
+
+  // get model name, validate string, determine packet rate
+  private_nh.param("model", config_.model, std::string("64E"));
+  std::string model_full_name;
+  double packet_rate = modelPacketRate(config_.model, &model_full_name);
 
   // Double packet rate for dual return
   private_nh.param("dual_return", config_.dual_return, false);
@@ -74,6 +140,51 @@ VelodyneDriver::VelodyneDriver(ros::NodeHandle node,
   config_.npackets = (int) ceil(packet_rate / frequency); // Minimum amount of packets for a scan with range >= 360 degrees.
   private_nh.getParam("npackets", config_.npackets); // Possibility to override npackets
 
+  // Optionally cut scans where the device passes a fixed azimuth
+  double cut_angle;
+  private_nh.param("cut_angle", cut_angle, -0.01);
+  if (cut_angle >= 2*M_PI)
+    {
+      ROS_ERROR_STREAM("cut_angle " << cut_angle << " out of range,"
+                       " allowed values are [0, 2*PI), or negative"
+                       " to disable");
+      cut_angle = -0.01;
+    }
+  // convert from radians to the packets' hundredths of a degree
+  config_.cut_angle = (cut_angle < 0.0) ? -1:
+    (int) round(cut_angle * 18000.0 / M_PI) % 36000;
+  last_azimuth_ = -1;
+
+  // Optionally also publish every few packets as soon as they arrive
+  private_nh.param("stream_packets", config_.stream_packets, 0);
+  if (config_.stream_packets < 0)
+    config_.stream_packets = 0;
+
+  // Publish what has arrived when a scan takes too long, so lost
+  // packets or a stalled device do not hold up the point clouds
+  private_nh.param("scan_deadline", config_.scan_deadline,
+                   2.0 * config_.npackets / packet_rate);
+
+  // Preallocate the messages of a few scans and touch all their
+  // packets, so reading them neither allocates nor page-faults
+  int pool_size;
+  private_nh.param("scan_pool", pool_size, 4);
+  pool_size = std::max(pool_size, 0);
+  scan_pool_.resize(pool_size);
+  status_pool_.resize(pool_size);
+  for (size_t i = 0; i < scan_pool_.size(); ++i)
+    scan_pool_[i].packets.resize(config_.npackets + CUT_READ_BATCH);
+  if (config_.stream_packets > 0)
+    {
+      stream_pool_.resize(pool_size * config_.npackets
+                          / config_.stream_packets + pool_size);
+      for (size_t i = 0; i < stream_pool_.size(); ++i)
+        stream_pool_[i].packets.resize(config_.stream_packets);
+    }
+
+  // HDL-64E packets have no device time stamp
+  monitor_.configure(packet_rate, config_.rpm, config_.model != "64E");
+
   // Output configuration information
   std::string deviceName(std::string("Velodyne ") + model_full_name);
   ROS_INFO_STREAM(deviceName << " rotating at " << config_.rpm << " RPM.");
@@ -82,13 +193,21 @@ VelodyneDriver::VelodyneDriver(ros::NodeHandle node,
   } else {
     ROS_INFO("Dual return disabled.");
   }
-  ROS_INFO_STREAM("Accumulating " << config_.npackets << " packets per point cloud.");
+  if (config_.cut_angle >= 0)
+    ROS_INFO_STREAM("Cutting point clouds at " << cut_angle << " rad.");
+  else
+    ROS_INFO_STREAM("Accumulating " << config_.npackets << " packets per point cloud.");
+  if (config_.stream_packets > 0)
+    ROS_INFO_STREAM("Streaming groups of " << config_.stream_packets
+                    << " packets.");
 
   // Configure pcap and UDP port
   std::string dump_file;
   private_nh.param("pcap", dump_file, std::string(""));
   int udp_port;
   private_nh.param("port", udp_port, (int) DATA_PORT_NUMBER);
+  std::string interface;
+  private_nh.param("interface", interface, std::string(""));
 
   // Initialize dynamic reconfigure
   srv_ = boost::make_shared <dynamic_reconfigure::Server<velodyne_driver::
@@ -112,6 +231,17 @@ VelodyneDriver::VelodyneDriver(ros::NodeHandle node,
                                                              0.1, 10),
                                         TimeStampStatusParam()));
 
+  read_stage_ = timing_.addStage("read");
+  latency_stage_ = timing_.addStage("receive_to_publish");
+  publish_stage_ = timing_.addStage("publish");
+  packets_counter_ = timing_.addCounter("packets");
+  recorder_dropped_counter_ = timing_.addCounter("recorder_dropped");
+  recorder_queue_gauge_ = timing_.addGauge("recorder_queue");
+  pool_misses_counter_ = timing_.addCounter("pool_misses");
+  timing_.advertise(diagnostics_, private_nh);
+  diagnostics_.add("Velodyne packets",
+                   boost::bind(&PacketMonitor::report, &monitor_, _1));
+
   // open Velodyne input device or file
   if (dump_file != "")                  // have PCAP file?
     {
@@ -119,45 +249,265 @@ VelodyneDriver::VelodyneDriver(ros::NodeHandle node,
       input_.reset(new velodyne_driver::InputPCAP(private_nh, udp_port,
                                                   packet_rate, dump_file));
     }
+  else if (interface != "")             // have packet ring interface?
+    {
+      // read data from memory-mapped kernel packet ring
+      input_.reset(new velodyne_driver::InputPacketRing(private_nh,
+                                                        interface,
+                                                        udp_port));
+    }
   else
     {
       // read data from live socket
       input_.reset(new velodyne_driver::InputSocket(private_nh, udp_port));
     }
+  // wake up often enough to notice a stalled device by the deadline
+  if (config_.scan_deadline > 0.0)
+    input_->setTimeout(std::max(10, (int) (config_.scan_deadline * 250.0)));
+
+  // optionally record the packets read
+  std::string devip_str;
+  private_nh.param("device_ip", devip_str, std::string(""));
+  in_addr devip;
+  devip.s_addr = 0;
+  if (!devip_str.empty())
+    inet_aton(devip_str.c_str(), &devip);
+  recorder_ = makeRecorder(private_nh, udp_port, devip);
 
   // raw packet output topic
   output_ =
     node.advertise<velodyne_msgs::VelodyneScan>("velodyne_packets", 10);
+
+  // low latency packet group topic
+  if (config_.stream_packets > 0)
+    stream_output_ =
+      node.advertise<velodyne_msgs::VelodyneScan>("velodyne_packets_stream",
+                                                  100);
+
+  // assembly status of each scan
+  status_output_ =
+    node.advertise<velodyne_msgs::VelodyneScanStatus>("velodyne_packets_status",
+                                                      10);
 }
 
-/** poll the device
+/** @returns true if a scan begun at start [µs] is past its deadline */
+bool VelodyneDriver::pastDeadline(uint64_t start) const
+{
+  return (config_.scan_deadline > 0.0
+          && monotonicUsec() - start >= config_.scan_deadline * 1.0e6);
+}
+
+/** @brief Read a scan of a fixed number of packets.
  *
- *  @returns true unless end of file reached
+ *  @param late returns true if the scan is incomplete, because its
+ *              deadline passed after the first packet
+ *  @returns 0 if successful,
+ *          -1 if end of file
  */
-bool VelodyneDriver::poll(void)
+int VelodyneDriver::readScan(velodyne_msgs::VelodyneScan &scan, bool *late)
 {
-  // Allocate a new shared pointer for zero-copy sharing with other nodelets.
-  velodyne_msgs::VelodyneScanPtr scan(new velodyne_msgs::VelodyneScan);
-  scan->packets.resize(config_.npackets);
+  scan.packets.resize(config_.npackets);
+  *late = false;
+  uint64_t start = 0;                   // first packet read [µs]
 
   // Since the velodyne delivers data at a very high rate, keep
-  // reading and publishing scans as fast as possible.
-  for (int i = 0; i < config_.npackets; ++i)
+  // reading and publishing scans as fast as possible.  The input may
+  // fill several packet slots per call.
+  for (int i = 0; i < config_.npackets; )
+    {
+      // keep reading until full packets received
+      int npackets = 0;
+      int rc = input_->getPackets(&scan.packets[i], config_.npackets - i,
+                                  &npackets, config_.time_offset);
+      if (rc < 0) return -1;        // end of file reached?
+      if (rc == 0)                  // got full packets?
+        {
+          if (i == 0)
+            start = monotonicUsec();
+          recordPackets(&scan.packets[i], npackets);
+          streamPackets(&scan.packets[i], npackets);
+          i += npackets;
+        }
+      if (i > 0 && i < config_.npackets && pastDeadline(start))
+        {
+          scan.packets.resize(i);       // publish what has arrived
+          *late = true;
+          return 0;
+        }
+    }
+  return 0;
+}
+
+/** @brief Read one rotation, ending where the device passes cut_angle.
+ *
+ *  Packets are read in batches straight into the scan.  Those read
+ *  beyond the cut are kept and begin the following scan, so every
+ *  packet is published exactly once.  A scan that has not reached
+ *  the cut after twice npackets is published anyway, whatever its
+ *  deadline, so a device that stops turning cannot grow it forever.
+ *
+ *  @param late returns true if the scan ends before the cut, because
+ *              its deadline passed after the first packet
+ *  @returns 0 if successful,
+ *          -1 if end of file
+ */
+int VelodyneDriver::readScanCut(velodyne_msgs::VelodyneScan &scan, bool *late)
+{
+  scan.packets.reserve(config_.npackets + CUT_READ_BATCH);
+  scan.packets.assign(carry_.begin(), carry_.end());
+  carry_.clear();
+  *late = false;
+  uint64_t start = monotonicUsec();     // first packet read [µs]
+  const size_t max_packets = 2 * config_.npackets;
+
+  size_t checked = 0;                   // packets compared with the cut
+  for (;;)
+    {
+      for (; checked < scan.packets.size() && checked < max_packets;
+           ++checked)
+        {
+          int azimuth = packetAzimuth(scan.packets[checked]);
+          if (checked > 0 && last_azimuth_ >= 0
+              && crossesCut(last_azimuth_, azimuth, config_.cut_angle))
+            {
+              // this packet starts the next scan
+              carry_.assign(scan.packets.begin() + checked,
+                            scan.packets.end());
+              scan.packets.resize(checked);
+              return 0;
+            }
+          last_azimuth_ = azimuth;
+        }
+      if (checked == max_packets)
+        {
+          ROS_WARN_THROTTLE(1.0, "Velodyne scan did not reach cut_angle "
+                            "in %zu packets, publishing it", max_packets);
+          carry_.assign(scan.packets.begin() + checked, scan.packets.end());
+          scan.packets.resize(checked);
+          return 0;
+        }
+      if (!scan.packets.empty() && pastDeadline(start))
+        {
+          *late = true;                 // publish what has arrived
+          return 0;
+        }
+
+      size_t n = scan.packets.size();
+      scan.packets.resize(n + CUT_READ_BATCH);
+      int npackets = 0;
+      int rc = input_->getPackets(&scan.packets[n], CUT_READ_BATCH,
+                                  &npackets, config_.time_offset);
+      scan.packets.resize(n + (rc == 0? npackets: 0));
+      if (rc < 0) return -1;            // end of file reached?
+      if (rc == 0)
+        {
+          if (n == 0)
+            start = monotonicUsec();
+          recordPackets(&scan.packets[n], npackets);
+          streamPackets(&scan.packets[n], npackets);
+        }
+    }
+}
+
+/** @brief Publish packets in small groups as soon as they are read.
+ *
+ *  Groups are independent of the full scans: a group may span two
+ *  scans, and each packet appears in exactly one group.
+ *
+ *  @param pkts packets just read
+ *  @param npackets number of packets
+ */
+void VelodyneDriver::streamPackets(const velodyne_msgs::VelodynePacket *pkts,
+                                   int npackets)
+{
+  if (config_.stream_packets <= 0)
+    return;
+
+  for (int i = 0; i < npackets; ++i)
     {
-      while (true)
+      if (!stream_scan_)
         {
-          // keep reading until full packet received
-          int rc = input_->getPacket(&scan->packets[i], config_.time_offset);
-          if (rc == 0) break;       // got a full packet?
-          if (rc < 0) return false; // end of file reached?
+          stream_scan_ = stream_pool_.get();
+          stream_scan_->packets.clear();
+          stream_scan_->packets.reserve(config_.stream_packets);
+        }
+      stream_scan_->packets.push_back(pkts[i]);
+
+      if ((int) stream_scan_->packets.size() >= config_.stream_packets)
+        {
+          stream_scan_->header.stamp = stream_scan_->packets[0].stamp;
+          stream_scan_->header.frame_id = config_.frame_id;
+          stream_output_.publish(stream_scan_);
+          stream_scan_.reset();         // published messages are immutable
         }
     }
+}
+
+/** @brief Hand packets just read to the recorder, if any. */
+void VelodyneDriver::recordPackets(const velodyne_msgs::VelodynePacket *pkts,
+                                   int npackets)
+{
+  if (!recorder_)
+    return;
+  for (int i = 0; i < npackets; ++i)
+    recorder_->record(&pkts[i].data[0], pkts[i].stamp.toNSec());
+}
+
+/** poll the device
+ *
+ *  @returns true unless end of file reached
+ */
+bool VelodyneDriver::poll(void)
+{
+  // Take a free scan from the pool, shared zero-copy with other
+  // nodelets once published.
+  velodyne_msgs::VelodyneScanPtr scan = scan_pool_.get();
+  uint64_t start = monotonicUsec();
+  bool late = false;
+  int rc = (config_.cut_angle >= 0)?
+    readScanCut(*scan, &late): readScan(*scan, &late);
+  if (rc < 0) return false;
+  timing_.recordSince(read_stage_, start);
+
+  // count lost packets, sorting any out of order ones back in place
+  velodyne_msgs::VelodyneScanStatusPtr status = status_pool_.get();
+  monitor_.check(*scan, *status);
+  if (late)
+    {
+      monitor_.countDeadline();
+      ROS_WARN_THROTTLE(1.0, "Velodyne scan incomplete at its deadline: "
+                        "%zu of %d packets", scan->packets.size(),
+                        config_.npackets);
+    }
 
   // publish message using time of first packet read
   ROS_DEBUG("Publishing a full Velodyne scan.");
   scan->header.stamp = scan->packets[0].stamp;
   scan->header.frame_id = config_.frame_id;
+  start = monotonicUsec();
   output_.publish(scan);
+  timing_.recordSince(publish_stage_, start);
+  status->header = scan->header;
+  status->expected_packets = config_.npackets;
+  status->deadline = late;
+  status_output_.publish(status);
+
+  // packet stamps include the time_offset
+  timing_.record(latency_stage_,
+                 usecSince(scan->packets.back().stamp
+                           - ros::Duration(config_.time_offset)));
+  timing_.count(packets_counter_, scan->packets.size());
+  if (recorder_)
+    {
+      uint64_t dropped = recorder_->dropped();
+      timing_.count(recorder_dropped_counter_, dropped - recorder_dropped_);
+      recorder_dropped_ = dropped;
+      timing_.setGauge(recorder_queue_gauge_, recorder_->queued());
+    }
+  uint64_t misses = (scan_pool_.misses() + status_pool_.misses()
+                     + stream_pool_.misses());
+  timing_.count(pool_misses_counter_, misses - pool_misses_);
+  pool_misses_ = misses;
 
   // notify diagnostics that a message has been published, updating
   // its status
@@ -16,17 +16,27 @@
 #define _VELODYNE_DRIVER_H_ 1
 
 #include <string>
+#include <vector>
 #include <ros/ros.h>
 #include <diagnostic_updater/diagnostic_updater.h>
 #include <diagnostic_updater/publisher.h>
 #include <dynamic_reconfigure/server.h>
 
 #include <velodyne_driver/input.h>
+#include <velodyne_driver/message_pool.h>
+#include <velodyne_driver/packet_monitor.h>
+#include <velodyne_driver/packet_recorder.h>
+#include <velodyne_driver/timing.h>
 #include <velodyne_driver/VelodyneNodeConfig.h>
 
 namespace velodyne_driver
 {
 
+double modelPacketRate(const std::string &model, std::string *full_name);
+boost::shared_ptr<PacketRecorder> makeRecorder(ros::NodeHandle private_nh,
+                                               uint16_t port,
+                                               const in_addr &devip);
+
 class VelodyneDriver
 {
 public:
@@ -39,6 +49,12 @@ public:
 
 private:
 
+  int readScan(velodyne_msgs::VelodyneScan &scan, bool *late);
+  int readScanCut(velodyne_msgs::VelodyneScan &scan, bool *late);
+  bool pastDeadline(uint64_t start) const;
+  void streamPackets(const velodyne_msgs::VelodynePacket *pkts, int npackets);
+  void recordPackets(const velodyne_msgs::VelodynePacket *pkts, int npackets);
+
   ///Callback for dynamic reconfigure
   void callback(velodyne_driver::VelodyneNodeConfig &config,
               uint32_t level);
@@ -56,16 +72,49 @@ private:
     int    npackets;                 ///< number of packets to collect
     double rpm;                      ///< device rotation rate (RPMs)
     double time_offset;              ///< time in seconds added to each velodyne time stamp
+    int    cut_angle;                ///< azimuth (1/100 degree) to cut scans at, negative for npackets
+    int    stream_packets;           ///< packets per streamed group, 0 if not streaming
+    double scan_deadline;            ///< seconds to publish a scan within, not if <= 0
   } config_;
 
   boost::shared_ptr<Input> input_;
+  boost::shared_ptr<PacketRecorder> recorder_; ///< raw packet recording, if enabled
   ros::Publisher output_;
 
+  // cut_angle scan assembly state
+  int last_azimuth_;                 ///< azimuth of last packet, negative if none
+  std::vector<velodyne_msgs::VelodynePacket> carry_; ///< packets read past the last cut
+
+  // streaming output of small packet groups
+  ros::Publisher stream_output_;
+  velodyne_msgs::VelodyneScanPtr stream_scan_; ///< group being assembled
+
+  // lost and reordered packets
+  PacketMonitor monitor_;
+  ros::Publisher status_output_;
+
+  // preallocated messages, reused once subscribers release them
+  MessagePool<velodyne_msgs::VelodyneScan> scan_pool_;
+  MessagePool<velodyne_msgs::VelodyneScanStatus> status_pool_;
+  MessagePool<velodyne_msgs::VelodyneScan> stream_pool_;
+
   /** diagnostics updater */
   diagnostic_updater::Updater diagnostics_;
   double diag_min_freq_;
   double diag_max_freq_;
   boost::shared_ptr<diagnostic_updater::TopicDiagnostic> diag_topic_;
+
+  /** timing statistics */
+  PipelineTiming timing_;
+  int read_stage_;                   ///< reading a scan from the input
+  int latency_stage_;                ///< last packet received to published
+  int publish_stage_;
+  int packets_counter_;
+  int recorder_dropped_counter_;
+  int recorder_queue_gauge_;
+  int pool_misses_counter_;
+  uint64_t recorder_dropped_;        ///< recorder drops counted so far
+  uint64_t pool_misses_;             ///< pool misses counted so far
 };
 
 } // namespace velodyne_driver
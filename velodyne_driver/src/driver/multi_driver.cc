@@ -0,0 +1,320 @@
+/*
+ *  Copyright (C) 2012 Austin Robot Technology, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  ROS driver implementation for several Velodyne 3D LIDARs served by
+ *  a single epoll() event loop.
+ */
+
+#include <string>
+#include <cmath>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+
+#include <ros/ros.h>
+#include <tf/transform_listener.h>
+
+#include "driver.h"
+#include "multi_driver.h"
+
+namespace velodyne_driver
+{
+
+static const size_t packet_size =
+  sizeof(velodyne_msgs::VelodynePacket().data);
+
+// Number of datagrams read by each recvmmsg() call.
+static const int RECV_BATCH = 32;
+
+MultiVelodyneDriver::MultiVelodyneDriver(ros::NodeHandle node,
+                                         ros::NodeHandle private_nh):
+  epollfd_(-1)
+{
+  std::string tf_prefix = tf::getPrefixParam(private_nh);
+  ROS_DEBUG_STREAM("tf_prefix: " << tf_prefix);
+
+  std::vector<std::string> names;
+  if (!private_nh.getParam("sensors", names) || names.empty())
+    {
+      ROS_ERROR("no ~sensors configured for multi-sensor driver");
+      return;
+    }
+
+  int rcvbuf;
+  private_nh.param("socket_rcvbuf", rcvbuf, 0);
+
+  epollfd_ = epoll_create(names.size());
+  if (epollfd_ == -1)
+    {
+      ROS_ERROR("epoll_create() failed: %s", strerror(errno));
+      return;
+    }
+
+  diagnostics_.setHardwareID("Velodyne multi-sensor driver");
+
+  for (size_t i = 0; i < names.size(); ++i)
+    {
+      // each sensor is configured in its own private namespace
+      ros::NodeHandle sensor_nh(private_nh, names[i]);
+      boost::shared_ptr<Sensor> sensor(new Sensor);
+      sensor->name = names[i];
+
+      sensor_nh.param("frame_id", sensor->frame_id, names[i]);
+      sensor->frame_id = tf::resolve(tf_prefix, sensor->frame_id);
+
+      sensor_nh.param("model", sensor->model, std::string("64E"));
+      std::string model_full_name;
+      double packet_rate = modelPacketRate(sensor->model, &model_full_name);
+      bool dual_return;
+      sensor_nh.param("dual_return", dual_return, false);
+      packet_rate = dual_return ? 2*packet_rate : packet_rate;
+
+      double rpm;
+      sensor_nh.param("rpm", rpm, 600.0);
+      sensor->npackets = (int) ceil(packet_rate / (rpm / 60.0));
+      sensor_nh.getParam("npackets", sensor->npackets);
+      sensor_nh.param("time_offset", sensor->time_offset, 0.0);
+
+      sensor_nh.param("device_ip", sensor->devip_str, std::string(""));
+      sensor->devip.s_addr = 0;
+      if (!sensor->devip_str.empty()
+          && inet_aton(sensor->devip_str.c_str(), &sensor->devip) == 0)
+        {
+          ROS_ERROR_STREAM(names[i] << ": invalid device_ip "
+                           << sensor->devip_str);
+          continue;
+        }
+
+      int udp_port;
+      sensor_nh.param("port", udp_port, (int) DATA_PORT_NUMBER);
+
+      // find or open the socket for this port
+      boost::shared_ptr<Port> port;
+      for (size_t j = 0; j < ports_.size(); ++j)
+        if (ports_[j]->number == udp_port)
+          port = ports_[j];
+      if (!port)
+        {
+          port.reset(new Port);
+          port->number = udp_port;
+          port->any = NULL;
+          if (!openPort(*port, rcvbuf))
+            continue;
+          ports_.push_back(port);
+        }
+
+      std::string topic;
+      sensor_nh.param("topic", topic, names[i] + "/velodyne_packets");
+      sensor->output = node.advertise<velodyne_msgs::VelodyneScan>(topic, 10);
+
+      ROS_INFO_STREAM(names[i] << ": Velodyne " << model_full_name
+                      << " on port " << udp_port
+                      << (sensor->devip_str.empty() ? std::string("")
+                          : " from " + sensor->devip_str)
+                      << ", " << sensor->npackets
+                      << " packets per scan, publishing " << topic);
+
+      const double diag_freq = packet_rate/sensor->npackets;
+      sensor->diag_min_freq = diag_freq;
+      sensor->diag_max_freq = diag_freq;
+      using namespace diagnostic_updater;
+      sensor->diag_topic.reset(new TopicDiagnostic(topic, diagnostics_,
+                                  FrequencyStatusParam(&sensor->diag_min_freq,
+                                                       &sensor->diag_max_freq,
+                                                       0.1, 10),
+                                  TimeStampStatusParam()));
+
+      sensor->scan.reset(new velodyne_msgs::VelodyneScan);
+      sensor->scan->packets.resize(sensor->npackets);
+      sensor->next = 0;
+
+      // optionally record this device's packets
+      sensor->recorder = makeRecorder(sensor_nh, udp_port, sensor->devip);
+
+      if (sensor->devip_str.empty())
+        {
+          if (port->any != NULL)
+            ROS_ERROR_STREAM(names[i] << " and " << port->any->name
+                             << " share port " << udp_port
+                             << " without a device_ip");
+          port->any = sensor.get();
+        }
+      else
+        {
+          port->sensors.push_back(sensor.get());
+        }
+      sensors_.push_back(sensor);
+    }
+
+  // receive buffers
+  buffers_.resize(RECV_BATCH * packet_size);
+  batch_.resize(RECV_BATCH);
+  for (int i = 0; i < RECV_BATCH; ++i)
+    batch_.setBuffer(i, &buffers_[i * packet_size]);
+}
+
+MultiVelodyneDriver::~MultiVelodyneDriver()
+{
+  for (size_t i = 0; i < ports_.size(); ++i)
+    (void) close(ports_[i]->fd);
+  if (epollfd_ != -1)
+    (void) close(epollfd_);
+}
+
+/** @brief Open, configure and register one UDP socket. */
+bool MultiVelodyneDriver::openPort(Port &port, int rcvbuf)
+{
+  ROS_INFO_STREAM("Opening UDP socket: port " << port.number);
+  port.fd = socket(PF_INET, SOCK_DGRAM, 0);
+  if (port.fd == -1)
+    {
+      ROS_ERROR("socket() failed: %s", strerror(errno));
+      return false;
+    }
+
+  sockaddr_in my_addr;                     // my address information
+  memset(&my_addr, 0, sizeof(my_addr));    // initialize to zeros
+  my_addr.sin_family = AF_INET;            // host byte order
+  my_addr.sin_port = htons(port.number);   // port in network byte order
+  my_addr.sin_addr.s_addr = INADDR_ANY;    // automatically fill in my IP
+
+  int on = 1;
+  if (bind(port.fd, (sockaddr *)&my_addr, sizeof(sockaddr)) == -1
+      || fcntl(port.fd, F_SETFL, O_NONBLOCK) < 0
+      || setsockopt(port.fd, SOL_SOCKET, SO_TIMESTAMPNS,
+                    &on, sizeof(on)) < 0)
+    {
+      ROS_ERROR("cannot set up port %u: %s", port.number, strerror(errno));
+      close(port.fd);
+      return false;
+    }
+  if (rcvbuf > 0
+      && setsockopt(port.fd, SOL_SOCKET, SO_RCVBUF,
+                    &rcvbuf, sizeof(rcvbuf)) < 0)
+    ROS_WARN("setsockopt(SO_RCVBUF) failed: %s", strerror(errno));
+
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.ptr = &port;
+  if (epoll_ctl(epollfd_, EPOLL_CTL_ADD, port.fd, &event) == -1)
+    {
+      ROS_ERROR("epoll_ctl() failed: %s", strerror(errno));
+      close(port.fd);
+      return false;
+    }
+  return true;
+}
+
+/** @brief Find the sensor a packet belongs to.
+ *
+ *  @returns the matching sensor, or NULL to drop the packet
+ */
+MultiVelodyneDriver::Sensor *
+MultiVelodyneDriver::findSensor(const Port &port,
+                                const sockaddr_in &sender) const
+{
+  for (size_t i = 0; i < port.sensors.size(); ++i)
+    if (port.sensors[i]->devip.s_addr == sender.sin_addr.s_addr)
+      return port.sensors[i];
+  return port.any;
+}
+
+/** @brief Store one packet, publishing the scan when it is complete. */
+void MultiVelodyneDriver::addPacket(Sensor &sensor, const uint8_t *data,
+                                    const ros::Time &stamp)
+{
+  velodyne_msgs::VelodynePacket &pkt = sensor.scan->packets[sensor.next];
+  memcpy(&pkt.data[0], data, packet_size);
+  pkt.stamp = stamp;
+  if (sensor.recorder)
+    sensor.recorder->record(data, pkt.stamp.toNSec());
+
+  if (++sensor.next < sensor.npackets)
+    return;
+
+  // publish message using time of first packet read
+  velodyne_msgs::VelodyneScanPtr scan = sensor.scan;
+  scan->header.stamp = scan->packets[0].stamp;
+  scan->header.frame_id = sensor.frame_id;
+  sensor.output.publish(scan);
+  sensor.diag_topic->tick(scan->header.stamp);
+
+  // subscribers may still hold the published scan, start a new one
+  sensor.scan.reset(new velodyne_msgs::VelodyneScan);
+  sensor.scan->packets.resize(sensor.npackets);
+  sensor.next = 0;
+}
+
+/** @brief Read all datagrams queued on a port. */
+void MultiVelodyneDriver::readPort(Port &port)
+{
+  while (true)
+    {
+      int nmsgs = batch_.receive(port.fd, RECV_BATCH);
+      if (nmsgs < 0)
+        {
+          if (errno != EWOULDBLOCK && errno != EINTR)
+            ROS_ERROR("recvmmsg() failed on port %u: %s",
+                      port.number, strerror(errno));
+          return;
+        }
+
+      const ros::Time now = ros::Time::now();
+      for (int i = 0; i < nmsgs; ++i)
+        {
+          if (!batch_.complete(i))
+            continue;
+          Sensor *sensor = findSensor(port, batch_.sender(i));
+          if (sensor == NULL)           // not from a configured device
+            continue;
+          addPacket(*sensor, &buffers_[i * packet_size],
+                    batch_.stamp(i, now, sensor->time_offset));
+        }
+
+      if (nmsgs < RECV_BATCH)           // socket drained?
+        return;
+    }
+}
+
+/** poll all devices once
+ *
+ *  @returns true unless the event loop failed
+ */
+bool MultiVelodyneDriver::poll(void)
+{
+  if (epollfd_ == -1 || ports_.empty())
+    return false;
+
+  static const int POLL_TIMEOUT = 1000; // [ms]
+  static const int MAX_EVENTS = 16;
+  struct epoll_event events[MAX_EVENTS];
+
+  int nevents = epoll_wait(epollfd_, events, MAX_EVENTS, POLL_TIMEOUT);
+  if (nevents < 0)
+    {
+      if (errno == EINTR)
+        return true;
+      ROS_ERROR("epoll_wait() error: %s", strerror(errno));
+      return false;
+    }
+  if (nevents == 0)
+    ROS_WARN("Velodyne poll() timeout");
+
+  for (int i = 0; i < nevents; ++i)
+    readPort(*static_cast<Port *>(events[i].data.ptr));
+
+  diagnostics_.update();
+  return true;
+}
+
+} // namespace velodyne_driver
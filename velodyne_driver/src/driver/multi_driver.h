@@ -0,0 +1,103 @@
+/* -*- mode: C++ -*- */
+/*
+ *  Copyright (C) 2012 Austin Robot Technology, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  ROS driver interface for several Velodyne 3D LIDARs served by a
+ *  single event loop.
+ */
+
+#ifndef _VELODYNE_MULTI_DRIVER_H_
+#define _VELODYNE_MULTI_DRIVER_H_ 1
+
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <ros/ros.h>
+#include <diagnostic_updater/diagnostic_updater.h>
+#include <diagnostic_updater/publisher.h>
+
+#include <velodyne_msgs/VelodyneScan.h>
+#include <velodyne_driver/input.h>
+#include <velodyne_driver/packet_recorder.h>
+
+namespace velodyne_driver
+{
+
+/** @brief Driver for several Velodyne devices in one thread.
+ *
+ *  Every UDP port is opened once and watched by a single epoll()
+ *  loop.  Packets arriving on a port are demultiplexed to a device by
+ *  their sender address, so several devices may share one port as
+ *  long as each has a distinct ~<sensor>/device_ip.
+ */
+class MultiVelodyneDriver
+{
+public:
+
+  MultiVelodyneDriver(ros::NodeHandle node,
+                      ros::NodeHandle private_nh);
+  ~MultiVelodyneDriver();
+
+  bool poll(void);
+
+private:
+
+  /** per-device configuration and scan assembly state */
+  struct Sensor
+  {
+    std::string name;                ///< sensor name (parameter namespace)
+    std::string frame_id;            ///< tf frame ID
+    std::string model;               ///< device model name
+    int    npackets;                 ///< number of packets to collect
+    double time_offset;              ///< time in seconds added to each time stamp
+    std::string devip_str;           ///< device IP address, empty for any
+    in_addr devip;
+
+    ros::Publisher output;
+    velodyne_msgs::VelodyneScanPtr scan; ///< scan being assembled
+    int next;                        ///< next packet slot in scan
+
+    double diag_min_freq;
+    double diag_max_freq;
+    boost::shared_ptr<diagnostic_updater::TopicDiagnostic> diag_topic;
+    boost::shared_ptr<PacketRecorder> recorder; ///< raw packet recording, if enabled
+  };
+
+  /** one UDP socket shared by all devices sending to its port */
+  struct Port
+  {
+    uint16_t number;                 ///< UDP port number
+    int fd;                          ///< socket file descriptor
+    std::vector<Sensor *> sensors;   ///< sensors with a device IP
+    Sensor *any;                     ///< sensor accepting any sender
+  };
+
+  bool openPort(Port &port, int rcvbuf);
+  void readPort(Port &port);
+  Sensor *findSensor(const Port &port, const sockaddr_in &sender) const;
+  void addPacket(Sensor &sensor, const uint8_t *data,
+                 const ros::Time &stamp);
+
+  int epollfd_;
+  std::vector<boost::shared_ptr<Sensor> > sensors_;
+  std::vector<boost::shared_ptr<Port> > ports_;
+
+  // recvmmsg() batch buffers shared by all ports
+  std::vector<uint8_t> buffers_;
+  PacketBatch batch_;
+
+  /** diagnostics updater */
+  diagnostic_updater::Updater diagnostics_;
+};
+
+} // namespace velodyne_driver
+
+#endif // _VELODYNE_MULTI_DRIVER_H_
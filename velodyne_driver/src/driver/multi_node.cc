@@ -0,0 +1,35 @@
+/*
+ *  Copyright (C) 2012 Austin Robot Technology, Jack O'Quin
+ * 
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  ROS driver node for several Velodyne 3D LIDARs.
+ */
+
+#include <ros/ros.h>
+#include <velodyne_driver/realtime.h>
+#include "multi_driver.h"
+
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "velodyne_multi_node");
+  ros::NodeHandle node;
+  ros::NodeHandle private_nh("~");
+
+  // start the driver
+  velodyne_driver::MultiVelodyneDriver dvr(node, private_nh);
+  velodyne_driver::setRealtime(private_nh);
+
+  // loop until shut down or the event loop fails
+  while(ros::ok() && dvr.poll())
+    {
+      ros::spinOnce();
+    }
+
+  return 0;
+}
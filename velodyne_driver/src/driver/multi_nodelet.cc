@@ -0,0 +1,88 @@
+/*
+ *  Copyright (C) 2012 Austin Robot Technology, Jack O'Quin
+ * 
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  ROS driver nodelet for several Velodyne 3D LIDARs.
+ */
+
+#include <string>
+#include <boost/thread.hpp>
+
+#include <ros/ros.h>
+#include <pluginlib/class_list_macros.h>
+#include <nodelet/nodelet.h>
+
+#include <velodyne_driver/realtime.h>
+#include "multi_driver.h"
+
+namespace velodyne_driver
+{
+
+class MultiDriverNodelet: public nodelet::Nodelet
+{
+public:
+
+  MultiDriverNodelet():
+    running_(false)
+  {}
+
+  ~MultiDriverNodelet()
+  {
+    if (running_)
+      {
+        NODELET_INFO("shutting down driver thread");
+        running_ = false;
+        deviceThread_->join();
+        NODELET_INFO("driver thread stopped");
+      }
+  }
+
+private:
+
+  virtual void onInit(void);
+  virtual void devicePoll(void);
+
+  volatile bool running_;               ///< device thread is running
+  boost::shared_ptr<boost::thread> deviceThread_;
+
+  boost::shared_ptr<MultiVelodyneDriver> dvr_; ///< driver implementation class
+};
+
+void MultiDriverNodelet::onInit()
+{
+  // start the driver
+  dvr_.reset(new MultiVelodyneDriver(getNodeHandle(),
+                                     getPrivateNodeHandle()));
+
+  // spawn a single poll thread serving all devices
+  running_ = true;
+  deviceThread_ = boost::shared_ptr< boost::thread >
+    (new boost::thread(boost::bind(&MultiDriverNodelet::devicePoll, this)));
+}
+
+/** @brief Device poll thread main loop. */
+void MultiDriverNodelet::devicePoll()
+{
+  setRealtime(getPrivateNodeHandle());
+  while(ros::ok() && running_)
+    {
+      // poll devices until the event loop fails
+      if (!dvr_->poll())
+        break;
+    }
+  running_ = false;
+}
+
+} // namespace velodyne_driver
+
+// Register this plugin with pluginlib.  Names must match nodelet_velodyne.xml.
+//
+// parameters are: package, class name, class type, base class type
+PLUGINLIB_DECLARE_CLASS(velodyne_driver, MultiDriverNodelet,
+                        velodyne_driver::MultiDriverNodelet, nodelet::Nodelet);
@@ -18,6 +18,7 @@
 #include <pluginlib/class_list_macros.h>
 #include <nodelet/nodelet.h>
 
+#include <velodyne_driver/realtime.h>
 #include "driver.h"
 
 namespace velodyne_driver
@@ -67,6 +68,7 @@ void DriverNodelet::onInit()
 /** @brief Device poll thread main loop. */
 void DriverNodelet::devicePoll()
 {
+  setRealtime(getPrivateNodeHandle());
   while(ros::ok())
     {
       // poll device until end of file
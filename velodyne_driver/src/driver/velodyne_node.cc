@@ -12,6 +12,7 @@
  */
 
 #include <ros/ros.h>
+#include <velodyne_driver/realtime.h>
 #include "driver.h"
 
 int main(int argc, char** argv)
@@ -22,6 +23,7 @@ int main(int argc, char** argv)
 
   // start the driver
   velodyne_driver::VelodyneDriver dvr(node, private_nh);
+  velodyne_driver::setRealtime(private_nh);
 
   // loop until shut down or end of file
   while(ros::ok() && dvr.poll())
@@ -18,11 +18,15 @@
  *     InputSocket -- derived class reads live data from the device
  *              via a UDP socket
  *
+ *     InputPacketRing -- derived class reads live data from the
+ *              device via a memory-mapped PACKET_MMAP ring
+ *
  *     InputPCAP -- derived class provides a similar interface from a
  *              PCAP dump
  */
 
 #include <unistd.h>
+#include <algorithm>
 #include <string>
 #include <sstream>
 #include <sys/socket.h>
@@ -31,6 +35,14 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
 #include <velodyne_driver/input.h>
 
 namespace velodyne_driver
@@ -38,6 +50,64 @@ namespace velodyne_driver
   static const size_t packet_size =
     sizeof(velodyne_msgs::VelodynePacket().data);
 
+  // Time to accumulate one VLP-16 data packet, 55.296µs * 24.  Packet
+  // stamps are shifted back by this amount to mark the first firing.
+  static const double packet_accumulation_time = 1327.104*1.0e-6; // [s]
+
+  ////////////////////////////////////////////////////////////////////////
+  // Captured frame parsing
+  ////////////////////////////////////////////////////////////////////////
+
+  static inline uint16_t get_be16(const uint8_t *p)
+  {
+    return (uint16_t) ((p[0] << 8) | p[1]);
+  }
+
+  bool parseUdpFrame(const uint8_t *frame, size_t len,
+                     const uint8_t **payload, size_t *payload_len,
+                     uint32_t *src_addr, uint16_t *dst_port)
+  {
+    size_t offset = ETH_HLEN;
+    if (len < offset)
+      return false;
+    uint16_t ethertype = get_be16(frame + ETH_ALEN*2);
+
+    // skip VLAN tags (at most two for 802.1ad QinQ)
+    for (int tags = 0;
+         tags < 2 && (ethertype == ETH_P_8021Q || ethertype == ETH_P_8021AD);
+         ++tags)
+      {
+        if (len < offset + 4)
+          return false;
+        ethertype = get_be16(frame + offset + 2);
+        offset += 4;
+      }
+    if (ethertype != ETH_P_IP || len < offset + sizeof(struct iphdr))
+      return false;
+
+    const uint8_t *ip = frame + offset;
+    const size_t ip_hlen = (ip[0] & 0x0f) * 4;
+    if ((ip[0] >> 4) != 4 || ip_hlen < sizeof(struct iphdr)
+        || ip[9] != IPPROTO_UDP
+        || (get_be16(ip + 6) & 0x3fff) != 0) // fragmented?
+      return false;
+    offset += ip_hlen;
+    if (len < offset + sizeof(struct udphdr))
+      return false;
+
+    const uint8_t *udp = frame + offset;
+    const size_t udp_len = get_be16(udp + 4);
+    if (udp_len < sizeof(struct udphdr)
+        || len < offset + udp_len)   // truncated capture?
+      return false;
+
+    memcpy(src_addr, ip + 12, sizeof(*src_addr));
+    *dst_port = get_be16(udp + 2);
+    *payload = udp + sizeof(struct udphdr);
+    *payload_len = udp_len - sizeof(struct udphdr);
+    return true;
+  }
+
   ////////////////////////////////////////////////////////////////////////
   // Input base class implementation
   ////////////////////////////////////////////////////////////////////////
@@ -49,7 +119,8 @@ namespace velodyne_driver
    */
   Input::Input(ros::NodeHandle private_nh, uint16_t port):
     private_nh_(private_nh),
-    port_(port)
+    port_(port),
+    timeout_ms_(1000)
   {
     private_nh.param("device_ip", devip_str_, std::string(""));
     if (!devip_str_.empty())
@@ -57,6 +128,94 @@ namespace velodyne_driver
                       << devip_str_);
   }
 
+  /** @brief Read a batch of packets, one at a time. */
+  int Input::getPackets(velodyne_msgs::VelodynePacket *pkts,
+                        int max_packets, int *npackets,
+                        const double time_offset)
+  {
+    *npackets = 0;
+    int rc = getPacket(pkts, time_offset);
+    if (rc == 0)
+      *npackets = 1;
+    return rc;
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Batched socket receive
+  ////////////////////////////////////////////////////////////////////////
+
+  static const size_t cmsg_size = CMSG_SPACE(sizeof(struct timespec));
+
+  // see the ASSUMPTION in InputSocket::getPacket()
+  ros::Time packetStamp(const ros::Time &received, double time_offset)
+  {
+    return received - ros::Duration(packet_accumulation_time)
+      + ros::Duration(time_offset);
+  }
+
+  void PacketBatch::resize(int size)
+  {
+    msgs_.resize(size);
+    iovecs_.resize(size);
+    senders_.resize(size);
+    cmsg_buf_.resize(size * cmsg_size);
+  }
+
+  void PacketBatch::setBuffer(int i, uint8_t *data)
+  {
+    iovecs_[i].iov_base = data;
+    iovecs_[i].iov_len = packet_size;
+  }
+
+  int PacketBatch::receive(int fd, int count)
+  {
+    for (int i = 0; i < count; ++i)
+      {
+        msghdr &hdr = msgs_[i].msg_hdr;
+        hdr.msg_name = &senders_[i];
+        hdr.msg_namelen = sizeof(sockaddr_in);
+        hdr.msg_iov = &iovecs_[i];
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = &cmsg_buf_[i * cmsg_size];
+        hdr.msg_controllen = cmsg_size;
+        hdr.msg_flags = 0;
+      }
+    return recvmmsg(fd, &msgs_[0], count, MSG_DONTWAIT, NULL);
+  }
+
+  bool PacketBatch::complete(int i) const
+  {
+    if ((msgs_[i].msg_hdr.msg_flags & MSG_TRUNC) == 0
+        && msgs_[i].msg_len == packet_size)
+      return true;
+    ROS_DEBUG_STREAM("incomplete Velodyne packet read: "
+                     << msgs_[i].msg_len << " bytes");
+    return false;
+  }
+
+  ros::Time PacketBatch::stamp(int i, const ros::Time &now,
+                               double time_offset)
+  {
+    ros::Time received = now;
+    if (!ros::Time::isSimTime())
+      {
+        msghdr &hdr = msgs_[i].msg_hdr;
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&hdr, cmsg))
+          {
+            if (cmsg->cmsg_level == SOL_SOCKET
+                && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+              {
+                struct timespec ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                received = ros::Time(ts.tv_sec, ts.tv_nsec);
+                break;
+              }
+          }
+      }
+    return packetStamp(received, time_offset);
+  }
+
   ////////////////////////////////////////////////////////////////////////
   // InputSocket class implementation
   ////////////////////////////////////////////////////////////////////////
@@ -98,6 +257,40 @@ namespace velodyne_driver
         return;
       }
 
+    if (!devip_str_.empty())
+      inet_aton(devip_str_.c_str(), &devip_);
+
+    // A larger kernel receive buffer absorbs bursts while the driver
+    // thread is descheduled.  The kernel doubles the requested value.
+    int rcvbuf;
+    private_nh.param("socket_rcvbuf", rcvbuf, 0);
+    if (rcvbuf > 0)
+      {
+        if (setsockopt(sockfd_, SOL_SOCKET, SO_RCVBUF,
+                       &rcvbuf, sizeof(rcvbuf)) < 0)
+          ROS_WARN("setsockopt(SO_RCVBUF) failed: %s", strerror(errno));
+        int actual = 0;
+        socklen_t len = sizeof(actual);
+        getsockopt(sockfd_, SOL_SOCKET, SO_RCVBUF, &actual, &len);
+        ROS_INFO("Socket receive buffer: %d bytes", actual);
+      }
+
+    // Batched receive: drain up to recv_batch datagrams per wakeup
+    // with recvmmsg(), stamping each one with its kernel receive time.
+    private_nh.param("recv_batch", batch_size_, 1);
+    if (batch_size_ > 1)
+      {
+        int on = 1;
+        if (setsockopt(sockfd_, SOL_SOCKET, SO_TIMESTAMPNS,
+                       &on, sizeof(on)) < 0)
+          ROS_WARN("setsockopt(SO_TIMESTAMPNS) failed: %s",
+                   strerror(errno));
+
+        batch_.resize(batch_size_);
+        ROS_INFO("Receiving up to %d packets per recvmmsg() call",
+                 batch_size_);
+      }
+
     ROS_DEBUG("Velodyne socket fd is %d\n", sockfd_);
   }
 
@@ -107,65 +300,92 @@ namespace velodyne_driver
     (void) close(sockfd_);
   }
 
-  /** @brief Get one Velodyne packet. */
-  int InputSocket::getPacket(velodyne_msgs::VelodynePacket *pkt, const double time_offset)
+  /** @brief Wait until the socket is readable.
+   *
+   *  @returns 0 if input is available, 1 on timeout or error
+   */
+  int InputSocket::waitForData(void)
   {
-
     struct pollfd fds[1];
     fds[0].fd = sockfd_;
     fds[0].events = POLLIN;
-    static const int POLL_TIMEOUT = 1000; // [ms]
 
+    // Unfortunately, the Linux kernel recvfrom() implementation
+    // uses a non-interruptible sleep() when waiting for data,
+    // which would cause this method to hang if the device is not
+    // providing data.  We poll() the device first to make sure
+    // the recvfrom() will not block.
+    //
+    // Note, however, that there is a known Linux kernel bug:
+    //
+    //   Under Linux, select() may report a socket file descriptor
+    //   as "ready for reading", while nevertheless a subsequent
+    //   read blocks.  This could for example happen when data has
+    //   arrived but upon examination has wrong checksum and is
+    //   discarded.  There may be other circumstances in which a
+    //   file descriptor is spuriously reported as ready.  Thus it
+    //   may be safer to use O_NONBLOCK on sockets that should not
+    //   block.
+
+    // poll() until input available
+    do
+      {
+        int retval = poll(fds, 1, timeout_ms_);
+        if (retval < 0)             // poll() error?
+          {
+            if (errno != EINTR)
+              ROS_ERROR("poll() error: %s", strerror(errno));
+            return 1;
+          }
+        if (retval == 0)            // poll() timeout?
+          {
+            ROS_WARN_THROTTLE(1.0, "Velodyne poll() timeout");
+            return 1;
+          }
+        if ((fds[0].revents & POLLERR)
+            || (fds[0].revents & POLLHUP)
+            || (fds[0].revents & POLLNVAL)) // device error?
+          {
+            ROS_ERROR("poll() reports Velodyne error");
+            return 1;
+          }
+      } while ((fds[0].revents & POLLIN) == 0);
+
+    return 0;
+  }
+
+  /** @brief Check a received datagram's size and sender address. */
+  bool InputSocket::acceptPacket(const sockaddr_in &sender,
+                                 ssize_t nbytes) const
+  {
+    if ((size_t) nbytes != packet_size)
+      {
+        ROS_DEBUG_STREAM("incomplete Velodyne packet read: "
+                         << nbytes << " bytes");
+        return false;
+      }
+
+    // If packet is not from the lidar scanner we selected by IP,
+    // reject it.
+    return (devip_str_.empty()
+            || sender.sin_addr.s_addr == devip_.s_addr);
+  }
+
+  /** @brief Get one Velodyne packet. */
+  int InputSocket::getPacket(velodyne_msgs::VelodynePacket *pkt, const double time_offset)
+  {
     sockaddr_in sender_address;
     socklen_t sender_address_len = sizeof(sender_address);
 
     while (true)
       {
-        // Unfortunately, the Linux kernel recvfrom() implementation
-        // uses a non-interruptible sleep() when waiting for data,
-        // which would cause this method to hang if the device is not
-        // providing data.  We poll() the device first to make sure
-        // the recvfrom() will not block.
-        //
-        // Note, however, that there is a known Linux kernel bug:
-        //
-        //   Under Linux, select() may report a socket file descriptor
-        //   as "ready for reading", while nevertheless a subsequent
-        //   read blocks.  This could for example happen when data has
-        //   arrived but upon examination has wrong checksum and is
-        //   discarded.  There may be other circumstances in which a
-        //   file descriptor is spuriously reported as ready.  Thus it
-        //   may be safer to use O_NONBLOCK on sockets that should not
-        //   block.
-
-        // poll() until input available
-        do
-          {
-            int retval = poll(fds, 1, POLL_TIMEOUT);
-            if (retval < 0)             // poll() error?
-              {
-                if (errno != EINTR)
-                  ROS_ERROR("poll() error: %s", strerror(errno));
-                return 1;
-              }
-            if (retval == 0)            // poll() timeout?
-              {
-                ROS_WARN("Velodyne poll() timeout");
-                return 1;
-              }
-            if ((fds[0].revents & POLLERR)
-                || (fds[0].revents & POLLHUP)
-                || (fds[0].revents & POLLNVAL)) // device error?
-              {
-                ROS_ERROR("poll() reports Velodyne error");
-                return 1;
-              }
-          } while ((fds[0].revents & POLLIN) == 0);
+        if (waitForData() != 0)
+          return 1;
 
         // Time stamp is set to the start time of packet creation (time of firing the packet's first beam of the first firing sequence). 
         // ASSUMPTION: For the VLP-16 the time to accumulate one data packet equals 55.296µs * 24 = 1327.104 µs 
         // We neglect the transfer time. It is handled by the calibration value.
-        pkt->stamp = ros::Time::now() - ros::Duration(1327.104*1.0e-6) + ros::Duration(time_offset);
+        pkt->stamp = packetStamp(ros::Time::now(), time_offset);
 
         // Receive packets that should now be available from the
         // socket using a blocking read.
@@ -183,19 +403,339 @@ namespace velodyne_driver
                 return 1;
               }
           }
-        else if ((size_t) nbytes == packet_size)
+        else if (acceptPacket(sender_address, nbytes))
+          break; //done
+      }
+    return 0;
+  }
+
+  /** @brief Get a batch of Velodyne packets.
+   *
+   *  Each recvmmsg() call receives directly into the caller's packet
+   *  slots, so no data are copied unless a datagram is rejected.
+   */
+  int InputSocket::getPackets(velodyne_msgs::VelodynePacket *pkts,
+                              int max_packets, int *npackets,
+                              const double time_offset)
+  {
+    if (batch_size_ <= 1)
+      return Input::getPackets(pkts, max_packets, npackets, time_offset);
+
+    *npackets = 0;
+    const int vlen = std::min(max_packets, batch_size_);
+    while (*npackets == 0)
+      {
+        if (waitForData() != 0)
+          return 1;
+
+        for (int i = 0; i < vlen; ++i)
+          batch_.setBuffer(i, &pkts[i].data[0]);
+        int nmsgs = batch_.receive(sockfd_, vlen);
+        if (nmsgs < 0)
           {
-            // If packet is not from the lidar scanner we selected by IP,
-            // continue; otherwise we are done.
-            if(devip_str_ != ""
-               && sender_address.sin_addr.s_addr != devip_.s_addr)
+            if (errno != EWOULDBLOCK && errno != EINTR)
+              {
+                perror("recvfail");
+                ROS_INFO("recvfail");
+                return 1;
+              }
+            continue;
+          }
+
+        const ros::Time now = ros::Time::now();
+        for (int i = 0; i < nmsgs; ++i)
+          {
+            if (!batch_.complete(i)
+                || !acceptPacket(batch_.sender(i), batch_.length(i)))
               continue;
-            else
-              break; //done
+
+            // Keep accepted packets contiguous.
+            velodyne_msgs::VelodynePacket &pkt = pkts[*npackets];
+            if (*npackets != i)
+              memcpy(&pkt.data[0], &pkts[i].data[0], packet_size);
+            pkt.stamp = batch_.stamp(i, now, time_offset);
+            ++(*npackets);
           }
+      }
+    return 0;
+  }
 
-        ROS_DEBUG_STREAM("incomplete Velodyne packet read: "
-                         << nbytes << " bytes");
+  ////////////////////////////////////////////////////////////////////////
+  // InputPacketRing class implementation
+  ////////////////////////////////////////////////////////////////////////
+
+  /** @brief constructor
+   *
+   *  @param private_nh ROS private handle for calling node.
+   *  @param interface network interface name
+   *  @param port UDP port number
+   */
+  InputPacketRing::InputPacketRing(ros::NodeHandle private_nh,
+                                   const std::string &interface,
+                                   uint16_t port):
+    Input(private_nh, port),
+    fd_(-1),
+    ring_(NULL),
+    ring_size_(0),
+    block_size_(0),
+    nblocks_(0),
+    block_(0),
+    frame_(NULL),
+    frames_left_(0)
+  {
+    if (!devip_str_.empty())
+      inet_aton(devip_str_.c_str(), &devip_);
+
+    // Ring geometry.  A block is handed to user space when it is full
+    // or when its retire timeout expires, which bounds the latency.
+    int block_size, nblocks, block_timeout;
+    private_nh.param("ring_block_size", block_size, 1 << 18);
+    private_nh.param("ring_blocks", nblocks, 32);
+    private_nh.param("ring_block_timeout", block_timeout, 2); // [ms]
+    static const int frame_size = 2048;   // holds one Velodyne frame
+    long page_size = sysconf(_SC_PAGESIZE);
+    block_size = ((block_size + page_size - 1) / page_size) * page_size;
+
+    ROS_INFO_STREAM("Opening PACKET_MMAP ring on " << interface
+                    << ": port " << port << ", " << nblocks
+                    << " blocks of " << block_size << " bytes");
+
+    fd_ = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_IP));
+    if (fd_ == -1)
+      {
+        ROS_ERROR("packet socket: %s (CAP_NET_RAW required)",
+                  strerror(errno));
+        return;
+      }
+
+    // Only let UDP packets for our port into the ring, so other
+    // traffic on the interface costs nothing.  This is the classic
+    // BPF program generated by: tcpdump -dd "udp dst port <port>"
+    // for untagged IPv4 frames.
+    struct sock_filter filter[] =
+      {
+        { 0x28, 0, 0, 0x0000000c },     // ldh [12]
+        { 0x15, 0, 8, 0x00000800 },     // jeq #0x800, drop
+        { 0x30, 0, 0, 0x00000017 },     // ldb [23]
+        { 0x15, 0, 6, 0x00000011 },     // jeq #17, drop
+        { 0x28, 0, 0, 0x00000014 },     // ldh [20]
+        { 0x45, 4, 0, 0x00001fff },     // jset #0x1fff, drop
+        { 0xb1, 0, 0, 0x0000000e },     // ldxb 4*([14]&0xf)
+        { 0x48, 0, 0, 0x00000010 },     // ldh [x + 16]
+        { 0x15, 0, 1, (uint32_t) port },// jeq #port, accept
+        { 0x06, 0, 0, 0x00040000 },     // accept: ret #262144
+        { 0x06, 0, 0, 0x00000000 },     // drop: ret #0
+      };
+    struct sock_fprog prog;
+    prog.len = sizeof(filter) / sizeof(filter[0]);
+    prog.filter = filter;
+    if (setsockopt(fd_, SOL_SOCKET, SO_ATTACH_FILTER,
+                   &prog, sizeof(prog)) < 0)
+      ROS_WARN("SO_ATTACH_FILTER failed: %s", strerror(errno));
+
+    int version = TPACKET_V3;
+    if (setsockopt(fd_, SOL_PACKET, PACKET_VERSION,
+                   &version, sizeof(version)) < 0)
+      {
+        ROS_ERROR("TPACKET_V3 not supported: %s", strerror(errno));
+        close(fd_);
+        fd_ = -1;
+        return;
+      }
+
+    struct tpacket_req3 req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = block_size;
+    req.tp_block_nr = nblocks;
+    req.tp_frame_size = frame_size;
+    req.tp_frame_nr = (block_size / frame_size) * nblocks;
+    req.tp_retire_blk_tov = block_timeout;
+    if (setsockopt(fd_, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+      {
+        ROS_ERROR("PACKET_RX_RING setup failed: %s", strerror(errno));
+        close(fd_);
+        fd_ = -1;
+        return;
+      }
+
+    ring_size_ = (size_t) block_size * nblocks;
+    void *ring = mmap(NULL, ring_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_LOCKED, fd_, 0);
+    if (ring == MAP_FAILED)             // retry without locked pages
+      ring = mmap(NULL, ring_size_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED, fd_, 0);
+    if (ring == MAP_FAILED)
+      {
+        ROS_ERROR("PACKET_MMAP ring mmap() failed: %s", strerror(errno));
+        close(fd_);
+        fd_ = -1;
+        return;
+      }
+    ring_ = (uint8_t *) ring;
+    block_size_ = block_size;
+    nblocks_ = nblocks;
+
+    struct sockaddr_ll ll;
+    memset(&ll, 0, sizeof(ll));
+    ll.sll_family = AF_PACKET;
+    ll.sll_protocol = htons(ETH_P_IP);
+    ll.sll_ifindex = if_nametoindex(interface.c_str());
+    if (ll.sll_ifindex == 0
+        || bind(fd_, (sockaddr *) &ll, sizeof(ll)) == -1)
+      {
+        ROS_ERROR_STREAM("cannot bind packet ring to interface "
+                         << interface << ": " << strerror(errno));
+        // unbound, it would see matching packets of every interface
+        munmap(ring_, ring_size_);
+        ring_ = NULL;
+        close(fd_);
+        fd_ = -1;
+        return;
+      }
+
+    ROS_DEBUG("Velodyne packet ring fd is %d\n", fd_);
+  }
+
+  /** @brief destructor */
+  InputPacketRing::~InputPacketRing(void)
+  {
+    if (ring_ != NULL)
+      munmap(ring_, ring_size_);
+    if (fd_ != -1)
+      (void) close(fd_);
+  }
+
+  /** @brief Wait until the current ring block belongs to user space.
+   *
+   *  @returns 0 if a block is available, 1 on timeout or error
+   */
+  int InputPacketRing::waitForBlock(void)
+  {
+    if (ring_ == NULL)
+      return 1;
+
+    tpacket_block_desc *desc =
+      (tpacket_block_desc *) (ring_ + block_ * block_size_);
+    while ((desc->hdr.bh1.block_status & TP_STATUS_USER) == 0)
+      {
+        struct pollfd fds[1];
+        fds[0].fd = fd_;
+        fds[0].events = POLLIN | POLLERR;
+        fds[0].revents = 0;
+        int retval = poll(fds, 1, timeout_ms_);
+        if (retval < 0)
+          {
+            if (errno != EINTR)
+              ROS_ERROR("poll() error: %s", strerror(errno));
+            return 1;
+          }
+        if (retval == 0)
+          {
+            ROS_WARN_THROTTLE(1.0, "Velodyne poll() timeout");
+            return 1;
+          }
+      }
+    __sync_synchronize();               // read block after status
+
+    frames_left_ = desc->hdr.bh1.num_pkts;
+    frame_ = (uint8_t *) desc + desc->hdr.bh1.offset_to_first_pkt;
+    return 0;
+  }
+
+  /** @brief Return the current block to the kernel. */
+  void InputPacketRing::releaseBlock(void)
+  {
+    tpacket_block_desc *desc =
+      (tpacket_block_desc *) (ring_ + block_ * block_size_);
+    __sync_synchronize();
+    desc->hdr.bh1.block_status = TP_STATUS_KERNEL;
+    block_ = (block_ + 1) % nblocks_;
+    frame_ = NULL;
+  }
+
+  /** @brief Copy the next valid frame of the current block, if any.
+   *
+   *  @returns true if a packet was stored, false when the block
+   *           has been used up and released.
+   */
+  bool InputPacketRing::nextPacket(velodyne_msgs::VelodynePacket *pkt,
+                                   const double time_offset)
+  {
+    while (frame_ != NULL)
+      {
+        if (frames_left_ == 0)
+          {
+            releaseBlock();
+            return false;
+          }
+
+        tpacket3_hdr *hdr = (tpacket3_hdr *) frame_;
+        const uint8_t *frame = frame_ + hdr->tp_mac;
+        frame_ += hdr->tp_next_offset;
+        --frames_left_;
+
+        const uint8_t *payload;
+        size_t payload_len;
+        uint32_t src_addr;
+        uint16_t dst_port;
+        if (!parseUdpFrame(frame, hdr->tp_snaplen, &payload, &payload_len,
+                           &src_addr, &dst_port)
+            || dst_port != port_ || payload_len != packet_size)
+          continue;
+
+        // If packet is not from the lidar scanner we selected by IP,
+        // skip it.
+        if (!devip_str_.empty() && src_addr != devip_.s_addr)
+          continue;
+
+        memcpy(&pkt->data[0], payload, packet_size);
+        pkt->stamp = packetStamp(ros::Time(hdr->tp_sec, hdr->tp_nsec),
+                                 time_offset);
+        return true;
+      }
+    return false;
+  }
+
+  /** @brief Get one Velodyne packet. */
+  int InputPacketRing::getPacket(velodyne_msgs::VelodynePacket *pkt,
+                                 const double time_offset)
+  {
+    while (true)
+      {
+        if (frame_ == NULL && waitForBlock() != 0)
+          return 1;
+        if (nextPacket(pkt, time_offset))
+          return 0;
+      }
+  }
+
+  /** @brief Get all packets available in the ring, up to max_packets.
+   *
+   *  Blocks only until the first packet arrives.
+   */
+  int InputPacketRing::getPackets(velodyne_msgs::VelodynePacket *pkts,
+                                  int max_packets, int *npackets,
+                                  const double time_offset)
+  {
+    *npackets = 0;
+    int rc = getPacket(pkts, time_offset);
+    if (rc != 0)
+      return rc;
+
+    *npackets = 1;
+    while (*npackets < max_packets)
+      {
+        if (frame_ == NULL)
+          {
+            // continue only with blocks the kernel already retired
+            tpacket_block_desc *desc =
+              (tpacket_block_desc *) (ring_ + block_ * block_size_);
+            if ((desc->hdr.bh1.block_status & TP_STATUS_USER) == 0
+                || waitForBlock() != 0)
+              break;
+          }
+        if (nextPacket(&pkts[*npackets], time_offset))
+          ++(*npackets);
       }
     return 0;
   }
@@ -204,92 +744,145 @@ namespace velodyne_driver
   // InputPCAP class implementation
   ////////////////////////////////////////////////////////////////////////
 
+  /** Largest capture time gap replayed as it is [ns].  Longer ones,
+   *  like pauses during recording or jumps back, restart the timing. */
+  static const uint64_t MAX_REPLAY_GAP = 1000000000ULL;
+
   /** @brief constructor
    *
    *  @param private_nh ROS private handle for calling node.
    *  @param port UDP port number
-   *  @param packet_rate expected device packet frequency (Hz)
-   *  @param filename PCAP dump file name
+   *  @param packet_rate ignored, replay follows the capture timing
+   *  @param filename PCAP or pcapng dump file name
    */
   InputPCAP::InputPCAP(ros::NodeHandle private_nh, uint16_t port,
                        double packet_rate, std::string filename,
                        bool read_once, bool read_fast, double repeat_delay):
     Input(private_nh, port),
-    packet_rate_(packet_rate),
-    filename_(filename)
+    filename_(filename),
+    paced_(false),
+    base_stamp_(0),
+    last_stamp_(0)
   {
-    pcap_ = NULL;
-    empty_ = true;
-
     // get parameters using private node handle
     private_nh.param("read_once", read_once_, false);
-    private_nh.param("read_fast", read_fast_, false);
+    private_nh.param("read_fast", read_fast, false);
+    private_nh.param("replay_rate", replay_rate_, 1.0);
     private_nh.param("repeat_delay", repeat_delay_, 0.0);
+    if (read_fast)
+      replay_rate_ = 0.0;
 
     if (read_once_)
       ROS_INFO("Read input file only once.");
-    if (read_fast_)
+    if (replay_rate_ <= 0.0)
       ROS_INFO("Read input file as quickly as possible.");
+    else
+      ROS_INFO("Replay input file at %.3f times capture speed.", replay_rate_);
     if (repeat_delay_ > 0.0)
       ROS_INFO("Delay %.3f seconds before repeating input file.",
                repeat_delay_);
 
-    // Open the PCAP dump file
+    // Map and index the dump file
     ROS_INFO("Opening PCAP file \"%s\"", filename_.c_str());
-    if ((pcap_ = pcap_open_offline(filename_.c_str(), errbuf_) ) == NULL)
+    in_addr devip;
+    devip.s_addr = 0;
+    if (!devip_str_.empty())
+      inet_aton(devip_str_.c_str(), &devip);
+    std::string error;
+    if (!file_.open(filename_, port, devip.s_addr, packet_size, &error))
       {
-        ROS_FATAL("Error opening Velodyne socket dump file.");
+        ROS_FATAL("Error opening Velodyne socket dump file: %s",
+                  error.c_str());
         return;
       }
-
-    std::stringstream filter;
-    if( devip_str_ != "" )              // using specific IP?
+    ROS_INFO("%zu packets, %zu revolutions, %.3f seconds.",
+             file_.packets(), file_.revolutions(),
+             (file_.endTime() - file_.startTime()) * 1.0e-9);
+
+    // Optionally start later in the file.
+    double start_time;
+    int start_revolution;
+    private_nh.param("start_time", start_time, 0.0);
+    private_nh.param("start_revolution", start_revolution, 0);
+    if (start_revolution > 0)
+      {
+        if (!seekRevolution(start_revolution))
+          ROS_ERROR("no revolution %d in file", start_revolution);
+      }
+    else if (start_time > 0.0)
       {
-        filter << "src host " << devip_str_ << " && ";
+        if (!seekTime(start_time))
+          ROS_ERROR("no packets %.3f seconds into file", start_time);
       }
-    filter << "udp dst port " << port;
-    pcap_compile(pcap_, &pcap_packet_filter_,
-                 filter.str().c_str(), 1, PCAP_NETMASK_UNKNOWN);
+    start_ = file_.tell();
   }
 
-  /** destructor */
-  InputPCAP::~InputPCAP(void)
+  bool InputPCAP::seekTime(double offset)
   {
-    pcap_close(pcap_);
+    paced_ = false;
+    return file_.seekTime(file_.startTime() + (uint64_t) (offset * 1.0e9));
+  }
+
+  bool InputPCAP::seekRevolution(size_t revolution)
+  {
+    paced_ = false;
+    return file_.seekRevolution(revolution);
+  }
+
+  /** @brief Wait until a packet's replay time.
+   *
+   *  The capture times since a base packet, divided by replay_rate,
+   *  are the wall times since it was replayed.
+   *
+   *  @param stamp capture time of the packet [ns]
+   */
+  void InputPCAP::pace(uint64_t stamp)
+  {
+    if (replay_rate_ <= 0.0)
+      return;
+
+    ros::WallTime now = ros::WallTime::now();
+    if (!paced_ || stamp < last_stamp_ || stamp - last_stamp_ > MAX_REPLAY_GAP)
+      {
+        paced_ = true;
+        base_time_ = now;
+        base_stamp_ = stamp;
+        last_stamp_ = stamp;
+        return;
+      }
+    last_stamp_ = stamp;
+
+    ros::WallTime due = base_time_
+      + ros::WallDuration((stamp - base_stamp_) * 1.0e-9 / replay_rate_);
+    if (due > now)
+      (due - now).sleep();
+    else if ((now - due).toSec() > 1.0)
+      {
+        // far behind, maybe stopped: do not rush to catch up
+        base_time_ = now;
+        base_stamp_ = stamp;
+      }
   }
 
   /** @brief Get one velodyne packet. */
   int InputPCAP::getPacket(velodyne_msgs::VelodynePacket *pkt, const double time_offset)
   {
-    struct pcap_pkthdr *header;
-    const u_char *pkt_data;
-
     while (true)
       {
-        int res;
-        if ((res = pcap_next_ex(pcap_, &header, &pkt_data)) >= 0)
+        PcapPacket packet;
+        if (file_.next(&packet))
           {
-            // Skip packets not for the correct port and from the
-            // selected IP address.
-            if (!devip_str_.empty() &&
-                (0 == pcap_offline_filter(&pcap_packet_filter_,
-                                          header, pkt_data)))
-              continue;
-
             // Keep the reader from blowing through the file.
-            if (read_fast_ == false)
-              packet_rate_.sleep();
+            pace(packet.stamp);
 
-            memcpy(&pkt->data[0], pkt_data+42, packet_size);
+            memcpy(&pkt->data[0], packet.data, packet_size);
             pkt->stamp = ros::Time::now(); // time_offset not considered here, as no synchronization required
-            empty_ = false;
             return 0;                   // success
           }
 
-        if (empty_)                 // no data in file?
+        if (file_.packets() == 0)       // no data in file?
           {
-            ROS_WARN("Error %d reading Velodyne packet: %s",
-                     res, pcap_geterr(pcap_));
+            ROS_WARN("No Velodyne packets in file \"%s\"", filename_.c_str());
             return -1;
           }
 
@@ -307,13 +900,8 @@ namespace velodyne_driver
           }
 
         ROS_DEBUG("replaying Velodyne dump file");
-
-        // I can't figure out how to rewind the file, because it
-        // starts with some kind of header.  So, close the file
-        // and reopen it with pcap.
-        pcap_close(pcap_);
-        pcap_ = pcap_open_offline(filename_.c_str(), errbuf_);
-        empty_ = true;              // maybe the file disappeared?
+        file_.seek(start_);
+        paced_ = false;
       } // loop back and try again
   }
 
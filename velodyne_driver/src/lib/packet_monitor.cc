@@ -0,0 +1,243 @@
+/*
+ *  Copyright (C) 2015, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Packet loss and reordering checks for the Velodyne 3D LIDARs.
+ */
+
+#include <math.h>
+#include <algorithm>
+
+#include <velodyne_driver/packet_monitor.h>
+
+namespace velodyne_driver
+{
+  static const int64_t HOUR_USEC = 3600000000LL;
+
+  /** device time steps beyond this are restarts, not losses [µs] */
+  static const int64_t RESYNC_USEC = 1000000;
+
+  /** @returns device time from first to t [µs], across the hour */
+  static inline int64_t timeStep(uint32_t first, uint32_t t)
+  {
+    int64_t dt = (int64_t) t - first;
+    if (dt > HOUR_USEC / 2)
+      dt -= HOUR_USEC;
+    else if (dt < -HOUR_USEC / 2)
+      dt += HOUR_USEC;
+    return dt;
+  }
+
+  /** orders packets by device time from the first one of a scan */
+  struct DeviceTimeOrder
+  {
+    DeviceTimeOrder(uint32_t first): first_(first) {}
+    bool operator()(const velodyne_msgs::VelodynePacket &a,
+                    const velodyne_msgs::VelodynePacket &b) const
+    {
+      return (timeStep(first_, packetDeviceTime(a))
+              < timeStep(first_, packetDeviceTime(b)));
+    }
+    uint32_t first_;
+  };
+
+  /** @returns azimuth in radians, from hundredths of a degree */
+  static inline float azimuthRadians(double azimuth)
+  {
+    return fmod(azimuth, 36000.0) * M_PI / 18000.0;
+  }
+
+  PacketMonitor::PacketMonitor():
+    device_time_(false),
+    interval_(0.0),
+    azimuth_step_(0.0),
+    started_(false),
+    last_time_(0),
+    last_azimuth_(0),
+    position_(0),
+    lost_(0), reordered_(0), deadline_scans_(0), sectors_(0),
+    period_lost_(0), period_reordered_(0), period_deadline_(0)
+  {}
+
+  void PacketMonitor::configure(double packet_rate, double rpm,
+                                bool device_time)
+  {
+    device_time_ = device_time;
+    interval_ = 1.0e6 / packet_rate;
+    azimuth_step_ = rpm / 60.0 * 36000.0 / packet_rate;
+  }
+
+  void PacketMonitor::check(velodyne_msgs::VelodyneScan &scan,
+                            velodyne_msgs::VelodyneScanStatus &status)
+  {
+    status.packets = scan.packets.size();
+    status.lost_packets = 0;
+    status.reordered_packets = 0;
+    status.missing_start.clear();
+    status.missing_end.clear();
+    if (interval_ <= 0.0)
+      return;                           // not configured
+
+    // Late packets are at most this far behind the latest one, so
+    // older gaps will not be filled.  Those of earlier scans were
+    // reported with them.
+    const int64_t horizon = device_time_? RESYNC_USEC: 18000;
+    while (!gaps_.empty() && gaps_.front().end < position_ - horizon)
+      gaps_.pop_front();
+    for (size_t i = 0; i < gaps_.size(); ++i)
+      gaps_[i].current = false;
+
+    const double step = device_time_? interval_: azimuth_step_;
+    size_t sectors = 0;
+    for (size_t i = 0; i < scan.packets.size(); ++i)
+      {
+        const velodyne_msgs::VelodynePacket &pkt = scan.packets[i];
+        int azimuth = packetAzimuth(pkt);
+        uint32_t time = packetDeviceTime(pkt);
+        if (!started_)
+          {
+            started_ = true;
+            last_time_ = time;
+            last_azimuth_ = azimuth;
+            continue;
+          }
+
+        int64_t delta;
+        if (device_time_)
+          {
+            delta = timeStep(last_time_, time);
+            if (delta < -RESYNC_USEC || delta > RESYNC_USEC)
+              {
+                // device restarted, or a capture file repeating: no
+                // later packet fills the gaps so far
+                position_ += 2 * horizon;
+                last_time_ = time;
+                last_azimuth_ = azimuth;
+                continue;
+              }
+          }
+        else
+          {
+            delta = (azimuth - last_azimuth_ + 36000) % 36000;
+            if (delta > 18000)
+              delta -= 36000;           // behind the latest packet
+          }
+
+        if (delta < 0 || (delta == 0 && device_time_))
+          {
+            // fills a gap already counted, keep the latest packet
+            ++status.reordered_packets;
+            fill(position_ + delta, azimuth, status);
+            continue;
+          }
+
+        if (delta > 1.5 * step)
+          {
+            Gap gap;
+            gap.start = position_;
+            gap.end = position_ + delta;
+            gap.lost = (int64_t) (delta / step + 0.5) - 1;
+            gap.first_azimuth = last_azimuth_ + azimuth_step_;
+            gap.end_azimuth = azimuth;
+            gap.current = true;
+            gaps_.push_back(gap);
+            status.lost_packets += gap.lost;
+          }
+        position_ += delta;
+        last_time_ = time;
+        last_azimuth_ = azimuth;
+      }
+
+    for (size_t i = 0; i < gaps_.size(); ++i)
+      if (gaps_[i].current)
+        {
+          status.missing_start.push_back(azimuthRadians(gaps_[i].first_azimuth));
+          status.missing_end.push_back(azimuthRadians(gaps_[i].end_azimuth));
+          ++sectors;
+        }
+
+    if (device_time_ && status.reordered_packets > 0)
+      std::stable_sort(scan.packets.begin(), scan.packets.end(),
+                       DeviceTimeOrder(packetDeviceTime(scan.packets[0])));
+
+    lost_ += status.lost_packets;
+    period_lost_ += status.lost_packets;
+    reordered_ += status.reordered_packets;
+    period_reordered_ += status.reordered_packets;
+    sectors_ += sectors;
+  }
+
+  /** @brief Take a late packet out of the gap it falls in.
+   *
+   *  The gap is split at the packet, and the parts with no packets
+   *  missing are dropped.  The loss of a gap reported with an earlier
+   *  scan is corrected in the totals.
+   */
+  void PacketMonitor::fill(int64_t position, int azimuth,
+                           velodyne_msgs::VelodyneScanStatus &status)
+  {
+    std::deque<Gap>::iterator gap = gaps_.begin();
+    while (gap != gaps_.end() && !(gap->start < position && position < gap->end))
+      ++gap;
+    if (gap == gaps_.end())
+      return;                           // a duplicate, or too late
+
+    const double step = device_time_? interval_: azimuth_step_;
+    int64_t before = (int64_t) ((position - gap->start) / step + 0.5) - 1;
+    before = std::max((int64_t) 0, std::min(before, gap->lost - 1));
+    Gap after = *gap;
+    after.start = position;
+    after.lost = gap->lost - before - 1;
+    after.first_azimuth = azimuth + azimuth_step_;
+    gap->end = position;
+    gap->lost = before;
+    gap->end_azimuth = azimuth;
+
+    if (gap->current)
+      --status.lost_packets;
+    else
+      {
+        // sectors reported with earlier scans, one more or one less
+        if (lost_ > 0)
+          --lost_;
+        if (period_lost_ > 0)
+          --period_lost_;
+        if (before > 0 && after.lost > 0)
+          ++sectors_;
+        else if (before == 0 && after.lost == 0 && sectors_ > 0)
+          --sectors_;
+      }
+
+    if (after.lost > 0)
+      gap = gaps_.insert(gap + 1, after) - 1;
+    if (gap->lost == 0)
+      gaps_.erase(gap);
+  }
+
+  void PacketMonitor::report(diagnostic_updater::DiagnosticStatusWrapper &status)
+  {
+    if (period_lost_ > 0 || period_reordered_ > 0 || period_deadline_ > 0)
+      status.summaryf(diagnostic_msgs::DiagnosticStatus::WARN,
+                      "%llu packets lost, %llu reordered, %llu late scans",
+                      (unsigned long long) period_lost_,
+                      (unsigned long long) period_reordered_,
+                      (unsigned long long) period_deadline_);
+    else
+      status.summary(diagnostic_msgs::DiagnosticStatus::OK,
+                     "No packets lost");
+    status.addf("lost_packets", "%llu", (unsigned long long) lost_);
+    status.addf("reordered_packets", "%llu", (unsigned long long) reordered_);
+    status.addf("deadline_scans", "%llu", (unsigned long long) deadline_scans_);
+    status.addf("missing_sectors", "%llu", (unsigned long long) sectors_);
+    period_lost_ = 0;
+    period_reordered_ = 0;
+    period_deadline_ = 0;
+  }
+
+} // velodyne_driver namespace
@@ -0,0 +1,286 @@
+/*
+ *  Copyright (C) 2009, 2010 Austin Robot Technology, Jack O'Quin
+ *  Copyright (C) 2015, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Raw packet recorder writing pcap files from a background thread.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include <ros/ros.h>
+#include <velodyne_driver/packet_recorder.h>
+
+namespace velodyne_driver
+{
+  /** write buffer alignment, and size multiple of O_DIRECT writes */
+  static const size_t RECORDER_ALIGN = 4096;
+
+  /** write buffer size, written once full */
+  static const size_t RECORDER_BUFFER_SIZE = 4 * 1024 * 1024;
+
+  /** packets taken from the ring at once */
+  static const size_t RECORDER_POP_BATCH = 256;
+
+  // classic pcap, nanosecond time stamps, Ethernet frames
+  static const uint32_t PCAP_MAGIC_NSEC = 0xa1b23c4d;
+  static const size_t PCAP_HEADER_SIZE = 24;
+  static const size_t PCAP_RECORD_SIZE = 16;
+  static const size_t FRAME_HEADER_SIZE = 42;
+  static const size_t RECORD_SIZE =
+    PCAP_RECORD_SIZE + FRAME_HEADER_SIZE + RECORDER_PAYLOAD_SIZE;
+
+  /** Velodyne factory default device address, 192.168.1.201 */
+  static const uint8_t DEFAULT_DEVICE_ADDR[4] = {192, 168, 1, 201};
+
+  static inline void put16(uint8_t *p, uint16_t value)
+  {
+    p[0] = value >> 8;                  // network order
+    p[1] = value & 0xff;
+  }
+
+  PacketRecorder::PacketRecorder(const std::string &prefix, uint16_t port,
+                                 uint32_t src_addr, uint64_t max_file_size,
+                                 double max_file_duration, bool direct_io,
+                                 size_t capacity)
+    : queue_(capacity),
+      capacity_(capacity),
+      dropped_(0),
+      running_(true),
+      prefix_(prefix),
+      max_file_size_(max_file_size),
+      max_file_duration_((uint64_t) (max_file_duration * 1.0e9)),
+      direct_io_(direct_io),
+      fd_(-1),
+      direct_(false),
+      files_(0),
+      file_bytes_(0),
+      file_stamp_(0),
+      buffer_(NULL),
+      used_(0)
+  {
+    // a file holds at least its header and one packet
+    if (max_file_size_ != 0 && max_file_size_ < PCAP_HEADER_SIZE + RECORD_SIZE)
+      max_file_size_ = PCAP_HEADER_SIZE + RECORD_SIZE;
+
+    // every packet gets the same broadcast frame header
+    uint8_t *eth = frame_header_;
+    memset(eth, 0xff, 6);               // broadcast destination
+    memset(eth + 6, 0, 6);
+    put16(eth + 12, 0x0800);            // IPv4
+
+    uint8_t *ip = eth + 14;
+    memset(ip, 0, 20);
+    ip[0] = 0x45;                       // version 4, 20 byte header
+    put16(ip + 2, 20 + 8 + RECORDER_PAYLOAD_SIZE);
+    put16(ip + 6, 0x4000);              // don't fragment
+    ip[8] = 64;                         // TTL
+    ip[9] = 17;                         // UDP
+    if (src_addr != 0)
+      memcpy(ip + 12, &src_addr, 4);
+    else
+      memcpy(ip + 12, DEFAULT_DEVICE_ADDR, 4);
+    memset(ip + 16, 0xff, 4);           // broadcast
+    uint32_t sum = 0;
+    for (int i = 0; i < 20; i += 2)
+      sum += (ip[i] << 8) | ip[i+1];
+    while (sum >> 16)
+      sum = (sum & 0xffff) + (sum >> 16);
+    put16(ip + 10, ~sum & 0xffff);
+
+    uint8_t *udp = ip + 20;
+    put16(udp, port);
+    put16(udp + 2, port);
+    put16(udp + 4, 8 + RECORDER_PAYLOAD_SIZE);
+    put16(udp + 6, 0);                  // no checksum
+
+    void *buffer;
+    if (posix_memalign(&buffer, RECORDER_ALIGN, RECORDER_BUFFER_SIZE) != 0)
+      {
+        ROS_ERROR("Unable to allocate packet recorder buffer");
+        return;
+      }
+    buffer_ = (uint8_t *) buffer;
+    thread_ = boost::thread(boost::bind(&PacketRecorder::writer, this));
+    ROS_INFO_STREAM("Recording packets to " << prefix_ << "-*.pcap");
+  }
+
+  PacketRecorder::~PacketRecorder()
+  {
+    running_ = false;
+    if (thread_.joinable())
+      thread_.join();
+    free(buffer_);
+    if (dropped_ > 0)
+      ROS_WARN_STREAM("Packet recorder dropped " << dropped_ << " packets");
+  }
+
+  void PacketRecorder::record(const uint8_t *data, uint64_t stamp)
+  {
+    Packet packet;
+    packet.stamp = stamp;
+    memcpy(packet.data, data, RECORDER_PAYLOAD_SIZE);
+    if (buffer_ == NULL || !queue_.push(packet))
+      ++dropped_;
+  }
+
+  /** Writer thread: drain the ring until stopped, then close the file. */
+  void PacketRecorder::writer()
+  {
+    std::vector<Packet> batch(RECORDER_POP_BATCH);
+    for (;;)
+      {
+        bool stopping = !running_;      // read before the last pop
+        size_t n = queue_.pop(&batch[0], RECORDER_POP_BATCH);
+        for (size_t i = 0; i < n; ++i)
+          append(batch[i]);
+        if (n == 0)
+          {
+            if (stopping)
+              break;
+            boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+          }
+      }
+    closeFile();
+  }
+
+  /** Add one packet record, starting a new file when due. */
+  void PacketRecorder::append(const Packet &packet)
+  {
+    // when the clock steps back, the file duration counts from there,
+    // not from a stamp the packets may never reach again
+    if (fd_ >= 0 && packet.stamp < file_stamp_)
+      file_stamp_ = packet.stamp;
+    if (fd_ >= 0
+        && ((max_file_size_ != 0
+             && file_bytes_ + RECORD_SIZE > max_file_size_)
+            || (max_file_duration_ != 0
+                && packet.stamp - file_stamp_ >= max_file_duration_)))
+      closeFile();
+    if (fd_ < 0 && !openFile(packet.stamp))
+      return;                           // packet lost
+
+    if (used_ + RECORD_SIZE > RECORDER_BUFFER_SIZE)
+      flush(false);
+
+    uint32_t record[4];
+    record[0] = packet.stamp / 1000000000ULL;
+    record[1] = packet.stamp % 1000000000ULL;
+    record[2] = FRAME_HEADER_SIZE + RECORDER_PAYLOAD_SIZE;
+    record[3] = record[2];
+    uint8_t *p = buffer_ + used_;
+    memcpy(p, record, PCAP_RECORD_SIZE);
+    memcpy(p + PCAP_RECORD_SIZE, frame_header_, FRAME_HEADER_SIZE);
+    memcpy(p + PCAP_RECORD_SIZE + FRAME_HEADER_SIZE, packet.data,
+           RECORDER_PAYLOAD_SIZE);
+    used_ += RECORD_SIZE;
+    file_bytes_ += RECORD_SIZE;
+  }
+
+  /** @brief Start a capture file with its pcap header.
+   *
+   *  @param stamp time of its first packet [ns]
+   *  @returns true if the file is open
+   */
+  bool PacketRecorder::openFile(uint64_t stamp)
+  {
+    char suffix[64];
+    time_t seconds = stamp / 1000000000ULL;
+    struct tm utc;
+    gmtime_r(&seconds, &utc);
+    size_t len = strftime(suffix, sizeof(suffix), "-%Y%m%d-%H%M%S", &utc);
+    snprintf(suffix + len, sizeof(suffix) - len, "-%04u.pcap", files_++);
+    std::string filename = prefix_ + suffix;
+
+    direct_ = direct_io_;
+    fd_ = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC
+               | (direct_? O_DIRECT: 0), 0644);
+    if (fd_ == -1 && direct_ && errno == EINVAL)
+      {
+        ROS_WARN_ONCE("O_DIRECT not supported for packet recording");
+        direct_ = false;
+        fd_ = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      }
+    if (fd_ == -1)
+      {
+        ROS_ERROR_THROTTLE(1.0, "Unable to open packet recording %s: %s",
+                           filename.c_str(), strerror(errno));
+        return false;
+      }
+
+    uint32_t header[6];
+    header[0] = PCAP_MAGIC_NSEC;
+    header[1] = 2 | (4 << 16);          // version 2.4, host order
+    header[2] = 0;                      // UTC
+    header[3] = 0;                      // accuracy
+    header[4] = 65535;                  // snapshot length
+    header[5] = 1;                      // Ethernet
+    memcpy(buffer_, header, PCAP_HEADER_SIZE);
+    used_ = PCAP_HEADER_SIZE;
+    file_bytes_ = PCAP_HEADER_SIZE;
+    file_stamp_ = stamp;
+    ROS_INFO("Recording packets to %s", filename.c_str());
+    return true;
+  }
+
+  /** Write all pending records and close the current file. */
+  void PacketRecorder::closeFile()
+  {
+    if (fd_ < 0)
+      return;
+    flush(true);
+    close(fd_);
+    fd_ = -1;
+  }
+
+  /** @brief Write the buffer to the file.
+   *
+   *  Writes whole pages and keeps the rest for the next call, so
+   *  O_DIRECT writes stay aligned.
+   *
+   *  @param all also write the last partial page
+   */
+  void PacketRecorder::flush(bool all)
+  {
+    size_t n = all? used_: used_ & ~(RECORDER_ALIGN - 1);
+    if (n == 0)
+      return;
+    if (all && direct_ && n % RECORDER_ALIGN != 0)
+      {
+        // the unaligned tail goes through the page cache
+        fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) & ~O_DIRECT);
+        direct_ = false;
+      }
+
+    size_t done = 0;
+    while (done < n)
+      {
+        ssize_t rc = write(fd_, buffer_ + done, n - done);
+        if (rc < 0)
+          {
+            if (errno == EINTR)
+              continue;
+            ROS_ERROR_THROTTLE(1.0, "Packet recording write failed: %s",
+                               strerror(errno));
+            break;                      // drop the rest of the buffer
+          }
+        done += rc;
+      }
+    memmove(buffer_, buffer_ + n, used_ - n);
+    used_ -= n;
+  }
+
+} // velodyne_driver namespace
@@ -0,0 +1,409 @@
+/*
+ *  Copyright (C) 2009, 2010 Austin Robot Technology, Jack O'Quin
+ *  Copyright (C) 2015, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Memory-mapped reader of Velodyne packet capture files.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#include <velodyne_driver/input.h>
+#include <velodyne_driver/pcap_file.h>
+
+namespace velodyne_driver
+{
+  /** packets between index checkpoints */
+  static const size_t PCAP_INDEX_STRIDE = 1024;
+
+  // classic pcap file header
+  static const uint32_t PCAP_MAGIC_USEC = 0xa1b2c3d4;
+  static const uint32_t PCAP_MAGIC_NSEC = 0xa1b23c4d;
+  static const size_t PCAP_HEADER_SIZE = 24;
+  static const size_t PCAP_RECORD_SIZE = 16;
+
+  // pcapng block types and options
+  static const uint32_t PCAPNG_SECTION_HEADER = 0x0a0d0d0a;
+  static const uint32_t PCAPNG_BYTE_ORDER_MAGIC = 0x1a2b3c4d;
+  static const uint32_t PCAPNG_INTERFACE = 1;
+  static const uint32_t PCAPNG_ENHANCED_PACKET = 6;
+  static const uint16_t PCAPNG_IF_TSRESOL = 9;
+
+  static const uint16_t LINKTYPE_ETHERNET = 1;
+
+  static inline uint32_t swap32(uint32_t value)
+  {
+    return ((value >> 24) | ((value >> 8) & 0xff00)
+            | ((value << 8) & 0xff0000) | (value << 24));
+  }
+
+  PcapFile::PcapFile():
+    base_(NULL),
+    size_(0),
+    pcapng_(false),
+    port_(0),
+    src_addr_(0),
+    payload_size_(0),
+    packets_(0),
+    end_stamp_(0)
+  {
+    memset(&cursor_, 0, sizeof(cursor_));
+    start_ = cursor_;
+  }
+
+  PcapFile::~PcapFile()
+  {
+    close();
+  }
+
+  uint16_t PcapFile::get16(const uint8_t *p, bool swapped) const
+  {
+    uint16_t value;
+    memcpy(&value, p, sizeof(value));
+    return swapped? (uint16_t) ((value >> 8) | (value << 8)): value;
+  }
+
+  uint32_t PcapFile::get32(const uint8_t *p, bool swapped) const
+  {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return swapped? swap32(value): value;
+  }
+
+  bool PcapFile::open(const std::string &filename, uint16_t port,
+                      uint32_t src_addr, size_t payload_size,
+                      std::string *error)
+  {
+    close();
+    port_ = port;
+    src_addr_ = src_addr;
+    payload_size_ = payload_size;
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+      {
+        *error = strerror(errno);
+        return false;
+      }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t) PCAP_HEADER_SIZE)
+      {
+        *error = "not a capture file";
+        ::close(fd);
+        return false;
+      }
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);                        // the mapping keeps the file
+    if (base == MAP_FAILED)
+      {
+        *error = strerror(errno);
+        return false;
+      }
+    base_ = (const uint8_t *) base;
+    size_ = st.st_size;
+    madvise(base, size_, MADV_WILLNEED);
+
+    if (!buildIndex(error))
+      {
+        close();
+        return false;
+      }
+    madvise(base, size_, MADV_SEQUENTIAL);
+    return true;
+  }
+
+  void PcapFile::close()
+  {
+    if (base_ != NULL)
+      munmap((void *) base_, size_);
+    base_ = NULL;
+    size_ = 0;
+    sections_.clear();
+    checkpoints_.clear();
+    revolutions_.clear();
+    packets_ = 0;
+    end_stamp_ = 0;
+  }
+
+  /** @brief Read the file header, then every record, to find the
+   *         packets and build the index. */
+  bool PcapFile::buildIndex(std::string *error)
+  {
+    uint32_t magic;
+    memcpy(&magic, base_, sizeof(magic));
+    Position position;
+    position.section = 0;
+    position.stamp = 0;
+    if (magic == PCAPNG_SECTION_HEADER)
+      {
+        pcapng_ = true;
+        position.offset = 0;            // the header is a block
+      }
+    else
+      {
+        pcapng_ = false;
+        Section section;
+        section.swapped = (magic == swap32(PCAP_MAGIC_USEC)
+                           || magic == swap32(PCAP_MAGIC_NSEC));
+        magic = get32(base_, section.swapped);
+        if (magic != PCAP_MAGIC_USEC && magic != PCAP_MAGIC_NSEC)
+          {
+            *error = "not a pcap or pcapng file";
+            return false;
+          }
+        Interface interface;
+        interface.linktype = get32(base_ + 20, section.swapped);
+        interface.ticks_per_second =
+          (magic == PCAP_MAGIC_NSEC)? 1000000000ULL: 1000000ULL;
+        if (interface.linktype != LINKTYPE_ETHERNET)
+          {
+            *error = "not an Ethernet capture";
+            return false;
+          }
+        section.interfaces.push_back(interface);
+        sections_.push_back(section);
+        position.offset = PCAP_HEADER_SIZE;
+      }
+
+    // walk all records, noting every few packets and each revolution
+    int last_azimuth = -1;
+    Frame frame;
+    for (;;)
+      {
+        Position record = position;
+        int rc = readBlock(position, &frame, &sections_);
+        if (rc == BLOCK_END)
+          break;
+        PcapPacket packet;
+        if (rc != BLOCK_FRAME || !payload(frame, &packet))
+          continue;
+
+        record.stamp = packet.stamp;
+        if (packets_ == 0)
+          start_ = record;
+        if (packets_ % PCAP_INDEX_STRIDE == 0)
+          checkpoints_.push_back(record);
+        int azimuth = packet.data[2] | (packet.data[3] << 8);
+        if (last_azimuth < 0 || azimuth < last_azimuth)
+          revolutions_.push_back(record);
+        last_azimuth = azimuth;
+        end_stamp_ = packet.stamp;
+        ++packets_;
+      }
+
+    if (pcapng_ && sections_.empty())
+      {
+        *error = "invalid pcapng file";
+        return false;
+      }
+    cursor_ = start_;
+    if (packets_ == 0)
+      cursor_ = position;               // at the end
+    return true;
+  }
+
+  /** @brief Read one record or block.
+   *
+   *  @param position record to read, returns the next one
+   *  @param frame returns the captured frame of packet records
+   *  @param sections first pass: collects pcapng sections and
+   *                  interfaces; NULL to look them up in sections_
+   *  @returns BLOCK_FRAME for an Ethernet frame, BLOCK_OTHER for
+   *           anything else, BLOCK_END at the end or a corrupt record
+   */
+  int PcapFile::readBlock(Position &position, Frame *frame,
+                           std::vector<Section> *sections) const
+  {
+    const uint8_t *p = base_ + position.offset;
+    const size_t left = size_ - position.offset;
+
+    if (!pcapng_)
+      {
+        if (left < PCAP_RECORD_SIZE)
+          return BLOCK_END;
+        const Section &section = sections_[0];
+        const uint32_t caplen = get32(p + 8, section.swapped);
+        if (caplen > left - PCAP_RECORD_SIZE)
+          return BLOCK_END;             // truncated file
+        uint64_t sec = get32(p, section.swapped);
+        uint64_t frac = get32(p + 4, section.swapped);
+        frame->stamp = sec * 1000000000ULL + frac
+          * (1000000000ULL / section.interfaces[0].ticks_per_second);
+        frame->data = p + PCAP_RECORD_SIZE;
+        frame->len = caplen;
+        position.offset += PCAP_RECORD_SIZE + caplen;
+        return BLOCK_FRAME;
+      }
+
+    if (left < 12)
+      return BLOCK_END;
+    uint32_t type;
+    memcpy(&type, p, sizeof(type));
+    if (type == PCAPNG_SECTION_HEADER)
+      {
+        // the byte order magic tells the order of this section
+        uint32_t magic;
+        memcpy(&magic, p + 8, sizeof(magic));
+        if (magic != PCAPNG_BYTE_ORDER_MAGIC
+            && magic != swap32(PCAPNG_BYTE_ORDER_MAGIC))
+          return BLOCK_END;
+        if (sections != NULL)
+          {
+            Section section;
+            section.swapped = (magic != PCAPNG_BYTE_ORDER_MAGIC);
+            sections->push_back(section);
+            position.section = sections->size() - 1;
+          }
+        else
+          ++position.section;           // positions are never at one
+      }
+    const std::vector<Section> &known = (sections != NULL)? *sections: sections_;
+    if (position.section >= known.size())
+      return BLOCK_END;
+    const Section &section = known[position.section];
+
+    type = get32(p, section.swapped);
+    const uint32_t length = get32(p + 4, section.swapped);
+    if (length < 12 || length % 4 != 0 || length > left)
+      return BLOCK_END;
+    position.offset += length;
+
+    if (type == PCAPNG_INTERFACE && sections != NULL && length >= 20)
+      {
+        Interface interface;
+        interface.linktype = get16(p + 8, section.swapped);
+        interface.ticks_per_second = 1000000ULL;
+        for (size_t option = 16; option + 4 <= length - 4; )
+          {
+            uint16_t code = get16(p + option, section.swapped);
+            uint16_t option_len = get16(p + option + 2, section.swapped);
+            if (code == 0 || option + 4 + option_len > length - 4)
+              break;
+            if (code == PCAPNG_IF_TSRESOL && option_len >= 1)
+              {
+                uint8_t resolution = p[option + 4];
+                uint64_t base = (resolution & 0x80)? 2: 10;
+                uint64_t ticks = 1;
+                for (int i = 0; i < (resolution & 0x7f) && ticks < (1ULL << 60); ++i)
+                  ticks *= base;
+                interface.ticks_per_second = ticks;
+              }
+            option += 4 + ((option_len + 3) & ~3);
+          }
+        (*sections)[position.section].interfaces.push_back(interface);
+        return BLOCK_OTHER;
+      }
+
+    if (type != PCAPNG_ENHANCED_PACKET || length < 32)
+      return BLOCK_OTHER;
+    const uint32_t id = get32(p + 8, section.swapped);
+    if (id >= section.interfaces.size()
+        || section.interfaces[id].linktype != LINKTYPE_ETHERNET)
+      return BLOCK_OTHER;
+    const uint32_t caplen = get32(p + 20, section.swapped);
+    if (caplen > length - 32)
+      return BLOCK_OTHER;
+
+    // time stamps count interface ticks since the epoch
+    const uint64_t ticks = ((uint64_t) get32(p + 12, section.swapped) << 32)
+      | get32(p + 16, section.swapped);
+    const uint64_t tps = section.interfaces[id].ticks_per_second;
+    frame->stamp = (ticks / tps) * 1000000000ULL
+      + (uint64_t) ((double) (ticks % tps) * 1.0e9 / tps);
+    frame->data = p + 28;
+    frame->len = caplen;
+    return BLOCK_FRAME;
+  }
+
+  /** @returns true if frame holds a Velodyne packet passing the filter */
+  bool PcapFile::payload(const Frame &frame, PcapPacket *packet) const
+  {
+    uint32_t src_addr;
+    uint16_t dst_port;
+    if (!parseUdpFrame(frame.data, frame.len, &packet->data, &packet->len,
+                       &src_addr, &dst_port)
+        || dst_port != port_ || packet->len != payload_size_
+        || (src_addr_ != 0 && src_addr != src_addr_))
+      return false;
+    packet->stamp = frame.stamp;
+    return true;
+  }
+
+  bool PcapFile::next(PcapPacket *packet)
+  {
+    return read(cursor_, packet);
+  }
+
+  bool PcapFile::read(Position &position, PcapPacket *packet) const
+  {
+    if (base_ == NULL)
+      return false;
+    Frame frame;
+    for (;;)
+      {
+        int rc = readBlock(position, &frame, NULL);
+        if (rc == BLOCK_END)
+          return false;
+        if (rc == BLOCK_FRAME && payload(frame, packet))
+          {
+            position.stamp = packet->stamp;
+            return true;
+          }
+      }
+  }
+
+  /** Order positions by time stamp. */
+  static bool earlier(const PcapFile::Position &a, uint64_t stamp)
+  {
+    return a.stamp < stamp;
+  }
+
+  bool PcapFile::seekTime(uint64_t stamp)
+  {
+    if (checkpoints_.empty())
+      return false;
+
+    // start from the last checkpoint before stamp
+    std::vector<Position>::const_iterator it =
+      std::lower_bound(checkpoints_.begin(), checkpoints_.end(), stamp,
+                       earlier);
+    if (it != checkpoints_.begin())
+      --it;
+    cursor_ = *it;
+
+    PcapPacket packet;
+    for (;;)
+      {
+        Position position = cursor_;
+        if (!next(&packet))
+          return false;
+        if (packet.stamp >= stamp)
+          {
+            position.stamp = packet.stamp;
+            cursor_ = position;
+            return true;
+          }
+      }
+  }
+
+  bool PcapFile::seekRevolution(size_t revolution)
+  {
+    if (revolution >= revolutions_.size())
+      return false;
+    cursor_ = revolutions_[revolution];
+    return true;
+  }
+
+} // velodyne_driver namespace
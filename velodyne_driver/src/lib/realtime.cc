@@ -0,0 +1,126 @@
+/*
+ *  Copyright (C) 2015, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Real-time execution of the Velodyne device threads.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <string>
+#include <vector>
+
+#include <velodyne_driver/realtime.h>
+
+namespace velodyne_driver
+{
+  /** stack touched after locking memory, so calls deeper than the
+   *  current one do not fault either */
+  static const size_t PREFAULT_STACK = 64 * 1024;
+
+  static void prefaultStack(void)
+  {
+    volatile unsigned char stack[PREFAULT_STACK];
+    for (size_t i = 0; i < sizeof(stack); i += 4096)
+      stack[i] = 0;
+  }
+
+  /** @returns 0 if successful, 1 if not */
+  static int setAffinity(const std::vector<int> &cpus)
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t i = 0; i < cpus.size(); ++i)
+      {
+        if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE)
+          {
+            ROS_ERROR("cpu_affinity %d out of range", cpus[i]);
+            return 1;
+          }
+        CPU_SET(cpus[i], &set);
+      }
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0)
+      {
+        ROS_WARN("Unable to set CPU affinity: %s", strerror(rc));
+        return 1;
+      }
+    ROS_INFO_STREAM("Velodyne thread bound to " << cpus.size() << " CPUs");
+    return 0;
+  }
+
+  /** @returns 0 if successful, 1 if not */
+  static int setScheduler(const std::string &policy_name, int priority)
+  {
+    int policy;
+    if (policy_name == "fifo")
+      policy = SCHED_FIFO;
+    else if (policy_name == "rr")
+      policy = SCHED_RR;
+    else
+      {
+        ROS_ERROR_STREAM("unknown sched_policy: " << policy_name);
+        return 1;
+      }
+
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+    int rc = pthread_setschedparam(pthread_self(), policy, &param);
+    if (rc != 0)
+      {
+        ROS_WARN("Unable to set %s scheduling at priority %d: %s",
+                 policy_name.c_str(), priority, strerror(rc));
+        return 1;
+      }
+    ROS_INFO("Velodyne thread scheduled %s at priority %d",
+             policy_name.c_str(), priority);
+    return 0;
+  }
+
+  /** @returns 0 if successful, 1 if not */
+  static int lockMemory(void)
+  {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+      {
+        ROS_WARN("Unable to lock memory: %s", strerror(errno));
+        return 1;
+      }
+    prefaultStack();
+    ROS_INFO("Velodyne process memory locked");
+    return 0;
+  }
+
+  int setRealtime(ros::NodeHandle private_nh)
+  {
+    int failed = 0;
+
+    std::vector<int> cpus;
+    if (private_nh.getParam("cpu_affinity", cpus) && !cpus.empty())
+      failed += setAffinity(cpus);
+
+    std::string policy;
+    int priority;
+    private_nh.param("sched_policy", policy, std::string("other"));
+    private_nh.param("sched_priority", priority, 10);
+    if (policy != "other")
+      failed += setScheduler(policy, priority);
+
+    bool lock_memory;
+    private_nh.param("lock_memory", lock_memory, false);
+    if (lock_memory)
+      failed += lockMemory();
+
+    return failed;
+  }
+
+} // velodyne_driver namespace
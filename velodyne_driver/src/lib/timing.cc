@@ -0,0 +1,210 @@
+/*
+ *  Copyright (C) 2015, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Low overhead timing statistics for the Velodyne nodes.
+ */
+
+#include <algorithm>
+#include <boost/bind.hpp>
+
+#include <velodyne_driver/timing.h>
+
+namespace velodyne_driver
+{
+  LatencyHistogram::LatencyHistogram():
+    sum_(0),
+    max_(0),
+    taken_sum_(0)
+  {
+    for (int i = 0; i < BUCKETS; ++i)
+      {
+        counts_[i].store(0);
+        taken_[i] = 0;
+      }
+  }
+
+  /** @returns histogram bucket of a value: the value itself below
+   *           SUB_BUCKETS, else its power of two and 3 more bits */
+  int LatencyHistogram::bucket(uint64_t value)
+  {
+    if (value < SUB_BUCKETS)
+      return value;
+    int exponent = 63 - __builtin_clzll(value);
+    int index = (exponent - 2) * SUB_BUCKETS
+      + (int) (value >> (exponent - 3)) - SUB_BUCKETS;
+    return index < BUCKETS? index: BUCKETS - 1;
+  }
+
+  /** @returns the middle of a bucket */
+  double LatencyHistogram::bucketValue(int bucket)
+  {
+    if (bucket < SUB_BUCKETS)
+      return bucket;
+    int exponent = bucket / SUB_BUCKETS + 2;
+    uint64_t width = 1ULL << (exponent - 3);
+    uint64_t low = (SUB_BUCKETS + bucket % SUB_BUCKETS) * width;
+    return low + (width - 1) / 2.0;
+  }
+
+  LatencyHistogram::Summary LatencyHistogram::take()
+  {
+    uint64_t counts[BUCKETS];
+    Summary summary;
+    summary.count = 0;
+    for (int i = 0; i < BUCKETS; ++i)
+      {
+        uint64_t total = counts_[i].load(boost::memory_order_relaxed);
+        counts[i] = total - taken_[i];
+        taken_[i] = total;
+        summary.count += counts[i];
+      }
+    uint64_t sum = sum_.load(boost::memory_order_relaxed);
+    summary.max = max_.exchange(0, boost::memory_order_relaxed);
+    summary.mean = summary.count? (sum - taken_sum_) / (double) summary.count: 0.0;
+    taken_sum_ = sum;
+
+    // percentiles at the middle of their buckets, but never above
+    // the largest value
+    double *quantiles[3] = {&summary.p50, &summary.p90, &summary.p99};
+    const double fractions[3] = {0.5, 0.9, 0.99};
+    int bucket = 0;
+    uint64_t below = 0;                 // values in buckets before bucket
+    for (int q = 0; q < 3; ++q)
+      {
+        uint64_t rank = (uint64_t) (fractions[q] * summary.count);
+        while (bucket < BUCKETS - 1 && below + counts[bucket] <= rank)
+          below += counts[bucket++];
+        *quantiles[q] = summary.count?
+          std::min(bucketValue(bucket), summary.max): 0.0;
+      }
+    return summary;
+  }
+
+  PipelineTiming::PipelineTiming(const std::string &name):
+    name_(name)
+  {}
+
+  int PipelineTiming::addStage(const std::string &name)
+  {
+    stage_names_.push_back(name);
+    stages_.push_back(boost::shared_ptr<LatencyHistogram>
+                      (new LatencyHistogram()));
+    return stages_.size() - 1;
+  }
+
+  int PipelineTiming::addCounter(const std::string &name)
+  {
+    counter_names_.push_back(name);
+    counters_.push_back(boost::shared_ptr<boost::atomic<uint64_t> >
+                        (new boost::atomic<uint64_t>(0)));
+    return counters_.size() - 1;
+  }
+
+  int PipelineTiming::addGauge(const std::string &name)
+  {
+    gauge_names_.push_back(name);
+    gauges_.push_back(boost::shared_ptr<Gauge>(new Gauge()));
+    return gauges_.size() - 1;
+  }
+
+  void PipelineTiming::advertise(diagnostic_updater::Updater &diagnostics,
+                                 ros::NodeHandle private_nh)
+  {
+    node_ = private_nh.getNamespace();
+    bool timing_topic;
+    private_nh.param("timing_topic", timing_topic, false);
+    if (timing_topic)
+      output_ = private_nh.advertise<velodyne_msgs::VelodyneTiming>("timing",
+                                                                    10);
+    diagnostics.add(name_, boost::bind(&PipelineTiming::report, this, _1));
+  }
+
+  void PipelineTiming::setGauge(int gauge, uint64_t value)
+  {
+    Gauge &g = *gauges_[gauge];
+    g.value.store(value, boost::memory_order_relaxed);
+    uint64_t max = g.max.load(boost::memory_order_relaxed);
+    while (value > max
+           && !g.max.compare_exchange_weak(max, value,
+                                           boost::memory_order_relaxed))
+      ;
+  }
+
+  /** Diagnostic task: summarize the period since the last report. */
+  void PipelineTiming::report(diagnostic_updater::DiagnosticStatusWrapper &status)
+  {
+    velodyne_msgs::VelodyneTimingPtr msg(new velodyne_msgs::VelodyneTiming);
+    msg->header.stamp = ros::Time::now();
+    msg->node = node_;
+    status.summary(diagnostic_msgs::DiagnosticStatus::OK, "Timing statistics");
+
+    for (size_t i = 0; i < stages_.size(); ++i)
+      {
+        LatencyHistogram::Summary summary = stages_[i]->take();
+        velodyne_msgs::VelodyneStageTiming stage;
+        stage.name = stage_names_[i];
+        stage.count = summary.count;
+        stage.mean = summary.mean * 1.0e-6;
+        stage.p50 = summary.p50 * 1.0e-6;
+        stage.p90 = summary.p90 * 1.0e-6;
+        stage.p99 = summary.p99 * 1.0e-6;
+        stage.max = summary.max * 1.0e-6;
+        msg->stages.push_back(stage);
+        status.addf(stage.name + " [ms]",
+                    "mean %.3f, p50 %.3f, p90 %.3f, p99 %.3f, max %.3f (%llu)",
+                    summary.mean * 1.0e-3, summary.p50 * 1.0e-3,
+                    summary.p90 * 1.0e-3, summary.p99 * 1.0e-3,
+                    summary.max * 1.0e-3, (unsigned long long) summary.count);
+      }
+
+    for (size_t i = 0; i < counters_.size(); ++i)
+      {
+        uint64_t value = counters_[i]->load(boost::memory_order_relaxed);
+        msg->counter_names.push_back(counter_names_[i]);
+        msg->counters.push_back(value);
+        status.addf(counter_names_[i], "%llu", (unsigned long long) value);
+      }
+
+    for (size_t i = 0; i < gauges_.size(); ++i)
+      {
+        Gauge &g = *gauges_[i];
+        uint64_t value = g.value.load(boost::memory_order_relaxed);
+        uint64_t max = g.max.exchange(value, boost::memory_order_relaxed);
+        msg->gauge_names.push_back(gauge_names_[i]);
+        msg->gauges.push_back(value);
+        msg->gauge_maxima.push_back(max);
+        status.addf(gauge_names_[i], "%llu (max %llu)",
+                    (unsigned long long) value, (unsigned long long) max);
+      }
+
+    if (output_)
+      output_.publish(msg);
+  }
+
+  uint64_t ScanGapDetector::missed(const velodyne_msgs::VelodyneScan &scan)
+  {
+    if (scan.packets.size() < 2)
+      return 0;
+    const ros::Time &first = scan.packets.front().stamp;
+    const ros::Time &last = scan.packets.back().stamp;
+    double interval = (last - first).toSec() / (scan.packets.size() - 1);
+    double period = interval * scan.packets.size();
+    double gap = (first - last_).toSec();
+    bool started = !last_.isZero();
+    last_ = last;
+
+    // a gap of more than half a scan beyond the packet interval;
+    // none when time goes back, as when a capture file repeats
+    if (!started || period <= 0.0 || gap - interval < 0.5 * period)
+      return 0;
+    return (uint64_t) ((gap - interval) / period + 0.5);
+  }
+
+} // velodyne_driver namespace
@@ -0,0 +1,180 @@
+//
+// C++ unit tests for the packet loss and reordering checks.
+//
+
+#include <gtest/gtest.h>
+
+#include <math.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <velodyne_driver/packet_monitor.h>
+using namespace velodyne_driver;
+
+// global test data: 800 packets a second at 600 RPM
+static const double PACKET_RATE = 800.0;
+static const double RPM = 600.0;
+static const uint32_t INTERVAL = 1250;          // [µs]
+static const int AZIMUTH_STEP = 450;            // [1/100 degree]
+static const uint32_t START = 1000000;          // [µs past the hour]
+
+// Packet i of a device turning at a steady rate.
+velodyne_msgs::VelodynePacket packet(int i)
+{
+  velodyne_msgs::VelodynePacket pkt;
+  pkt.data.assign(0);
+  int azimuth = (i * AZIMUTH_STEP) % 36000;
+  pkt.data[2] = azimuth & 0xff;
+  pkt.data[3] = azimuth >> 8;
+  uint32_t time = START + i * INTERVAL;
+  for (int byte = 0; byte < 4; ++byte)
+    pkt.data[1200 + byte] = (time >> (8 * byte)) & 0xff;
+  return pkt;
+}
+
+// A scan of the packets with these numbers, in this order.
+velodyne_msgs::VelodyneScan scan(const std::vector<int> &numbers)
+{
+  velodyne_msgs::VelodyneScan scan;
+  for (size_t i = 0; i < numbers.size(); ++i)
+    scan.packets.push_back(packet(numbers[i]));
+  return scan;
+}
+
+std::vector<int> numbers(int first, int last)
+{
+  std::vector<int> numbers;
+  for (int i = first; i <= last; ++i)
+    numbers.push_back(i);
+  return numbers;
+}
+
+// Value of a diagnostic key.
+std::string value(const diagnostic_updater::DiagnosticStatusWrapper &status,
+                  const std::string &key)
+{
+  for (size_t i = 0; i < status.values.size(); ++i)
+    if (status.values[i].key == key)
+      return status.values[i].value;
+  return "";
+}
+
+// Expect a missing sector from packet first to the one after it.
+void expect_sector(const velodyne_msgs::VelodyneScanStatus &status, size_t i,
+                   int first, int after)
+{
+  ASSERT_LT(i, status.missing_start.size());
+  ASSERT_EQ(status.missing_end.size(), status.missing_start.size());
+  EXPECT_NEAR(status.missing_start[i], first * AZIMUTH_STEP * M_PI / 18000.0,
+              1.0e-5);
+  EXPECT_NEAR(status.missing_end[i], after * AZIMUTH_STEP * M_PI / 18000.0,
+              1.0e-5);
+}
+
+///////////////////////////////////////////////////////////////
+// Test cases
+///////////////////////////////////////////////////////////////
+
+// Both checks, with device time stamps and azimuths only.
+class PacketMonitorTest: public testing::TestWithParam<bool>
+{
+protected:
+  PacketMonitorTest()
+  {
+    monitor_.configure(PACKET_RATE, RPM, GetParam());
+  }
+
+  velodyne_msgs::VelodyneScanStatus check(const std::vector<int> &numbers)
+  {
+    velodyne_msgs::VelodyneScan packets = scan(numbers);
+    velodyne_msgs::VelodyneScanStatus status;
+    monitor_.check(packets, status);
+    return status;
+  }
+
+  PacketMonitor monitor_;
+};
+
+TEST_P(PacketMonitorTest, lost)
+{
+  std::vector<int> sent = numbers(0, 9);
+  sent.erase(sent.begin() + 3, sent.begin() + 6);
+  velodyne_msgs::VelodyneScanStatus status = check(sent);
+  EXPECT_EQ(status.packets, 7u);
+  EXPECT_EQ(status.lost_packets, 3u);
+  EXPECT_EQ(status.reordered_packets, 0u);
+  ASSERT_EQ(status.missing_start.size(), 1u);
+  expect_sector(status, 0, 3, 6);
+}
+
+// A late packet at either end of a gap shrinks its sector, and one
+// filling it removes it.
+TEST_P(PacketMonitorTest, reordered_shrinks_sector)
+{
+  const int order[] = {0, 1, 2, 5, 6, 3, 7, 4, 8};
+  velodyne_msgs::VelodyneScan packets =
+    scan(std::vector<int>(order, order + 9));
+  velodyne_msgs::VelodyneScanStatus status;
+  monitor_.check(packets, status);
+  EXPECT_EQ(status.lost_packets, 0u);
+  EXPECT_EQ(status.reordered_packets, 2u);
+  EXPECT_TRUE(status.missing_start.empty());
+  if (GetParam())
+    for (size_t i = 0; i < packets.packets.size(); ++i)
+      EXPECT_EQ(packetDeviceTime(packets.packets[i]), START + i * INTERVAL);
+}
+
+TEST_P(PacketMonitorTest, reordered_splits_sector)
+{
+  const int order[] = {0, 1, 7, 4, 8};
+  velodyne_msgs::VelodyneScanStatus status =
+    check(std::vector<int>(order, order + 5));
+  EXPECT_EQ(status.lost_packets, 4u);
+  EXPECT_EQ(status.reordered_packets, 1u);
+  ASSERT_EQ(status.missing_start.size(), 2u);
+  expect_sector(status, 0, 2, 4);
+  expect_sector(status, 1, 5, 7);
+}
+
+// A packet late enough to arrive with the next scan corrects the
+// totals of the scan it belongs to.
+TEST_P(PacketMonitorTest, reordered_across_scans)
+{
+  std::vector<int> first = numbers(0, 9);
+  first.erase(first.begin() + 5, first.begin() + 7);
+  velodyne_msgs::VelodyneScanStatus status = check(first);
+  EXPECT_EQ(status.lost_packets, 2u);
+
+  std::vector<int> second = numbers(10, 19);
+  second.insert(second.begin() + 1, 5);
+  status = check(second);
+  EXPECT_EQ(status.lost_packets, 0u);
+  EXPECT_EQ(status.reordered_packets, 1u);
+  EXPECT_TRUE(status.missing_start.empty());
+
+  diagnostic_updater::DiagnosticStatusWrapper diagnostics;
+  monitor_.report(diagnostics);
+  EXPECT_EQ(value(diagnostics, "lost_packets"), "1");
+  EXPECT_EQ(value(diagnostics, "reordered_packets"), "1");
+  EXPECT_EQ(value(diagnostics, "missing_sectors"), "1");
+
+  // the other one fills the sector
+  status = check(std::vector<int>(1, 6));
+  EXPECT_EQ(status.reordered_packets, 1u);
+  diagnostics = diagnostic_updater::DiagnosticStatusWrapper();
+  monitor_.report(diagnostics);
+  EXPECT_EQ(value(diagnostics, "lost_packets"), "0");
+  EXPECT_EQ(value(diagnostics, "missing_sectors"), "0");
+  EXPECT_EQ(diagnostics.level, diagnostic_msgs::DiagnosticStatus::WARN);
+}
+
+INSTANTIATE_TEST_CASE_P(PacketMonitor, PacketMonitorTest,
+                        testing::Values(true, false));
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,221 @@
+//
+// C++ unit tests for the raw packet recorder.
+//
+
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <velodyne_driver/packet_recorder.h>
+#include <velodyne_driver/pcap_file.h>
+using namespace velodyne_driver;
+
+// global test data
+static const uint16_t PORT = 2368;
+static const uint64_t START = 1500000000ULL * 1000000000ULL; // [ns]
+static const uint64_t MSEC = 1000000ULL;                     // [ns]
+static const size_t HEADER_SIZE = 24;                        // pcap file
+static const size_t RECORD_SIZE = 16 + 42 + RECORDER_PAYLOAD_SIZE;
+
+// A packet payload that differs from packet to packet.
+std::vector<uint8_t> payload(size_t i)
+{
+  std::vector<uint8_t> data(RECORDER_PAYLOAD_SIZE);
+  for (size_t byte = 0; byte < data.size(); ++byte)
+    data[byte] = (i * 7 + byte) & 0xff;
+  return data;
+}
+
+// A new directory in /tmp, removed with its files when the test ends.
+class TempDir
+{
+public:
+  TempDir()
+  {
+    char name[] = "/tmp/test_packet_recorder_XXXXXX";
+    if (mkdtemp(name) != NULL)
+      name_ = name;
+  }
+  ~TempDir()
+  {
+    if (name_.empty())
+      return;
+    std::vector<std::string> names = files();
+    for (size_t i = 0; i < names.size(); ++i)
+      unlink(names[i].c_str());
+    rmdir(name_.c_str());
+  }
+  const std::string &name() const { return name_; }
+
+  // capture files, in the order they were written
+  std::vector<std::string> files() const
+  {
+    std::vector<std::pair<int, std::string> > numbered;
+    DIR *dir = opendir(name_.c_str());
+    if (dir == NULL)
+      return std::vector<std::string>();
+    for (dirent *entry = readdir(dir); entry != NULL; entry = readdir(dir))
+      {
+        std::string file = entry->d_name;
+        if (file.size() < 10 || file.substr(file.size() - 5) != ".pcap")
+          continue;
+        int number = atoi(file.substr(file.size() - 9, 4).c_str());
+        numbered.push_back(std::make_pair(number, name_ + "/" + file));
+      }
+    closedir(dir);
+    std::sort(numbered.begin(), numbered.end());
+    std::vector<std::string> names;
+    for (size_t i = 0; i < numbered.size(); ++i)
+      names.push_back(numbered[i].second);
+    return names;
+  }
+
+private:
+  std::string name_;
+};
+
+// Bytes of a file.
+std::string contents(const std::string &filename)
+{
+  std::string bytes;
+  FILE *file = fopen(filename.c_str(), "rb");
+  if (file == NULL)
+    return bytes;
+  char buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    bytes.append(buffer, n);
+  fclose(file);
+  return bytes;
+}
+
+// Record packets with these stamps, then expect them back, the
+// first[k] one being the first packet of file k.
+void expect_recorded(const std::vector<uint64_t> &stamps,
+                     const std::vector<size_t> &first,
+                     uint64_t max_file_size, double max_file_duration,
+                     bool direct_io)
+{
+  TempDir dir;
+  ASSERT_FALSE(dir.name().empty());
+  {
+    PacketRecorder recorder(dir.name() + "/velodyne", PORT, 0,
+                            max_file_size, max_file_duration, direct_io);
+    for (size_t i = 0; i < stamps.size(); ++i)
+      recorder.record(&payload(i)[0], stamps[i]);
+    EXPECT_EQ(recorder.dropped(), 0u);
+  }                                     // writes the rest and closes
+
+  std::vector<std::string> files = dir.files();
+  ASSERT_EQ(files.size(), first.size());
+  const uint32_t device = inet_addr("192.168.1.201");
+  size_t i = 0;
+  for (size_t k = 0; k < files.size(); ++k)
+    {
+      const size_t end = (k + 1 < first.size())? first[k + 1]: stamps.size();
+      ASSERT_EQ(i, first[k]) << files[k];
+
+      // whole records behind the header, each with a valid IPv4
+      // header checksum
+      std::string bytes = contents(files[k]);
+      ASSERT_EQ(bytes.size(), HEADER_SIZE + (end - i) * RECORD_SIZE)
+        << files[k];
+      for (size_t r = 0; r < end - i; ++r)
+        {
+          const uint8_t *ip =
+            (const uint8_t *) bytes.data() + HEADER_SIZE + r * RECORD_SIZE
+            + 16 + 14;
+          uint32_t sum = 0;
+          for (int b = 0; b < 20; b += 2)
+            sum += (ip[b] << 8) | ip[b + 1];
+          while (sum >> 16)
+            sum = (sum & 0xffff) + (sum >> 16);
+          EXPECT_EQ(sum, 0xffffu) << files[k] << ", record " << r;
+        }
+
+      PcapFile file;
+      std::string error;
+      ASSERT_TRUE(file.open(files[k], PORT, device, RECORDER_PAYLOAD_SIZE,
+                            &error)) << error;
+      EXPECT_EQ(file.packets(), end - i) << files[k];
+      PcapPacket packet;
+      for (; i < end; ++i)
+        {
+          ASSERT_TRUE(file.next(&packet)) << files[k] << ", packet " << i;
+          EXPECT_EQ(packet.stamp, stamps[i]) << "packet " << i;
+          ASSERT_EQ(packet.len, RECORDER_PAYLOAD_SIZE);
+          std::vector<uint8_t> expected = payload(i);
+          EXPECT_EQ(memcmp(packet.data, &expected[0], packet.len), 0)
+            << "packet " << i;
+        }
+      EXPECT_FALSE(file.next(&packet)) << files[k];
+    }
+  EXPECT_EQ(i, stamps.size());
+}
+
+///////////////////////////////////////////////////////////////
+// Test cases
+///////////////////////////////////////////////////////////////
+
+// Buffered writes, and O_DIRECT ones with their unaligned tail.
+class PacketRecorderTest: public testing::TestWithParam<bool> {};
+
+// Three records fit in a file, whatever the page alignment.
+TEST_P(PacketRecorderTest, size_rotation)
+{
+  std::vector<uint64_t> stamps;
+  for (size_t i = 0; i < 10; ++i)
+    stamps.push_back(START + i * MSEC);
+  std::vector<size_t> first;
+  first.push_back(0);
+  first.push_back(3);
+  first.push_back(6);
+  first.push_back(9);
+  expect_recorded(stamps, first, HEADER_SIZE + 3 * RECORD_SIZE + 100, 0.0,
+                  GetParam());
+}
+
+// Files of a second, from their first packet.  A stamp that goes back
+// restarts the duration of the current file.
+TEST_P(PacketRecorderTest, duration_rotation)
+{
+  const uint64_t offsets[] =            // [ms]
+    {0, 300, 600, 900, 1200, 1500, 1800, 500, 1400, 1600, 1700};
+  std::vector<uint64_t> stamps;
+  for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); ++i)
+    stamps.push_back(START + offsets[i] * MSEC);
+  std::vector<size_t> first;
+  first.push_back(0);
+  first.push_back(4);                   // 1200 is a second after 0
+  first.push_back(9);                   // 1600 is a second after 500
+  expect_recorded(stamps, first, 0, 1.0, GetParam());
+}
+
+// Many packets in one file, flushed a page at a time.
+TEST_P(PacketRecorderTest, large_file)
+{
+  std::vector<uint64_t> stamps;
+  for (size_t i = 0; i < 5000; ++i)
+    stamps.push_back(START + i * MSEC / 10);
+  expect_recorded(stamps, std::vector<size_t>(1, 0), 0, 0.0, GetParam());
+}
+
+INSTANTIATE_TEST_CASE_P(PacketRecorder, PacketRecorderTest,
+                        testing::Values(false, true));
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
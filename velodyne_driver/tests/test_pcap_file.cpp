@@ -0,0 +1,489 @@
+//
+// C++ unit tests for the packet capture file reader.
+//
+
+#include <gtest/gtest.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+
+#include <velodyne_driver/pcap_file.h>
+using namespace velodyne_driver;
+
+// global test data
+static const uint16_t PORT = 2368;
+static const size_t PAYLOAD_SIZE = 64;
+static const uint64_t START = 1500000000ULL * 1000000000ULL; // [ns]
+static const size_t PACKETS_PER_REVOLUTION = 100;
+
+// Capture time of packet i, a millisecond after the one before.
+uint64_t packetStamp(size_t i)
+{
+  return START + i * 1000000ULL;
+}
+
+// Builds capture files byte by byte, in either byte order.
+class Capture
+{
+public:
+  explicit Capture(bool swapped = false): swapped_(swapped) {}
+
+  void setSwapped(bool swapped) { swapped_ = swapped; }
+  const std::string &bytes() const { return bytes_; }
+  size_t size() const { return bytes_.size(); }
+  void truncate(size_t size) { bytes_.resize(size); }
+
+  void put8(uint8_t value) { bytes_ += (char) value; }
+  void put16(uint16_t value)
+  {
+    put(value, 2);
+  }
+  void put32(uint32_t value)
+  {
+    put(value, 4);
+  }
+  void putBytes(const std::string &bytes) { bytes_ += bytes; }
+  void pad4()
+  {
+    while (bytes_.size() % 4)
+      put8(0);
+  }
+
+  // store a 32 bit value at offset, for block lengths
+  void set32(size_t offset, uint32_t value)
+  {
+    Capture field(swapped_);
+    field.put32(value);
+    bytes_.replace(offset, 4, field.bytes());
+  }
+
+  /** classic pcap file header of Ethernet frames */
+  void pcapHeader(bool nsec)
+  {
+    put32(nsec? 0xa1b23c4d: 0xa1b2c3d4);
+    put16(2);
+    put16(4);
+    put32(0);                           // thiszone
+    put32(0);                           // sigfigs
+    put32(65535);                       // snaplen
+    put32(1);                           // LINKTYPE_ETHERNET
+  }
+
+  /** classic pcap record */
+  void pcapRecord(uint64_t stamp, bool nsec, const std::string &frame)
+  {
+    put32(stamp / 1000000000ULL);
+    put32(nsec? stamp % 1000000000ULL: (stamp % 1000000000ULL) / 1000);
+    put32(frame.size());
+    put32(frame.size());
+    putBytes(frame);
+  }
+
+  /** pcapng section header block */
+  void sectionHeader()
+  {
+    put32(0x0a0d0d0a);
+    put32(28);
+    put32(0x1a2b3c4d);
+    put16(1);
+    put16(0);
+    put32(0xffffffff);                  // unknown section length
+    put32(0xffffffff);
+    put32(28);
+  }
+
+  /** pcapng interface description block, with an if_tsresol option
+   *  unless tsresol is zero */
+  void interface(uint16_t linktype, uint8_t tsresol)
+  {
+    const size_t start = size();
+    put32(1);
+    put32(0);
+    put16(linktype);
+    put16(0);
+    put32(65535);
+    if (tsresol)
+      {
+        put16(9);
+        put16(1);
+        put8(tsresol);
+        pad4();
+        put16(0);                       // opt_endofopt
+        put16(0);
+      }
+    endBlock(start);
+  }
+
+  /** pcapng enhanced packet block */
+  void enhancedPacket(uint32_t interface, uint64_t ticks,
+                      const std::string &frame)
+  {
+    const size_t start = size();
+    put32(6);
+    put32(0);
+    put32(interface);
+    put32(ticks >> 32);
+    put32(ticks & 0xffffffff);
+    put32(frame.size());
+    put32(frame.size());
+    putBytes(frame);
+    pad4();
+    endBlock(start);
+  }
+
+  /** pcapng block of another type, which readers skip */
+  void otherBlock(uint32_t type)
+  {
+    const size_t start = size();
+    put32(type);
+    put32(0);
+    put32(0);
+    endBlock(start);
+  }
+
+private:
+  void put(uint32_t value, int bytes)
+  {
+    for (int i = 0; i < bytes; ++i)
+      {
+        int shift = swapped_? 8 * (bytes - 1 - i): 8 * i;
+        put8((value >> shift) & 0xff);
+      }
+  }
+  void endBlock(size_t start)
+  {
+    const uint32_t length = size() - start + 4;
+    put32(length);
+    set32(start + 4, length);
+  }
+
+  bool swapped_;
+  std::string bytes_;
+};
+
+// Payload of packet i: a block header, then its azimuth, which
+// starts a new revolution every PACKETS_PER_REVOLUTION packets.
+std::string packetPayload(size_t i)
+{
+  std::string payload(PAYLOAD_SIZE, (char) (i & 0xff));
+  const uint16_t azimuth = (i % PACKETS_PER_REVOLUTION) * 360;
+  payload[0] = (char) 0xff;
+  payload[1] = (char) 0xee;
+  payload[2] = azimuth & 0xff;
+  payload[3] = azimuth >> 8;
+  return payload;
+}
+
+// Ethernet frame of an IPv4/UDP datagram, behind vlan_tags 802.1Q or
+// 802.1ad tags.
+std::string udpFrame(const std::string &payload, int vlan_tags = 0,
+                     uint16_t port = PORT)
+{
+  std::string frame(12, (char) 0x11);   // MAC addresses
+  for (int tag = 0; tag < vlan_tags; ++tag)
+    {
+      if (tag == 0 && vlan_tags > 1)
+        frame += std::string("\x88\xa8", 2); // 802.1ad
+      else
+        frame += std::string("\x81\x00", 2); // 802.1Q
+      frame += std::string("\x00\x05", 2);   // VLAN id
+    }
+  frame += std::string("\x08\x00", 2);  // IPv4
+  const size_t udp_len = 8 + payload.size();
+  const size_t ip_len = 20 + udp_len;
+  std::string ip(20, '\0');
+  ip[0] = 0x45;
+  ip[2] = ip_len >> 8;
+  ip[3] = ip_len & 0xff;
+  ip[8] = 64;                           // TTL
+  ip[9] = 17;                           // UDP
+  ip[12] = (char) 192;                  // 192.168.1.201
+  ip[13] = (char) 168;
+  ip[14] = 1;
+  ip[15] = (char) 201;
+  std::string udp(8, '\0');
+  udp[0] = 0x09;                        // source port 2368
+  udp[1] = 0x40;
+  udp[2] = port >> 8;
+  udp[3] = port & 0xff;
+  udp[4] = udp_len >> 8;
+  udp[5] = udp_len & 0xff;
+  return frame + ip + udp + payload;
+}
+
+// A classic pcap file of n packets.
+Capture pcapFile(size_t n, bool swapped, bool nsec)
+{
+  Capture capture(swapped);
+  capture.pcapHeader(nsec);
+  for (size_t i = 0; i < n; ++i)
+    capture.pcapRecord(packetStamp(i), nsec, udpFrame(packetPayload(i)));
+  return capture;
+}
+
+// Write a capture to a new temporary file, and remove it again.
+class TempCapture
+{
+public:
+  explicit TempCapture(const Capture &capture)
+  {
+    char name[] = "/tmp/test_pcap_file_XXXXXX";
+    int fd = mkstemp(name);
+    if (fd != -1)
+      {
+        const std::string &bytes = capture.bytes();
+        if (write(fd, bytes.data(), bytes.size()) == (ssize_t) bytes.size())
+          name_ = name;
+        else
+          unlink(name);
+        close(fd);
+      }
+  }
+  ~TempCapture()
+  {
+    if (!name_.empty())
+      unlink(name_.c_str());
+  }
+  const std::string &name() const { return name_; }
+
+private:
+  std::string name_;
+};
+
+// Expect to open a capture and read its first n packets.
+void expect_packets(const Capture &capture, size_t n, PcapFile &file)
+{
+  TempCapture temp(capture);
+  ASSERT_FALSE(temp.name().empty());
+  std::string error;
+  ASSERT_TRUE(file.open(temp.name(), PORT, 0, PAYLOAD_SIZE, &error)) << error;
+  EXPECT_EQ(file.packets(), n);
+  EXPECT_EQ(file.startTime(), packetStamp(0));
+  EXPECT_EQ(file.endTime(), packetStamp(n - 1));
+
+  PcapPacket packet;
+  for (size_t i = 0; i < n; ++i)
+    {
+      ASSERT_TRUE(file.next(&packet)) << "packet " << i;
+      EXPECT_EQ(packet.stamp, packetStamp(i));
+      ASSERT_EQ(packet.len, PAYLOAD_SIZE);
+      EXPECT_EQ(std::string((const char *) packet.data, packet.len),
+                packetPayload(i)) << "packet " << i;
+    }
+  EXPECT_FALSE(file.next(&packet));
+}
+
+///////////////////////////////////////////////////////////////
+// Test cases
+///////////////////////////////////////////////////////////////
+
+TEST(PcapFile, missing_file)
+{
+  PcapFile file;
+  std::string error;
+  EXPECT_FALSE(file.open("/tmp/no_such_test_pcap_file", PORT, 0,
+                         PAYLOAD_SIZE, &error));
+  EXPECT_FALSE(error.empty());
+  EXPECT_FALSE(file.isOpen());
+}
+
+TEST(PcapFile, not_a_capture)
+{
+  Capture capture;
+  for (int i = 0; i < 16; ++i)
+    capture.put32(0x12345678);
+  TempCapture temp(capture);
+  PcapFile file;
+  std::string error;
+  EXPECT_FALSE(file.open(temp.name(), PORT, 0, PAYLOAD_SIZE, &error));
+  EXPECT_FALSE(file.isOpen());
+}
+
+TEST(PcapFile, microseconds)
+{
+  PcapFile file;
+  expect_packets(pcapFile(250, false, false), 250, file);
+}
+
+TEST(PcapFile, byte_swapped)
+{
+  PcapFile file;
+  expect_packets(pcapFile(250, true, false), 250, file);
+}
+
+TEST(PcapFile, nanoseconds)
+{
+  for (int swapped = 0; swapped < 2; ++swapped)
+    {
+      Capture capture(swapped);
+      capture.pcapHeader(true);
+      for (size_t i = 0; i < 10; ++i)
+        capture.pcapRecord(packetStamp(i) + 123, true,
+                           udpFrame(packetPayload(i)));
+      TempCapture temp(capture);
+      PcapFile file;
+      std::string error;
+      ASSERT_TRUE(file.open(temp.name(), PORT, 0, PAYLOAD_SIZE, &error))
+        << error;
+      PcapPacket packet;
+      for (size_t i = 0; i < 10; ++i)
+        {
+          ASSERT_TRUE(file.next(&packet));
+          EXPECT_EQ(packet.stamp, packetStamp(i) + 123);
+        }
+    }
+}
+
+// Only the Velodyne packets of Ethernet interfaces count: not other
+// ports or payload sizes, other link types or other blocks.
+TEST(PcapFile, pcapng)
+{
+  Capture capture;
+  capture.sectionHeader();
+  capture.interface(1, 9);              // nanoseconds
+  capture.interface(101, 0);            // raw IP, microseconds
+  capture.otherBlock(5);                // interface statistics
+  size_t i = 0;
+  for (; i < 100; ++i)
+    {
+      capture.enhancedPacket(0, packetStamp(i), udpFrame(packetPayload(i)));
+      capture.enhancedPacket(0, packetStamp(i),
+                             udpFrame(packetPayload(i), 0, 8308));
+      capture.enhancedPacket(0, packetStamp(i),
+                             udpFrame(packetPayload(i).substr(4)));
+      capture.enhancedPacket(1, packetStamp(i) / 1000,
+                             udpFrame(packetPayload(i)));
+    }
+
+  // a byte-swapped section, with the default microsecond ticks
+  capture.setSwapped(true);
+  capture.sectionHeader();
+  capture.interface(1, 0);
+  capture.interface(1, 0x80 | 20);      // 2^-20 s
+  for (; i < 200; ++i)
+    {
+      capture.enhancedPacket(0, packetStamp(i) / 1000,
+                             udpFrame(packetPayload(i)));
+      capture.otherBlock(3);            // simple packet block
+    }
+  capture.enhancedPacket(1, (packetStamp(i) / 1000000000ULL) << 20,
+                         udpFrame(packetPayload(i)));
+
+  TempCapture temp(capture);
+  PcapFile file;
+  std::string error;
+  ASSERT_TRUE(file.open(temp.name(), PORT, 0, PAYLOAD_SIZE, &error)) << error;
+  EXPECT_EQ(file.packets(), 201u);
+  PcapPacket packet;
+  for (size_t j = 0; j < 200; ++j)
+    {
+      ASSERT_TRUE(file.next(&packet)) << "packet " << j;
+      EXPECT_EQ(packet.stamp, packetStamp(j));
+      EXPECT_EQ(std::string((const char *) packet.data, packet.len),
+                packetPayload(j)) << "packet " << j;
+    }
+  ASSERT_TRUE(file.next(&packet));
+  EXPECT_EQ(packet.stamp, packetStamp(200) / 1000000000ULL * 1000000000ULL);
+  EXPECT_FALSE(file.next(&packet));
+}
+
+TEST(PcapFile, vlan_tags)
+{
+  Capture capture;
+  capture.pcapHeader(false);
+  for (size_t i = 0; i < 30; ++i)
+    capture.pcapRecord(packetStamp(i), false,
+                       udpFrame(packetPayload(i), i % 3));
+  capture.pcapRecord(packetStamp(30), false, udpFrame(packetPayload(30), 3));
+  PcapFile file;
+  expect_packets(capture, 30, file);
+}
+
+// A capture stopped while writing a record ends before it.
+TEST(PcapFile, truncated)
+{
+  const size_t record = 16 + udpFrame(packetPayload(0)).size();
+  Capture capture = pcapFile(20, false, false);
+  capture.truncate(capture.size() - 10);  // in the frame
+  PcapFile file;
+  expect_packets(capture, 19, file);
+
+  capture = pcapFile(20, false, false);
+  capture.truncate(capture.size() - record + 8); // in the record header
+  PcapFile header;
+  expect_packets(capture, 19, header);
+}
+
+// The index has a checkpoint every 1024 packets.
+TEST(PcapFile, seek_time)
+{
+  const size_t n = 2500;
+  TempCapture temp(pcapFile(n, false, false));
+  PcapFile file;
+  std::string error;
+  ASSERT_TRUE(file.open(temp.name(), PORT, 0, PAYLOAD_SIZE, &error)) << error;
+  PcapPacket packet;
+
+  // before the first checkpoint
+  ASSERT_TRUE(file.seekTime(START - 1));
+  ASSERT_TRUE(file.next(&packet));
+  EXPECT_EQ(packet.stamp, packetStamp(0));
+
+  // between checkpoints, at and after a packet
+  ASSERT_TRUE(file.seekTime(packetStamp(1500)));
+  EXPECT_EQ(file.tell().stamp, packetStamp(1500));
+  ASSERT_TRUE(file.next(&packet));
+  EXPECT_EQ(packet.stamp, packetStamp(1500));
+  ASSERT_TRUE(file.seekTime(packetStamp(700) + 1));
+  ASSERT_TRUE(file.next(&packet));
+  EXPECT_EQ(packet.stamp, packetStamp(701));
+
+  // at a checkpoint, and after the last one
+  ASSERT_TRUE(file.seekTime(packetStamp(2048)));
+  ASSERT_TRUE(file.next(&packet));
+  EXPECT_EQ(packet.stamp, packetStamp(2048));
+  ASSERT_TRUE(file.seekTime(packetStamp(n - 1)));
+  ASSERT_TRUE(file.next(&packet));
+  EXPECT_EQ(packet.stamp, packetStamp(n - 1));
+  EXPECT_FALSE(file.next(&packet));
+
+  // after the last packet
+  EXPECT_FALSE(file.seekTime(packetStamp(n - 1) + 1));
+}
+
+TEST(PcapFile, seek_revolution)
+{
+  const size_t n = 2450;
+  TempCapture temp(pcapFile(n, false, false));
+  PcapFile file;
+  std::string error;
+  ASSERT_TRUE(file.open(temp.name(), PORT, 0, PAYLOAD_SIZE, &error)) << error;
+  ASSERT_EQ(file.revolutions(), 25u);
+  for (size_t revolution = 0; revolution < file.revolutions(); ++revolution)
+    EXPECT_EQ(file.revolution(revolution).stamp,
+              packetStamp(revolution * PACKETS_PER_REVOLUTION));
+
+  PcapPacket packet;
+  ASSERT_TRUE(file.seekRevolution(12));
+  ASSERT_TRUE(file.next(&packet));
+  EXPECT_EQ(packet.stamp, packetStamp(1200));
+  ASSERT_TRUE(file.seekRevolution(0));
+  ASSERT_TRUE(file.next(&packet));
+  EXPECT_EQ(packet.stamp, packetStamp(0));
+  EXPECT_FALSE(file.seekRevolution(25));
+
+  // the cursor stays where it was
+  ASSERT_TRUE(file.next(&packet));
+  EXPECT_EQ(packet.stamp, packetStamp(1));
+}
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
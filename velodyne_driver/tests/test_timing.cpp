@@ -0,0 +1,154 @@
+//
+// C++ unit tests for the timing statistics.
+//
+
+#include <gtest/gtest.h>
+
+#include <stdint.h>
+#include <vector>
+
+#include <velodyne_driver/timing.h>
+using namespace velodyne_driver;
+
+// global test data
+static const double START = 1500000000.0;       // [s]
+static const double INTERVAL = 0.001;           // [s] between packets
+static const int PACKETS = 10;                  // per scan
+
+// The middle of the bucket a value is counted in: the median of two
+// of them and a much larger value.
+double bucket_value(uint64_t usec)
+{
+  LatencyHistogram histogram;
+  histogram.record(usec);
+  histogram.record(usec);
+  histogram.record(usec << 10);
+  return histogram.take().p50;
+}
+
+// A scan of packets INTERVAL apart, the first one at this time.
+velodyne_msgs::VelodyneScan scan(double first)
+{
+  velodyne_msgs::VelodyneScan scan;
+  scan.packets.resize(PACKETS);
+  for (int i = 0; i < PACKETS; ++i)
+    scan.packets[i].stamp = ros::Time(first + i * INTERVAL);
+  return scan;
+}
+
+///////////////////////////////////////////////////////////////
+// Test cases
+///////////////////////////////////////////////////////////////
+
+// Values below SUB_BUCKETS are exact, then each power of two is split
+// in eight buckets.
+TEST(LatencyHistogram, bucket_boundaries)
+{
+  EXPECT_EQ(bucket_value(0), 0.0);
+  EXPECT_EQ(bucket_value(7), 7.0);
+  EXPECT_EQ(bucket_value(8), 8.0);
+  EXPECT_EQ(bucket_value(15), 15.0);
+  EXPECT_EQ(bucket_value(16), 16.5);            // 16 and 17
+  EXPECT_EQ(bucket_value(17), 16.5);
+  EXPECT_EQ(bucket_value(18), 18.5);
+  EXPECT_EQ(bucket_value(31), 30.5);            // 30 and 31
+  EXPECT_EQ(bucket_value(32), 33.5);            // 32 to 35
+  EXPECT_EQ(bucket_value(35), 33.5);
+  EXPECT_EQ(bucket_value(36), 37.5);
+  EXPECT_EQ(bucket_value(4608), 4863.5);        // 4608 to 5119
+  EXPECT_EQ(bucket_value(5119), 4863.5);
+  EXPECT_EQ(bucket_value(5120), 5375.5);
+}
+
+TEST(LatencyHistogram, percentiles)
+{
+  LatencyHistogram histogram;
+  for (int i = 0; i < 980; ++i)
+    histogram.record(10);
+  for (int i = 0; i < 5; ++i)
+    histogram.record(1000);
+  for (int i = 0; i < 15; ++i)
+    histogram.record(5000);
+  LatencyHistogram::Summary summary = histogram.take();
+  EXPECT_EQ(summary.count, 1000u);
+  EXPECT_DOUBLE_EQ(summary.mean, 89.8);
+  EXPECT_EQ(summary.p50, 10.0);
+  EXPECT_EQ(summary.p90, 10.0);
+  EXPECT_EQ(summary.p99, 4863.5);               // bucket of 5000
+  EXPECT_EQ(summary.max, 5000.0);
+}
+
+// A percentile is never above the largest value.
+TEST(LatencyHistogram, percentile_below_max)
+{
+  LatencyHistogram histogram;
+  histogram.record(4700);
+  LatencyHistogram::Summary summary = histogram.take();
+  EXPECT_EQ(summary.p50, 4700.0);
+  EXPECT_EQ(summary.p99, 4700.0);
+  EXPECT_EQ(summary.max, 4700.0);
+}
+
+// Values from 2^32 µs on are counted in the last bucket.
+TEST(LatencyHistogram, overflow)
+{
+  const double last = 15 * (1ULL << 28) + ((1ULL << 28) - 1) / 2.0;
+  EXPECT_EQ(bucket_value((1ULL << 32) - 1), last);
+  EXPECT_EQ(bucket_value(1ULL << 32), last);
+  EXPECT_EQ(bucket_value(1ULL << 40), last);
+
+  LatencyHistogram histogram;
+  histogram.record(1ULL << 40);
+  histogram.record(1ULL << 50);
+  LatencyHistogram::Summary summary = histogram.take();
+  EXPECT_EQ(summary.count, 2u);
+  EXPECT_EQ(summary.p50, last);
+  EXPECT_EQ(summary.p99, last);
+  EXPECT_EQ(summary.max, (double) (1ULL << 50));
+}
+
+// Each summary covers the values since the previous one.
+TEST(LatencyHistogram, take_restarts)
+{
+  LatencyHistogram histogram;
+  histogram.record(100);
+  histogram.record(300);
+  LatencyHistogram::Summary summary = histogram.take();
+  EXPECT_EQ(summary.count, 2u);
+  EXPECT_EQ(summary.mean, 200.0);
+
+  summary = histogram.take();
+  EXPECT_EQ(summary.count, 0u);
+  EXPECT_EQ(summary.mean, 0.0);
+  EXPECT_EQ(summary.p50, 0.0);
+  EXPECT_EQ(summary.max, 0.0);
+
+  histogram.record(20);
+  summary = histogram.take();
+  EXPECT_EQ(summary.count, 1u);
+  EXPECT_EQ(summary.mean, 20.0);
+  EXPECT_EQ(summary.max, 20.0);
+}
+
+TEST(ScanGapDetector, gap)
+{
+  const double period = PACKETS * INTERVAL;
+  ScanGapDetector detector;
+  EXPECT_EQ(detector.missed(scan(START)), 0u);  // nothing before it
+  EXPECT_EQ(detector.missed(scan(START + period)), 0u);
+
+  // a little late, then three scans missing
+  EXPECT_EQ(detector.missed(scan(START + 2.4 * period)), 0u);
+  EXPECT_EQ(detector.missed(scan(START + 6.4 * period)), 3u);
+
+  // time going back, as when a capture file repeats
+  EXPECT_EQ(detector.missed(scan(START)), 0u);
+  EXPECT_EQ(detector.missed(scan(START + period)), 0u);
+}
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
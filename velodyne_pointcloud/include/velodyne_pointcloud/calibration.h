@@ -51,12 +51,54 @@ namespace velodyne_pointcloud {
     int laser_ring;                        ///< ring number for this laser
   };
 
+  /** \brief Flat per-laser correction table for unpacking packets.
+   *
+   * Structure of arrays indexed by hardware laser number, built from
+   * laser_corrections whenever a calibration is read.  It holds only
+   * the values used for every return, including constants derived
+   * from the calibration, so the unpack loops index plain arrays
+   * instead of searching a std::map.  The table has no particular
+   * alignment: it lives inside Calibration and the calibration cache
+   * image, so the vector unpack kernels use unaligned loads.
+   *
+   * The two-point distance correction becomes linear in the absolute
+   * temporary X (or Y) coordinate:
+   *
+   *   distance_corr_x = two_pt_slope_x * |xx| + two_pt_offset_x
+   *
+   * Both terms are zero for lasers without two-point correction.
+   */
+  struct CorrectionTable {
+
+    enum { MAX_LASERS = 64 };
+
+    float dist_correction[MAX_LASERS];
+    float cos_vert_correction[MAX_LASERS];
+    float sin_vert_correction[MAX_LASERS];
+    float cos_rot_correction[MAX_LASERS];
+    float sin_rot_correction[MAX_LASERS];
+    float vert_offset_correction[MAX_LASERS];
+    float horiz_offset_correction[MAX_LASERS];
+    float two_pt_slope_x[MAX_LASERS];
+    float two_pt_offset_x[MAX_LASERS];
+    float two_pt_slope_y[MAX_LASERS];
+    float two_pt_offset_y[MAX_LASERS];
+    float focal_slope[MAX_LASERS];
+    float focal_offset[MAX_LASERS];       ///< 256 * (1 - focal_distance/13100)^2
+    float min_intensity[MAX_LASERS];
+    float max_intensity[MAX_LASERS];
+    int laser_ring[MAX_LASERS];           ///< ring number for each laser
+    int row[MAX_LASERS];                  ///< organized cloud row: num_lasers-1 - ring
+  };
+
   /** \brief Calibration information for the entire device. */
   class Calibration {
 
   public:
 
     std::map<int, LaserCorrection> laser_corrections;
+    CorrectionTable correction_table;
+    std::string id;           ///< hash of correction_table, hex digits
     int num_lasers;
     bool initialized;
     bool ros_info;
@@ -74,6 +116,7 @@ namespace velodyne_pointcloud {
 
     void read(const std::string& calibration_file);
     void write(const std::string& calibration_file);
+    void buildCorrectionTable();
   };
   
 } /* velodyne_pointcloud */
@@ -0,0 +1,125 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (C) 2012 Austin Robot Technology, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  @brief Compiled Velodyne calibrations, shared within a process.
+ *
+ *  A compiled calibration holds everything RawData derives from a
+ *  YAML calibration: the flat correction table, its ID and the
+ *  azimuth sine and cosine tables.  The compile_calibration tool, or
+ *  the calibration_cache parameter, writes it as a versioned and
+ *  checksummed binary file that is mapped read-only instead of being
+ *  parsed.
+ *
+ *  CompiledCalibration::load() keeps one copy of each calibration
+ *  per process, so all the nodelets of a manager share it, and
+ *  reloading an unchanged file costs only a stat().
+ */
+
+#ifndef __VELODYNE_CALIBRATION_CACHE_H
+#define __VELODYNE_CALIBRATION_CACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <boost/shared_ptr.hpp>
+
+#include <velodyne_pointcloud/calibration.h>
+
+namespace velodyne_pointcloud
+{
+  /** "VCAL", first word of a compiled calibration */
+  static const uint32_t CALIBRATION_IMAGE_MAGIC = 0x4c414356;
+
+  /** layout version, incremented whenever CalibrationImage changes */
+  static const uint32_t CALIBRATION_IMAGE_VERSION = 1;
+
+  /** azimuth table entries, one per 1/100 degree */
+  static const int CALIBRATION_ROTATION_UNITS = 36000;
+
+  /** \brief Compiled calibration file layout.
+   *
+   *  Written and mapped as is, in host byte order.  The checksum is
+   *  a 64 bit FNV-1a hash of all the bytes after it.
+   */
+  struct CalibrationImage
+  {
+    uint32_t magic;                     ///< CALIBRATION_IMAGE_MAGIC
+    uint32_t version;                   ///< CALIBRATION_IMAGE_VERSION
+    uint32_t size;                      ///< sizeof(CalibrationImage)
+    int32_t num_lasers;
+    uint64_t checksum;
+    uint64_t source_size;               ///< YAML file size [bytes]
+    uint64_t source_mtime;              ///< YAML file modification [ns]
+    char id[24];                        ///< Calibration::id, terminated
+    CorrectionTable table;
+    float cos_rot_table[CALIBRATION_ROTATION_UNITS];
+    float sin_rot_table[CALIBRATION_ROTATION_UNITS];
+  };
+
+  /** \brief Read-only calibration, mapped or compiled once. */
+  class CompiledCalibration
+  {
+  public:
+
+    typedef boost::shared_ptr<const CompiledCalibration> ConstPtr;
+
+    /** @brief Get a calibration, shared by every user in the process.
+     *
+     *  Compiled files are mapped.  YAML files are parsed and
+     *  compiled; with a cache file, one compiled from the same
+     *  version of the YAML file is mapped instead, or else it is
+     *  written for next time.  A file is read again once it changes.
+     *
+     *  @param filename compiled or YAML calibration file
+     *  @param cache_file compiled file kept for a YAML one, or ""
+     *  @returns the calibration, or NULL if unreadable
+     */
+    static ConstPtr load(const std::string &filename,
+                         const std::string &cache_file = "");
+
+    /** @brief Compile a YAML calibration file.
+     *
+     *  The file is replaced atomically, so processes still mapping
+     *  an older version keep it.
+     *
+     *  @returns true if successful
+     */
+    static bool compile(const std::string &yaml_file,
+                        const std::string &filename);
+
+    ~CompiledCalibration();
+
+    const CalibrationImage &image() const { return *image_; }
+
+    /** @brief Set the fields unpacking uses: correction_table,
+     *         num_lasers, id and initialized.
+     *
+     *  laser_corrections is left as it is.
+     */
+    void apply(Calibration &calibration) const;
+
+  private:
+
+    CompiledCalibration(): image_(NULL), mapped_(false) {}
+
+    static ConstPtr map(const std::string &filename,
+                        uint64_t source_size, uint64_t source_mtime);
+    static ConstPtr parse(const std::string &yaml_file,
+                          uint64_t source_size, uint64_t source_mtime);
+    static bool write(const CalibrationImage &image,
+                      const std::string &filename);
+
+    const CalibrationImage *image_;
+    bool mapped_;                       ///< image_ is a file mapping
+  };
+
+} // namespace velodyne_pointcloud
+
+#endif // __VELODYNE_CALIBRATION_CACHE_H
@@ -0,0 +1,101 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (C) 2009, 2010, 2012 Austin Robot Technology, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  @brief Binary diagnostics capture for the Velodyne 3D LIDAR.
+ *
+ *  The unpack loops push one fixed-size record per VLP-16 firing into
+ *  a lock-free single producer, single consumer ring.  A background
+ *  thread drains the ring to a binary file, so the unpack thread
+ *  never formats text or waits for the disk.
+ *
+ *  The file starts with CAPTURE_MAGIC and the record size, as two
+ *  uint32_t words, followed by raw CaptureRecord structures in host
+ *  byte order.
+ */
+
+#ifndef __VELODYNE_CAPTURE_H
+#define __VELODYNE_CAPTURE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <boost/atomic.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/thread.hpp>
+
+namespace velodyne_rawdata
+{
+  /** "VDC1", first word of a capture file */
+  static const uint32_t CAPTURE_MAGIC = 0x31434456;
+
+  /** \brief One captured firing. */
+  struct CaptureRecord
+  {
+    uint64_t stamp;             ///< firing time, ROS time in nanoseconds
+    uint32_t device_time;       ///< packet time stamp, microseconds past the hour
+    uint32_t sequence;          ///< record number, gaps show dropped records
+    uint16_t azimuth;           ///< corrected azimuth of the first beam [deg/100]
+    uint16_t azimuth_diff;      ///< rotation during a block [deg/100]
+    uint8_t  return_type;       ///< packet return mode factory byte
+    uint8_t  data_source;       ///< packet product id factory byte
+    uint8_t  block;             ///< block number in its packet
+    uint8_t  firing;            ///< firing number in its block
+  };
+
+  /** \brief Diagnostics capture writer. */
+  class DiagnosticCapture
+  {
+  public:
+
+    /** @brief Open the capture file and start the writer thread.
+     *
+     *  @param filename capture file to create
+     *  @param capacity ring size in records
+     */
+    DiagnosticCapture(const std::string &filename, size_t capacity = 65536);
+
+    /** Write all pending records, then close the file. */
+    ~DiagnosticCapture();
+
+    /** @returns true if the capture file is open */
+    bool isOpen() const { return file_ != NULL; }
+
+    /** @brief Queue a record, never blocking.
+     *
+     *  Only one thread may push.  The record is dropped if the ring
+     *  is full; sequence still counts it.
+     */
+    void push(CaptureRecord &record)
+    {
+      record.sequence = sequence_++;
+      if (!queue_.push(record))
+        ++dropped_;
+    }
+
+    /** @returns number of records dropped so far */
+    uint64_t dropped() const { return dropped_; }
+
+  private:
+
+    void writer();
+    size_t drain();
+
+    boost::lockfree::spsc_queue<CaptureRecord> queue_;
+    FILE *file_;
+    uint32_t sequence_;
+    boost::atomic<uint64_t> dropped_;
+    boost::atomic<bool> running_;
+    boost::thread thread_;
+  };
+
+} // namespace velodyne_rawdata
+
+#endif // __VELODYNE_CAPTURE_H
@@ -0,0 +1,106 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (C) 2009, 2010, 2012 Austin Robot Technology, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  @brief Pool of reusable output point clouds.
+ *
+ *  Published clouds are shared with subscribers, so a node cannot
+ *  simply reuse its last one.  Clouds handed out by the pool come
+ *  back to it when the last shared pointer to them is released, and
+ *  keep their point storage for the next scan.
+ */
+
+#ifndef __VELODYNE_CLOUD_POOL_H
+#define __VELODYNE_CLOUD_POOL_H
+
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace velodyne_rawdata
+{
+  /** \brief Recycling allocator of output clouds.
+   *
+   *  @param Cloud VPointCloud or sensor_msgs::PointCloud2
+   */
+  template <class Cloud>
+  class CloudPool
+  {
+  public:
+
+    typedef boost::shared_ptr<Cloud> CloudPtr;
+
+    /** @param max_free number of released clouds kept for reuse */
+    CloudPool(size_t max_free = 4):
+      state_(new State)
+    {
+      state_->max_free = max_free;
+      state_->free.reserve(max_free);
+    }
+
+    /** @brief Get a cloud, reusing a released one if possible.
+     *
+     *  Contents are left over from its previous use: RawData::unpack()
+     *  overwrites every point.
+     */
+    CloudPtr get()
+    {
+      Cloud *cloud = NULL;
+      {
+        boost::mutex::scoped_lock lock(state_->lock);
+        if (!state_->free.empty())
+          {
+            cloud = state_->free.back();
+            state_->free.pop_back();
+          }
+      }
+      if (cloud == NULL)
+        cloud = new Cloud();
+
+      return CloudPtr(cloud, boost::bind(&CloudPool::recycle, state_, _1));
+    }
+
+  private:
+
+    /** Shared with the deleters, which may outlive the pool. */
+    struct State
+    {
+      boost::mutex lock;
+      std::vector<Cloud *> free;
+      size_t max_free;
+
+      ~State()
+      {
+        for (size_t i = 0; i < free.size(); ++i)
+          delete free[i];
+      }
+    };
+
+    /** Deleter of the pool's clouds: keep them, unless enough are. */
+    static void recycle(boost::shared_ptr<State> state, Cloud *cloud)
+    {
+      {
+        boost::mutex::scoped_lock lock(state->lock);
+        if (state->free.size() < state->max_free)
+          {
+            state->free.push_back(cloud);
+            return;
+          }
+      }
+      delete cloud;
+    }
+
+    boost::shared_ptr<State> state_;
+  };
+
+} // namespace velodyne_rawdata
+
+#endif // __VELODYNE_CLOUD_POOL_H
@@ -0,0 +1,84 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (C) 2009, 2010, 2012 Austin Robot Technology, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  @brief Decoder of compact Velodyne scans.
+ *
+ *  A velodyne_msgs/VelodyneCompactScan holds the raw distance and
+ *  intensity of every return, as written by RawData::unpackCompact(),
+ *  in a few bytes each.  Consumers with the same calibration turn
+ *  returns into points only when they need them.
+ */
+
+#ifndef __VELODYNE_COMPACT_SCAN_H
+#define __VELODYNE_COMPACT_SCAN_H
+
+#include <vector>
+
+#include <velodyne_msgs/VelodyneCompactScan.h>
+#include <velodyne_pointcloud/calibration.h>
+#include <velodyne_pointcloud/rawdata.h>
+
+namespace velodyne_rawdata
+{
+  /** \brief Computes the points of compact scans. */
+  class CompactDecoder
+  {
+  public:
+
+    /** @param calibration calibration of the sensor, already read */
+    CompactDecoder(const velodyne_pointcloud::Calibration &calibration);
+
+    /** @returns true if scan was written with this calibration */
+    bool matches(const velodyne_msgs::VelodyneCompactScan &scan) const;
+
+    /** @brief Convert a whole compact scan to an organized cloud.
+     *
+     *  The cloud has the layout of RawData::unpack(), with empty
+     *  cells for missing returns.
+     *
+     *  @param scan compact scan
+     *  @param pc returns the points in the sensor frame
+     *  @returns 0 if successful;
+     *           EINVAL if scan does not match the calibration
+     */
+    int decode(const velodyne_msgs::VelodyneCompactScan &scan,
+               VPointCloud &pc) const;
+
+    /** @brief Compute a single point of a compact scan.
+     *
+     *  Does not check the calibration, see matches().
+     *
+     *  @param scan compact scan
+     *  @param row row of the return, as in the organized cloud
+     *  @param col column of the return
+     *  @param point returns the point in the sensor frame
+     *  @returns false if there is no return there
+     */
+    bool point(const velodyne_msgs::VelodyneCompactScan &scan,
+               uint32_t row, uint32_t col, VPoint &point) const;
+
+  private:
+
+    /** azimuth of a ring's return in a column [deg/100] */
+    int beamAzimuth(const velodyne_msgs::VelodyneCompactScan &scan,
+                    int laser, uint32_t col) const;
+
+    velodyne_pointcloud::CorrectionTable table_;
+    std::string id_;
+    int num_lasers_;
+    int row_laser_[velodyne_pointcloud::CorrectionTable::MAX_LASERS];
+    std::vector<float> cos_rot_table_;
+    std::vector<float> sin_rot_table_;
+  };
+
+} // namespace velodyne_rawdata
+
+#endif // __VELODYNE_COMPACT_SCAN_H
@@ -0,0 +1,79 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (C) 2009, 2010, 2012 Austin Robot Technology, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  @brief Packed PointCloud2 layouts for the Velodyne 3D LIDAR.
+ *
+ *  Instead of the 32 byte aligned PointXYZIR, packed clouds store
+ *  only the payload of each point, written directly into the
+ *  PointCloud2 data buffer:
+ *
+ *    - x, y, z: FLOAT32 meters; or x_float16, y_float16, z_float16:
+ *      FLOAT16 bits in UINT16 fields; or x_int16_<r>um, y_int16_<r>um,
+ *      z_int16_<r>um: INT16 multiples of the layout resolution, r
+ *      micrometers, e.g. x_int16_5000um for 5 mm
+ *    - intensity: FLOAT32
+ *    - ring: UINT16
+ *    - time: FLOAT32 seconds since the cloud stamp, optional
+ *
+ *  Empty cells hold NaN coordinates, or -32768 for INT16.
+ */
+
+#ifndef __VELODYNE_PACKED_CLOUD_H
+#define __VELODYNE_PACKED_CLOUD_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <sensor_msgs/PointField.h>
+
+namespace velodyne_rawdata
+{
+  /** \brief Field layout of packed PointCloud2 output. */
+  struct PackedLayout
+  {
+    enum Coordinates { FLOAT32, FLOAT16, INT16 };
+
+    Coordinates coordinates;            ///< coordinate encoding
+    bool time;                          ///< time field present
+    float resolution;                   ///< [m] per INT16 unit, whole µm
+    uint32_t point_step;                ///< bytes per point
+
+    /** byte offsets of the fields in a point */
+    uint32_t x_offset, y_offset, z_offset;
+    uint32_t intensity_offset, ring_offset, time_offset;
+
+    std::vector<sensor_msgs::PointField> fields;
+
+    PackedLayout();
+
+    /** @brief Choose the layout.
+     *
+     *  @param format "float32", "float16" or "int16"
+     *  @param time add the per-point time field
+     *  @param resolution [m] per unit of int16 coordinates, rounded
+     *         to micrometers; float32 is used if it is not positive
+     *  @returns false for an unknown format
+     */
+    bool configure(const std::string &format, bool time, double resolution);
+
+    /** @brief Read back a point stored in this layout.
+     *
+     *  @param cell first byte of the point in the cloud data
+     *  @param x, y, z coordinates [m], NaN for an empty cell
+     *  @param ring laser ring number
+     */
+    void readPoint(const uint8_t *cell, float &x, float &y, float &z,
+                   uint16_t &ring) const;
+  };
+
+} // namespace velodyne_rawdata
+
+#endif // __VELODYNE_PACKED_CLOUD_H
@@ -32,6 +32,37 @@ namespace velodyne_pointcloud
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW     // ensure proper alignment
   } EIGEN_ALIGN16;
 
+  /** PointXYZIRT return_index values */
+  enum
+    {
+      RETURN_SINGLE = 0,                ///< single return mode
+      RETURN_STRONGEST = 1,             ///< dual return mode, strongest
+      RETURN_LAST = 2                   ///< dual return mode, last
+    };
+
+  /** Euclidean Velodyne coordinate, including intensity, ring number,
+   *  firing time and return. */
+  struct PointXYZIRT
+  {
+    PCL_ADD_POINT4D;                    // quad-word XYZ
+    float    intensity;                 ///< laser intensity reading
+    uint16_t ring;                      ///< laser ring number
+    uint8_t  return_index;              ///< RETURN_SINGLE, _STRONGEST or _LAST
+    float    time;                      ///< seconds since the cloud stamp
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW     // ensure proper alignment
+  } EIGEN_ALIGN16;
+
+  /** Euclidean Velodyne coordinate, including intensity, ring number
+   *  and the index of its sensor in a fused cloud. */
+  struct PointXYZIRS
+  {
+    PCL_ADD_POINT4D;                    // quad-word XYZ
+    float    intensity;                 ///< laser intensity reading
+    uint16_t ring;                      ///< laser ring number
+    uint16_t sensor;                    ///< sensor index
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW     // ensure proper alignment
+  } EIGEN_ALIGN16;
+
 }; // namespace velodyne_pointcloud
 
 
@@ -42,5 +73,22 @@ POINT_CLOUD_REGISTER_POINT_STRUCT(velodyne_pointcloud::PointXYZIR,
                                   (float, intensity, intensity)
                                   (uint16_t, ring, ring))
 
+POINT_CLOUD_REGISTER_POINT_STRUCT(velodyne_pointcloud::PointXYZIRT,
+                                  (float, x, x)
+                                  (float, y, y)
+                                  (float, z, z)
+                                  (float, intensity, intensity)
+                                  (uint16_t, ring, ring)
+                                  (uint8_t, return_index, return_index)
+                                  (float, time, time))
+
+POINT_CLOUD_REGISTER_POINT_STRUCT(velodyne_pointcloud::PointXYZIRS,
+                                  (float, x, x)
+                                  (float, y, y)
+                                  (float, z, z)
+                                  (float, intensity, intensity)
+                                  (uint16_t, ring, ring)
+                                  (uint16_t, sensor, sensor))
+
 #endif // __VELODYNE_POINTCLOUD_POINT_TYPES_H
 
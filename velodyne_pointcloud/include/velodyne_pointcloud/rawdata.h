@@ -23,26 +23,39 @@
 #include <errno.h>
 #include <stdint.h>
 #include <string>
+#include <vector>
 #include <boost/format.hpp>
 #include <math.h>
- #include <fstream>
+#include <boost/shared_ptr.hpp>
 
 #include <ros/ros.h>
 #include <tf/transform_listener.h>
 #include <pcl_ros/point_cloud.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <velodyne_msgs/VelodyneCompactScan.h>
+#include <velodyne_msgs/VelodyneRangeImage.h>
 #include <velodyne_msgs/VelodyneScan.h>
 #include <velodyne_pointcloud/point_types.h>
 #include <velodyne_pointcloud/calibration.h>
+#include <velodyne_pointcloud/calibration_cache.h>
+#include <velodyne_pointcloud/packed_cloud.h>
 
 namespace velodyne_rawdata
 {
   // Shorthand typedefs for point cloud representations
   typedef velodyne_pointcloud::PointXYZIR VPoint;
   typedef pcl::PointCloud<VPoint> VPointCloud;
+  typedef velodyne_pointcloud::PointXYZIRT VTPoint;
+  typedef pcl::PointCloud<VTPoint> VTPointCloud;
+  typedef velodyne_pointcloud::PointXYZIRS VSPoint;
+  typedef pcl::PointCloud<VSPoint> VSPointCloud;
 
   /** Log rate for throttled warnings and errors in seconds */
   static const double LOG_PERIOD_ = 1.0;
 
+  /** Fewest packets worth a worker pool task */
+  static const size_t MIN_PACKETS_PER_TASK = 16;
+
   /**
    * Raw Velodyne packet constants and structures.
    */
@@ -66,6 +79,11 @@ namespace velodyne_rawdata
   static const float  VLP16_DSR_TOFFSET       =   2.304f;   // [µs]
   static const float  VLP16_FIRING_TOFFSET    =  55.296f;   // [µs]
 
+  /** Firing times of the HDL models, for deskewing.  HDL-64E upper
+   *  and lower blocks fire together, so a packet holds six firings. */
+  static const float  HDL32_BLOCK_TDURATION   =  46.080f;   // [µs]
+  static const float  HDL64_FIRING_TDURATION  =  48.000f;   // [µs], approximate
+
 
   /** \brief Raw Velodyne data block.
    *
@@ -116,28 +134,17 @@ namespace velodyne_rawdata
     uint8_t status[PACKET_STATUS_SIZE];
   } raw_packet_t;
 
-  inline float packet_interp_time(const uint32_t time) {
-      // Check endiasness
-      int x = 1;
-      char *y = (char*)&x;
-      uint32_t time_hex;
-      if(*y) // Little endian
-      {
-        // Then do nothing, since the time stamp are transmitted least significant byte first.
-        time_hex = time;
-      } else { // Big endian
-        // Then reverse byte order
-        time_hex =  ((time>>24)&0xff)    |   // move byte 3 to byte 0
-                    ((time<<8)&0xff0000) |   // move byte 1 to byte 2
-                    ((time>>8)&0xff00)   |   // move byte 2 to byte 1
-                    ((time<<24)&0xff000000); // byte 0 to byte 3
-      }
-      float time_dec;
-      std::stringstream stream;
-      stream << time_hex;
-      stream >> std::hex >> time_dec;
-      return time_dec;
-    }
+  /** @brief Device time stamp of a VLP-16 packet.
+   *
+   *  @param time packet time field, least significant byte first
+   *  @returns microseconds past the hour
+   */
+  inline uint32_t packet_interp_time(const uint32_t time)
+  {
+    const uint8_t *bytes = (const uint8_t *) &time;
+    return (bytes[0] | (bytes[1] << 8) | (bytes[2] << 16)
+            | ((uint32_t) bytes[3] << 24));
+  }
 
   typedef struct raw_packet_vlp16
   {
@@ -147,6 +154,45 @@ namespace velodyne_rawdata
     uint8_t data_source;  // 21 for HDL-32E or 22 for VLP-16
   } raw_packet_vlp16_t;
 
+  /** @brief Organized cloud column of a VLP-16 firing.
+   *
+   *  In dual return mode consecutive blocks hold the two returns of
+   *  the same firings, and their columns alternate.
+   *
+   *  @param packet index of the packet in the scan
+   *  @param block block in the packet
+   *  @param firing firing in the block
+   *  @param dual_return packet holds dual returns
+   */
+  inline int vlp16_column(size_t packet, int block, int firing,
+                          bool dual_return)
+  {
+    if (dual_return)
+      return packet * BLOCKS_PER_PACKET * VLP16_FIRINGS_PER_BLOCK
+        + (block/2) * 2 * VLP16_FIRINGS_PER_BLOCK
+        + firing * 2
+        + block % 2;
+    return packet * BLOCKS_PER_PACKET * VLP16_FIRINGS_PER_BLOCK
+      + block * VLP16_FIRINGS_PER_BLOCK
+      + firing;
+  }
+
+  struct BlockPoints;
+  class CudaUnpacker;
+  struct ReturnClouds;
+  struct DecimatedCloud;
+  struct FusedCloud;
+  class DiagnosticCapture;
+  class WorkerPool;
+  template <class Cloud> class CloudWriter;
+
+  /** block unpacking kernel, see unpack_kernel.h */
+  typedef void (*UnpackBlockFn)(const velodyne_pointcloud::CorrectionTable &table,
+                                int laser, int n, const uint8_t *data,
+                                const float *cos_azimuth,
+                                const float *sin_azimuth,
+                                BlockPoints &points);
+
   /** \brief Velodyne data conversion class */
   class RawData
   {
@@ -177,20 +223,213 @@ namespace velodyne_rawdata
      */
     void unpack(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg, VPointCloud &pc);
 
+    /** @brief convert raw Velodyne message to a packed point cloud
+     *
+     *  Writes the points straight into the PointCloud2 data, in the
+     *  layout selected by the cloud_format parameter.
+     *
+     *  @param scanMsg raw Velodyne scan message
+     *  @param cloud organized point cloud
+     */
+    void unpack(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg,
+                sensor_msgs::PointCloud2 &cloud);
+
+    /** @brief convert raw Velodyne message to a timed point cloud
+     *
+     *  Like the PointXYZIR cloud, with the time of each firing and
+     *  its return.
+     *
+     *  @param scanMsg raw Velodyne scan message
+     *  @param pc organized point cloud
+     */
+    void unpack(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg,
+                VTPointCloud &pc);
+
+    /** @brief convert raw Velodyne message to one cloud per return
+     *
+     *  A single pass over the packets.  In dual return mode both
+     *  clouds have a column per firing, half as many as the combined
+     *  cloud.  When the strongest return is also the last one the
+     *  device reports the second strongest instead.  In single return
+     *  mode the points of the scan go to the cloud of the return mode
+     *  of its first packet, and the other one is left without points.
+     *
+     *  @param scanMsg raw Velodyne scan message
+     *  @param strongest organized cloud of the strongest returns
+     *  @param last organized cloud of the last returns
+     */
+    void unpackReturns(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg,
+                       VTPointCloud &strongest, VTPointCloud &last);
+
+    /** @brief convert raw Velodyne message to a decimated point cloud
+     *
+     *  Keeps one ring in ring_stride and one firing in column_stride
+     *  of the organized cloud, see setDecimation().  The dropped
+     *  points are not computed.
+     *
+     *  @param scanMsg raw Velodyne scan message
+     *  @param pc organized point cloud
+     */
+    void unpackDecimated(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg,
+                         VPointCloud &pc);
+
+    /** @brief convert raw Velodyne message into part of a fused cloud
+     *
+     *  For merging several sensors in one pass: the cells of the scan
+     *  are written straight into its columns of a cloud the caller
+     *  has sized for all of them, with the sensor index.  Rows past
+     *  scanRows() in those columns are emptied, and the header is
+     *  left as it is.
+     *
+     *  @param scanMsg raw Velodyne scan message
+     *  @param fused organized cloud of all the sensors
+     *  @param first_column first of the scanColumns() columns of the scan
+     *  @param sensor sensor field of its cells
+     *  @returns false if the scan does not fit in the cloud
+     */
+    bool unpackFused(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg,
+                     VSPointCloud &fused, uint32_t first_column,
+                     uint16_t sensor);
+
+    /** @returns columns of the organized cloud of a scan */
+    uint32_t scanColumns(const velodyne_msgs::VelodyneScan &scanMsg) const;
+
+    /** @returns rows of the organized clouds, one per laser */
+    uint32_t scanRows() const { return calibration_.num_lasers; }
+
+    /** @brief Set the strides of unpackDecimated(), 1 to keep all. */
+    void setDecimation(int ring_stride, int column_stride);
+
+    /** @brief Choose the packed PointCloud2 layout, see PackedLayout.
+     *
+     *  @param format "pcl" for PointXYZIR clouds, or a packed layout
+     *  @param time add the per-point time field
+     *  @param resolution [m] per unit of int16 coordinates, see
+     *         PackedLayout::configure()
+     *  @returns false for an unknown format
+     */
+    bool setCloudFormat(const std::string &format, bool time,
+                        double resolution);
+
+    /** @returns true if the cloud_format parameter asks for packed
+     *           PointCloud2 output */
+    bool packedOutput() const { return packed_output_; }
+
+    /** @returns layout of the packed PointCloud2 clouds */
+    const PackedLayout &packedLayout() const { return packed_layout_; }
+
+    /** @brief copy the raw returns of a Velodyne message to a compact scan
+     *
+     *  No point math: distances and intensities are copied as they
+     *  are, into the cells of the organized cloud, highest ring
+     *  first.  Neither the view
+     *  window nor the range limits apply.  Decode the points with
+     *  CompactDecoder, see compact_scan.h.
+     *
+     *  @param scanMsg raw Velodyne scan message
+     *  @param compact range image of the scan
+     */
+    void unpackCompact(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg,
+                       velodyne_msgs::VelodyneCompactScan &compact);
+
+    /** @brief convert raw Velodyne message to a range image
+     *
+     *  Bins every return in range by its beam azimuth into the
+     *  range_image_width columns of a full circle, keeping the
+     *  nearest one of each cell.  Only the corrected distance is
+     *  computed, no point coordinates.  The view window does not
+     *  apply.
+     *
+     *  @param scanMsg raw Velodyne scan message
+     *  @param image range image of the scan
+     */
+    void unpackRangeImage(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg,
+                          velodyne_msgs::VelodyneRangeImage &image);
+
     void setParameters(double min_range, double max_range, double view_direction,
                        double view_width, const std::string& frame_id = "", const std::string& fixed_frame_id = "");
 
+    /** @brief Transform points with a fixed extrinsic.
+     *
+     *  For a rigidly mounted sensor, the transform to the target
+     *  frame_id of setParameters(), looked up once by the caller,
+     *  replaces the tf lookups for every packet.  Neither motion
+     *  compensation nor deskewing apply.
+     *
+     *  @param extrinsic sensor to target frame transform
+     */
+    void setExtrinsic(const tf::Transform &extrinsic);
+
+    /** @brief Switch to another calibration file.
+     *
+     *  Compiled and already loaded calibrations are not parsed again,
+     *  see CompiledCalibration::load().
+     *
+     *  @param calibration_file YAML or compiled calibration
+     *  @returns 0 if successful, the old calibration stays otherwise
+     */
+    int setCalibration(const std::string &calibration_file);
+
+    /** @brief Unpack scans on a pool of worker threads.
+     *
+     *  Ranges of packets are converted in parallel; the clouds are
+     *  the same as without a pool.
+     *
+     *  @param workers worker pool, or NULL to unpack on the calling
+     *                 thread alone
+     */
+    void setWorkerPool(const boost::shared_ptr<WorkerPool> &workers)
+    {
+      workers_ = workers;
+    }
+
+    /** @brief Unpack PCL clouds on a CUDA device, see deviceCloud().
+     *
+     *  Selects the scalar CPU kernel, which computes the same points
+     *  as the device, for the scans left to the CPU.
+     *
+     *  @param device CUDA device number, or -1 to unpack on the CPU
+     *  @returns true if unpacking on the device
+     */
+    bool setCudaDevice(int device);
+
+    /** \brief A cloud unpacked on a CUDA device, see deviceCloud(). */
+    struct DeviceCloud
+    {
+      const void *device;               ///< PointXYZIR cells in device memory
+      const VPoint *host;               ///< the same, in pinned host memory
+      uint32_t width;
+      uint32_t height;
+    };
+
+    /** @brief Locate the last PointXYZIR cloud unpacked on a CUDA device.
+     *
+     *  With the cuda parameter set, and CUDA found at build time,
+     *  unpack() computes PCL clouds on the device, and falls back to
+     *  the CPU for view windows and unsupported devices.  Its cells
+     *  stay on the device, row by row, until the next unpack().
+     *
+     *  @param cloud returns the cloud
+     *  @returns false if the last cloud was unpacked on the CPU
+     */
+    bool deviceCloud(DeviceCloud &cloud) const;
+
   private:
 
     /** configuration parameters */
     typedef struct {
       std::string calibrationFile;     ///< calibration file name
+      std::string calibrationCache;    ///< compiled copy of a YAML one, or ""
       double max_range;                ///< maximum range to publish
       double min_range;                ///< minimum range to publish
       int min_angle;                   ///< minimum angle to publish
       int max_angle;                   ///< maximum angle to publish
       std::string frame_id;            ///< frame into which to transform points
       std::string fixed_frame_id;     ///<  fixed frame for tf transform
+      int deskew_samples;              ///< poses per scan, 0 to look up each packet
+      int range_image_width;           ///< azimuth columns of range images
+      int ring_stride;                 ///< decimated rows, see setDecimation()
+      int column_stride;               ///< decimated firings
 
       double tmp_min_angle;
       double tmp_max_angle;
@@ -201,20 +440,183 @@ namespace velodyne_rawdata
      * Calibration file
      */
     velodyne_pointcloud::Calibration calibration_;
-    float sin_rot_table_[ROTATION_MAX_UNITS];
-    float cos_rot_table_[ROTATION_MAX_UNITS];
+    velodyne_pointcloud::CompiledCalibration::ConstPtr compiled_;
+
+    /** sin and cos of all the possible headings, in the first
+     *  calibration loaded: they do not depend on it */
+    velodyne_pointcloud::CompiledCalibration::ConstPtr rot_tables_;
+    const float *sin_rot_table_;
+    const float *cos_rot_table_;
 
     tf::TransformListener* tf_listener_;
 
-    std::ofstream file_;
+    /** cached sensor to target transform, see setExtrinsic() */
+    bool has_extrinsic_;
+    tf::Transform extrinsic_;
 
-    /** @brief convert raw VLP16 message to point cloud
+    /** true if points are transformed to config_.frame_id */
+    bool transforming() const
+    {
+      return ((tf_listener_ != NULL || has_extrinsic_)
+              && !config_.frame_id.empty());
+    }
+
+    /** kernel computing the points of one block */
+    UnpackBlockFn unpack_block_;
+
+    /** optional firing diagnostics capture, NULL when off */
+    boost::shared_ptr<DiagnosticCapture> capture_;
+
+    /** optional worker threads, see setWorkerPool() */
+    boost::shared_ptr<WorkerPool> workers_;
+    void packetRanges(size_t n_packets, std::vector<size_t> &bounds) const;
+
+    /** optional CUDA backend, see deviceCloud() */
+    boost::shared_ptr<CudaUnpacker> cuda_;
+    bool on_device_;                    ///< last cloud is on the device
+    std::vector<float> cuda_transforms_; ///< of each column
+    bool uploadCalibration();
+    bool unpackCuda(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg,
+                    VPointCloud &pc);
+    void columnTransforms(const velodyne_msgs::VelodyneScan &scanMsg,
+                          uint32_t width);
+
+    /** packed output layout, see packedOutput() */
+    bool packed_output_;
+    PackedLayout packed_layout_;
+
+    /** unpack instantiations for the current configuration */
+    template <class Cloud>
+    struct UnpackFn
+    {
+      typedef void (RawData::*type)(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg,
+                                    Cloud &cloud);
+    };
+    UnpackFn<VPointCloud>::type unpack_;
+    UnpackFn<sensor_msgs::PointCloud2>::type unpack_packed_;
+    UnpackFn<VTPointCloud>::type unpack_timed_;
+    UnpackFn<ReturnClouds>::type unpack_returns_;
+    UnpackFn<DecimatedCloud>::type unpack_decimated_;
+    UnpackFn<FusedCloud>::type unpack_fused_;
+    void selectUnpack();
+    template <class Cloud>
+    typename UnpackFn<Cloud>::type chooseUnpack() const;
+
+    /** \brief Sensor to target frame transform across one packet.
      *
-     *  @param scanMsg raw Velodyne scan message
-     *  @param pc shared pointer to point cloud (points are appended)
+     *  Looked up at the packet boundaries, and interpolated for the
+     *  time of each firing.
      */
+    struct PacketTransform
+    {
+      bool valid;                       ///< false if tf has none
+      tf::Transform start;              ///< transform at the packet time
+      tf::Transform end;                ///< transform at the next packet time
+      float duration;                   ///< [µs] from start to end
+      bool have_end;                    ///< end is the next start
+
+      /** @returns transform t µs after the packet time */
+      tf::Transform at(float t) const
+      {
+        if (duration <= 0.0f)
+          return start;
+        return interpolate(start, end, t / duration);
+      }
+    };
+
+    /** @returns rotation slerped and translation interpolated
+     *           linearly from a (ratio 0) to b (ratio 1) */
+    static tf::Transform interpolate(const tf::Transform &a,
+                                     const tf::Transform &b, double ratio)
+    {
+      return tf::Transform(tf::slerp(a.getRotation(), b.getRotation(), ratio),
+                           tf::lerp(a.getOrigin(), b.getOrigin(), ratio));
+    }
+    void packetTransform(const velodyne_msgs::VelodyneScan &scanMsg,
+                         size_t packet, bool motion,
+                         PacketTransform &transform);
+
+    /** \brief Sensor poses sampled across a scan, for deskewing. */
+    struct PoseTrack
+    {
+      std::vector<ros::Time> stamps;    ///< increasing sample times
+      std::vector<tf::Transform> poses; ///< sensor to target transforms
+      tf::Transform at(const ros::Time &stamp) const;
+    };
+    PoseTrack track_;
+    void samplePoses(const velodyne_msgs::VelodyneScan &scanMsg);
+
+    bool lookupTransform(const std::string &source_frame,
+                         const ros::Time &stamp,
+                         const ros::Time &target_stamp,
+                         bool fixed_frame, tf::Transform &transform);
+
+    template <int NUM_LASERS, bool TRANSFORM, bool VIEW_WINDOW, class Cloud>
+    void unpack_hdl(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg,
+                    Cloud &cloud);
+    template <int NUM_LASERS, bool TRANSFORM, bool VIEW_WINDOW, class Cloud>
+    int unpack_hdl_packets(const velodyne_msgs::VelodyneScan &scanMsg,
+                           size_t first, size_t last, int n_points,
+                           CloudWriter<Cloud> &out);
+    int hdlPacketPoints(const velodyne_msgs::VelodynePacket &pkt,
+                        bool view_window);
+    template <bool TRANSFORM, bool VIEW_WINDOW, class Cloud>
     void unpack_vlp16(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg,
-                      VPointCloud &pc);
+                      Cloud &cloud);
+    template <bool TRANSFORM, bool VIEW_WINDOW, class Cloud>
+    void unpack_vlp16_packets(const velodyne_msgs::VelodyneScan &scanMsg,
+                              size_t first, size_t last,
+                              CloudWriter<Cloud> &out, size_t &stop);
+    template <bool DUAL_RETURN, bool TRANSFORM, bool VIEW_WINDOW, class Cloud>
+    bool unpack_vlp16_packet(const velodyne_msgs::VelodyneScan &scanMsg,
+                             size_t packet, const PacketTransform &transform,
+                             CloudWriter<Cloud> &out);
+
+    /** in-line test whether an azimuth is in the view window */
+    bool inViewWindow(int azimuth)
+    {
+      return ((azimuth >= config_.min_angle
+               && azimuth <= config_.max_angle
+               && config_.min_angle < config_.max_angle)
+              || (config_.min_angle > config_.max_angle
+                  && (azimuth <= config_.max_angle
+                      || azimuth >= config_.min_angle)));
+    }
+
+    /** in-line test whether the azimuth arc turning forward from
+     *  first to last (inclusive) meets the view window */
+    bool arcInViewWindow(int first, int last)
+    {
+      int span = (last - first + ROTATION_MAX_UNITS) % ROTATION_MAX_UNITS;
+      int start = (config_.min_angle - first + ROTATION_MAX_UNITS)
+        % ROTATION_MAX_UNITS;
+      return (inViewWindow(first) || inViewWindow(last) || start <= span);
+    }
+
+    /** horizontal angle correction of each laser [deg/100] */
+    float rot_correction_units_[velodyne_pointcloud::CorrectionTable::MAX_LASERS];
+
+    /** range image cell updates, see unpackRangeImage() */
+    void addRangeReturn(velodyne_msgs::VelodyneRangeImage &image, int laser,
+                        float azimuth, const uint8_t *data);
+    void addRangeColumn(velodyne_msgs::VelodyneRangeImage &image,
+                        float azimuth, float time);
+
+    /** raw distance limits for each laser, see updateRawLimits() */
+    int raw_min_[velodyne_pointcloud::CorrectionTable::MAX_LASERS];
+    int raw_max_[velodyne_pointcloud::CorrectionTable::MAX_LASERS];
+    void updateRawLimits();
+
+    /** in-line test whether a raw distance may be in range
+     *
+     *  Rejects missing returns (zero distance) and those clearly out
+     *  of range before any point math.  It is conservative by a raw
+     *  unit, so pointInRange() still decides close cases.
+     */
+    bool rawInRange(int laser, int raw)
+    {
+      return (raw >= raw_min_[laser] && raw <= raw_max_[laser]);
+    }
 
     /** in-line test whether a point is in range */
     bool pointInRange(float range)
@@ -0,0 +1,104 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (C) 2012 Austin Robot Technology, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  @brief Matching the scans of several Velodyne 3D LIDARs.
+ *
+ *  Sensors mounted at different headings, or not phase locked, cut
+ *  their scans at different azimuths, so their scan stamps do not
+ *  tell which scans saw the same surroundings at the same time.  The
+ *  instants their beams swept the same direction of a common target
+ *  frame do.  The fusion nodelet groups the scans of its sensors by
+ *  these sweep times.
+ */
+
+#ifndef __VELODYNE_SWEEP_MATCHER_H
+#define __VELODYNE_SWEEP_MATCHER_H
+
+#include <deque>
+#include <vector>
+
+#include <ros/time.h>
+#include <velodyne_msgs/VelodyneScan.h>
+
+namespace velodyne_rawdata
+{
+  /** \brief Groups the scans of several sensors by sweep time. */
+  class SweepMatcher
+  {
+  public:
+
+    /** @param sensors number of sensors
+     *  @param max_skew largest difference in sweep times matched [s]
+     */
+    SweepMatcher(size_t sensors, double max_skew);
+
+    /** @brief Set the device azimuth of the target frame x axis.
+     *
+     *  @param sensor index of the sensor
+     *  @param azimuth [deg/100], from the sensor mounting yaw
+     */
+    void setAzimuth(size_t sensor, int azimuth);
+
+    /** @brief Time a scan swept the target frame x axis.
+     *
+     *  Interpolated from the first and last packets; when that
+     *  direction is in the gap between scans, the crossing nearest to
+     *  the scan is extrapolated.
+     */
+    ros::Time sweepTime(size_t sensor,
+                        const velodyne_msgs::VelodyneScan &scan) const;
+
+    /** @brief Queue a scan of a sensor.
+     *
+     *  @returns false if the oldest scan of the sensor was dropped to
+     *           make room, for a sensor much ahead of the others
+     */
+    bool add(size_t sensor, const velodyne_msgs::VelodyneScan::ConstPtr &scan);
+
+    /** @brief Take the next group of matched scans.
+     *
+     *  The earliest queued sweep is grouped with the scan of every
+     *  other sensor that swept within max_skew of it.  A sensor that
+     *  has no scan queued is waited for until some sensor sends a
+     *  packet later than max_skew and a scan duration after the
+     *  sweep, when its match would have arrived, then left out.  So
+     *  no sensor holds up the others for long, whichever stops.
+     *
+     *  @param scans returns the scan of each sensor, NULL for those
+     *               left out
+     *  @param skews returns their sweep times relative to the
+     *               earliest one [s]
+     *  @returns index of the sensor with the earliest sweep, or -1 if
+     *           no group is complete yet
+     */
+    int next(std::vector<velodyne_msgs::VelodyneScan::ConstPtr> &scans,
+             std::vector<double> &skews);
+
+    size_t sensors() const { return sensors_.size(); }
+
+  private:
+
+    /** \brief Scans of one sensor, not matched yet. */
+    struct Sensor
+    {
+      int azimuth;                      ///< device azimuth of the target
+                                        ///  frame x axis [deg/100]
+      std::deque<velodyne_msgs::VelodyneScan::ConstPtr> scans; ///< oldest first
+      std::deque<ros::Time> sweeps;     ///< of each scan
+    };
+
+    ros::Duration max_skew_;
+    std::vector<Sensor> sensors_;
+  };
+
+} // namespace velodyne_rawdata
+
+#endif // __VELODYNE_SWEEP_MATCHER_H
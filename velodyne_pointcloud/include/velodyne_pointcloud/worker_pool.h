@@ -0,0 +1,118 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (C) 2009, 2010, 2012 Austin Robot Technology, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  @brief Worker threads for converting Velodyne scans.
+ *
+ *  RawData::unpack() splits the packets of a scan into contiguous
+ *  ranges, each writing its own columns of the cloud, and runs them
+ *  on the pool.  The nodes also post the publication of finished
+ *  clouds to it, so the next scan is unpacked meanwhile.
+ */
+
+#ifndef __VELODYNE_WORKER_POOL_H
+#define __VELODYNE_WORKER_POOL_H
+
+#include <deque>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+namespace velodyne_rawdata
+{
+  /** \brief Counts the unfinished tasks of a group. */
+  class TaskGroup
+  {
+  public:
+
+    TaskGroup(): pending_(0) {}
+
+    /** wait until every task posted with this group has finished */
+    void wait()
+    {
+      boost::mutex::scoped_lock lock(lock_);
+      while (pending_ > 0)
+        finished_.wait(lock);
+    }
+
+  private:
+
+    friend class WorkerPool;
+
+    void add()
+    {
+      boost::mutex::scoped_lock lock(lock_);
+      ++pending_;
+    }
+
+    void done()
+    {
+      boost::mutex::scoped_lock lock(lock_);
+      if (--pending_ == 0)
+        finished_.notify_all();
+    }
+
+    boost::mutex lock_;
+    boost::condition_variable finished_;
+    int pending_;
+  };
+
+  /** \brief Fixed set of threads running queued tasks in order. */
+  class WorkerPool
+  {
+  public:
+
+    typedef boost::function<void ()> Task;
+
+    /** @param threads number of worker threads to start */
+    WorkerPool(int threads);
+
+    /** Finish all queued tasks, then stop the threads. */
+    ~WorkerPool();
+
+    /** @returns number of worker threads */
+    int threads() const { return threads_.size(); }
+
+    /** @brief Queue a task, without waiting for it.
+     *
+     *  @param task function to call on a worker thread
+     *  @param group counts the task until it has finished; must
+     *               outlive it
+     */
+    void post(const Task &task, TaskGroup &group);
+
+    /** @brief Run tasks in parallel and wait for all of them.
+     *
+     *  The calling thread runs the last task itself, so a pool of n
+     *  threads runs up to n + 1 tasks at once.
+     */
+    void run(const std::vector<Task> &tasks);
+
+  private:
+
+    void work();
+
+    struct Entry
+    {
+      Task task;
+      TaskGroup *group;
+    };
+
+    boost::mutex lock_;
+    boost::condition_variable ready_;
+    std::deque<Entry> queue_;
+    bool stopping_;
+    std::vector<boost::shared_ptr<boost::thread> > threads_;
+  };
+
+} // namespace velodyne_rawdata
+
+#endif // __VELODYNE_WORKER_POOL_H
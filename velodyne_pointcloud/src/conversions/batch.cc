@@ -0,0 +1,334 @@
+/*
+ *  Copyright (C) 2012 Austin Robot Technology, Jack O'Quin
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    This class converts a Velodyne packet capture file offline, on
+    all cores, to point clouds or compact scans in a bag, or to PCD
+    files.
+
+*/
+
+#include "batch.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include <pcl/io/pcd_io.h>
+#include <pcl_conversions/pcl_conversions.h>
+#include <velodyne_driver/input.h>
+
+namespace velodyne_pointcloud
+{
+  /** @brief Constructor.
+   *
+   *  Maps and indexes the capture file and sets up one RawData per
+   *  worker thread.
+   */
+  BatchConvert::BatchConvert(ros::NodeHandle private_nh):
+    valid_(false),
+    next_chunk_(0),
+    written_(0),
+    window_(0),
+    scans_(0)
+  {
+    private_nh.param("pcap", config_.pcap, std::string(""));
+    private_nh.param("format", config_.format, std::string("bag"));
+    private_nh.param("frame_id", config_.frame_id, std::string("velodyne"));
+    private_nh.param("threads", config_.threads,
+                     (int) boost::thread::hardware_concurrency());
+    private_nh.param("chunk_revolutions", config_.chunk_revolutions, 4);
+    config_.threads = std::max(config_.threads, 1);
+    config_.chunk_revolutions = std::max(config_.chunk_revolutions, 1);
+
+    if (config_.pcap.empty())
+      {
+        ROS_FATAL("No ~pcap file to convert.");
+        return;
+      }
+    if (config_.format != "bag" && config_.format != "compact"
+        && config_.format != "pcd")
+      {
+        ROS_FATAL_STREAM("unknown output format: " << config_.format);
+        return;
+      }
+
+    // by default, write next to the input file
+    std::string base = config_.pcap;
+    size_t dot = base.rfind('.');
+    if (dot != std::string::npos
+        && (base.rfind('/') == std::string::npos || dot > base.rfind('/')))
+      base.erase(dot);
+    private_nh.param("output", config_.output,
+                     config_.format == "pcd"? base + "_": base + ".bag");
+
+    // same packet filter as the driver
+    int port;
+    std::string device_ip;
+    private_nh.param("port", port, (int) velodyne_driver::DATA_PORT_NUMBER);
+    private_nh.param("device_ip", device_ip, std::string(""));
+    in_addr devip;
+    devip.s_addr = 0;
+    if (!device_ip.empty())
+      inet_aton(device_ip.c_str(), &devip);
+
+    ROS_INFO("Opening PCAP file \"%s\"", config_.pcap.c_str());
+    std::string error;
+    if (!file_.open(config_.pcap, port, devip.s_addr,
+                    velodyne_rawdata::PACKET_SIZE, &error))
+      {
+        ROS_FATAL("Error opening Velodyne socket dump file: %s",
+                  error.c_str());
+        return;
+      }
+    ROS_INFO("%zu packets, %zu revolutions, %.3f seconds.",
+             file_.packets(), file_.revolutions(),
+             (file_.endTime() - file_.startTime()) * 1.0e-9);
+
+    // no dynamic reconfigure here: read its parameters once
+    double min_range, max_range, view_direction, view_width;
+    private_nh.param("min_range", min_range, 0.9);
+    private_nh.param("max_range", max_range, 130.0);
+    private_nh.param("view_direction", view_direction, 0.0);
+    private_nh.param("view_width", view_width, 2.0 * M_PI);
+    for (int i = 0; i < config_.threads; ++i)
+      {
+        boost::shared_ptr<velodyne_rawdata::RawData>
+          data(new velodyne_rawdata::RawData());
+        if (data->setup(private_nh) != 0)
+          return;
+        data->setParameters(min_range, max_range, view_direction, view_width);
+        data_.push_back(data);
+      }
+
+    for (size_t first = 0; first < file_.revolutions();
+         first += config_.chunk_revolutions)
+      {
+        Chunk chunk;
+        chunk.first = first;
+        chunk.last = std::min(first + config_.chunk_revolutions,
+                              file_.revolutions());
+        chunk.done = false;
+        chunk.scans = 0;
+        chunks_.push_back(chunk);
+      }
+
+    // keep the threads busy while a chunk is written, without
+    // holding many converted scans in memory
+    window_ = 2 * config_.threads;
+    valid_ = true;
+  }
+
+  int BatchConvert::run()
+  {
+    if (!valid_)
+      return 1;
+
+    if (config_.format != "pcd")
+      {
+        try
+          {
+            bag_.open(config_.output, rosbag::bagmode::Write);
+          }
+        catch (rosbag::BagException &e)
+          {
+            ROS_FATAL("Error opening bag \"%s\": %s",
+                      config_.output.c_str(), e.what());
+            return 1;
+          }
+      }
+    ROS_INFO_STREAM("Converting to " << config_.format << " output \""
+                    << config_.output << "\" on " << config_.threads
+                    << " threads.");
+
+    ros::WallTime start = ros::WallTime::now();
+    bool ok = true;
+    {
+      velodyne_rawdata::WorkerPool workers(config_.threads);
+      velodyne_rawdata::TaskGroup group;
+      for (int i = 0; i < config_.threads; ++i)
+        workers.post(boost::bind(&BatchConvert::work, this, i), group);
+
+      // write chunks in file order as they are finished
+      for (size_t k = 0; ok && k < chunks_.size(); ++k)
+        {
+          {
+            boost::mutex::scoped_lock lock(lock_);
+            while (!chunks_[k].done)
+              changed_.wait(lock);
+          }
+          ok = writeChunk(chunks_[k]) && ros::ok();
+          {
+            boost::mutex::scoped_lock lock(lock_);
+            written_ = k + 1;
+            if (!ok)
+              next_chunk_ = chunks_.size(); // start no more
+          }
+          changed_.notify_all();
+          ROS_INFO_THROTTLE(10.0, "%zu of %zu revolutions converted.",
+                            chunks_[k].last, file_.revolutions());
+        }
+      group.wait();
+    }
+    if (config_.format != "pcd")
+      bag_.close();
+
+    double elapsed = (ros::WallTime::now() - start).toSec();
+    double recorded = (file_.endTime() - file_.startTime()) * 1.0e-9;
+    ROS_INFO("Converted %zu scans in %.3f seconds (%.1f times real time).",
+             scans_, elapsed, elapsed > 0.0? recorded / elapsed: 0.0);
+    return ok? 0: 1;
+  }
+
+  /** Worker thread: convert chunks until none are left. */
+  void BatchConvert::work(int worker)
+  {
+    for (;;)
+      {
+        size_t k;
+        {
+          boost::mutex::scoped_lock lock(lock_);
+          while (next_chunk_ < chunks_.size()
+                 && next_chunk_ >= written_ + window_)
+            changed_.wait(lock);
+          if (next_chunk_ >= chunks_.size())
+            return;
+          k = next_chunk_++;
+        }
+        convertChunk(*data_[worker], chunks_[k]);
+        {
+          boost::mutex::scoped_lock lock(lock_);
+          chunks_[k].done = true;
+        }
+        changed_.notify_all();
+      }
+  }
+
+  /** @brief Convert each revolution of a chunk to one output scan.
+   *
+   *  PCD files are written here; bag messages are kept in the chunk
+   *  for writeChunk().
+   */
+  void BatchConvert::convertChunk(velodyne_rawdata::RawData &data,
+                                  Chunk &chunk)
+  {
+    for (size_t revolution = chunk.first; revolution < chunk.last;
+         ++revolution)
+      {
+        velodyne_msgs::VelodyneScanPtr scan(new velodyne_msgs::VelodyneScan);
+        if (!readScan(revolution, *scan))
+          continue;
+
+        if (config_.format == "compact")
+          {
+            velodyne_msgs::VelodyneCompactScanPtr
+              compact(new velodyne_msgs::VelodyneCompactScan);
+            data.unpackCompact(scan, *compact);
+            chunk.compact.push_back(compact);
+          }
+        else if (config_.format == "bag" && data.packedOutput())
+          {
+            sensor_msgs::PointCloud2Ptr packed(new sensor_msgs::PointCloud2);
+            data.unpack(scan, *packed);
+            chunk.packed.push_back(packed);
+          }
+        else
+          {
+            velodyne_rawdata::VPointCloud::Ptr
+              cloud(new velodyne_rawdata::VPointCloud);
+            data.unpack(scan, *cloud);
+            if (config_.format == "bag")
+              chunk.clouds.push_back(cloud);
+            else if (!cloud->points.empty())
+              {
+                char name[32];
+                snprintf(name, sizeof(name), "%06zu.pcd", revolution);
+                if (pcl::io::savePCDFileBinary(config_.output + name,
+                                               *cloud) != 0)
+                  {
+                    ROS_ERROR("Error writing %s%s",
+                              config_.output.c_str(), name);
+                    continue;
+                  }
+              }
+          }
+        ++chunk.scans;
+      }
+  }
+
+  /** @brief Collect the packets of one revolution.
+   *
+   *  Safe on several threads at once: only reads the mapped file.
+   *
+   *  @returns false if there are none
+   */
+  bool BatchConvert::readScan(size_t revolution,
+                              velodyne_msgs::VelodyneScan &scan) const
+  {
+    // stop at the first packet of the next revolution
+    const uint8_t *end = NULL;
+    velodyne_driver::PcapPacket packet;
+    if (revolution + 1 < file_.revolutions())
+      {
+        velodyne_driver::PcapFile::Position next =
+          file_.revolution(revolution + 1);
+        if (file_.read(next, &packet))
+          end = packet.data;
+      }
+
+    velodyne_driver::PcapFile::Position position = file_.revolution(revolution);
+    while (file_.read(position, &packet) && packet.data != end)
+      {
+        scan.packets.push_back(velodyne_msgs::VelodynePacket());
+        velodyne_msgs::VelodynePacket &pkt = scan.packets.back();
+        pkt.stamp.fromNSec(packet.stamp);
+        memcpy(&pkt.data[0], packet.data, packet.len);
+      }
+    if (scan.packets.empty())
+      return false;
+
+    scan.header.stamp = scan.packets[0].stamp;
+    scan.header.frame_id = config_.frame_id;
+    return true;
+  }
+
+  /** @brief Write the messages of a chunk to the bag, then free them.
+   *
+   *  @returns false if the bag could not be written
+   */
+  bool BatchConvert::writeChunk(Chunk &chunk)
+  {
+    try
+      {
+        for (size_t i = 0; i < chunk.clouds.size(); ++i)
+          bag_.write("velodyne_points",
+                     pcl_conversions::fromPCL(chunk.clouds[i]->header.stamp),
+                     *chunk.clouds[i]);
+        for (size_t i = 0; i < chunk.packed.size(); ++i)
+          bag_.write("velodyne_points", chunk.packed[i]->header.stamp,
+                     *chunk.packed[i]);
+        for (size_t i = 0; i < chunk.compact.size(); ++i)
+          bag_.write("velodyne_compact", chunk.compact[i]->header.stamp,
+                     *chunk.compact[i]);
+      }
+    catch (rosbag::BagException &e)
+      {
+        ROS_FATAL("Error writing bag \"%s\": %s",
+                  config_.output.c_str(), e.what());
+        return false;
+      }
+    scans_ += chunk.scans;
+
+    std::vector<velodyne_rawdata::VPointCloud::Ptr>().swap(chunk.clouds);
+    std::vector<sensor_msgs::PointCloud2Ptr>().swap(chunk.packed);
+    std::vector<velodyne_msgs::VelodyneCompactScanPtr>().swap(chunk.compact);
+    return true;
+  }
+
+} // namespace velodyne_pointcloud
@@ -0,0 +1,98 @@
+/* -*- mode: C++ -*- */
+/*
+ *  Copyright (C) 2012 Austin Robot Technology, Jack O'Quin
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    This class converts a Velodyne packet capture file offline, on
+    all cores, to point clouds or compact scans in a bag, or to PCD
+    files.
+
+    The file is split into chunks of whole revolutions.  Each worker
+    thread has its own RawData, set up with the same parameters, and
+    converts one chunk at a time; the calling thread writes finished
+    chunks to the bag in file order.
+
+*/
+
+#ifndef _VELODYNE_POINTCLOUD_BATCH_H_
+#define _VELODYNE_POINTCLOUD_BATCH_H_ 1
+
+#include <ros/ros.h>
+
+#include <boost/thread.hpp>
+#include <rosbag/bag.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <velodyne_driver/pcap_file.h>
+#include <velodyne_msgs/VelodyneCompactScan.h>
+#include <velodyne_pointcloud/rawdata.h>
+#include <velodyne_pointcloud/worker_pool.h>
+
+namespace velodyne_pointcloud
+{
+  class BatchConvert
+  {
+  public:
+
+    BatchConvert(ros::NodeHandle private_nh);
+
+    /** @brief Convert the whole file.
+     *
+     *  @returns 0 if successful
+     */
+    int run();
+
+  private:
+
+    /** revolutions converted by one task, and their output */
+    struct Chunk
+    {
+      size_t first;                     ///< first revolution
+      size_t last;                      ///< one past the last revolution
+      bool done;                        ///< converted, ready to write
+      size_t scans;                     ///< scans converted
+      std::vector<velodyne_rawdata::VPointCloud::Ptr> clouds;
+      std::vector<sensor_msgs::PointCloud2Ptr> packed;
+      std::vector<velodyne_msgs::VelodyneCompactScanPtr> compact;
+    };
+
+    void work(int worker);
+    void convertChunk(velodyne_rawdata::RawData &data, Chunk &chunk);
+    bool readScan(size_t revolution, velodyne_msgs::VelodyneScan &scan) const;
+    bool writeChunk(Chunk &chunk);
+
+    velodyne_driver::PcapFile file_;
+    std::vector<boost::shared_ptr<velodyne_rawdata::RawData> > data_;
+    bool valid_;                        ///< file and calibration opened
+
+    // chunks handed to worker threads, at most window_ ahead of the
+    // one being written
+    std::vector<Chunk> chunks_;
+    size_t next_chunk_;                 ///< next one to convert
+    size_t written_;                    ///< chunks written so far
+    size_t window_;
+    boost::mutex lock_;
+    boost::condition_variable changed_;
+
+    rosbag::Bag bag_;
+    size_t scans_;                      ///< scans written
+
+    /// configuration parameters
+    typedef struct {
+      std::string pcap;                ///< input capture file
+      std::string output;              ///< bag file, or PCD file prefix
+      std::string format;              ///< "bag", "compact" or "pcd"
+      std::string frame_id;            ///< frame of the scans
+      int threads;                     ///< worker threads
+      int chunk_revolutions;           ///< revolutions per task
+    } Config;
+    Config config_;
+  };
+
+} // namespace velodyne_pointcloud
+
+#endif // _VELODYNE_POINTCLOUD_BATCH_H_
@@ -0,0 +1,27 @@
+/*
+ *  Copyright (C) 2012 Austin Robot Technology, Jack O'Quin
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+
+    This ROS node converts a Velodyne packet capture file offline to
+    point clouds or compact scans in a bag, or to PCD files, using
+    all cores.  It reads private parameters, then exits when done.
+
+*/
+
+#include <ros/ros.h>
+#include "batch.h"
+
+/** Main node entry point. */
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "batch_node");
+
+  // convert the whole file, then exit
+  velodyne_pointcloud::BatchConvert batch(ros::NodeHandle("~"));
+  return batch.run();
+}
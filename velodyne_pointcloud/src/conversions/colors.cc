@@ -39,9 +39,50 @@ namespace
 namespace velodyne_pointcloud
 {
 
-  /** types of output point and cloud */
-  typedef pcl::PointXYZRGB RGBPoint;
-  typedef pcl::PointCloud<RGBPoint> RGBPointCloud;
+  void colorRings(const VPointCloud &in, RGBPointCloud &out)
+  {
+    out.header = in.header;
+    out.width = in.width;
+    out.height = in.height;
+    out.is_dense = in.is_dense;
+    out.points.resize(in.points.size());
+
+    for (size_t i = 0; i < in.points.size(); ++i)
+      {
+        RGBPoint &p = out.points[i];
+        p.x = in.points[i].x;
+        p.y = in.points[i].y;
+        p.z = in.points[i].z;
+
+        // color lasers with the rainbow array
+        int color = in.points[i].ring % N_COLORS;
+        p.rgb = *reinterpret_cast<float*>(rainbow+color);
+      }
+  }
+
+  void colorRings(const sensor_msgs::PointCloud2 &in,
+                  const velodyne_rawdata::PackedLayout &layout,
+                  RGBPointCloud &out)
+  {
+    out.header = pcl_conversions::toPCL(in.header);
+    out.width = in.width;
+    out.height = in.height;
+    out.is_dense = in.is_dense;
+    out.points.resize(in.width * in.height);
+
+    for (uint32_t row = 0; row < in.height; ++row)
+      {
+        const uint8_t *cell = &in.data[row * in.row_step];
+        for (uint32_t col = 0; col < in.width; ++col, cell += in.point_step)
+          {
+            RGBPoint &p = out.points[row * in.width + col];
+            uint16_t ring;
+            layout.readPoint(cell, p.x, p.y, p.z, ring);
+            int color = ring % N_COLORS;
+            p.rgb = *reinterpret_cast<float*>(rainbow+color);
+          }
+      }
+  }
 
   /** @brief Constructor. */
   RingColors::RingColors(ros::NodeHandle node, ros::NodeHandle private_nh)
@@ -65,27 +106,10 @@ namespace velodyne_pointcloud
     if (output_.getNumSubscribers() == 0)         // no one listening?
       return;                                     // do nothing
 
-    // allocate an PointXYZRGB message with same time and frame ID as
-    // input data
+    // allocate an PointXYZRGB message with same time, frame ID and
+    // organization as input data
     RGBPointCloud::Ptr outMsg(new RGBPointCloud());
-    outMsg->header.stamp = inMsg->header.stamp;
-    outMsg->header.frame_id = inMsg->header.frame_id;
-    outMsg->height = 1;
-
-    for (size_t i = 0; i < inMsg->points.size(); ++i)
-      {
-        RGBPoint p;
-        p.x = inMsg->points[i].x;
-        p.y = inMsg->points[i].y;
-        p.z = inMsg->points[i].z;
-
-        // color lasers with the rainbow array
-        int color = inMsg->points[i].ring % N_COLORS;
-        p.rgb = *reinterpret_cast<float*>(rainbow+color);
-
-        outMsg->points.push_back(p);
-        ++outMsg->width;
-      }
+    colorRings(*inMsg, *outMsg);
 
     output_.publish(outMsg);
   }
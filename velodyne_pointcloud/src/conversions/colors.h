@@ -21,6 +21,9 @@
 #include <ros/ros.h>
 #include <pcl_ros/point_cloud.h>
 #include <pcl/point_types.h>
+#include <pcl_conversions/pcl_conversions.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <velodyne_pointcloud/packed_cloud.h>
 #include <velodyne_pointcloud/point_types.h>
 
 namespace velodyne_pointcloud
@@ -29,6 +32,24 @@ namespace velodyne_pointcloud
   typedef velodyne_pointcloud::PointXYZIR VPoint;
   typedef pcl::PointCloud<VPoint> VPointCloud;
 
+  /** types of output point and cloud */
+  typedef pcl::PointXYZRGB RGBPoint;
+  typedef pcl::PointCloud<RGBPoint> RGBPointCloud;
+
+  /** @brief Color the points of a cloud by laser ring.
+   *
+   *  The output has the header and organization of the input.
+   */
+  void colorRings(const VPointCloud &in, RGBPointCloud &out);
+
+  /** @brief Color the points of a packed cloud by laser ring.
+   *
+   *  Quantized coordinates are converted back to meters.
+   */
+  void colorRings(const sensor_msgs::PointCloud2 &in,
+                  const velodyne_rawdata::PackedLayout &layout,
+                  RGBPointCloud &out);
+
   class RingColors
   {
   public:
@@ -0,0 +1,35 @@
+/*
+ *  Copyright (C) 2012 Austin Robot Technology, Jack O'Quin
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+
+    This program compiles a YAML calibration file to the binary form
+    the cloud and transform nodes map without parsing it.
+
+    Usage: compile_calibration <calibration.yaml> <compiled file>
+
+*/
+
+#include <stdio.h>
+#include <velodyne_pointcloud/calibration_cache.h>
+
+int main(int argc, char **argv)
+{
+  if (argc != 3)
+    {
+      fprintf(stderr, "usage: %s <calibration.yaml> <compiled file>\n",
+              argv[0]);
+      return 2;
+    }
+  if (!velodyne_pointcloud::CompiledCalibration::compile(argv[1], argv[2]))
+    {
+      fprintf(stderr, "%s: unable to compile %s to %s\n",
+              argv[0], argv[1], argv[2]);
+      return 1;
+    }
+  return 0;
+}
@@ -15,18 +15,93 @@
 
 #include "convert.h"
 
+#include <algorithm>
+#include <velodyne_driver/packet_monitor.h>
+
 namespace velodyne_pointcloud
 {
   /** @brief Constructor. */
   Convert::Convert(ros::NodeHandle node, ros::NodeHandle private_nh):
-    data_(new velodyne_rawdata::RawData())
+    data_(new velodyne_rawdata::RawData()),
+    sector_azimuth_(-1),
+    diagnostics_(node, private_nh),
+    timing_("Velodyne conversion timing")
   {
     data_->setup(private_nh);
 
+    diagnostics_.setHardwareID("none");
+    delivery_stage_ = timing_.addStage("delivery");
+    unpack_stage_ = timing_.addStage("unpack");
+    publish_stage_ = timing_.addStage("publish");
+    latency_stage_ = timing_.addStage("receive_to_publish");
+    scans_counter_ = timing_.addCounter("scans");
+    skipped_counter_ = timing_.addCounter("skipped_scans");
+    missed_counter_ = timing_.addCounter("missed_scans");
+    timing_.advertise(diagnostics_, private_nh);
+
+    // optionally unpack on several threads, and publish each cloud
+    // while the next scan is unpacked
+    private_nh.param("threads", config_.threads, 1);
+    if (config_.threads > 1)
+      {
+        ROS_INFO_STREAM("Converting scans on " << config_.threads
+                        << " threads.");
+        workers_.reset(new velodyne_rawdata::WorkerPool(config_.threads - 1));
+        data_->setWorkerPool(workers_);
+      }
+
+    // optional low latency output from streamed packet groups
+    private_nh.param("stream", config_.stream, std::string(""));
+    if (config_.stream != "" && config_.stream != "partial"
+        && config_.stream != "sector")
+      {
+        ROS_ERROR_STREAM("unknown stream mode: " << config_.stream);
+        config_.stream = "";
+      }
+
+
+    // optional compact scans, for links too slow for point clouds
+    private_nh.param("compact", config_.compact, false);
+
+    // optional range images on a fixed azimuth grid
+    private_nh.param("range_image", config_.range_image, false);
+
+    // optional ring colored clouds, from the same unpacked points
+    private_nh.param("rings", config_.rings, false);
+
+    // optional strongest and last return clouds, with point times
+    private_nh.param("split_returns", config_.split_returns, false);
+
+    // optional low resolution clouds, see the ring_stride and
+    // column_stride dynamic parameters
+    private_nh.param("decimated", config_.decimated, false);
 
     // advertise output point cloud (before subscribing to input data)
     output_ =
       node.advertise<sensor_msgs::PointCloud2>("velodyne_points", 10);
+    if (config_.compact)
+      compact_output_ =
+        node.advertise<velodyne_msgs::VelodyneCompactScan>("velodyne_compact",
+                                                           10);
+    if (config_.range_image)
+      range_image_output_ =
+        node.advertise<velodyne_msgs::VelodyneRangeImage>("velodyne_range_image",
+                                                          10);
+    if (config_.rings)
+      rings_output_ =
+        node.advertise<sensor_msgs::PointCloud2>("velodyne_rings", 10);
+    if (config_.split_returns)
+      {
+        strongest_output_ =
+          node.advertise<sensor_msgs::PointCloud2>("velodyne_points_strongest",
+                                                   10);
+        last_output_ =
+          node.advertise<sensor_msgs::PointCloud2>("velodyne_points_last", 10);
+      }
+    if (config_.decimated)
+      decimated_output_ =
+        node.advertise<sensor_msgs::PointCloud2>("velodyne_points_decimated",
+                                                 10);
 
     srv_ = boost::make_shared <dynamic_reconfigure::Server<velodyne_pointcloud::
       CloudNodeConfig> > (private_nh);
@@ -40,32 +115,271 @@ namespace velodyne_pointcloud
       node.subscribe("velodyne_packets", 10,
                      &Convert::processScan, (Convert *) this,
                      ros::TransportHints().tcpNoDelay(true));
+
+    if (config_.stream != "")
+      {
+        ROS_INFO_STREAM("Publishing " << config_.stream
+                        << " clouds of streamed packets.");
+        stream_output_ =
+          node.advertise<sensor_msgs::PointCloud2>("velodyne_points_stream",
+                                                   10);
+        velodyne_stream_ =
+          node.subscribe("velodyne_packets_stream", 100,
+                         &Convert::processStream, (Convert *) this,
+                         ros::TransportHints().tcpNoDelay(true));
+      }
   }
 
   void Convert::callback(velodyne_pointcloud::CloudNodeConfig &config,
                 uint32_t level)
   {
   ROS_INFO("Reconfigure request.");
+  if (!config.calibration.empty())
+    data_->setCalibration(config.calibration);
   data_->setParameters(config.min_range, config.max_range, config.view_direction,
                        config.view_width);
+  data_->setDecimation(config.ring_stride, config.column_stride);
   }
 
   /** @brief Callback for raw scan messages. */
   void Convert::processScan(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg)
   {
-    if (output_.getNumSubscribers() == 0)         // no one listening?
-      return;                                     // avoid much work
+    // report the last period, then time this scan from its last packet
+    diagnostics_.update();
+    const ros::Time received = scanMsg->packets.empty()?
+      scanMsg->header.stamp: scanMsg->packets.back().stamp;
+    timing_.record(delivery_stage_, velodyne_driver::usecSince(received));
+    timing_.count(scans_counter_);
+    timing_.count(missed_counter_, gaps_.missed(*scanMsg));
+
+    if (config_.compact && compact_output_.getNumSubscribers() > 0)
+      {
+        velodyne_msgs::VelodyneCompactScanPtr
+          compact(new velodyne_msgs::VelodyneCompactScan);
+        data_->unpackCompact(scanMsg, *compact);
+        compact_output_.publish(compact);
+      }
+
+    if (config_.range_image && range_image_output_.getNumSubscribers() > 0)
+      {
+        velodyne_msgs::VelodyneRangeImagePtr
+          image(new velodyne_msgs::VelodyneRangeImage);
+        data_->unpackRangeImage(scanMsg, *image);
+        range_image_output_.publish(image);
+      }
+
+    const bool split = config_.split_returns
+      && (strongest_output_.getNumSubscribers() > 0
+          || last_output_.getNumSubscribers() > 0);
+    if (split)
+      {
+        // both returns in one pass over the packets
+        velodyne_rawdata::VTPointCloud::Ptr
+          strongest(new velodyne_rawdata::VTPointCloud);
+        velodyne_rawdata::VTPointCloud::Ptr
+          last(new velodyne_rawdata::VTPointCloud);
+        data_->unpackReturns(scanMsg, *strongest, *last);
+        strongest_output_.publish(strongest);
+        last_output_.publish(last);
+      }
+
+    const bool decimated = config_.decimated
+      && decimated_output_.getNumSubscribers() > 0;
+    if (decimated)
+      {
+        // only the points kept are computed
+        velodyne_rawdata::VPointCloud::Ptr
+          low(new velodyne_rawdata::VPointCloud);
+        data_->unpackDecimated(scanMsg, *low);
+        decimated_output_.publish(low);
+      }
 
-    // allocate a point cloud with same time and frame ID as raw data
-    velodyne_rawdata::VPointCloud::Ptr outMsg(new velodyne_rawdata::VPointCloud());
+    const bool points = output_.getNumSubscribers() > 0;
+    const bool rings = config_.rings && rings_output_.getNumSubscribers() > 0;
+    if (!points && !rings)                        // no one listening?
+      {
+        if (!split && !decimated)
+          timing_.count(skipped_counter_);
+        return;                                   // avoid much work
+      }
+
+    if (points && data_->packedOutput())
+      {
+        sensor_msgs::PointCloud2Ptr packed(packed_pool_.get());
+        uint64_t start = velodyne_driver::monotonicUsec();
+        data_->unpack(scanMsg, *packed);
+        timing_.recordSince(unpack_stage_, start);
+
+        // color the packed points, before a worker may publish them
+        if (rings)
+          {
+            RGBPointCloud::Ptr colored(new RGBPointCloud);
+            colorRings(*packed, data_->packedLayout(), *colored);
+            rings_output_.publish(colored);
+          }
+        publish(packed, received);
+        return;
+      }
+
+    // get a point cloud, recycled once subscribers release it
+    velodyne_rawdata::VPointCloud::Ptr outMsg(pool_.get());
 
     // process all packets provided by the driver
+    uint64_t start = velodyne_driver::monotonicUsec();
     data_->unpack(scanMsg, *outMsg);
+    if (points)
+      timing_.recordSince(unpack_stage_, start);
+
+    // color the same points, instead of a ring colors node
+    // deserializing the published cloud
+    if (rings)
+      {
+        RGBPointCloud::Ptr colored(new RGBPointCloud);
+        colorRings(*outMsg, *colored);
+        rings_output_.publish(colored);
+      }
+
+    if (!points)
+      return;
 
     // publish the cloud message
     ROS_DEBUG_STREAM("Publishing " << outMsg->height << " x " << outMsg->width
                      << " Velodyne points, time: " << outMsg->header.stamp);
-    output_.publish(outMsg);
+    publish(outMsg, received);
+  }
+
+  /** @brief Publish a cloud on velodyne_points.
+   *
+   *  With worker threads, the cloud is published by one of them,
+   *  after the previous one so they stay in order, and this returns
+   *  at once to unpack the next scan.
+   *
+   *  @param received time of the last packet of the scan
+   */
+  template <class Cloud>
+  void Convert::publish(const boost::shared_ptr<Cloud> &cloud,
+                        const ros::Time &received)
+  {
+    if (!workers_)
+      {
+        publishNow(cloud, received);
+        return;
+      }
+    publishing_.wait();
+    workers_->post(boost::bind(&Convert::publishNow<Cloud>, this, cloud,
+                               received),
+                   publishing_);
+  }
+
+  template <class Cloud>
+  void Convert::publishNow(const boost::shared_ptr<Cloud> &cloud,
+                           const ros::Time &received)
+  {
+    uint64_t start = velodyne_driver::monotonicUsec();
+    output_.publish(cloud);
+    timing_.recordSince(publish_stage_, start);
+    timing_.record(latency_stage_, velodyne_driver::usecSince(received));
+  }
+
+  /** @brief Callback for streamed packet groups.
+   *
+   *  In "partial" mode each group becomes its own cloud.  In "sector"
+   *  mode the clouds of all groups since the azimuth last wrapped
+   *  around are published after each group, so the sector grows to a
+   *  full revolution.
+   */
+  void Convert::processStream(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg)
+  {
+    if (config_.stream == "partial")
+      {
+        if (stream_output_.getNumSubscribers() == 0)
+          return;
+        if (data_->packedOutput())
+          {
+            sensor_msgs::PointCloud2Ptr packed(packed_pool_.get());
+            data_->unpack(scanMsg, *packed);
+            stream_output_.publish(packed);
+            return;
+          }
+        velodyne_rawdata::VPointCloud::Ptr outMsg(pool_.get());
+        data_->unpack(scanMsg, *outMsg);
+        stream_output_.publish(outMsg);
+        return;
+      }
+
+    // find the first packet of a new revolution, if any
+    size_t wrap = scanMsg->packets.size();
+    int last = sector_azimuth_;
+    for (size_t i = 0; i < scanMsg->packets.size(); ++i)
+      {
+        int azimuth = velodyne_driver::packetAzimuth(scanMsg->packets[i]);
+        if (last >= 0 && azimuth < last)
+          {
+            wrap = i;
+            break;
+          }
+        last = azimuth;
+      }
+
+    if (wrap == scanMsg->packets.size())
+      {
+        publishSector(scanMsg);
+        return;
+      }
+
+    // finish the current revolution, then start the next one
+    velodyne_msgs::VelodyneScanPtr head(new velodyne_msgs::VelodyneScan);
+    velodyne_msgs::VelodyneScanPtr tail(new velodyne_msgs::VelodyneScan);
+    head->header = tail->header = scanMsg->header;
+    head->packets.assign(scanMsg->packets.begin(),
+                         scanMsg->packets.begin() + wrap);
+    tail->packets.assign(scanMsg->packets.begin() + wrap,
+                         scanMsg->packets.end());
+    tail->header.stamp = tail->packets[0].stamp;
+    if (!head->packets.empty())
+      publishSector(head);
+    sector_.reset();
+    sector_azimuth_ = -1;
+    publishSector(tail);
+  }
+
+  /** @brief Add packets of one revolution to the sector and publish it. */
+  void Convert::publishSector(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg)
+  {
+    sector_azimuth_ = velodyne_driver::packetAzimuth(scanMsg->packets.back());
+    if (stream_output_.getNumSubscribers() == 0)
+      {
+        sector_.reset();                // nothing to grow
+        return;
+      }
+
+    data_->unpack(scanMsg, group_);
+
+    // published clouds are shared and must not change, so each
+    // message gets its own copy of the sector, sized once and filled
+    // row by row with the columns of the sector and then the group
+    const velodyne_rawdata::VPointCloud &first = sector_? *sector_: group_;
+    const uint32_t sector_width = sector_? sector_->width: 0;
+    const uint32_t width = sector_width + group_.width;
+    velodyne_rawdata::VPointCloud::Ptr outMsg(pool_.get());
+    outMsg->header = first.header;
+    outMsg->is_dense = first.is_dense && group_.is_dense;
+    outMsg->width = width;
+    outMsg->height = group_.height;
+    outMsg->points.resize(width * group_.height);
+    for (uint32_t row = 0; row < group_.height; ++row)
+      {
+        velodyne_rawdata::VPointCloud::VectorType::iterator out =
+          outMsg->points.begin() + row * width;
+        if (sector_)
+          out = std::copy(sector_->points.begin() + row * sector_width,
+                          sector_->points.begin() + (row + 1) * sector_width,
+                          out);
+        std::copy(group_.points.begin() + row * group_.width,
+                  group_.points.begin() + (row + 1) * group_.width, out);
+      }
+    sector_ = outMsg;
+    stream_output_.publish(outMsg);
   }
 
 } // namespace velodyne_pointcloud
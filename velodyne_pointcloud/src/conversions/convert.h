@@ -19,10 +19,16 @@
 
 #include <ros/ros.h>
 
+#include <diagnostic_updater/diagnostic_updater.h>
 #include <dynamic_reconfigure/server.h>
 #include <pcl_conversions/pcl_conversions.h>
 #include <sensor_msgs/PointCloud2.h>
+#include <velodyne_driver/timing.h>
+#include <velodyne_pointcloud/cloud_pool.h>
 #include <velodyne_pointcloud/rawdata.h>
+#include <velodyne_pointcloud/worker_pool.h>
+
+#include "colors.h"
 
 #include <velodyne_pointcloud/CloudNodeConfig.h>
 
@@ -33,27 +39,73 @@ namespace velodyne_pointcloud
   public:
 
     Convert(ros::NodeHandle node, ros::NodeHandle private_nh);
-    ~Convert() {}
+    ~Convert() { publishing_.wait(); }
 
   private:
     
     void callback(velodyne_pointcloud::CloudNodeConfig &config,
                 uint32_t level);
     void processScan(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg);
+    void processStream(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg);
+    void publishSector(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg);
+    template <class Cloud>
+    void publish(const boost::shared_ptr<Cloud> &cloud,
+                 const ros::Time &received);
+    template <class Cloud>
+    void publishNow(const boost::shared_ptr<Cloud> &cloud,
+                    const ros::Time &received);
 
     ///Pointer to dynamic reconfigure service srv_
     boost::shared_ptr<dynamic_reconfigure::Server<velodyne_pointcloud::
       CloudNodeConfig> > srv_;
     
     boost::shared_ptr<velodyne_rawdata::RawData> data_;
+    velodyne_rawdata::CloudPool<velodyne_rawdata::VPointCloud> pool_; ///< recycled output clouds
+    velodyne_rawdata::CloudPool<sensor_msgs::PointCloud2> packed_pool_; ///< recycled packed clouds
     ros::Subscriber velodyne_scan_;
     ros::Publisher output_;
+    ros::Publisher compact_output_;  ///< compact scans, if enabled
+    ros::Publisher range_image_output_; ///< range images, if enabled
+    ros::Publisher rings_output_;    ///< ring colored clouds, if enabled
+    ros::Publisher strongest_output_; ///< strongest returns, if enabled
+    ros::Publisher last_output_;     ///< last returns, if enabled
+    ros::Publisher decimated_output_; ///< decimated clouds, if enabled
+
+    // streaming packet group input and partial cloud output
+    ros::Subscriber velodyne_stream_;
+    ros::Publisher stream_output_;
+    velodyne_rawdata::VPointCloud::Ptr sector_; ///< cloud since last wrap
+    velodyne_rawdata::VPointCloud group_; ///< cloud of the last group
+    int sector_azimuth_;               ///< last azimuth in sector_, or -1
+
+    // optional worker threads unpacking scans and publishing clouds
+    velodyne_rawdata::TaskGroup publishing_; ///< cloud being published
+    boost::shared_ptr<velodyne_rawdata::WorkerPool> workers_;
 
     /// configuration parameters
     typedef struct {
       int npackets;                    ///< number of packets to combine
+      std::string stream;              ///< "", "partial" or "sector"
+      bool compact;                    ///< publish compact scans
+      bool range_image;                ///< publish range images
+      bool rings;                      ///< publish ring colored clouds
+      bool split_returns;              ///< publish a cloud per return
+      bool decimated;                  ///< publish decimated clouds
+      int threads;                     ///< threads converting scans
     } Config;
     Config config_;
+
+    // timing statistics, see velodyne_driver/timing.h
+    diagnostic_updater::Updater diagnostics_;
+    velodyne_driver::PipelineTiming timing_;
+    velodyne_driver::ScanGapDetector gaps_;
+    int delivery_stage_;               ///< last packet received to processScan()
+    int unpack_stage_;
+    int publish_stage_;
+    int latency_stage_;                ///< last packet received to published
+    int scans_counter_;
+    int skipped_counter_;              ///< scans nobody subscribed to
+    int missed_counter_;               ///< scans lost before processScan()
   };
 
 } // namespace velodyne_pointcloud
@@ -0,0 +1,252 @@
+/*
+ *  Copyright (C) 2012 Austin Robot Technology, Jack O'Quin
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+    This class fuses the raw packets of several Velodyne 3D LIDARs
+    into one PointCloud2 in a common frame of reference.
+*/
+
+#include "fusion.h"
+
+#include <math.h>
+#include <algorithm>
+#include <pcl_conversions/pcl_conversions.h>
+
+namespace velodyne_pointcloud
+{
+  /** @brief Constructor. */
+  Fusion::Fusion(ros::NodeHandle node, ros::NodeHandle private_nh):
+    diagnostics_(node, private_nh),
+    timing_("Velodyne fusion timing")
+  {
+    const std::string tf_prefix = tf::getPrefixParam(private_nh);
+    private_nh.param("frame_id", frame_id_, std::string("base_link"));
+    frame_id_ = tf::resolve(tf_prefix, frame_id_);
+    double max_skew;
+    private_nh.param("max_skew", max_skew, 0.05);
+
+    diagnostics_.setHardwareID("none");
+    skew_stage_ = timing_.addStage("skew");
+    fuse_stage_ = timing_.addStage("fuse");
+    publish_stage_ = timing_.addStage("publish");
+    latency_stage_ = timing_.addStage("receive_to_publish");
+    scans_counter_ = timing_.addCounter("scans");
+    clouds_counter_ = timing_.addCounter("clouds");
+    incomplete_counter_ = timing_.addCounter("incomplete_clouds");
+    dropped_counter_ = timing_.addCounter("dropped_scans");
+    skipped_counter_ = timing_.addCounter("skipped_clouds");
+    missed_counter_ = timing_.addCounter("missed_scans");
+    timing_.advertise(diagnostics_, private_nh);
+
+    // optionally unpack the sensors on several threads
+    int threads;
+    private_nh.param("threads", threads, 1);
+    if (threads > 1)
+      {
+        ROS_INFO_STREAM("Fusing sensors on " << threads << " threads.");
+        workers_.reset(new velodyne_rawdata::WorkerPool(threads - 1));
+      }
+
+    std::vector<std::string> names;
+    if (!private_nh.getParam("sensors", names) || names.empty())
+      {
+        ROS_ERROR("no ~sensors configured for fusion");
+        return;
+      }
+
+    matcher_.reset(new velodyne_rawdata::SweepMatcher(names.size(), max_skew));
+
+    // advertise output point cloud (before subscribing to input data)
+    output_ =
+      node.advertise<sensor_msgs::PointCloud2>("velodyne_points", 10);
+
+    for (size_t i = 0; i < names.size(); ++i)
+      {
+        // each sensor is configured in its own private namespace
+        ros::NodeHandle sensor_nh(private_nh, names[i]);
+        boost::shared_ptr<Sensor> sensor(new Sensor);
+        sensor->name = names[i];
+        sensor->have_extrinsic = false;
+        sensor->data.reset(new velodyne_rawdata::RawData());
+        if (sensor->data->setup(sensor_nh) != 0)
+          {
+            ROS_ERROR_STREAM(names[i] << ": unable to set up unpacking,"
+                             " not fusing any sensor");
+            sensors_.clear();
+            matcher_.reset();
+            return;
+          }
+
+        // the whole circle, transformed to frame_id_ once the
+        // extrinsic is known
+        double min_range, max_range;
+        sensor_nh.param("min_range", min_range, 0.9);
+        sensor_nh.param("max_range", max_range, 130.0);
+        sensor->data->setParameters(min_range, max_range, 0.0, 2 * M_PI,
+                                    frame_id_);
+
+        std::string topic;
+        sensor_nh.param("topic", topic, names[i] + "/velodyne_packets");
+        sensor->input =
+          node.subscribe<velodyne_msgs::VelodyneScan>(
+            topic, 10, boost::bind(&Fusion::processScan, this, _1, i),
+            ros::VoidConstPtr(), ros::TransportHints().tcpNoDelay(true));
+        ROS_INFO_STREAM(names[i] << ": sensor " << i << ", fusing " << topic
+                        << " into " << frame_id_);
+        sensors_.push_back(sensor);
+      }
+  }
+
+  /** @brief Callback for the raw scans of one sensor. */
+  void Fusion::processScan(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg,
+                           size_t index)
+  {
+    diagnostics_.update();
+    timing_.count(scans_counter_);
+    Sensor &sensor = *sensors_[index];
+    timing_.count(missed_counter_, sensor.gaps.missed(*scanMsg));
+    if (scanMsg->packets.empty())
+      return;
+    if (!sensor.have_extrinsic
+        && !cacheExtrinsic(index, scanMsg->header.frame_id))
+      {
+        timing_.count(dropped_counter_);
+        return;
+      }
+
+    if (!matcher_->add(index, scanMsg))
+      timing_.count(dropped_counter_);
+    fuse();
+  }
+
+  /** @brief Look up and cache the transform of a sensor.
+   *
+   *  The sensors are rigidly mounted, so the latest transform is
+   *  looked up once, and used for all their scans.
+   *
+   *  @returns false if tf cannot provide it yet
+   */
+  bool Fusion::cacheExtrinsic(size_t index, const std::string &sensor_frame)
+  {
+    Sensor &sensor = *sensors_[index];
+    tf::StampedTransform extrinsic;
+    try
+      {
+        listener_.lookupTransform(frame_id_, sensor_frame, ros::Time(0),
+                                  extrinsic);
+      }
+    catch (tf::TransformException &ex)
+      {
+        // only log tf error once every second
+        ROS_WARN_THROTTLE(velodyne_rawdata::LOG_PERIOD_, "%s", ex.what());
+        return false;
+      }
+    sensor.data->setExtrinsic(extrinsic);
+
+    // Device azimuths turn clockwise from the sensor x axis, so an
+    // upright sensor points along the target x axis at its yaw.
+    double roll, pitch, yaw;
+    extrinsic.getBasis().getRPY(roll, pitch, yaw);
+    matcher_->setAzimuth(index, lrint(yaw * 18000.0 / M_PI));
+    sensor.have_extrinsic = true;
+    ROS_INFO_STREAM(sensor.name << ": cached " << sensor_frame << " to "
+                    << frame_id_ << " transform, yaw " << yaw << " rad");
+    return true;
+  }
+
+  /** @brief Fuse the groups of matched scans, see SweepMatcher::next(). */
+  void Fusion::fuse()
+  {
+    if (!matcher_)
+      return;
+    std::vector<velodyne_msgs::VelodyneScan::ConstPtr> scans;
+    std::vector<double> skews;
+    int earliest;
+    while ((earliest = matcher_->next(scans, skews)) >= 0)
+      {
+        for (size_t i = 0; i < scans.size(); ++i)
+          if (scans[i] && (int) i != earliest)
+            timing_.record(skew_stage_, (uint64_t) (fabs(skews[i]) * 1.0e6));
+        publish(scans, earliest);
+      }
+  }
+
+  /** @brief Unpack matched scans into one cloud and publish it.
+   *
+   *  The scans are side by side in sensor order, each in its own
+   *  columns; the cloud is as high as the sensor with most lasers.
+   *
+   *  @param scans of each sensor, NULL for those left out
+   *  @param earliest sensor whose scan stamps the cloud
+   */
+  void Fusion::publish(const std::vector<velodyne_msgs::VelodyneScan::ConstPtr> &scans,
+                       size_t earliest)
+  {
+    timing_.count(clouds_counter_);
+    if (std::count(scans.begin(), scans.end(),
+                   velodyne_msgs::VelodyneScan::ConstPtr()) > 0)
+      timing_.count(incomplete_counter_);
+    if (output_.getNumSubscribers() == 0)         // no one listening?
+      {
+        timing_.count(skipped_counter_);
+        return;                                   // avoid much work
+      }
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<uint32_t> columns(scans.size(), 0);
+    ros::Time received = scans[earliest]->packets.back().stamp;
+    for (size_t i = 0; i < scans.size(); ++i)
+      if (scans[i])
+        {
+          const velodyne_rawdata::RawData &data = *sensors_[i]->data;
+          columns[i] = width;
+          width += data.scanColumns(*scans[i]);
+          height = std::max(height, data.scanRows());
+          received = std::max(received, scans[i]->packets.back().stamp);
+        }
+
+    // get an output point cloud, recycled once subscribers release it
+    velodyne_rawdata::VSPointCloud::Ptr cloud(pool_.get());
+    cloud->header.stamp = pcl_conversions::toPCL(scans[earliest]->header).stamp;
+    cloud->header.frame_id = frame_id_;
+    cloud->width = width;
+    cloud->height = height;
+    cloud->is_dense = false;
+    cloud->points.resize(width * height);
+
+    // each sensor writes only its own columns
+    uint64_t start = velodyne_driver::monotonicUsec();
+    if (!workers_)
+      {
+        for (size_t i = 0; i < scans.size(); ++i)
+          if (scans[i])
+            sensors_[i]->data->unpackFused(scans[i], *cloud, columns[i], i);
+      }
+    else
+      {
+        std::vector<velodyne_rawdata::WorkerPool::Task> tasks;
+        for (size_t i = 0; i < scans.size(); ++i)
+          if (scans[i])
+            tasks.push_back(boost::bind(&velodyne_rawdata::RawData::unpackFused,
+                                        sensors_[i]->data.get(),
+                                        boost::cref(scans[i]),
+                                        boost::ref(*cloud), columns[i],
+                                        (uint16_t) i));
+        workers_->run(tasks);
+      }
+    timing_.recordSince(fuse_stage_, start);
+
+    ROS_DEBUG_STREAM("Publishing " << cloud->width << " x " << cloud->height
+                     << " fused Velodyne points, time: " << cloud->header.stamp);
+    start = velodyne_driver::monotonicUsec();
+    output_.publish(cloud);
+    timing_.recordSince(publish_stage_, start);
+    timing_.record(latency_stage_, velodyne_driver::usecSince(received));
+  }
+
+} // namespace velodyne_pointcloud
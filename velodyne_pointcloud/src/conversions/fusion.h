@@ -0,0 +1,109 @@
+/* -*- mode: C++ -*- */
+/*
+ *  Copyright (C) 2012 Austin Robot Technology, Jack O'Quin
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    This class fuses the raw packets of several Velodyne 3D LIDARs
+    into one PointCloud2 in a common frame of reference.
+
+    Each sensor has its own calibration and a transform to the target
+    frame, looked up once, since the sensors are rigidly mounted.  The
+    scans that swept the target frame x axis at about the same time
+    are unpacked straight into their columns of one recycled cloud,
+    tagged with the index of their sensor, instead of converting each
+    of them to a cloud and concatenating those.
+
+    Parameters:
+
+     - ~sensors (string list): sensor names, as for the multi-sensor
+       driver
+     - ~frame_id (string): target frame (default: "base_link")
+     - ~max_skew (double): largest difference in sweep times fused
+       [s] (default: 0.05, half a revolution at 600 RPM); a sensor
+       without a scan in time is left out, see SweepMatcher::next()
+     - ~threads (int): threads unpacking the sensors (default: 1)
+     - ~\<sensor\>/topic (string): raw scans of the sensor (default:
+       \<sensor\>/velodyne_packets)
+     - ~\<sensor\>/calibration and the other RawData::setup() parameters
+     - ~\<sensor\>/min_range, max_range (double): [m] (default: 0.9
+       and 130.0)
+
+*/
+
+#ifndef _VELODYNE_POINTCLOUD_FUSION_H_
+#define _VELODYNE_POINTCLOUD_FUSION_H_ 1
+
+#include <string>
+#include <vector>
+
+#include <ros/ros.h>
+#include <tf/transform_listener.h>
+#include <sensor_msgs/PointCloud2.h>
+
+#include <diagnostic_updater/diagnostic_updater.h>
+#include <velodyne_driver/timing.h>
+#include <velodyne_pointcloud/cloud_pool.h>
+#include <velodyne_pointcloud/rawdata.h>
+#include <velodyne_pointcloud/sweep_matcher.h>
+#include <velodyne_pointcloud/worker_pool.h>
+
+namespace velodyne_pointcloud
+{
+  class Fusion
+  {
+  public:
+
+    Fusion(ros::NodeHandle node, ros::NodeHandle private_nh);
+    ~Fusion() {}
+
+  private:
+
+    /** \brief One of the fused sensors. */
+    struct Sensor
+    {
+      std::string name;
+      boost::shared_ptr<velodyne_rawdata::RawData> data;
+      ros::Subscriber input;
+      bool have_extrinsic;              ///< transform to frame_id_ cached
+      velodyne_driver::ScanGapDetector gaps;
+    };
+
+    void processScan(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg,
+                     size_t index);
+    bool cacheExtrinsic(size_t index, const std::string &sensor_frame);
+    void fuse();
+    void publish(const std::vector<velodyne_msgs::VelodyneScan::ConstPtr> &scans,
+                 size_t earliest);
+
+    std::string frame_id_;              ///< target frame
+    std::vector<boost::shared_ptr<Sensor> > sensors_;
+    boost::shared_ptr<velodyne_rawdata::SweepMatcher> matcher_;
+    tf::TransformListener listener_;
+
+    velodyne_rawdata::CloudPool<velodyne_rawdata::VSPointCloud> pool_; ///< recycled output clouds
+    boost::shared_ptr<velodyne_rawdata::WorkerPool> workers_; ///< optional
+    ros::Publisher output_;
+
+    // timing statistics, see velodyne_driver/timing.h
+    diagnostic_updater::Updater diagnostics_;
+    velodyne_driver::PipelineTiming timing_;
+    int skew_stage_;                    ///< sweep time difference of fused scans
+    int fuse_stage_;                    ///< unpacking all the scans
+    int publish_stage_;
+    int latency_stage_;                 ///< last packet received to published
+    int scans_counter_;
+    int clouds_counter_;
+    int incomplete_counter_;            ///< clouds missing a sensor
+    int dropped_counter_;               ///< scans dropped unmatched
+    int skipped_counter_;               ///< clouds nobody subscribed to
+    int missed_counter_;                ///< scans lost before processScan()
+  };
+
+} // namespace velodyne_pointcloud
+
+#endif // _VELODYNE_POINTCLOUD_FUSION_H_
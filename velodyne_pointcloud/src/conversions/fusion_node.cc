@@ -0,0 +1,31 @@
+/*
+ *  Copyright (C) 2012 Austin Robot Technology, Jack O'Quin
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+
+    This ROS node fuses raw packets of several Velodyne LIDARs into one
+    PointCloud2 in the given frame of reference.
+
+*/
+
+#include <ros/ros.h>
+#include "fusion.h"
+
+/** Main node entry point. */
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "fusion_node");
+
+  // create fusion class, which subscribes to raw data
+  velodyne_pointcloud::Fusion fusion(ros::NodeHandle(),
+                                     ros::NodeHandle("~"));
+
+  // handle callbacks until shut down
+  ros::spin();
+
+  return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ *  Copyright (C) 2012 Austin Robot Technology, Jack O'Quin
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    This ROS nodelet fuses raw packets of several Velodyne LIDARs into
+    one PointCloud2 in the given frame.
+
+*/
+
+#include <ros/ros.h>
+#include <pluginlib/class_list_macros.h>
+#include <nodelet/nodelet.h>
+
+#include "fusion.h"
+
+namespace velodyne_pointcloud
+{
+  class FusionNodelet: public nodelet::Nodelet
+  {
+  public:
+
+    FusionNodelet() {}
+    ~FusionNodelet() {}
+
+  private:
+
+    virtual void onInit();
+    boost::shared_ptr<Fusion> fusion_;
+  };
+
+  /** @brief Nodelet initialization. */
+  void FusionNodelet::onInit()
+  {
+    fusion_.reset(new Fusion(getNodeHandle(), getPrivateNodeHandle()));
+  }
+
+} // namespace velodyne_pointcloud
+
+
+// Register this plugin with pluginlib.  Names must match nodelet_velodyne.xml.
+//
+// parameters: package, class name, class type, base class type
+PLUGINLIB_DECLARE_CLASS(velodyne_pointcloud, FusionNodelet,
+                        velodyne_pointcloud::FusionNodelet,
+                        nodelet::Nodelet);
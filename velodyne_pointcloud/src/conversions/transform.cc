@@ -23,10 +23,22 @@ namespace velodyne_pointcloud
   /** @brief Constructor. */
   Transform::Transform(ros::NodeHandle node, ros::NodeHandle private_nh):
     tf_prefix_(tf::getPrefixParam(private_nh)),
-    data_(new velodyne_rawdata::RawData())
+    data_(new velodyne_rawdata::RawData()),
+    diagnostics_(node, private_nh),
+    timing_("Velodyne transform timing")
   {
     data_->setup(private_nh, &listener_);
 
+    diagnostics_.setHardwareID("none");
+    delivery_stage_ = timing_.addStage("delivery");
+    transform_stage_ = timing_.addStage("transform");
+    publish_stage_ = timing_.addStage("publish");
+    latency_stage_ = timing_.addStage("receive_to_publish");
+    scans_counter_ = timing_.addCounter("scans");
+    skipped_counter_ = timing_.addCounter("skipped_scans");
+    missed_counter_ = timing_.addCounter("missed_scans");
+    timing_.advertise(diagnostics_, private_nh);
+
     // Advertise output point cloud before subscribing to input data.
     output_ =
       node.advertise<sensor_msgs::PointCloud2>("velodyne_points", 10);
@@ -54,6 +66,8 @@ namespace velodyne_pointcloud
 
     const std::string frame_id = tf::resolve(tf_prefix_, config.frame_id);
     tf_filter_->setTargetFrames(std::vector<std::string>(1, frame_id));
+    if (!config.calibration.empty())
+      data_->setCalibration(config.calibration);
     data_->setParameters(config.min_range, config.max_range,
                          config.view_direction, config.view_width,
                          frame_id, config.fixed_frame_id);
@@ -64,19 +78,46 @@ namespace velodyne_pointcloud
   /// Transforms the scan message to a point cloud and publishes it.
   void Transform::processScan(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg)
   {
-    if (output_.getNumSubscribers() == 0)         // no one listening?
-      return;                                     // avoid much work
-
-    // allocate an output point cloud with same time as raw data
-    VPointCloud::Ptr outMsg(new VPointCloud());
+    // report the last period, then time this scan from its last packet
+    diagnostics_.update();
+    const ros::Time received = scanMsg->packets.empty()?
+      scanMsg->header.stamp: scanMsg->packets.back().stamp;
+    timing_.record(delivery_stage_, velodyne_driver::usecSince(received));
+    timing_.count(scans_counter_);
+    timing_.count(missed_counter_, gaps_.missed(*scanMsg));
 
-    // unpack the raw data
-    data_->unpack(scanMsg, *outMsg);
-
-    // publish the cloud message
-    ROS_DEBUG_STREAM("Publishing " << outMsg->width << " x " << outMsg->height
-                     << " Velodyne points, time: " << outMsg->header.stamp);
-    output_.publish(outMsg);
+    if (output_.getNumSubscribers() == 0)         // no one listening?
+      {
+        timing_.count(skipped_counter_);
+        return;                                   // avoid much work
+      }
+
+    uint64_t start = velodyne_driver::monotonicUsec();
+    if (data_->packedOutput())
+      {
+        sensor_msgs::PointCloud2Ptr packed(packed_pool_.get());
+        data_->unpack(scanMsg, *packed);
+        timing_.recordSince(transform_stage_, start);
+        start = velodyne_driver::monotonicUsec();
+        output_.publish(packed);
+      }
+    else
+      {
+        // get an output point cloud, recycled once subscribers release it
+        VPointCloud::Ptr outMsg(pool_.get());
+
+        // unpack the raw data
+        data_->unpack(scanMsg, *outMsg);
+        timing_.recordSince(transform_stage_, start);
+
+        // publish the cloud message
+        ROS_DEBUG_STREAM("Publishing " << outMsg->width << " x " << outMsg->height
+                         << " Velodyne points, time: " << outMsg->header.stamp);
+        start = velodyne_driver::monotonicUsec();
+        output_.publish(outMsg);
+      }
+    timing_.recordSince(publish_stage_, start);
+    timing_.record(latency_stage_, velodyne_driver::usecSince(received));
   }
 
 } // namespace velodyne_pointcloud
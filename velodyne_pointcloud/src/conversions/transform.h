@@ -23,10 +23,13 @@
 #include "message_filters/subscriber.h"
 #include <sensor_msgs/PointCloud2.h>
 
+#include <velodyne_pointcloud/cloud_pool.h>
 #include <velodyne_pointcloud/rawdata.h>
 #include <velodyne_pointcloud/point_types.h>
 
+#include <diagnostic_updater/diagnostic_updater.h>
 #include <dynamic_reconfigure/server.h>
+#include <velodyne_driver/timing.h>
 #include <velodyne_pointcloud/TransformNodeConfig.h>
 
 // include template implementations to transform a custom point cloud
@@ -66,6 +69,8 @@ namespace velodyne_pointcloud
 
     const std::string tf_prefix_;
     boost::shared_ptr<velodyne_rawdata::RawData> data_;
+    velodyne_rawdata::CloudPool<velodyne_rawdata::VPointCloud> pool_; ///< recycled output clouds
+    velodyne_rawdata::CloudPool<sensor_msgs::PointCloud2> packed_pool_; ///< recycled packed clouds
     message_filters::Subscriber<velodyne_msgs::VelodyneScan> velodyne_scan_;
     tf::MessageFilter<velodyne_msgs::VelodyneScan> *tf_filter_;
     ros::Publisher output_;
@@ -76,6 +81,18 @@ namespace velodyne_pointcloud
     // every message.
     VPointCloud inPc_;              ///< input packet point cloud
     VPointCloud tfPc_;              ///< transformed packet point cloud
+
+    // timing statistics, see velodyne_driver/timing.h
+    diagnostic_updater::Updater diagnostics_;
+    velodyne_driver::PipelineTiming timing_;
+    velodyne_driver::ScanGapDetector gaps_;
+    int delivery_stage_;            ///< last packet received to processScan()
+    int transform_stage_;           ///< unpacking to the target frame
+    int publish_stage_;
+    int latency_stage_;             ///< last packet received to published
+    int scans_counter_;
+    int skipped_counter_;           ///< scans nobody subscribed to
+    int missed_counter_;            ///< scans lost before processScan()
   };
 
 } // namespace velodyne_pointcloud
@@ -15,6 +15,9 @@
 #include <fstream>
 #include <string>
 #include <cmath>
+#include <cstdio>
+#include <stdint.h>
+#include <cstring>
 #include <limits>
 #include <yaml-cpp/yaml.h>
 
@@ -184,6 +187,84 @@ namespace velodyne_pointcloud
     }
   }
 
+  /** Fill the flat correction table from laser_corrections.
+   *
+   *  Lasers missing from the calibration get zero corrections and an
+   *  invalid ring of -1.
+   */
+  void Calibration::buildCorrectionTable() {
+    CorrectionTable &table = correction_table;
+    memset(&table, 0, sizeof(table));
+    for (int laser = 0; laser < CorrectionTable::MAX_LASERS; ++laser) {
+      table.max_intensity[laser] = 255;
+      table.laser_ring[laser] = -1;
+      table.row[laser] = 0;
+    }
+
+    for (std::map<int, LaserCorrection>::const_iterator
+           it = laser_corrections.begin();
+         it != laser_corrections.end(); it++)
+      {
+        int laser = it->first;
+        if (laser < 0 || laser >= CorrectionTable::MAX_LASERS) {
+          if (ros_info)
+            ROS_WARN("ignoring correction for laser %d", laser);
+          continue;
+        }
+        const LaserCorrection &corrections = it->second;
+
+        table.dist_correction[laser] = corrections.dist_correction;
+        table.cos_vert_correction[laser] = corrections.cos_vert_correction;
+        table.sin_vert_correction[laser] = corrections.sin_vert_correction;
+        table.cos_rot_correction[laser] = corrections.cos_rot_correction;
+        table.sin_rot_correction[laser] = corrections.sin_rot_correction;
+        table.vert_offset_correction[laser] =
+          corrections.vert_offset_correction;
+        table.horiz_offset_correction[laser] =
+          corrections.horiz_offset_correction;
+
+        // Two-point correction interpolates linearly between the
+        // distance corrections at 2.4 m (1.93 m for Y) and 25.04 m:
+        //
+        //   (dist_correction - dist_correction_x) * (xx - 2.4) / (25.04 - 2.4)
+        //     + dist_correction_x - dist_correction
+        if (corrections.two_pt_correction_available) {
+          float slope_x = (corrections.dist_correction
+                           - corrections.dist_correction_x) / (25.04 - 2.4);
+          table.two_pt_slope_x[laser] = slope_x;
+          table.two_pt_offset_x[laser] = corrections.dist_correction_x
+            - corrections.dist_correction - slope_x * 2.4;
+          float slope_y = (corrections.dist_correction
+                           - corrections.dist_correction_y) / (25.04 - 1.93);
+          table.two_pt_slope_y[laser] = slope_y;
+          table.two_pt_offset_y[laser] = corrections.dist_correction_y
+            - corrections.dist_correction - slope_y * 1.93;
+        }
+
+        float focal = 1 - corrections.focal_distance / 13100;
+        table.focal_slope[laser] = corrections.focal_slope;
+        table.focal_offset[laser] = 256 * focal * focal;
+        table.min_intensity[laser] = corrections.min_intensity;
+        table.max_intensity[laser] = corrections.max_intensity;
+
+        table.laser_ring[laser] = corrections.laser_ring;
+        table.row[laser] = num_lasers - 1 - corrections.laser_ring;
+      }
+
+    // Identify the calibration by a 64 bit FNV-1a hash of the table,
+    // so compact scans can be matched with the one that decodes them.
+    // memset() above cleared any padding.
+    const unsigned char *bytes = (const unsigned char *) &table;
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < sizeof(table); ++i) {
+      hash ^= bytes[i];
+      hash *= 1099511628211ULL;
+    }
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long) hash);
+    id = hex;
+  }
+
   YAML::Emitter& operator << (YAML::Emitter& out,
                               const std::pair<int, LaserCorrection> correction)
   {
@@ -252,6 +333,7 @@ namespace velodyne_pointcloud
       parser.GetNextDocument(doc);
 #endif
       doc >> *this;
+      buildCorrectionTable();
     } catch (YAML::Exception &e) {
       std::cerr << "YAML Exception: " << e.what() << std::endl;
       initialized = false;
@@ -0,0 +1,297 @@
+/*
+ *  Copyright (C) 2012 Austin Robot Technology, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  Compiled Velodyne calibrations, shared within a process.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <map>
+
+#include <ros/ros.h>
+#include <angles/angles.h>
+#include <boost/thread/mutex.hpp>
+#include <boost/weak_ptr.hpp>
+
+#include <velodyne_pointcloud/calibration_cache.h>
+#include <velodyne_pointcloud/rawdata.h>
+
+namespace velodyne_pointcloud
+{
+  // the image tables are indexed like RawData's
+  typedef char rotation_units_match
+  [(CALIBRATION_ROTATION_UNITS == velodyne_rawdata::ROTATION_MAX_UNITS)? 1: -1];
+
+  /** one calibration file loaded in this process */
+  struct CacheEntry
+  {
+    dev_t dev;                          ///< file identity when loaded
+    ino_t ino;
+    uint64_t size;
+    uint64_t mtime;
+    boost::weak_ptr<const CompiledCalibration> calibration;
+  };
+
+  static boost::mutex cache_lock;
+  static std::map<std::string, CacheEntry> cache;
+
+  static inline uint64_t mtimeNsec(const struct stat &st)
+  {
+    return st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+  }
+
+  /** FNV-1a hash of the image after its checksum field */
+  static uint64_t imageChecksum(const CalibrationImage &image)
+  {
+    const unsigned char *bytes = (const unsigned char *) &image;
+    size_t begin = offsetof(CalibrationImage, checksum) + sizeof(image.checksum);
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = begin; i < sizeof(image); ++i)
+      {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+      }
+    return hash;
+  }
+
+  /** @returns true if the file starts with CALIBRATION_IMAGE_MAGIC */
+  static bool isCompiled(const std::string &filename)
+  {
+    uint32_t magic = 0;
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (file == NULL)
+      return false;
+    bool compiled = (fread(&magic, sizeof(magic), 1, file) == 1
+                     && magic == CALIBRATION_IMAGE_MAGIC);
+    fclose(file);
+    return compiled;
+  }
+
+  CompiledCalibration::ConstPtr
+  CompiledCalibration::load(const std::string &filename,
+                            const std::string &cache_file)
+  {
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0)
+      return ConstPtr();
+
+    // Hold the lock while loading, so nodelets starting together
+    // parse the file only once.
+    boost::mutex::scoped_lock lock(cache_lock);
+    std::string key = filename + '\n' + cache_file;
+    std::map<std::string, CacheEntry>::iterator it = cache.find(key);
+    if (it != cache.end()
+        && it->second.dev == st.st_dev && it->second.ino == st.st_ino
+        && it->second.size == (uint64_t) st.st_size
+        && it->second.mtime == mtimeNsec(st))
+      {
+        ConstPtr shared = it->second.calibration.lock();
+        if (shared)
+          return shared;
+      }
+
+    ConstPtr calibration;
+    if (isCompiled(filename))
+      {
+        calibration = map(filename, 0, 0);
+      }
+    else
+      {
+        if (!cache_file.empty())
+          calibration = map(cache_file, st.st_size, mtimeNsec(st));
+        if (!calibration)
+          {
+            calibration = parse(filename, st.st_size, mtimeNsec(st));
+            if (calibration && !cache_file.empty()
+                && write(calibration->image(), cache_file))
+              ROS_INFO_STREAM("Compiled calibration cached in " << cache_file);
+          }
+      }
+    if (!calibration)
+      return ConstPtr();
+
+    CacheEntry &entry = cache[key];
+    entry.dev = st.st_dev;
+    entry.ino = st.st_ino;
+    entry.size = st.st_size;
+    entry.mtime = mtimeNsec(st);
+    entry.calibration = calibration;
+    return calibration;
+  }
+
+  bool CompiledCalibration::compile(const std::string &yaml_file,
+                                    const std::string &filename)
+  {
+    struct stat st;
+    if (stat(yaml_file.c_str(), &st) != 0)
+      return false;
+    ConstPtr calibration = parse(yaml_file, st.st_size, mtimeNsec(st));
+    return calibration && write(calibration->image(), filename);
+  }
+
+  CompiledCalibration::~CompiledCalibration()
+  {
+    if (mapped_)
+      munmap((void *) image_, sizeof(CalibrationImage));
+    else
+      delete image_;
+  }
+
+  void CompiledCalibration::apply(Calibration &calibration) const
+  {
+    calibration.correction_table = image_->table;
+    calibration.num_lasers = image_->num_lasers;
+    calibration.id = image_->id;
+    calibration.initialized = true;
+  }
+
+  /** @brief Map a compiled calibration file.
+   *
+   *  @param source_size, source_mtime YAML file it must have been
+   *                                   compiled from, or 0 for any
+   *  @returns the calibration, or NULL if missing, corrupt or stale
+   */
+  CompiledCalibration::ConstPtr
+  CompiledCalibration::map(const std::string &filename,
+                           uint64_t source_size, uint64_t source_mtime)
+  {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+      return ConstPtr();
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size != sizeof(CalibrationImage))
+      {
+        close(fd);
+        return ConstPtr();
+      }
+    void *addr = mmap(NULL, sizeof(CalibrationImage), PROT_READ, MAP_SHARED,
+                      fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+      return ConstPtr();
+
+    const CalibrationImage *image = (const CalibrationImage *) addr;
+    const char *problem = NULL;
+    if (image->magic != CALIBRATION_IMAGE_MAGIC
+        || image->version != CALIBRATION_IMAGE_VERSION
+        || image->size != sizeof(CalibrationImage))
+      problem = "unsupported version";
+    else if (image->checksum != imageChecksum(*image))
+      problem = "bad checksum";
+    else if (image->num_lasers <= 0
+             || image->num_lasers > CorrectionTable::MAX_LASERS
+             || memchr(image->id, '\0', sizeof(image->id)) == NULL)
+      problem = "invalid contents";
+    else if (source_mtime != 0
+             && (image->source_size != source_size
+                 || image->source_mtime != source_mtime))
+      problem = "out of date";
+    if (problem != NULL)
+      {
+        ROS_WARN("Ignoring compiled calibration %s: %s",
+                 filename.c_str(), problem);
+        munmap(addr, sizeof(CalibrationImage));
+        return ConstPtr();
+      }
+
+    CompiledCalibration *calibration = new CompiledCalibration();
+    calibration->image_ = image;
+    calibration->mapped_ = true;
+    return ConstPtr(calibration);
+  }
+
+  /** @brief Parse a YAML calibration file and compile it.
+   *
+   *  @returns the calibration, or NULL if unreadable
+   */
+  CompiledCalibration::ConstPtr
+  CompiledCalibration::parse(const std::string &yaml_file,
+                             uint64_t source_size, uint64_t source_mtime)
+  {
+    Calibration parsed(yaml_file);
+    if (!parsed.initialized)
+      return ConstPtr();
+
+    CalibrationImage *image = new CalibrationImage;
+    memset(image, 0, sizeof(*image));
+    image->magic = CALIBRATION_IMAGE_MAGIC;
+    image->version = CALIBRATION_IMAGE_VERSION;
+    image->size = sizeof(CalibrationImage);
+    image->num_lasers = parsed.num_lasers;
+    image->source_size = source_size;
+    image->source_mtime = source_mtime;
+    strncpy(image->id, parsed.id.c_str(), sizeof(image->id) - 1);
+    image->table = parsed.correction_table;
+
+    // sin and cos of all the possible headings
+    for (uint16_t rot_index = 0; rot_index < CALIBRATION_ROTATION_UNITS;
+         ++rot_index)
+      {
+        float rotation = angles::from_degrees(velodyne_rawdata::ROTATION_RESOLUTION
+                                              * rot_index);
+        image->cos_rot_table[rot_index] = cosf(rotation);
+        image->sin_rot_table[rot_index] = sinf(rotation);
+      }
+    image->checksum = imageChecksum(*image);
+
+    CompiledCalibration *calibration = new CompiledCalibration();
+    calibration->image_ = image;
+    return ConstPtr(calibration);
+  }
+
+  /** @brief Write a compiled calibration, replacing the file atomically.
+   *
+   *  @returns true if successful
+   */
+  bool CompiledCalibration::write(const CalibrationImage &image,
+                                  const std::string &filename)
+  {
+    char pid[32];
+    snprintf(pid, sizeof(pid), ".%d.tmp", (int) getpid());
+    std::string tmp_file = filename + pid;
+    int fd = open(tmp_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+      {
+        ROS_WARN("Unable to write compiled calibration %s: %s",
+                 filename.c_str(), strerror(errno));
+        return false;
+      }
+    const char *bytes = (const char *) &image;
+    size_t done = 0;
+    while (done < sizeof(image))
+      {
+        ssize_t rc = ::write(fd, bytes + done, sizeof(image) - done);
+        if (rc < 0 && errno == EINTR)
+          continue;
+        if (rc <= 0)
+          break;
+        done += rc;
+      }
+    bool ok = (done == sizeof(image));
+    if (close(fd) != 0)
+      ok = false;
+    if (ok && rename(tmp_file.c_str(), filename.c_str()) != 0)
+      ok = false;
+    if (!ok)
+      {
+        ROS_WARN("Unable to write compiled calibration %s: %s",
+                 filename.c_str(), strerror(errno));
+        unlink(tmp_file.c_str());
+      }
+    return ok;
+  }
+
+} // namespace velodyne_pointcloud
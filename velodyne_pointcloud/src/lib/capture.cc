@@ -0,0 +1,91 @@
+/*
+ *  Copyright (C) 2009, 2010, 2012 Austin Robot Technology, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/**
+ *  @file
+ *
+ *  Binary diagnostics capture writer.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <ros/ros.h>
+
+#include <velodyne_pointcloud/capture.h>
+
+namespace velodyne_rawdata
+{
+  /** records written with each fwrite() */
+  static const size_t CAPTURE_WRITE_BATCH = 1024;
+
+  DiagnosticCapture::DiagnosticCapture(const std::string &filename,
+                                       size_t capacity)
+    : queue_(capacity),
+      file_(NULL),
+      sequence_(0),
+      dropped_(0),
+      running_(true)
+  {
+    file_ = fopen(filename.c_str(), "wb");
+    if (file_ == NULL)
+      {
+        ROS_ERROR_STREAM("Unable to open capture file: " << filename
+                         << ": " << strerror(errno));
+        return;
+      }
+
+    uint32_t header[2] = {CAPTURE_MAGIC, sizeof(CaptureRecord)};
+    fwrite(header, sizeof(header), 1, file_);
+    thread_ = boost::thread(boost::bind(&DiagnosticCapture::writer, this));
+    ROS_INFO_STREAM("Capturing firing diagnostics to " << filename);
+  }
+
+  DiagnosticCapture::~DiagnosticCapture()
+  {
+    if (file_ == NULL)
+      return;
+
+    running_ = false;
+    thread_.join();
+    drain();
+    fclose(file_);
+    if (dropped_ > 0)
+      ROS_WARN_STREAM("Capture dropped " << dropped_ << " records");
+  }
+
+  /** Write the pending records to the capture file.
+   *
+   *  @returns number of records written
+   */
+  size_t DiagnosticCapture::drain()
+  {
+    CaptureRecord records[CAPTURE_WRITE_BATCH];
+    size_t total = 0;
+    size_t n;
+    while ((n = queue_.pop(records, CAPTURE_WRITE_BATCH)) > 0)
+      {
+        if (fwrite(records, sizeof(CaptureRecord), n, file_) != n)
+          ROS_WARN_THROTTLE(1.0, "Capture file write failed: %s",
+                            strerror(errno));
+        total += n;
+      }
+    return total;
+  }
+
+  /** Writer thread: drain the ring until stopped. */
+  void DiagnosticCapture::writer()
+  {
+    while (running_)
+      {
+        if (drain() == 0)
+          boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+      }
+  }
+
+} // namespace velodyne_rawdata
@@ -0,0 +1,488 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (C) 2009, 2010, 2012 Austin Robot Technology, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  @brief Cell writers for the organized clouds of RawData::unpack().
+ *
+ *  Private to the velodyne_rawdata library.  The unpack loops are
+ *  templates on the output cloud type, and store each cell through
+ *  the matching CloudWriter exactly once.
+ */
+
+#ifndef __VELODYNE_CLOUD_WRITER_H
+#define __VELODYNE_CLOUD_WRITER_H
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <limits>
+
+#include <pcl_conversions/pcl_conversions.h>
+#include <sensor_msgs/PointCloud2.h>
+
+#include <velodyne_pointcloud/packed_cloud.h>
+#include <velodyne_pointcloud/rawdata.h>
+
+namespace velodyne_rawdata
+{
+  /** @returns IEEE 754 half precision bits of a float, rounded */
+  static inline uint16_t floatToHalf(float value)
+  {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign = (bits >> 16) & 0x8000;
+    int biased = (bits >> 23) & 0xff;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (biased == 0xff)                 // infinity or NaN
+      return sign | 0x7c00 | (mantissa? 0x200: 0);
+
+    int exponent = biased - 127 + 15;
+    if (exponent >= 31)                 // too large: infinity
+      return sign | 0x7c00;
+    if (exponent <= 0)                  // subnormal or zero
+      {
+        if (exponent < -10)
+          return sign;
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint16_t half = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1)
+          ++half;
+        return sign | half;
+      }
+
+    // rounding may carry into the exponent, which is still correct
+    uint16_t half = sign | (exponent << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000)
+      ++half;
+    return half;
+  }
+
+  /** @returns a PointXYZIRT cell */
+  static inline VTPoint timedPoint(const VPoint &point, float time,
+                                   uint8_t return_index)
+  {
+    VTPoint cell;
+    cell.x = point.x;
+    cell.y = point.y;
+    cell.z = point.z;
+    cell.intensity = point.intensity;
+    cell.ring = point.ring;
+    cell.return_index = return_index;
+    cell.time = time;
+    return cell;
+  }
+
+  /** @returns a PointXYZIRS cell */
+  static inline VSPoint sensorPoint(const VPoint &point, uint16_t sensor)
+  {
+    VSPoint cell;
+    cell.x = point.x;
+    cell.y = point.y;
+    cell.z = point.z;
+    cell.intensity = point.intensity;
+    cell.ring = point.ring;
+    cell.sensor = sensor;
+    return cell;
+  }
+
+  /** @brief Size a PCL cloud for unpacking a scan.
+   *
+   *  The points are not initialized: the unpack loops write every
+   *  cell, so a recycled cloud needs no clearing.
+   */
+  template <class PointT>
+  static void resizeCloud(pcl::PointCloud<PointT> &pc,
+                          const std_msgs::Header &header,
+                          const std::string &frame_id,
+                          uint32_t width, uint32_t height)
+  {
+    pc.header.stamp = pcl_conversions::toPCL(header).stamp;
+    pc.header.frame_id = frame_id;
+    pc.width = width;
+    pc.height = height;
+    pc.points.resize(width * height);
+  }
+
+  template <class Cloud>
+  class CloudWriter;
+
+  /** \brief Writers keeping every cell, see CloudWriter<DecimatedCloud>. */
+  struct FullResolution
+  {
+    /** true if the unpack loops should skip dropped cells */
+    static const bool DECIMATED = false;
+
+    bool keepColumn(uint32_t col) const { return true; }
+    bool keepRow(uint32_t row) const { return true; }
+  };
+
+  /** \brief Writes PointXYZIR cells of a PCL cloud. */
+  template <>
+  class CloudWriter<VPointCloud>: public FullResolution
+  {
+  public:
+
+    CloudWriter(VPointCloud &pc, const PackedLayout &layout):
+      pc_(pc)
+    {}
+
+    /** Size the cloud for unpacking a scan, see resizeCloud(). */
+    void resize(const std_msgs::Header &header, const std::string &frame_id,
+                uint32_t width, uint32_t height)
+    {
+      resizeCloud(pc_, header, frame_id, width, height);
+    }
+
+    uint32_t width() const { return pc_.width; }
+    uint32_t height() const { return pc_.height; }
+
+    /** Store a cell; PointXYZIR has no time or return field. */
+    void set(uint32_t col, uint32_t row, const VPoint &point, float time,
+             uint8_t return_index = velodyne_pointcloud::RETURN_SINGLE)
+    {
+      pc_.at(col, row) = point;
+    }
+
+  private:
+    VPointCloud &pc_;
+  };
+
+  /** \brief Writes PointXYZIRT cells of a PCL cloud. */
+  template <>
+  class CloudWriter<VTPointCloud>: public FullResolution
+  {
+  public:
+
+    CloudWriter(VTPointCloud &pc, const PackedLayout &layout):
+      pc_(pc)
+    {}
+
+    void resize(const std_msgs::Header &header, const std::string &frame_id,
+                uint32_t width, uint32_t height)
+    {
+      resizeCloud(pc_, header, frame_id, width, height);
+    }
+
+    uint32_t width() const { return pc_.width; }
+    uint32_t height() const { return pc_.height; }
+
+    void set(uint32_t col, uint32_t row, const VPoint &point, float time,
+             uint8_t return_index = velodyne_pointcloud::RETURN_SINGLE)
+    {
+      pc_.at(col, row) = timedPoint(point, time, return_index);
+    }
+
+  private:
+    VTPointCloud &pc_;
+  };
+
+  /** \brief Output of RawData::unpackReturns(). */
+  struct ReturnClouds
+  {
+    ReturnClouds(VTPointCloud &strongest_cloud, VTPointCloud &last_cloud):
+      strongest(strongest_cloud),
+      last(last_cloud),
+      dual(false),
+      single(&strongest_cloud)
+    {}
+
+    VTPointCloud &strongest;
+    VTPointCloud &last;
+    bool dual;                          ///< scan starts in dual return mode
+    VTPointCloud *single;               ///< cloud of single return scans
+  };
+
+  /** \brief Splits the cells of a scan by return.
+   *
+   *  The unpack loops address the columns of the combined cloud,
+   *  where dual returns alternate.  In dual return mode each return
+   *  goes to column col/2 of its cloud, and the cells of single
+   *  return packets, after a mode change, to both.  Otherwise every
+   *  cell goes to the single return cloud as is.
+   */
+  template <>
+  class CloudWriter<ReturnClouds>: public FullResolution
+  {
+  public:
+
+    CloudWriter(ReturnClouds &returns, const PackedLayout &layout):
+      returns_(returns),
+      width_(0)
+    {}
+
+    /** Size the clouds for a combined cloud of width x height. */
+    void resize(const std_msgs::Header &header, const std::string &frame_id,
+                uint32_t width, uint32_t height)
+    {
+      width_ = width;
+      if (returns_.dual)
+        {
+          resizeCloud(returns_.strongest, header, frame_id, width / 2, height);
+          resizeCloud(returns_.last, header, frame_id, width / 2, height);
+          return;
+        }
+      VTPointCloud &other = (returns_.single == &returns_.strongest)?
+        returns_.last: returns_.strongest;
+      resizeCloud(*returns_.single, header, frame_id, width, height);
+      resizeCloud(other, header, frame_id, 0, height);
+    }
+
+    /** @returns width of the combined cloud */
+    uint32_t width() const { return width_; }
+    uint32_t height() const { return returns_.strongest.height; }
+
+    void set(uint32_t col, uint32_t row, const VPoint &point, float time,
+             uint8_t return_index = velodyne_pointcloud::RETURN_SINGLE)
+    {
+      VTPoint cell = timedPoint(point, time, return_index);
+      if (!returns_.dual)
+        returns_.single->at(col, row) = cell;
+      else if (return_index == velodyne_pointcloud::RETURN_STRONGEST)
+        returns_.strongest.at(col / 2, row) = cell;
+      else if (return_index == velodyne_pointcloud::RETURN_LAST)
+        returns_.last.at(col / 2, row) = cell;
+      else
+        returns_.strongest.at(col / 2, row) =
+          returns_.last.at(col / 2, row) = cell;
+    }
+
+  private:
+    ReturnClouds &returns_;
+    uint32_t width_;
+  };
+
+  /** \brief Output of RawData::unpackDecimated(). */
+  struct DecimatedCloud
+  {
+    DecimatedCloud(VPointCloud &decimated, int rings, int columns, int group):
+      cloud(decimated),
+      ring_stride(rings),
+      column_stride(columns),
+      column_group(group)
+    {}
+
+    VPointCloud &cloud;
+    uint32_t ring_stride;               ///< rows kept, one in ring_stride
+    uint32_t column_stride;             ///< firings kept, one in column_stride
+    uint32_t column_group;              ///< adjacent columns of a firing
+  };
+
+  /** \brief Writes one cell in ring_stride x column_stride.
+   *
+   *  The unpack loops address the full resolution cloud, and ask
+   *  keepColumn() and keepRow() first so the dropped cells are never
+   *  computed.  The columns of each firing, the two returns in dual
+   *  return mode, are kept or dropped together.
+   */
+  template <>
+  class CloudWriter<DecimatedCloud>
+  {
+  public:
+
+    static const bool DECIMATED = true;
+
+    CloudWriter(DecimatedCloud &decimated, const PackedLayout &layout):
+      d_(decimated),
+      width_(0),
+      height_(0)
+    {}
+
+    /** Size the cloud for a full resolution one of width x height. */
+    void resize(const std_msgs::Header &header, const std::string &frame_id,
+                uint32_t width, uint32_t height)
+    {
+      width_ = width;
+      height_ = height;
+      uint32_t firings = width / d_.column_group;
+      resizeCloud(d_.cloud, header, frame_id,
+                  (firings + d_.column_stride - 1) / d_.column_stride
+                  * d_.column_group,
+                  (height + d_.ring_stride - 1) / d_.ring_stride);
+    }
+
+    /** @returns size of the full resolution cloud */
+    uint32_t width() const { return width_; }
+    uint32_t height() const { return height_; }
+
+    bool keepColumn(uint32_t col) const
+    {
+      return (col / d_.column_group) % d_.column_stride == 0;
+    }
+    bool keepRow(uint32_t row) const { return row % d_.ring_stride == 0; }
+
+    void set(uint32_t col, uint32_t row, const VPoint &point, float time,
+             uint8_t return_index = velodyne_pointcloud::RETURN_SINGLE)
+    {
+      if (keepColumn(col) && keepRow(row))
+        d_.cloud.at(col / d_.column_group / d_.column_stride * d_.column_group
+                    + col % d_.column_group, row / d_.ring_stride) = point;
+    }
+
+  private:
+    DecimatedCloud &d_;
+    uint32_t width_;
+    uint32_t height_;
+  };
+
+  /** \brief Output of RawData::unpackFused(). */
+  struct FusedCloud
+  {
+    FusedCloud(VSPointCloud &fused, uint32_t first_column, uint16_t index):
+      cloud(fused),
+      column(first_column),
+      sensor(index)
+    {}
+
+    VSPointCloud &cloud;
+    uint32_t column;                    ///< first column of the scan
+    uint16_t sensor;                    ///< sensor field of its cells
+  };
+
+  /** \brief Writes the cells of one sensor into a fused cloud.
+   *
+   *  The owner of the fused cloud sizes it for all the sensors, so
+   *  resize() only records the size of this scan, and empties the
+   *  rows of its columns that have no laser.
+   */
+  template <>
+  class CloudWriter<FusedCloud>: public FullResolution
+  {
+  public:
+
+    CloudWriter(FusedCloud &fused, const PackedLayout &layout):
+      f_(fused),
+      width_(0),
+      height_(0)
+    {}
+
+    void resize(const std_msgs::Header &header, const std::string &frame_id,
+                uint32_t width, uint32_t height)
+    {
+      width_ = width;
+      height_ = height;
+      VSPoint empty;
+      empty.x = empty.y = empty.z = std::numeric_limits<float>::quiet_NaN();
+      empty.intensity = 0.0f;
+      empty.ring = (uint16_t) -1;
+      empty.sensor = f_.sensor;
+      for (uint32_t row = height; row < f_.cloud.height; ++row)
+        std::fill(f_.cloud.points.begin() + row * f_.cloud.width + f_.column,
+                  f_.cloud.points.begin() + row * f_.cloud.width + f_.column
+                  + width, empty);
+    }
+
+    /** @returns size of this scan's part */
+    uint32_t width() const { return width_; }
+    uint32_t height() const { return height_; }
+
+    void set(uint32_t col, uint32_t row, const VPoint &point, float time,
+             uint8_t return_index = velodyne_pointcloud::RETURN_SINGLE)
+    {
+      f_.cloud.at(f_.column + col, row) = sensorPoint(point, f_.sensor);
+    }
+
+  private:
+    FusedCloud &f_;
+    uint32_t width_;
+    uint32_t height_;
+  };
+
+  /** \brief Writes packed cells straight into a PointCloud2 buffer. */
+  template <>
+  class CloudWriter<sensor_msgs::PointCloud2>: public FullResolution
+  {
+  public:
+
+    CloudWriter(sensor_msgs::PointCloud2 &cloud, const PackedLayout &layout):
+      cloud_(cloud),
+      layout_(layout)
+    {}
+
+    /** @brief Size the cloud for unpacking a scan.
+     *
+     *  The data are not initialized, see CloudWriter<VPointCloud>.
+     */
+    void resize(const std_msgs::Header &header, const std::string &frame_id,
+                uint32_t width, uint32_t height)
+    {
+      cloud_.header.stamp = header.stamp;
+      cloud_.header.frame_id = frame_id;
+      cloud_.width = width;
+      cloud_.height = height;
+      if (cloud_.fields.size() != layout_.fields.size()
+          || cloud_.point_step != layout_.point_step)
+        cloud_.fields = layout_.fields;
+      cloud_.is_bigendian = false;
+      cloud_.point_step = layout_.point_step;
+      cloud_.row_step = width * layout_.point_step;
+      cloud_.is_dense = false;
+      cloud_.data.resize(cloud_.row_step * height);
+    }
+
+    uint32_t width() const { return cloud_.width; }
+    uint32_t height() const { return cloud_.height; }
+
+    /** Store a cell in the packed layout, which has no return field. */
+    void set(uint32_t col, uint32_t row, const VPoint &point, float time,
+             uint8_t return_index = velodyne_pointcloud::RETURN_SINGLE)
+    {
+      uint8_t *cell = &cloud_.data[row * cloud_.row_step
+                                   + col * layout_.point_step];
+      switch (layout_.coordinates)
+        {
+        case PackedLayout::FLOAT32:
+          memcpy(cell + layout_.x_offset, &point.x, sizeof(float));
+          memcpy(cell + layout_.y_offset, &point.y, sizeof(float));
+          memcpy(cell + layout_.z_offset, &point.z, sizeof(float));
+          break;
+        case PackedLayout::FLOAT16:
+          storeHalf(cell + layout_.x_offset, point.x);
+          storeHalf(cell + layout_.y_offset, point.y);
+          storeHalf(cell + layout_.z_offset, point.z);
+          break;
+        case PackedLayout::INT16:
+          storeInt16(cell + layout_.x_offset, point.x);
+          storeInt16(cell + layout_.y_offset, point.y);
+          storeInt16(cell + layout_.z_offset, point.z);
+          break;
+        }
+      memcpy(cell + layout_.intensity_offset, &point.intensity, sizeof(float));
+      memcpy(cell + layout_.ring_offset, &point.ring, sizeof(uint16_t));
+      if (layout_.time)
+        memcpy(cell + layout_.time_offset, &time, sizeof(float));
+    }
+
+  private:
+
+    static void storeHalf(uint8_t *field, float value)
+    {
+      uint16_t half = floatToHalf(value);
+      memcpy(field, &half, sizeof(half));
+    }
+
+    /** quantize to the resolution, -32768 for NaN or out of range */
+    void storeInt16(uint8_t *field, float value) const
+    {
+      float units = value / layout_.resolution;
+      int16_t quantized = -32768;
+      if (units > -32767.5f && units < 32767.5f) // false for NaN
+        quantized = (int16_t) lrintf(units);
+      memcpy(field, &quantized, sizeof(quantized));
+    }
+
+    sensor_msgs::PointCloud2 &cloud_;
+    const PackedLayout &layout_;
+  };
+
+} // namespace velodyne_rawdata
+
+#endif // __VELODYNE_CLOUD_WRITER_H
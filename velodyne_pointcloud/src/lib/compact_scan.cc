@@ -0,0 +1,146 @@
+/*
+ *  Copyright (C) 2009, 2010, 2012 Austin Robot Technology, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/**
+ *  @file
+ *
+ *  Compact Velodyne scan decoder implementation.
+ */
+
+#include <errno.h>
+#include <limits>
+#include <math.h>
+
+#include <angles/angles.h>
+#include <pcl_conversions/pcl_conversions.h>
+
+#include <velodyne_pointcloud/compact_scan.h>
+
+#include "unpack_kernel.h"
+
+namespace velodyne_rawdata
+{
+  /** Largest plausible azimuth step between VLP-16 firings [deg/100]. */
+  static const int MAX_FIRING_AZIMUTH_STEP = 200;
+
+  CompactDecoder::CompactDecoder(const velodyne_pointcloud::Calibration &calibration):
+    table_(calibration.correction_table),
+    id_(calibration.id),
+    num_lasers_(calibration.num_lasers),
+    cos_rot_table_(ROTATION_MAX_UNITS),
+    sin_rot_table_(ROTATION_MAX_UNITS)
+  {
+    // map the rows of compact scans back to the lasers
+    for (int row = 0; row < velodyne_pointcloud::CorrectionTable::MAX_LASERS;
+         ++row)
+      row_laser_[row] = -1;
+    for (int laser = 0; laser < num_lasers_; ++laser)
+      {
+        int ring = table_.laser_ring[laser];
+        if (ring >= 0 && ring < num_lasers_)
+          row_laser_[table_.row[laser]] = laser;
+      }
+
+    for (uint16_t rot_index = 0; rot_index < ROTATION_MAX_UNITS; ++rot_index)
+      {
+        float rotation = angles::from_degrees(ROTATION_RESOLUTION * rot_index);
+        cos_rot_table_[rot_index] = cosf(rotation);
+        sin_rot_table_[rot_index] = sinf(rotation);
+      }
+  }
+
+  bool CompactDecoder::matches(const velodyne_msgs::VelodyneCompactScan &scan) const
+  {
+    return (scan.calibration_id == id_
+            && scan.height == num_lasers_
+            && scan.azimuth.size() == scan.width
+            && scan.distance.size() == (size_t) scan.width * scan.height
+            && scan.intensity.size() == scan.distance.size());
+  }
+
+  /** The column azimuth is that of the first beam.  VLP-16 beams fire
+   *  one after the other while the sensor turns, so later ones are
+   *  interpolated toward the next firing of the same return. */
+  int CompactDecoder::beamAzimuth(const velodyne_msgs::VelodyneCompactScan &scan,
+                                  int laser, uint32_t col) const
+  {
+    int azimuth = scan.azimuth[col] % ROTATION_MAX_UNITS;
+    if (num_lasers_ != 16 || laser == 0)
+      return azimuth;
+
+    const uint32_t step = scan.returns_per_firing? scan.returns_per_firing: 1;
+    int diff = -1;
+    if (col + step < scan.width)
+      diff = (ROTATION_MAX_UNITS + scan.azimuth[col + step] - azimuth)
+        % ROTATION_MAX_UNITS;
+    if ((diff < 0 || diff > MAX_FIRING_AZIMUTH_STEP) && col >= step)
+      diff = (ROTATION_MAX_UNITS + azimuth - scan.azimuth[col - step])
+        % ROTATION_MAX_UNITS;
+    if (diff < 0 || diff > MAX_FIRING_AZIMUTH_STEP)
+      return azimuth;
+
+    float corrected = azimuth
+      + diff * laser * VLP16_DSR_TOFFSET / VLP16_FIRING_TOFFSET;
+    return ((int) round(corrected)) % ROTATION_MAX_UNITS;
+  }
+
+  bool CompactDecoder::point(const velodyne_msgs::VelodyneCompactScan &scan,
+                             uint32_t row, uint32_t col, VPoint &point) const
+  {
+    if (row >= scan.height || col >= scan.width)
+      return false;
+    const size_t cell = row * scan.width + col;
+    const uint16_t raw = scan.distance[cell];
+    const int laser = row_laser_[row];
+    if (raw == 0 || laser < 0)
+      return false;
+
+    int azimuth = beamAzimuth(scan, laser, col);
+    BlockPoints points;
+    unpackPoint(table_, laser, raw, scan.intensity[cell],
+                cos_rot_table_[azimuth], sin_rot_table_[azimuth], points, 0);
+    point.x = points.x[0];
+    point.y = points.y[0];
+    point.z = points.z[0];
+    point.intensity = points.intensity[0];
+    point.ring = table_.laser_ring[laser];
+    return true;
+  }
+
+  int CompactDecoder::decode(const velodyne_msgs::VelodyneCompactScan &scan,
+                             VPointCloud &pc) const
+  {
+    if (!matches(scan))
+      return EINVAL;
+
+    pc.header = pcl_conversions::toPCL(scan.header);
+    pc.width = scan.width;
+    pc.height = scan.height;
+    pc.is_dense = false;
+    pc.points.resize(scan.width * scan.height);
+
+    VPoint empty;
+    empty.x = empty.y = empty.z = std::numeric_limits<float>::quiet_NaN();
+    empty.intensity = 0u;
+
+    // compact scans have the rows of organized clouds, highest ring
+    // first
+    for (uint32_t row = 0; row < scan.height; ++row)
+      {
+        empty.ring = scan.height - 1 - row;
+        for (uint32_t col = 0; col < scan.width; ++col)
+          {
+            VPoint &cell = pc.at(col, row);
+            if (!point(scan, row, col, cell))
+              cell = empty;
+          }
+      }
+    return 0;
+  }
+
+} // namespace velodyne_rawdata
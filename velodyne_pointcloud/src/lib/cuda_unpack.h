@@ -0,0 +1,136 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (C) 2009, 2010, 2012 Austin Robot Technology, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  @brief CUDA unpacking backend for the Velodyne 3D LIDAR.
+ *
+ *  Private to the velodyne_rawdata library, and only built when CMake
+ *  finds CUDA, which defines HAVE_CUDA for rawdata.cc.  The device
+ *  keeps the flat CorrectionTable and the rotation tables of the
+ *  calibration.  The packets of each scan are copied to it in one
+ *  batch, and one thread per return computes its organized cloud
+ *  cell with unpackPoint(), the scalar kernel's math.  The cloud
+ *  stays in device memory, with a copy in pinned host memory.
+ *
+ *  Like the SIMD kernels, this interface must not include ROS
+ *  headers, nor CUDA ones: nvcc compiles unpack_cuda.cu alone.
+ */
+
+#ifndef __VELODYNE_CUDA_UNPACK_H
+#define __VELODYNE_CUDA_UNPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include <velodyne_pointcloud/calibration.h>
+
+namespace velodyne_rawdata
+{
+  /** PointXYZIR cell layout, checked against it in rawdata.cc */
+  struct CudaPoint
+  {
+    float x, y, z, pad;
+    float intensity;
+    uint16_t ring;
+  } __attribute__((aligned(16)));
+
+  /** floats per column transform: a row-major 3x4 matrix [R | t],
+   *  then 1 if the transform is valid, else 0 */
+  static const int CUDA_TRANSFORM_SIZE = 16;
+
+  /** \brief One scan to unpack. */
+  struct CudaScan
+  {
+    const uint8_t *packets;             ///< data of the first packet
+    size_t packet_stride;               ///< bytes from one packet to the next
+    int n_packets;
+    int num_lasers;                     ///< 16 for the VLP-16, else 32 or 64
+    double min_range;                   ///< [m]
+    double max_range;                   ///< [m]
+    const float *transforms;            ///< per column, NULL not to transform
+  };
+
+  /** \brief Unpacks scans on one CUDA device.
+   *
+   *  Any one thread may use it at a time.
+   */
+  class CudaUnpacker
+  {
+  public:
+
+    CudaUnpacker();
+    ~CudaUnpacker();
+
+    /** @brief Start using a device.
+     *
+     *  @returns true if successful, else the error is set
+     */
+    bool open(int device, std::string *error);
+
+    /** @brief Upload a calibration.
+     *
+     *  @param table flat correction table
+     *  @param cos_rot_table, sin_rot_table cos and sin of each rotation
+     *  @param rotation_units entries in each
+     *  @returns true if successful, else the error is set
+     */
+    bool setCalibration(const velodyne_pointcloud::CorrectionTable &table,
+                        const float *cos_rot_table, const float *sin_rot_table,
+                        int rotation_units, std::string *error);
+
+    /** @brief Unpack a scan into an organized cloud.
+     *
+     *  Every cell is written as the CPU unpacking writes it, without
+     *  a view window.  A VLP-16 packet with an invalid block header
+     *  empties its columns and all those after it.
+     *
+     *  @param scan packets to unpack
+     *  @param stop returns the first invalid packet, or n_packets
+     *  @returns true if successful, else the error is set
+     */
+    bool unpack(const CudaScan &scan, int *stop, std::string *error);
+
+    /** cells of the last cloud, row by row */
+    const CudaPoint *devicePoints() const { return points_; }
+    const CudaPoint *hostPoints() const { return host_points_; }
+    uint32_t width() const { return width_; }
+    uint32_t height() const { return height_; }
+
+  private:
+
+    int device_;
+    void *stream_;                      ///< cudaStream_t
+
+    // calibration, on the device
+    velodyne_pointcloud::CorrectionTable *table_;
+    float *cos_rot_;
+    float *sin_rot_;
+    int rotation_units_;
+
+    // scan buffers, grown as needed
+    uint8_t *packets_;
+    uint8_t *host_packets_;             ///< pinned
+    size_t packet_capacity_;            ///< [bytes]
+    CudaPoint *points_;
+    CudaPoint *host_points_;            ///< pinned
+    size_t point_capacity_;             ///< [bytes]
+    float *transforms_;
+    size_t transform_capacity_;         ///< [bytes]
+    int *stop_;
+    int *host_stop_;                    ///< pinned
+
+    uint32_t width_;
+    uint32_t height_;
+  };
+
+} // namespace velodyne_rawdata
+
+#endif // __VELODYNE_CUDA_UNPACK_H
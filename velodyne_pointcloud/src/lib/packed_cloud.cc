@@ -0,0 +1,158 @@
+/*
+ *  Copyright (C) 2009, 2010, 2012 Austin Robot Technology, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/**
+ *  @file
+ *
+ *  Packed PointCloud2 layouts.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <ros/ros.h>
+#include <velodyne_pointcloud/packed_cloud.h>
+
+namespace velodyne_rawdata
+{
+  /** Append a single element field to a layout. */
+  static uint32_t addField(std::vector<sensor_msgs::PointField> &fields,
+                           const std::string &name, uint8_t datatype,
+                           uint32_t size, uint32_t &offset)
+  {
+    sensor_msgs::PointField field;
+    field.name = name;
+    field.offset = offset;
+    field.datatype = datatype;
+    field.count = 1;
+    fields.push_back(field);
+    uint32_t field_offset = offset;
+    offset += size;
+    return field_offset;
+  }
+
+  PackedLayout::PackedLayout()
+  {
+    configure("float32", false, 0.005);
+  }
+
+  bool PackedLayout::configure(const std::string &format, bool time,
+                               double resolution)
+  {
+    // Quantized coordinates are not meters, so generic consumers
+    // looking for x, y and z must not find them.
+    uint8_t datatype;
+    uint32_t size;
+    std::string suffix;
+    if (format == "float32")
+      {
+        coordinates = FLOAT32;
+        datatype = sensor_msgs::PointField::FLOAT32;
+        size = 4;
+      }
+    else if (format == "float16")
+      {
+        coordinates = FLOAT16;
+        datatype = sensor_msgs::PointField::UINT16;
+        size = 2;
+        suffix = "_float16";
+      }
+    else if (format == "int16")
+      {
+        // the field names carry the resolution, in whole micrometers
+        long micrometers = lrint(resolution * 1.0e6);
+        if (micrometers <= 0)
+          {
+            ROS_ERROR_STREAM("int16 coordinate resolution " << resolution
+                             << " m is not positive, using float32");
+            return configure("float32", time, resolution);
+          }
+        coordinates = INT16;
+        datatype = sensor_msgs::PointField::INT16;
+        size = 2;
+        char name[32];
+        snprintf(name, sizeof(name), "_int16_%ldum", micrometers);
+        suffix = name;
+        resolution = micrometers * 1.0e-6;
+      }
+    else
+      return false;
+
+    this->time = time;
+    this->resolution = resolution;
+
+    uint32_t offset = 0;
+    fields.clear();
+    x_offset = addField(fields, "x" + suffix, datatype, size, offset);
+    y_offset = addField(fields, "y" + suffix, datatype, size, offset);
+    z_offset = addField(fields, "z" + suffix, datatype, size, offset);
+    intensity_offset = addField(fields, "intensity",
+                                sensor_msgs::PointField::FLOAT32, 4, offset);
+    ring_offset = addField(fields, "ring",
+                           sensor_msgs::PointField::UINT16, 2, offset);
+    time_offset = 0;
+    if (time)
+      time_offset = addField(fields, "time",
+                             sensor_msgs::PointField::FLOAT32, 4, offset);
+    point_step = offset;
+    return true;
+  }
+
+  /** @returns float value of IEEE 754 half precision bits */
+  static float halfToFloat(uint16_t half)
+  {
+    int exponent = (half >> 10) & 0x1f;
+    int mantissa = half & 0x3ff;
+    float value;
+    if (exponent == 0)                  // zero or subnormal
+      value = ldexpf(mantissa, -24);
+    else if (exponent == 0x1f)
+      value = mantissa? NAN: INFINITY;
+    else
+      value = ldexpf(mantissa | 0x400, exponent - 25);
+    return (half & 0x8000)? -value: value;
+  }
+
+  /** Read one coordinate in the layout encoding. */
+  static float readCoordinate(const PackedLayout &layout, const uint8_t *field)
+  {
+    switch (layout.coordinates)
+      {
+      case PackedLayout::FLOAT16:
+        {
+          uint16_t half;
+          memcpy(&half, field, sizeof(half));
+          return halfToFloat(half);
+        }
+      case PackedLayout::INT16:
+        {
+          int16_t quantized;
+          memcpy(&quantized, field, sizeof(quantized));
+          if (quantized == -32768)
+            return NAN;
+          return quantized * layout.resolution;
+        }
+      default:
+        {
+          float value;
+          memcpy(&value, field, sizeof(value));
+          return value;
+        }
+      }
+  }
+
+  void PackedLayout::readPoint(const uint8_t *cell, float &x, float &y,
+                               float &z, uint16_t &ring) const
+  {
+    x = readCoordinate(*this, cell + x_offset);
+    y = readCoordinate(*this, cell + y_offset);
+    z = readCoordinate(*this, cell + z_offset);
+    memcpy(&ring, cell + ring_offset, sizeof(ring));
+  }
+
+} // namespace velodyne_rawdata
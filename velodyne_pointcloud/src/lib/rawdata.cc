@@ -25,18 +25,49 @@
  *  HDL-64E S2 calibration support provided by Nick Hillier
  */
 
+#include <algorithm>
 #include <fstream>
 #include <math.h>
-#include <iomanip>
+#include <stddef.h>
+#include <string.h>
 
 #include <ros/ros.h>
 #include <ros/package.h>
 #include <angles/angles.h>
+#include <boost/bind.hpp>
 
+#include <velodyne_pointcloud/capture.h>
 #include <velodyne_pointcloud/rawdata.h>
+#include <velodyne_pointcloud/worker_pool.h>
+
+#include "cloud_writer.h"
+#include "cuda_unpack.h"
+#include "unpack_kernel.h"
 
 namespace velodyne_rawdata
 {
+  // CUDA cells are copied straight into PCL clouds
+  typedef char cuda_point_layout_matches
+  [(sizeof(CudaPoint) == sizeof(VPoint)
+    && offsetof(CudaPoint, intensity) == offsetof(VPoint, intensity)
+    && offsetof(CudaPoint, ring) == offsetof(VPoint, ring))? 1: -1];
+
+  // the kernels and the CUDA backend read packets with their own copy
+  // of the layout, see unpack_kernel.h
+  typedef char kernel_packet_layout_matches
+  [(KERNEL_BLOCK_RETURNS == SCANS_PER_BLOCK
+    && KERNEL_RETURN_SIZE == RAW_SCAN_SIZE
+    && KERNEL_PACKET_SIZE == PACKET_SIZE
+    && KERNEL_BLOCKS_PER_PACKET == BLOCKS_PER_PACKET
+    && KERNEL_BLOCK_SIZE == (int) sizeof(raw_block_t)
+    && KERNEL_PACKET_RETURNS == SCANS_PER_PACKET
+    && KERNEL_MODE_BYTE == (int) offsetof(raw_packet_t, status)
+                           + PACKET_STATUS_SIZE - 2
+    && KERNEL_UPPER_BANK == UPPER_BANK
+    && KERNEL_LOWER_BANK == LOWER_BANK
+    && KERNEL_VLP16_FIRINGS_PER_BLOCK == VLP16_FIRINGS_PER_BLOCK
+    && KERNEL_VLP16_SCANS_PER_FIRING == VLP16_SCANS_PER_FIRING)? 1: -1];
+
   ////////////////////////////////////////////////////////////////////////
   //
   // RawData base class implementation
@@ -44,8 +75,33 @@ namespace velodyne_rawdata
   ////////////////////////////////////////////////////////////////////////
 
   RawData::RawData()
-      : tf_listener_(NULL)
+      : sin_rot_table_(NULL),
+        cos_rot_table_(NULL),
+        tf_listener_(NULL),
+        has_extrinsic_(false),
+        unpack_block_(unpackBlockScalar),
+        on_device_(false),
+        packed_output_(false),
+        unpack_(&RawData::unpack_hdl<0, false, false, VPointCloud>),
+        unpack_packed_(&RawData::unpack_hdl<0, false, false,
+                                          sensor_msgs::PointCloud2>),
+        unpack_timed_(&RawData::unpack_hdl<0, false, false, VTPointCloud>),
+        unpack_returns_(&RawData::unpack_hdl<0, false, false, ReturnClouds>),
+        unpack_decimated_(&RawData::unpack_hdl<0, false, false, DecimatedCloud>),
+        unpack_fused_(&RawData::unpack_hdl<0, false, false, FusedCloud>)
   {
+    // publish the whole circle at any range until setParameters() is called
+    config_.min_range = 0.0;
+    config_.max_range = std::numeric_limits<float>::max();
+    config_.min_angle = 0;
+    config_.max_angle = ROTATION_MAX_UNITS;
+    config_.deskew_samples = 0;
+    config_.range_image_width = 1800;
+    config_.ring_stride = 1;
+    config_.column_stride = 1;
+    for (int laser = 0;
+         laser < velodyne_pointcloud::CorrectionTable::MAX_LASERS; ++laser)
+      rot_correction_units_[laser] = 0.0f;
   }
 
   /** Update parameters: conversions and update */
@@ -89,8 +145,153 @@ namespace velodyne_rawdata
     config_.frame_id = frame_id;
     if (!config_.frame_id.empty() && config_.frame_id != last_frame_id)
         ROS_INFO_STREAM("Target frame: " << config_.frame_id);
+
+    updateRawLimits();
+    selectUnpack();
+  }
+
+  /** Set a fixed sensor to target transform. */
+  void RawData::setExtrinsic(const tf::Transform &extrinsic)
+  {
+    extrinsic_ = extrinsic;
+    has_extrinsic_ = true;
+    selectUnpack();
+  }
+
+  /** Set the decimation strides. */
+  void RawData::setDecimation(int ring_stride, int column_stride)
+  {
+    config_.ring_stride = std::max(ring_stride, 1);
+    config_.column_stride = std::max(column_stride, 1);
+  }
+
+  /** Choose the packed output layout. */
+  bool RawData::setCloudFormat(const std::string &format, bool time,
+                               double resolution)
+  {
+    packed_output_ = false;
+    if (format == "pcl")
+      return true;
+    if (!packed_layout_.configure(format, time, resolution))
+      return false;
+    packed_output_ = true;
+    return true;
   }
 
+  /** Precompute the raw distance limits of each laser.
+   *
+   *  A return's range is raw * DISTANCE_RESOLUTION + dist_correction,
+   *  so the range limits map to raw limits for each laser.  Those are
+   *  widened by one unit against rounding, and never admit zero.
+   */
+  void RawData::updateRawLimits()
+  {
+    const velodyne_pointcloud::CorrectionTable &table =
+      calibration_.correction_table;
+    for (int laser = 0;
+         laser < velodyne_pointcloud::CorrectionTable::MAX_LASERS; ++laser)
+      {
+        double raw_min = floor((config_.min_range - table.dist_correction[laser])
+                               / DISTANCE_RESOLUTION) - 1;
+        double raw_max = ceil((config_.max_range - table.dist_correction[laser])
+                              / DISTANCE_RESOLUTION) + 1;
+        raw_min_[laser] = (int) std::max(raw_min, 1.0);
+        raw_max_[laser] = (int) std::min(raw_max, 65535.0);
+      }
+  }
+
+  /** Load a calibration file, shared with other RawData instances. */
+  int RawData::setCalibration(const std::string &calibration_file)
+  {
+    velodyne_pointcloud::CompiledCalibration::ConstPtr compiled =
+      velodyne_pointcloud::CompiledCalibration::load(calibration_file,
+                                                     config_.calibrationCache);
+    if (!compiled) {
+      ROS_ERROR_STREAM("Unable to open calibration file: " <<
+          calibration_file);
+      return -1;
+    }
+    config_.calibrationFile = calibration_file;
+    if (compiled == compiled_)
+      return 0;                         // unchanged
+
+    ROS_INFO_STREAM("correction angles: " << calibration_file);
+    compiled_ = compiled;
+    compiled_->apply(calibration_);
+    ROS_INFO_STREAM("Number of lasers: " << calibration_.num_lasers << ".");
+
+    // Horizontal angle corrections, for binning range image returns.
+    const velodyne_pointcloud::CorrectionTable &table =
+      calibration_.correction_table;
+    for (int laser = 0;
+         laser < velodyne_pointcloud::CorrectionTable::MAX_LASERS; ++laser)
+      rot_correction_units_[laser] =
+        angles::to_degrees(atan2(table.sin_rot_correction[laser],
+                                 table.cos_rot_correction[laser]))
+        / ROTATION_RESOLUTION;
+
+    if (!rot_tables_) {
+      rot_tables_ = compiled_;
+      cos_rot_table_ = rot_tables_->image().cos_rot_table;
+      sin_rot_table_ = rot_tables_->image().sin_rot_table;
+    }
+
+    updateRawLimits();
+    selectUnpack();
+    if (cuda_ && !uploadCalibration())
+      cuda_.reset();
+    return 0;
+  }
+
+  /** @brief Upload the calibration to the CUDA device.
+   *
+   *  @returns true if successful
+   */
+  bool RawData::uploadCalibration()
+  {
+#ifdef HAVE_CUDA
+    std::string error;
+    if (!cuda_->setCalibration(calibration_.correction_table, cos_rot_table_,
+                               sin_rot_table_, ROTATION_MAX_UNITS, &error))
+      {
+        ROS_ERROR_STREAM("Unable to upload the calibration to the CUDA device,"
+                         " unpacking on the CPU: " << error);
+        return false;
+      }
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  bool RawData::setCudaDevice(int device)
+  {
+    cuda_.reset();
+    if (device < 0)
+      return false;
+#ifdef HAVE_CUDA
+    std::string error;
+    cuda_.reset(new CudaUnpacker());
+    if (!cuda_->open(device, &error))
+      {
+        ROS_WARN_STREAM("Unable to use CUDA device " << device
+                        << ", unpacking on the CPU: " << error);
+        cuda_.reset();
+        return false;
+      }
+    if (calibration_.initialized && !uploadCalibration())
+      {
+        cuda_.reset();
+        return false;
+      }
+    ROS_INFO_STREAM("Unpacking on CUDA device " << device << ".");
+    unpack_block_ = unpackBlockScalar;
+    return true;
+#else
+    ROS_WARN("Built without CUDA, unpacking on the CPU.");
+    return false;
+#endif
+  }
 
   /** Set up for on-line operation. */
   int RawData::setup(ros::NodeHandle private_nh, tf::TransformListener* tf_listener)
@@ -105,68 +306,951 @@ namespace velodyne_rawdata
         config_.calibrationFile = pkgPath + "/params/64e_utexas.yaml";
       }
 
-    ROS_INFO_STREAM("correction angles: " << config_.calibrationFile);
-
-    calibration_.read(config_.calibrationFile);
-    if (!calibration_.initialized) {
-      ROS_ERROR_STREAM("Unable to open calibration file: " <<
-          config_.calibrationFile);
+    // optional compiled copy of a YAML calibration, to map next time
+    private_nh.param("calibration_cache", config_.calibrationCache,
+                     std::string(""));
+    if (setCalibration(config_.calibrationFile) != 0)
       return -1;
-    }
-
-    ROS_INFO_STREAM("Number of lasers: " << calibration_.num_lasers << ".");
-
-    // Set up cached values for sin and cos of all the possible headings
-    for (uint16_t rot_index = 0; rot_index < ROTATION_MAX_UNITS; ++rot_index) {
-      float rotation = angles::from_degrees(ROTATION_RESOLUTION * rot_index);
-      cos_rot_table_[rot_index] = cosf(rotation);
-      sin_rot_table_[rot_index] = sinf(rotation);
-    }
 
     tf_listener_ = tf_listener;
 
-    file_.open("azimuth_corrected.txt");
+    // Optionally unpack PCL clouds on a CUDA device.  The CPU then
+    // uses the scalar kernel for the scans the device leaves to it, so
+    // all the points are alike: the SIMD kernels may fuse multiply-adds.
+    bool cuda;
+    private_nh.param("cuda", cuda, false);
+    int device;
+    private_nh.param("cuda_device", device, 0);
+    cuda = setCudaDevice(cuda? device: -1);
+
+    // Choose the block unpacking kernel for this CPU.
+    bool simd;
+    private_nh.param("simd", simd, true);
+    const char *kernel_name = "scalar";
+    unpack_block_ = (simd && !cuda)?
+      selectUnpackBlock(&kernel_name): unpackBlockScalar;
+    ROS_INFO_STREAM("Using " << kernel_name << " unpack kernel.");
+    updateRawLimits();
+    selectUnpack();
+
+    // Optionally write packed PointCloud2 clouds instead of PCL ones.
+    std::string cloud_format;
+    bool point_time;
+    double coordinate_resolution;
+    private_nh.param("cloud_format", cloud_format, std::string("pcl"));
+    private_nh.param("point_time", point_time, false);
+    private_nh.param("coordinate_resolution", coordinate_resolution, 0.005);
+    if (!setCloudFormat(cloud_format, point_time, coordinate_resolution))
+      ROS_ERROR_STREAM("unknown cloud format: " << cloud_format);
+    else if (packed_output_)
+      ROS_INFO_STREAM("Writing packed " << cloud_format << " clouds, "
+                      << packed_layout_.point_step << " bytes per point.");
+
+    // Deskew transformed clouds with poses sampled across each scan.
+    private_nh.param("deskew_samples", config_.deskew_samples, 0);
+
+    // Azimuth columns of range images, 0.2 degrees each by default.
+    private_nh.param("range_image_width", config_.range_image_width, 1800);
+    if (config_.range_image_width <= 0)
+      {
+        ROS_ERROR_STREAM("invalid range_image_width: "
+                         << config_.range_image_width);
+        config_.range_image_width = 1800;
+      }
+
+    // Optionally capture VLP-16 firing times and azimuths.
+    std::string capture_file;
+    private_nh.param("capture_file", capture_file, std::string(""));
+    if (!capture_file.empty())
+      {
+        capture_.reset(new DiagnosticCapture(capture_file));
+        if (!capture_->isOpen())
+          capture_.reset();
+      }
 
     return 0;
   }
 
 
+  /** Choose the unpack instantiation for the current configuration.
+   *
+   *  Called whenever setup() or setParameters() changes the device,
+   *  the target frame or the view window, so that the unpack loops
+   *  test none of them for each point.
+   */
+  void RawData::selectUnpack()
+  {
+    unpack_ = chooseUnpack<VPointCloud>();
+    unpack_packed_ = chooseUnpack<sensor_msgs::PointCloud2>();
+    unpack_timed_ = chooseUnpack<VTPointCloud>();
+    unpack_returns_ = chooseUnpack<ReturnClouds>();
+    unpack_decimated_ = chooseUnpack<DecimatedCloud>();
+    unpack_fused_ = chooseUnpack<FusedCloud>();
+  }
+
+  /** @returns the unpack instantiation writing Cloud */
+  template <class Cloud>
+  typename RawData::UnpackFn<Cloud>::type RawData::chooseUnpack() const
+  {
+    const bool transform = transforming();
+    const bool view_window = !(config_.min_angle == 0
+                               && config_.max_angle == ROTATION_MAX_UNITS);
+
+    if (calibration_.num_lasers == 16)
+      {
+        if (transform)
+          return view_window? &RawData::unpack_vlp16<true, true, Cloud>:
+                              &RawData::unpack_vlp16<true, false, Cloud>;
+        else
+          return view_window? &RawData::unpack_vlp16<false, true, Cloud>:
+                              &RawData::unpack_vlp16<false, false, Cloud>;
+      }
+    else if (calibration_.num_lasers == 32)
+      {
+        if (transform)
+          return view_window? &RawData::unpack_hdl<32, true, true, Cloud>:
+                              &RawData::unpack_hdl<32, true, false, Cloud>;
+        else
+          return view_window? &RawData::unpack_hdl<32, false, true, Cloud>:
+                              &RawData::unpack_hdl<32, false, false, Cloud>;
+      }
+    else if (calibration_.num_lasers == 64)
+      {
+        if (transform)
+          return view_window? &RawData::unpack_hdl<64, true, true, Cloud>:
+                              &RawData::unpack_hdl<64, true, false, Cloud>;
+        else
+          return view_window? &RawData::unpack_hdl<64, false, true, Cloud>:
+                              &RawData::unpack_hdl<64, false, false, Cloud>;
+      }
+    else
+      {
+        // unusual calibration: read the number of lasers at run time
+        if (transform)
+          return view_window? &RawData::unpack_hdl<0, true, true, Cloud>:
+                              &RawData::unpack_hdl<0, true, false, Cloud>;
+        else
+          return view_window? &RawData::unpack_hdl<0, false, true, Cloud>:
+                              &RawData::unpack_hdl<0, false, false, Cloud>;
+      }
+  }
+
   /// Convert scan message to point cloud.
   void RawData::unpack(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg, VPointCloud &pc)
   {
     ROS_DEBUG_STREAM("Received Velodyne message, time: " << scanMsg->header.stamp);
+    on_device_ = (cuda_ && unpackCuda(scanMsg, pc));
+    if (!on_device_)
+      (this->*unpack_)(scanMsg, pc);
+  }
 
-    /** special parsing for the VLP16 **/
+  /** @brief Convert scan message to point cloud on the CUDA device.
+   *
+   *  @returns false if the CPU must do it: for a view window, a
+   *           firing capture, an unusual number of lasers or a
+   *           device error
+   */
+  bool RawData::unpackCuda(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg,
+                           VPointCloud &pc)
+  {
+#ifdef HAVE_CUDA
+    const int num_lasers = calibration_.num_lasers;
+    const size_t n_packets = scanMsg->packets.size();
+    const bool view_window = !(config_.min_angle == 0
+                               && config_.max_angle == ROTATION_MAX_UNITS);
+    if (view_window || capture_ || n_packets == 0
+        || (num_lasers != 16 && num_lasers != 32 && num_lasers != 64))
+      return false;
+
+    const bool transform = transforming();
+    const uint32_t width = scanColumns(*scanMsg);
+    if (transform)
+      columnTransforms(*scanMsg, width);
+
+    CudaScan scan;
+    scan.packets = &scanMsg->packets[0].data[0];
+    scan.packet_stride = sizeof(velodyne_msgs::VelodynePacket);
+    scan.n_packets = n_packets;
+    scan.num_lasers = num_lasers;
+    scan.min_range = config_.min_range;
+    scan.max_range = config_.max_range;
+    scan.transforms = transform? &cuda_transforms_[0]: NULL;
+    int stop;
+    std::string error;
+    if (!cuda_->unpack(scan, &stop, &error))
+      {
+        ROS_ERROR_STREAM_THROTTLE(LOG_PERIOD_, "CUDA unpacking failed,"
+                                  " unpacking on the CPU: " << error);
+        return false;
+      }
+    if (stop < (int) n_packets)
+      ROS_WARN_STREAM_THROTTLE(LOG_PERIOD_, "skipping invalid VLP-16 packet "
+                               << stop << " and the rest of the scan");
+
+    CloudWriter<VPointCloud> out(pc, packed_layout_);
+    out.resize(scanMsg->header,
+               transform? config_.frame_id: scanMsg->header.frame_id,
+               width, num_lasers);
+    memcpy(&pc.points[0], cuda_->hostPoints(),
+           pc.points.size() * sizeof(VPoint));
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  bool RawData::deviceCloud(DeviceCloud &cloud) const
+  {
+#ifdef HAVE_CUDA
+    if (!cuda_ || !on_device_)
+      return false;
+    cloud.device = cuda_->devicePoints();
+    cloud.host = (const VPoint *) cuda_->hostPoints();
+    cloud.width = cuda_->width();
+    cloud.height = cuda_->height();
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  /// Convert scan message to packed point cloud.
+  void RawData::unpack(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg,
+                       sensor_msgs::PointCloud2 &cloud)
+  {
+    ROS_DEBUG_STREAM("Received Velodyne message, time: " << scanMsg->header.stamp);
+    (this->*unpack_packed_)(scanMsg, cloud);
+  }
+
+  /// Convert scan message to timed point cloud.
+  void RawData::unpack(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg,
+                       VTPointCloud &pc)
+  {
+    ROS_DEBUG_STREAM("Received Velodyne message, time: " << scanMsg->header.stamp);
+    (this->*unpack_timed_)(scanMsg, pc);
+  }
+
+  /// Convert scan message to strongest and last return clouds.
+  void RawData::unpackReturns(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg,
+                              VTPointCloud &strongest, VTPointCloud &last)
+  {
+    ROS_DEBUG_STREAM("Received Velodyne message, time: " << scanMsg->header.stamp);
+
+    // The first packet tells the return mode.  Only the VLP-16
+    // unpacking reads dual returns.
+    ReturnClouds returns(strongest, last);
+    if (calibration_.num_lasers == 16 && !scanMsg->packets.empty())
+      {
+        const raw_packet_t *raw =
+          (const raw_packet_t *) &scanMsg->packets[0].data[0];
+        const uint8_t mode = raw->status[PACKET_STATUS_SIZE-2];
+        returns.dual = (mode == 0x39);
+        if (mode == 0x38)               // last return mode
+          returns.single = &last;
+      }
+    (this->*unpack_returns_)(scanMsg, returns);
+  }
+
+  /// Convert scan message to decimated point cloud.
+  void RawData::unpackDecimated(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg,
+                                VPointCloud &pc)
+  {
+    ROS_DEBUG_STREAM("Received Velodyne message, time: " << scanMsg->header.stamp);
+
+    // Dual return firings have two columns, kept or dropped together.
+    int group = 1;
+    if (calibration_.num_lasers == 16 && !scanMsg->packets.empty())
+      {
+        const raw_packet_t *raw =
+          (const raw_packet_t *) &scanMsg->packets[0].data[0];
+        if (raw->status[PACKET_STATUS_SIZE-2] == 0x39)
+          group = 2;
+      }
+    DecimatedCloud decimated(pc, config_.ring_stride, config_.column_stride,
+                             group);
+    (this->*unpack_decimated_)(scanMsg, decimated);
+  }
+
+  /// Convert scan message into its columns of a fused cloud.
+  bool RawData::unpackFused(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg,
+                            VSPointCloud &fused, uint32_t first_column,
+                            uint16_t sensor)
+  {
+    ROS_DEBUG_STREAM("Received Velodyne message, time: " << scanMsg->header.stamp);
+    if (first_column + scanColumns(*scanMsg) > fused.width
+        || scanRows() > fused.height
+        || fused.points.size() != fused.width * fused.height)
+      {
+        ROS_ERROR_STREAM_THROTTLE(LOG_PERIOD_, "scan of sensor " << sensor
+                                  << " does not fit in the fused cloud");
+        return false;
+      }
+    FusedCloud part(fused, first_column, sensor);
+    (this->*unpack_fused_)(scanMsg, part);
+    return true;
+  }
+
+  uint32_t RawData::scanColumns(const velodyne_msgs::VelodyneScan &scanMsg) const
+  {
+    const size_t n_packets = scanMsg.packets.size();
     if (calibration_.num_lasers == 16)
-    {
-      unpack_vlp16(scanMsg, pc);
+      return n_packets * BLOCKS_PER_PACKET * VLP16_FIRINGS_PER_BLOCK;
+    return n_packets * SCANS_PER_PACKET / calibration_.num_lasers;
+  }
+
+  /// Copy the raw returns of a scan message to a compact scan.
+  void RawData::unpackCompact(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg,
+                              velodyne_msgs::VelodyneCompactScan &compact)
+  {
+    const velodyne_pointcloud::CorrectionTable &table =
+      calibration_.correction_table;
+    const int num_lasers = calibration_.num_lasers;
+    const bool vlp16 = (num_lasers == 16);
+    const size_t n_packets = scanMsg->packets.size();
+    const uint32_t width = vlp16?
+      n_packets * BLOCKS_PER_PACKET * VLP16_FIRINGS_PER_BLOCK:
+      n_packets * SCANS_PER_PACKET / num_lasers;
+
+    compact.header = scanMsg->header;
+    compact.calibration_id = calibration_.id;
+    compact.height = num_lasers;
+    compact.width = width;
+    compact.returns_per_firing = 1;
+    compact.azimuth.assign(width, 0);
+    compact.distance.assign(width * num_lasers, 0);
+    compact.intensity.assign(width * num_lasers, 0);
+
+    if (!vlp16)
+      {
+        // HDL columns are filled laser by laser, as in unpack_hdl().
+        // A column takes the azimuth of the block of its first return.
+        uint32_t n_points = 0;
+        for (size_t next = 0; next < n_packets; ++next) {
+          const raw_packet_t *raw =
+            (const raw_packet_t *) &scanMsg->packets[next].data[0];
+          for (int i = 0; i < BLOCKS_PER_PACKET; i++) {
+            int bank_origin = (raw->blocks[i].header == LOWER_BANK)? 32: 0;
+            for (int j = 0, k = 0; j < SCANS_PER_BLOCK;
+                 j++, k += RAW_SCAN_SIZE, n_points++) {
+              uint32_t col = n_points / num_lasers;
+              int ring = table.laser_ring[j + bank_origin];
+              if (col >= width)
+                return;
+              if (n_points % num_lasers == 0)
+                compact.azimuth[col] = raw->blocks[i].rotation;
+              if (ring < 0 || ring >= num_lasers)
+                continue;
+              const uint8_t *data = &raw->blocks[i].data[k];
+              const size_t cell = table.row[j + bank_origin] * width + col;
+              compact.distance[cell] = data[0] | (data[1] << 8);
+              compact.intensity[cell] = data[2];
+            }
+          }
+        }
+        return;
+      }
+
+    for (size_t packet = 0; packet < n_packets; ++packet) {
+      const raw_packet_t *raw =
+        (const raw_packet_t *) &scanMsg->packets[packet].data[0];
+      for (int block = 0; block < BLOCKS_PER_PACKET; block++) {
+        if (UPPER_BANK != raw->blocks[block].header) {
+          ROS_WARN_STREAM_THROTTLE(LOG_PERIOD_, "skipping invalid VLP-16 packet: block "
+                                   << block << " header value is "
+                                   << raw->blocks[block].header);
+          return;                       // leave the rest empty
+        }
+      }
+
+      const bool dual_return = (raw->status[PACKET_STATUS_SIZE-2] == 0x39);
+      const int i_diff = 1 + (int) dual_return;
+      if (dual_return)
+        compact.returns_per_firing = 2;
+
+      float azimuth_diff = 0.0f;
+      for (int block = 0; block < BLOCKS_PER_PACKET; block++) {
+        if (block < (BLOCKS_PER_PACKET-i_diff))
+          azimuth_diff = (float)((36000 + raw->blocks[block+i_diff].rotation
+                                  - raw->blocks[block].rotation)%36000);
+
+        for (int firing = 0; firing < VLP16_FIRINGS_PER_BLOCK; firing++) {
+          int col = vlp16_column(packet, block, firing, dual_return);
+
+          // azimuth of the first beam, as corrected by unpack_vlp16()
+          float azimuth = raw->blocks[block].rotation + azimuth_diff
+            * firing * VLP16_FIRING_TOFFSET / VLP16_BLOCK_TDURATION;
+          compact.azimuth[col] = ((int) round(azimuth)) % 36000;
+
+          const uint8_t *data =
+            &raw->blocks[block].data[firing * VLP16_SCANS_PER_FIRING * RAW_SCAN_SIZE];
+          for (int dsr = 0; dsr < VLP16_SCANS_PER_FIRING;
+               dsr++, data += RAW_SCAN_SIZE) {
+            int ring = table.laser_ring[dsr];
+            if (ring < 0 || ring >= num_lasers)
+              continue;
+            const size_t cell = table.row[dsr] * width + col;
+            compact.distance[cell] = data[0] | (data[1] << 8);
+            compact.intensity[cell] = data[2];
+          }
+        }
+      }
+    }
+  }
+
+  /** Keep a return in its range image cell, unless the cell holds a
+   *  nearer one.
+   *
+   *  @param azimuth rotation of the firing [deg/100]
+   *  @param data raw return
+   */
+  void RawData::addRangeReturn(velodyne_msgs::VelodyneRangeImage &image,
+                               int laser, float azimuth, const uint8_t *data)
+  {
+    const velodyne_pointcloud::CorrectionTable &table =
+      calibration_.correction_table;
+    int raw = data[0] | (data[1] << 8);
+    int ring = table.laser_ring[laser];
+    if (ring < 0 || ring >= image.height || !rawInRange(laser, raw))
       return;
+    float range = raw * DISTANCE_RESOLUTION + table.dist_correction[laser];
+    if (!pointInRange(range))
+      return;
+
+    // bin by the beam azimuth, which the laser's rotation correction
+    // turns away from the firing azimuth
+    float beam = azimuth - rot_correction_units_[laser];
+    beam -= floorf(beam / ROTATION_MAX_UNITS) * ROTATION_MAX_UNITS;
+    uint32_t col = (uint32_t) (beam * image.width / ROTATION_MAX_UNITS);
+    if (col >= image.width)
+      col = 0;
+    size_t cell = table.row[laser] * image.width + col;
+    if (!(image.range[cell] <= range))   // true for NaN
+      {
+        image.range[cell] = range;
+        image.intensity[cell] = data[2];
+      }
+  }
+
+  /** Record the first firing in a range image column.
+   *
+   *  @param azimuth rotation of the firing [deg/100]
+   *  @param time of the firing since the scan stamp [s]
+   */
+  void RawData::addRangeColumn(velodyne_msgs::VelodyneRangeImage &image,
+                               float azimuth, float time)
+  {
+    azimuth -= floorf(azimuth / ROTATION_MAX_UNITS) * ROTATION_MAX_UNITS;
+    uint32_t col = (uint32_t) (azimuth * image.width / ROTATION_MAX_UNITS);
+    if (col >= image.width)
+      col = 0;
+    if (isnan(image.time[col]))
+      {
+        image.time[col] = time;
+        image.azimuth[col] = angles::from_degrees(ROTATION_RESOLUTION * azimuth);
+      }
+  }
+
+  /// Convert scan message to a range image.
+  void RawData::unpackRangeImage(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg,
+                                 velodyne_msgs::VelodyneRangeImage &image)
+  {
+    const int num_lasers = calibration_.num_lasers;
+    const uint32_t width = config_.range_image_width;
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+
+    image.header = scanMsg->header;
+    image.height = num_lasers;
+    image.width = width;
+    image.range.assign(width * num_lasers, nan);
+    image.intensity.assign(width * num_lasers, 0);
+    image.azimuth.assign(width, nan);
+    image.time.assign(width, nan);
+
+    for (size_t packet = 0; packet < scanMsg->packets.size(); ++packet) {
+      const velodyne_msgs::VelodynePacket &pkt = scanMsg->packets[packet];
+      const raw_packet_t *raw = (const raw_packet_t *) &pkt.data[0];
+      const float packet_time = (pkt.stamp - scanMsg->header.stamp).toSec();
+
+      if (num_lasers != 16)
+        {
+          // HDL blocks fire all their lasers at the block azimuth.
+          const bool paired_blocks = (num_lasers == 64);
+          const float block_tduration = paired_blocks?
+            HDL64_FIRING_TDURATION: HDL32_BLOCK_TDURATION;
+          for (int i = 0; i < BLOCKS_PER_PACKET; i++) {
+            int bank_origin = (raw->blocks[i].header == LOWER_BANK)? 32: 0;
+            const float azimuth = raw->blocks[i].rotation;
+            addRangeColumn(image, azimuth, packet_time
+                           + (paired_blocks? i / 2: i) * block_tduration * 1.0e-6f);
+            for (int j = 0, k = 0; j < SCANS_PER_BLOCK; j++, k += RAW_SCAN_SIZE)
+              addRangeReturn(image, j + bank_origin, azimuth,
+                             &raw->blocks[i].data[k]);
+          }
+          continue;
+        }
+
+      // VLP-16 beams fire in sequence while the sensor turns, as in
+      // unpack_vlp16_packet().
+      for (int block = 0; block < BLOCKS_PER_PACKET; block++) {
+        if (UPPER_BANK != raw->blocks[block].header) {
+          ROS_WARN_STREAM_THROTTLE(LOG_PERIOD_, "skipping invalid VLP-16 packet: block "
+                                   << block << " header value is "
+                                   << raw->blocks[block].header);
+          return;                       // leave the rest empty
+        }
+      }
+      const int i_diff = 1 + (int) (raw->status[PACKET_STATUS_SIZE-2] == 0x39);
+      float azimuth_diff = 0.0f;
+      for (int block = 0; block < BLOCKS_PER_PACKET; block++) {
+        if (block < (BLOCKS_PER_PACKET-i_diff))
+          azimuth_diff = (float)((36000 + raw->blocks[block+i_diff].rotation
+                                  - raw->blocks[block].rotation)%36000);
+        const float rate = azimuth_diff / VLP16_BLOCK_TDURATION; // [deg/100 / µs]
+        for (int firing = 0; firing < VLP16_FIRINGS_PER_BLOCK; firing++) {
+          const float t_firing = (block / i_diff) * VLP16_BLOCK_TDURATION
+            + firing * VLP16_FIRING_TOFFSET;
+          const float azimuth = raw->blocks[block].rotation
+            + rate * firing * VLP16_FIRING_TOFFSET;
+          addRangeColumn(image, azimuth, packet_time + t_firing * 1.0e-6f);
+          const uint8_t *data =
+            &raw->blocks[block].data[firing * VLP16_SCANS_PER_FIRING * RAW_SCAN_SIZE];
+          for (int dsr = 0; dsr < VLP16_SCANS_PER_FIRING;
+               dsr++, data += RAW_SCAN_SIZE)
+            addRangeReturn(image, dsr, azimuth + rate * dsr * VLP16_DSR_TOFFSET,
+                           data);
+        }
+      }
     }
+  }
 
-    // Convert scan message header to point cloud message header.
-    pc.header.stamp = pcl_conversions::toPCL(scanMsg->header).stamp;
-
-    // Define dimensions of the organized output point cloud and fill it with NaN-valued points.
-    pc.width  = scanMsg->packets.size() * SCANS_PER_PACKET / calibration_.num_lasers;
-    pc.height = calibration_.num_lasers;
-    VPoint nanPoint;
-    nanPoint.x = nanPoint.y = nanPoint.z = std::numeric_limits<float>::quiet_NaN();
-    nanPoint.intensity = 0u;
-    nanPoint.ring = -1;
-    pc.points.resize(pc.width * pc.height, nanPoint);
-
-    // Set the output point cloud frame.
-    if (tf_listener_ == NULL || config_.frame_id.empty())
-      pc.header.frame_id = scanMsg->header.frame_id;
-    else
-      pc.header.frame_id = config_.frame_id;
+  /** @returns an empty cloud cell: no coordinates, no intensity */
+  static inline VPoint emptyPoint(int ring)
+  {
+    VPoint point;
+    point.x = point.y = point.z = std::numeric_limits<float>::quiet_NaN();
+    point.intensity = 0u;
+    point.ring = ring;
+    return point;
+  }
+
+  /** Empty columns [first, last) of an organized cloud. */
+  template <class Writer>
+  static void emptyColumns(Writer &out, uint32_t first, uint32_t last)
+  {
+    const VPoint empty = emptyPoint(-1);
+    for (uint32_t row = 0; row < out.height(); ++row)
+      for (uint32_t col = first; col < last; ++col)
+        out.set(col, row, empty, 0.0f);
+  }
+
+  /** @brief Compute only the accepted points of a block.
+   *
+   *  For decimated clouds, which drop most of each block: the kernel
+   *  converts the accepted returns one at a time, and the others are
+   *  left zero.
+   */
+  static void unpackAccepted(UnpackBlockFn kernel,
+                             const velodyne_pointcloud::CorrectionTable &table,
+                             int laser, int n, const uint8_t *data,
+                             const float *cos_azimuth, const float *sin_azimuth,
+                             const bool *accepted, BlockPoints &points)
+  {
+    BlockPoints one;
+    for (int j = 0; j < n; ++j)
+      {
+        if (!accepted[j])
+          {
+            points.x[j] = points.y[j] = points.z[j] = 0.0f;
+            points.intensity[j] = points.distance[j] = 0.0f;
+            continue;
+          }
+        kernel(table, laser + j, 1, data + j * RAW_SCAN_SIZE,
+               cos_azimuth + j, sin_azimuth + j, one);
+        points.x[j] = one.x[0];
+        points.y[j] = one.y[0];
+        points.z[j] = one.z[0];
+        points.intensity[j] = one.intensity[0];
+        points.distance[j] = one.distance[0];
+      }
+  }
+
+  /** Store a transform as the row-major 3x4 matrix of transformPoints(). */
+  static void toMatrix(const tf::Transform &transform, float *m)
+  {
+    const tf::Matrix3x3 &basis = transform.getBasis();
+    const tf::Vector3 &origin = transform.getOrigin();
+    for (int i = 0; i < 3; ++i)
+      {
+        m[4*i]   = basis[i].x();
+        m[4*i+1] = basis[i].y();
+        m[4*i+2] = basis[i].z();
+        m[4*i+3] = origin[i];
+      }
+  }
+
+  /** @brief Look up the transform from the sensor to the target frame.
+   *
+   *  @param source_frame sensor frame
+   *  @param stamp time of the sensor pose
+   *  @param target_stamp time of the target frame pose, used when
+   *                      fixed_frame is set
+   *  @param fixed_frame go through config_.fixed_frame_id, if there
+   *                     is one, compensating for the sensor motion
+   *  @param transform returns the transform
+   *  @returns false if tf cannot provide it
+   */
+  bool RawData::lookupTransform(const std::string &source_frame,
+                                const ros::Time &stamp,
+                                const ros::Time &target_stamp,
+                                bool fixed_frame, tf::Transform &transform)
+  {
+    tf::StampedTransform stamped;
+    try
+      {
+        if (fixed_frame && !config_.fixed_frame_id.empty())
+          tf_listener_->lookupTransform(config_.frame_id, target_stamp,
+                                        source_frame, stamp,
+                                        config_.fixed_frame_id, stamped);
+        else
+          tf_listener_->lookupTransform(config_.frame_id, source_frame,
+                                        stamp, stamped);
+      }
+    catch (tf::TransformException &ex)
+      {
+        // only log tf error once every second
+        ROS_WARN_THROTTLE(LOG_PERIOD_, "%s", ex.what());
+        return false;
+      }
+    transform = stamped;
+    return true;
+  }
+
+  /** @brief Find the sensor to target transform across a packet.
+   *
+   *  A fixed extrinsic, see setExtrinsic(), is used as it is.  When
+   *  deskewing, it comes from the poses sampled by samplePoses().
+   *  Otherwise tf is asked for the pose at the packet time and, with
+   *  motion set, at the next packet time through the fixed frame.
+   *  The end of one packet is the start of the next, so that is one
+   *  lookup per packet.
+   *
+   *  @param scanMsg raw Velodyne scan message
+   *  @param packet index of the packet in scanMsg
+   *  @param motion compensate for the sensor motion during the packet
+   *  @param transform returns the transform; the previous packet's
+   *                   on entry, or valid and have_end false for the
+   *                   first one
+   */
+  void RawData::packetTransform(const velodyne_msgs::VelodyneScan &scanMsg,
+                                size_t packet, bool motion,
+                                PacketTransform &transform)
+  {
+    if (has_extrinsic_)
+      {
+        transform.valid = true;
+        transform.start = transform.end = extrinsic_;
+        transform.duration = 0.0f;
+        transform.have_end = false;
+        return;
+      }
+
+    const ros::Time &stamp = scanMsg.packets[packet].stamp;
+    const bool has_next = (packet + 1 < scanMsg.packets.size());
+
+    if (!track_.poses.empty())
+      {
+        const ros::Time &next = has_next? scanMsg.packets[packet+1].stamp: stamp;
+        transform.valid = true;
+        transform.start = track_.at(stamp);
+        transform.end = track_.at(next);
+        transform.duration = (next - stamp).toSec() * 1.0e6;
+        return;
+      }
+
+    if (transform.have_end)
+      transform.start = transform.end;
+    transform.valid = transform.have_end
+      || lookupTransform(scanMsg.header.frame_id, stamp,
+                         scanMsg.header.stamp, motion, transform.start);
+
+    // The last packet has no next packet time: use its start pose.
+    transform.have_end = false;
+    transform.end = transform.start;
+    transform.duration = 0.0f;
+    if (motion && transform.valid && has_next)
+      {
+        const ros::Time &next = scanMsg.packets[packet+1].stamp;
+        transform.have_end = lookupTransform(scanMsg.header.frame_id, next,
+                                             scanMsg.header.stamp, true,
+                                             transform.end);
+        if (transform.have_end)
+          transform.duration = (next - stamp).toSec() * 1.0e6;
+        else
+          transform.end = transform.start;
+      }
+  }
+
+  /** @brief Sample sensor poses across a scan for deskewing.
+   *
+   *  Looks up config_.deskew_samples poses through the fixed frame,
+   *  evenly spaced from the first to the last packet time.  Leaves
+   *  the track empty when deskewing is off, or with a fixed extrinsic.
+   */
+  void RawData::samplePoses(const velodyne_msgs::VelodyneScan &scanMsg)
+  {
+    track_.stamps.clear();
+    track_.poses.clear();
+    if (has_extrinsic_ || config_.deskew_samples <= 0
+        || scanMsg.packets.empty())
+      return;
+
+    const ros::Time &first = scanMsg.packets.front().stamp;
+    const ros::Duration span = scanMsg.packets.back().stamp - first;
+    const int samples = std::max(config_.deskew_samples, 2);
+    tf::Transform pose;
+    for (int i = 0; i < samples; ++i)
+      {
+        ros::Time stamp = first + span * (i / (double) (samples - 1));
+        if (lookupTransform(scanMsg.header.frame_id, stamp,
+                            scanMsg.header.stamp, true, pose))
+          {
+            track_.stamps.push_back(stamp);
+            track_.poses.push_back(pose);
+          }
+      }
+  }
+
+  /** @returns the sensor pose interpolated at stamp, or the nearest
+   *           sampled pose outside the samples */
+  tf::Transform RawData::PoseTrack::at(const ros::Time &stamp) const
+  {
+    if (stamp <= stamps.front())
+      return poses.front();
+    if (stamp >= stamps.back())
+      return poses.back();
+
+    // stamps[i-1] <= stamp < stamps[i]
+    size_t i = std::upper_bound(stamps.begin(), stamps.end(), stamp)
+      - stamps.begin();
+    double ratio = ((stamp - stamps[i-1]).toSec()
+                    / (stamps[i] - stamps[i-1]).toSec());
+    return interpolate(poses[i-1], poses[i], ratio);
+  }
+
+  /** @brief Find the sensor to target transform of each column.
+   *
+   *  For the CUDA backend: looked up as unpack_hdl_packets() and
+   *  unpack_vlp16_packet() do, in CUDA_TRANSFORM_SIZE floats per
+   *  column, all zero when tf has none.
+   *
+   *  @param scanMsg raw Velodyne scan message
+   *  @param width columns of its cloud
+   */
+  void RawData::columnTransforms(const velodyne_msgs::VelodyneScan &scanMsg,
+                                 uint32_t width)
+  {
+    const int num_lasers = calibration_.num_lasers;
+    const bool vlp16 = (num_lasers == 16);
+    const bool paired_blocks = (num_lasers == 64);
+    const float block_tduration = paired_blocks?
+      HDL64_FIRING_TDURATION: HDL32_BLOCK_TDURATION;
+    cuda_transforms_.assign(width * CUDA_TRANSFORM_SIZE, 0.0f);
+    samplePoses(scanMsg);
+
+    PacketTransform transform;
+    transform.valid = false;
+    transform.have_end = false;
+    for (size_t packet = 0; packet < scanMsg.packets.size(); ++packet)
+      {
+        // Only the VLP-16 compensates for the motion during a packet
+        // without deskewing.
+        packetTransform(scanMsg, packet, vlp16, transform);
+        if (!transform.valid)
+          continue;
+
+        const raw_packet_t *raw =
+          (const raw_packet_t *) &scanMsg.packets[packet].data[0];
+        const bool dual = (vlp16 && raw->status[PACKET_STATUS_SIZE-2] == 0x39);
+        const int i_diff = 1 + (int) dual;
+        for (int block = 0; block < BLOCKS_PER_PACKET; block++)
+          {
+            if (!vlp16)
+              {
+                float *m = &cuda_transforms_[CUDA_TRANSFORM_SIZE
+                                             * ((packet * SCANS_PER_PACKET
+                                                 + block * SCANS_PER_BLOCK)
+                                                / num_lasers)];
+                toMatrix(transform.at((paired_blocks? block / 2: block)
+                                      * block_tduration), m);
+                m[12] = 1.0f;
+                continue;
+              }
+            for (int firing = 0; firing < VLP16_FIRINGS_PER_BLOCK; firing++)
+              {
+                float *m = &cuda_transforms_[CUDA_TRANSFORM_SIZE
+                                             * vlp16_column(packet, block,
+                                                            firing, dual)];
+                toMatrix(transform.at((block / i_diff) * VLP16_BLOCK_TDURATION
+                                      + firing * VLP16_FIRING_TOFFSET), m);
+                m[12] = 1.0f;
+              }
+          }
+      }
+  }
+
+  /** @brief Split the packets of a scan for the worker pool.
+   *
+   *  @param n_packets number of packets in the scan
+   *  @param bounds returns the first packet of each range, then
+   *                n_packets; a single range without a pool, or while
+   *                capturing, as DiagnosticCapture has one producer
+   */
+  void RawData::packetRanges(size_t n_packets, std::vector<size_t> &bounds) const
+  {
+    size_t ranges = 1;
+    if (workers_ && !capture_)
+      ranges = std::min((size_t) workers_->threads() + 1,
+                        n_packets / MIN_PACKETS_PER_TASK);
+    ranges = std::max(ranges, (size_t) 1);
+
+    bounds.resize(ranges + 1);
+    for (size_t r = 0; r <= ranges; ++r)
+      bounds[r] = r * n_packets / ranges;
+  }
+
+  /** @returns number of HDL points unpack_hdl_packets() reads from
+   *           a packet, all unless the view window skips blocks */
+  int RawData::hdlPacketPoints(const velodyne_msgs::VelodynePacket &pkt,
+                               bool view_window)
+  {
+    if (!view_window)
+      return SCANS_PER_PACKET;
+
+    const raw_packet_t *raw = (const raw_packet_t *) &pkt.data[0];
+    if (!arcInViewWindow(raw->blocks[0].rotation,
+                         raw->blocks[BLOCKS_PER_PACKET-1].rotation))
+      return 0;
+    int n_points = 0;
+    for (int i = 0; i < BLOCKS_PER_PACKET; i++)
+      if (inViewWindow(raw->blocks[i].rotation))
+        n_points += SCANS_PER_BLOCK;
+    return n_points;
+  }
 
-    // process each packet provided by the driver
+  /** @brief convert raw HDL-32E or HDL-64E message to point cloud
+   *
+   *  @param NUM_LASERS number of lasers, or 0 to use the calibration's
+   *  @param TRANSFORM transform points to config_.frame_id
+   *  @param VIEW_WINDOW only publish points inside the view window
+   *  @param Cloud output type with a CloudWriter, see cloud_writer.h
+   */
+  template <int NUM_LASERS, bool TRANSFORM, bool VIEW_WINDOW, class Cloud>
+  void RawData::unpack_hdl(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg,
+                           Cloud &cloud)
+  {
+    const int num_lasers = NUM_LASERS? NUM_LASERS: calibration_.num_lasers;
+
+    // Define the header and dimensions of the organized output point
+    // cloud, in the target frame if transforming.
+    CloudWriter<Cloud> out(cloud, packed_layout_);
+    out.resize(scanMsg->header,
+               TRANSFORM? config_.frame_id: scanMsg->header.frame_id,
+               scanMsg->packets.size() * SCANS_PER_PACKET / num_lasers,
+               num_lasers);
+
+    if (TRANSFORM)
+      samplePoses(*scanMsg);
+
+    // process each packet provided by the driver, in parallel ranges
+    // when there is a worker pool
+    std::vector<size_t> bounds;
+    packetRanges(scanMsg->packets.size(), bounds);
     int n_points = 0;    // Number of points read.
-    for (size_t next = 0; next < scanMsg->packets.size(); ++next) {
-      const velodyne_msgs::VelodynePacket& pkt = scanMsg->packets[next];
+    if (bounds.size() == 2)
+      {
+        n_points = unpack_hdl_packets<NUM_LASERS, TRANSFORM, VIEW_WINDOW, Cloud>(
+                     *scanMsg, bounds[0], bounds[1], 0, out);
+      }
+    else
+      {
+        // Each range continues the column order after the points of
+        // the ranges before it, counted from the block azimuths.
+        std::vector<WorkerPool::Task> tasks;
+        for (size_t r = 0; r + 1 < bounds.size(); ++r)
+          {
+            tasks.push_back(boost::bind(
+                &RawData::unpack_hdl_packets<NUM_LASERS, TRANSFORM,
+                                             VIEW_WINDOW, Cloud>,
+                this, boost::cref(*scanMsg), bounds[r], bounds[r+1],
+                n_points, boost::ref(out)));
+            for (size_t p = bounds[r]; p < bounds[r+1]; ++p)
+              n_points += hdlPacketPoints(scanMsg->packets[p], VIEW_WINDOW);
+          }
+        workers_->run(tasks);
+      }
+
+    // Empty the cells left after skipped blocks, continuing the
+    // column order of the points read.
+    const velodyne_pointcloud::CorrectionTable &table =
+      calibration_.correction_table;
+    const VPoint empty = emptyPoint(-1);
+    for (int k = n_points; k < (int) (out.width() * num_lasers); ++k)
+      out.set(k / num_lasers, table.row[k % num_lasers], empty, 0.0f);
+  }
+
+  /** @brief convert a range of raw HDL packets into their columns
+   *
+   *  @param scanMsg raw Velodyne scan message
+   *  @param first first packet to convert
+   *  @param last packet after the range
+   *  @param n_points points read from the packets before first
+   *  @param out writer of the organized point cloud, already sized
+   *  @returns points read up to last
+   */
+  template <int NUM_LASERS, bool TRANSFORM, bool VIEW_WINDOW, class Cloud>
+  int RawData::unpack_hdl_packets(const velodyne_msgs::VelodyneScan &scanMsg,
+                                  size_t first, size_t last, int n_points,
+                                  CloudWriter<Cloud> &out)
+  {
+    const int num_lasers = NUM_LASERS? NUM_LASERS: calibration_.num_lasers;
+    const velodyne_pointcloud::CorrectionTable &table =
+      calibration_.correction_table;
+    BlockPoints points;
+    float cos_azimuth[SCANS_PER_BLOCK];
+    float sin_azimuth[SCANS_PER_BLOCK];
+
+    // Firing duration of each block, for deskewing.  HDL-64E upper
+    // and lower blocks come in pairs firing together.
+    const bool paired_blocks = (num_lasers == 64);
+    const float block_tduration = paired_blocks?
+      HDL64_FIRING_TDURATION: HDL32_BLOCK_TDURATION;
+    PacketTransform transform;
+    transform.valid = false;
+    transform.have_end = false;
+
+    for (size_t next = first; next < last; ++next) {
+      const velodyne_msgs::VelodynePacket& pkt = scanMsg.packets[next];
       const raw_packet_t *raw = (const raw_packet_t *) &pkt.data[0];
 
+      // Skip whole packets outside the view window.
+      if (VIEW_WINDOW
+          && !arcInViewWindow(raw->blocks[0].rotation,
+                              raw->blocks[BLOCKS_PER_PACKET-1].rotation))
+        continue;
+
+      // Point times are relative to the cloud stamp.
+      const float packet_time = (pkt.stamp - scanMsg.header.stamp).toSec();
+
+      // Find the sensor pose for the packet.  Only deskewing moves it
+      // during the packet.
+      float matrix[12];
+      if (TRANSFORM)
+        {
+          packetTransform(scanMsg, next, false, transform);
+          if (transform.valid)
+            toMatrix(transform.start, matrix);
+        }
+
       for (int i = 0; i < BLOCKS_PER_PACKET; i++) {
 
         // upper bank lasers are numbered [0..31]
@@ -177,444 +1261,356 @@ namespace velodyne_rawdata
           bank_origin = 32;
         }
 
+        /*condition added to avoid calculating points which are not
+          in the interesting area (min_angle < area < max_angle)*/
+        const uint16_t rotation = raw->blocks[i].rotation;
+        if (VIEW_WINDOW && !inViewWindow(rotation))
+          continue;
+
+        // Skip the blocks of columns a decimated cloud drops.
+        if (!out.keepColumn(n_points / num_lasers)) {
+          n_points += SCANS_PER_BLOCK;
+          continue;
+        }
+        const float block_offset = (paired_blocks? i / 2: i) * block_tduration;
+
+        // Reject missing and out of range returns before any point
+        // math, and skip the math for blocks without any others.
+        bool accepted[SCANS_PER_BLOCK];
+        int n_accepted = 0;
         for (int j = 0, k = 0; j < SCANS_PER_BLOCK; j++, k += RAW_SCAN_SIZE) {
+          accepted[j] = (out.keepRow(table.row[j + bank_origin])
+                         && rawInRange(j + bank_origin,
+                                       raw->blocks[i].data[k]
+                                       | (raw->blocks[i].data[k+1] << 8)));
+          n_accepted += accepted[j];
+        }
 
-          float x, y, z;
-          float intensity;
-          uint8_t laser_number;       ///< hardware laser number
+        // Compute all 32 points of this block at once.  They share
+        // the block azimuth.
+        if (n_accepted > 0) {
+          for (int j = 0; j < SCANS_PER_BLOCK; j++) {
+            cos_azimuth[j] = cos_rot_table_[rotation];
+            sin_azimuth[j] = sin_rot_table_[rotation];
+          }
+          if (CloudWriter<Cloud>::DECIMATED)
+            unpackAccepted(unpack_block_, table, bank_origin, SCANS_PER_BLOCK,
+                           raw->blocks[i].data, cos_azimuth, sin_azimuth,
+                           accepted, points);
+          else
+            unpack_block_(table, bank_origin, SCANS_PER_BLOCK,
+                          raw->blocks[i].data, cos_azimuth, sin_azimuth, points);
+          if (TRANSFORM && transform.valid)
+            {
+              if (transform.duration > 0.0f)
+                toMatrix(transform.at(block_offset), matrix);
+              transformPoints(matrix, SCANS_PER_BLOCK, points);
+            }
+        }
 
-          laser_number = j + bank_origin;
-          velodyne_pointcloud::LaserCorrection &corrections =
-            calibration_.laser_corrections[laser_number];
+        for (int j = 0; j < SCANS_PER_BLOCK; j++) {
 
-          /** Position Calculation */
+          int laser = j + bank_origin;  ///< hardware laser number
 
-          union two_bytes tmp;
-          tmp.bytes[0] = raw->blocks[i].data[k];
-          tmp.bytes[1] = raw->blocks[i].data[k+1];
-          /*condition added to avoid calculating points which are not
-            in the interesting area (min_angle < area < max_angle)*/
-          if ((raw->blocks[i].rotation >= config_.min_angle
-               && raw->blocks[i].rotation <= config_.max_angle
-               && config_.min_angle < config_.max_angle)
-               ||(config_.min_angle > config_.max_angle
-               && (raw->blocks[i].rotation <= config_.max_angle
-               || raw->blocks[i].rotation >= config_.min_angle))){
-            float distance = tmp.uint * DISTANCE_RESOLUTION;
-            distance += corrections.dist_correction;
-
-            float cos_vert_angle = corrections.cos_vert_correction;
-            float sin_vert_angle = corrections.sin_vert_correction;
-            float cos_rot_correction = corrections.cos_rot_correction;
-            float sin_rot_correction = corrections.sin_rot_correction;
-
-            // cos(a-b) = cos(a)*cos(b) + sin(a)*sin(b)
-            // sin(a-b) = sin(a)*cos(b) - cos(a)*sin(b)
-            float cos_rot_angle =
-              cos_rot_table_[raw->blocks[i].rotation] * cos_rot_correction +
-              sin_rot_table_[raw->blocks[i].rotation] * sin_rot_correction;
-            float sin_rot_angle =
-              sin_rot_table_[raw->blocks[i].rotation] * cos_rot_correction -
-              cos_rot_table_[raw->blocks[i].rotation] * sin_rot_correction;
-
-            float horiz_offset = corrections.horiz_offset_correction;
-            float vert_offset = corrections.vert_offset_correction;
-
-            // Compute the distance in the xy plane (w/o accounting for rotation)
-            /**the new term of 'vert_offset * sin_vert_angle'
-             * was added to the expression due to the mathemathical
-             * model we used.
-             */
-            float xy_distance = distance * cos_vert_angle - vert_offset * sin_vert_angle;
-
-            // Calculate temporal X, use absolute value.
-            float xx = xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle;
-            // Calculate temporal Y, use absolute value
-            float yy = xy_distance * cos_rot_angle + horiz_offset * sin_rot_angle;
-            if (xx < 0) xx=-xx;
-            if (yy < 0) yy=-yy;
-
-            // Get 2points calibration values,Linear interpolation to get distance
-            // correction for X and Y, that means distance correction use
-            // different value at different distance
-            float distance_corr_x = 0;
-            float distance_corr_y = 0;
-            if (corrections.two_pt_correction_available) {
-              distance_corr_x =
-                (corrections.dist_correction - corrections.dist_correction_x)
-                  * (xx - 2.4) / (25.04 - 2.4)
-                + corrections.dist_correction_x;
-              distance_corr_x -= corrections.dist_correction;
-              distance_corr_y =
-                (corrections.dist_correction - corrections.dist_correction_y)
-                  * (yy - 1.93) / (25.04 - 1.93)
-                + corrections.dist_correction_y;
-              distance_corr_y -= corrections.dist_correction;
-            }
+          // Compute this point's index in the point cloud.
+          int col = n_points / num_lasers;
+          int row = table.row[laser];
 
-            float distance_x = distance + distance_corr_x;
-            /**the new term of 'vert_offset * sin_vert_angle'
-             * was added to the expression due to the mathemathical
-             * model we used.
-             */
-            xy_distance = distance_x * cos_vert_angle - vert_offset * sin_vert_angle ;
-            ///the expression with '-' is proved to be better than the one with '+'
-            x = xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle;
-
-            float distance_y = distance + distance_corr_y;
-            xy_distance = distance_y * cos_vert_angle - vert_offset * sin_vert_angle ;
-            /**the new term of 'vert_offset * sin_vert_angle'
-             * was added to the expression due to the mathemathical
-             * model we used.
-             */
-            y = xy_distance * cos_rot_angle + horiz_offset * sin_rot_angle;
-
-            // Using distance_y is not symmetric, but the velodyne manual
-            // does this.
-            /**the new term of 'vert_offset * cos_vert_angle'
-             * was added to the expression due to the mathemathical
-             * model we used.
-             */
-            z = distance_y * sin_vert_angle + vert_offset*cos_vert_angle;
-
-            /** Use standard ROS coordinate system (right-hand rule) */
-            float x_coord = y;
-            float y_coord = -x;
-            float z_coord = z;
-
-            /** Intensity Calculation */
-
-            float min_intensity = corrections.min_intensity;
-            float max_intensity = corrections.max_intensity;
-
-            intensity = raw->blocks[i].data[k+2];
-
-            float focal_offset = 256
-                               * (1 - corrections.focal_distance / 13100)
-                               * (1 - corrections.focal_distance / 13100);
-            float focal_slope = corrections.focal_slope;
-            intensity += focal_slope * (abs(focal_offset - 256 *
-              (1 - static_cast<float>(tmp.uint)/65535)*(1 - static_cast<float>(tmp.uint)/65535)));
-            intensity = (intensity < min_intensity) ? min_intensity : intensity;
-            intensity = (intensity > max_intensity) ? max_intensity : intensity;
-
-            // Compute this point's index in the point cloud.
-            int col = n_points / calibration_.num_lasers;
-            int row = calibration_.num_lasers-1 - corrections.laser_ring;
-
-            // Increase the point counter.
-            n_points++;
-
-            // Set the point's ring number.
-            pc.at(col, row).ring = corrections.laser_ring;
-
-            // If the point is not in the valid measurement range, skip it.
-            if (!pointInRange(distance))
-                continue;
+          // Increase the point counter.
+          n_points++;
 
-            // Set the point's intensity.
-            pc.at(col, row).intensity = intensity;
+          // Build the point, then write it once.
+          VPoint point = emptyPoint(table.laser_ring[laser]);
 
-            // Set the point's coordinates.
-            if (tf_listener_ == NULL || config_.frame_id.empty())
-            {
-                pc.at(col, row).x = x_coord;
-                pc.at(col, row).y = y_coord;
-                pc.at(col, row).z = z_coord;
-            }
-            else
-            {
-                // If given transform listener, transform point from sensor frame to target frame.
-                geometry_msgs::PointStamped t_point;
-                /// \todo Use the exact beam firing time for transforming points,
-                ///       not the packet time.
-                t_point.header.stamp = pkt.stamp; // Sensor pose equals the time of first firing of the first firing sequence in the packet 
-                t_point.header.frame_id = scanMsg->header.frame_id;
-                t_point.point.x = x_coord;
-                t_point.point.y = y_coord;
-                t_point.point.z = z_coord;
-
-                try
-                {
-                    ROS_DEBUG_STREAM_THROTTLE(LOG_PERIOD_,
-                        "Transforming from " << t_point.header.frame_id << " to " << pc.header.frame_id << ".");
-                    tf_listener_->transformPoint(pc.header.frame_id, t_point, t_point);
-                }
-                catch (std::exception& ex)
-                {
-                    // only log tf error once every 100 times
-                    ROS_WARN_THROTTLE(LOG_PERIOD_, "%s", ex.what());
-                    continue;                   // skip this point
-                }
-
-                pc.at(col, row).x = t_point.point.x;
-                pc.at(col, row).y = t_point.point.y;
-                pc.at(col, row).z = t_point.point.z;
+          // If the point is in the valid measurement range, set its
+          // intensity and, unless the transform failed, coordinates.
+          if (accepted[j] && pointInRange(points.distance[j])) {
+            point.intensity = points.intensity[j];
+            if (!TRANSFORM || transform.valid) {
+              point.x = points.x[j];
+              point.y = points.y[j];
+              point.z = points.z[j];
             }
           }
+          out.set(col, row, point, packet_time + block_offset * 1.0e-6f);
         }
       }
     }
+    return n_points;
   }
 
 
+  /** @brief convert raw VLP16 message to point cloud
+   *
+   *  @param TRANSFORM transform points to config_.frame_id
+   *  @param VIEW_WINDOW only publish points inside the view window
+   *  @param Cloud output type with a CloudWriter, see cloud_writer.h
+   */
+  template <bool TRANSFORM, bool VIEW_WINDOW, class Cloud>
   void RawData::unpack_vlp16(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg,
-                             VPointCloud &pc)
+                             Cloud &cloud)
   {
-    float azimuth;
-    float azimuth_diff; // azimuth(N+2)-azimuth(N) with N ... number of firing in packet
-    float last_azimuth_diff = 0.0;
-    float azimuth_corrected_f;
-    int azimuth_corrected;
-    float x, y, z;
-    float intensity;
-
-    // Convert scan message header to point cloud message header.
-    pc.header.stamp = pcl_conversions::toPCL(scanMsg->header).stamp;
-
-    // Initialize the organized output point cloud.
-    pc.width  = scanMsg->packets.size() * BLOCKS_PER_PACKET * VLP16_FIRINGS_PER_BLOCK;
-    pc.height = calibration_.num_lasers;
-    VPoint nan_point;
-    nan_point.x = nan_point.y = nan_point.z = std::numeric_limits<float>::quiet_NaN();
-    nan_point.intensity = 0u;
-    nan_point.ring = -1;
-    pc.points.resize(pc.width * pc.height, nan_point);
-
-    // Set the output point cloud frame ID.
-    if (tf_listener_ == NULL || config_.frame_id.empty())
-      pc.header.frame_id = scanMsg->header.frame_id;
+    // Initialize the organized output point cloud, in the target
+    // frame if transforming.
+    CloudWriter<Cloud> out(cloud, packed_layout_);
+    out.resize(scanMsg->header,
+               TRANSFORM? config_.frame_id: scanMsg->header.frame_id,
+               scanMsg->packets.size() * BLOCKS_PER_PACKET
+               * VLP16_FIRINGS_PER_BLOCK, calibration_.num_lasers);
+
+    // Sensor poses sampled across the scan when deskewing.
+    if (TRANSFORM)
+      samplePoses(*scanMsg);
+
+    // Packet columns are fixed, so ranges of packets convert in
+    // parallel when there is a worker pool.
+    std::vector<size_t> bounds;
+    packetRanges(scanMsg->packets.size(), bounds);
+    std::vector<size_t> stops(bounds.size() - 1);
+    if (stops.size() == 1)
+      {
+        unpack_vlp16_packets<TRANSFORM, VIEW_WINDOW, Cloud>(
+          *scanMsg, bounds[0], bounds[1], out, stops[0]);
+      }
     else
-      pc.header.frame_id = config_.frame_id;
-
-    // process each packet provided by the driver
-    for (size_t packet = 0; packet < scanMsg->packets.size(); ++packet) {
-      const velodyne_msgs::VelodynePacket& pkt = scanMsg->packets[packet];
-      const raw_packet_t *raw = (const raw_packet_t *) &pkt.data[0];
+      {
+        std::vector<WorkerPool::Task> tasks;
+        for (size_t r = 0; r < stops.size(); ++r)
+          tasks.push_back(boost::bind(
+              &RawData::unpack_vlp16_packets<TRANSFORM, VIEW_WINDOW, Cloud>,
+              this, boost::cref(*scanMsg), bounds[r], bounds[r+1],
+              boost::ref(out), boost::ref(stops[r])));
+        workers_->run(tasks);
+      }
 
-      const raw_packet_vlp16_t *raw_c = (const raw_packet_vlp16_t *) &pkt.data[0];
+    // bad packet: skip the rest, whatever later ranges found
+    for (size_t r = 0; r < stops.size(); ++r)
+      {
+        if (stops[r] < bounds[r+1])
+          {
+            emptyColumns(out, stops[r] * BLOCKS_PER_PACKET
+                         * VLP16_FIRINGS_PER_BLOCK, out.width());
+            return;
+          }
+      }
+  }
 
+  /** @brief convert a range of raw VLP16 packets into their columns
+   *
+   *  @param scanMsg raw Velodyne scan message
+   *  @param first first packet to convert
+   *  @param last packet after the range
+   *  @param out writer of the organized point cloud, already sized
+   *  @param stop returns the first invalid packet, or last
+   */
+  template <bool TRANSFORM, bool VIEW_WINDOW, class Cloud>
+  void RawData::unpack_vlp16_packets(const velodyne_msgs::VelodyneScan &scanMsg,
+                                     size_t first, size_t last,
+                                     CloudWriter<Cloud> &out, size_t &stop)
+  {
+    // Sensor poses at each packet time, unless deskewing.  Each range
+    // looks up its first pose itself.
+    PacketTransform transform;
+    transform.valid = false;
+    transform.have_end = false;
+
+    for (size_t packet = first; packet < last; ++packet) {
+      const velodyne_msgs::VelodynePacket& pkt = scanMsg.packets[packet];
+      const raw_packet_t *raw = (const raw_packet_t *) &pkt.data[0];
 
-      ROS_INFO_STREAM("Time Stamp: " << std::setprecision(12) << packet_interp_time(raw_c->time)*1.0e-6);
-      assert(packet_interp_time(raw_c->time) < 3600*1.e6);
-      ROS_INFO_STREAM("Return mode: " << std::hex << +raw_c->return_type << " data source: " << std::hex <<  +raw_c->data_source);
+      if (TRANSFORM)
+        packetTransform(scanMsg, packet, true, transform);
+
+      // Read the factory bytes to find out whether the sensor is in
+      // dual return mode, which changes the packet layout.
+      bool valid;
+      if (raw->status[PACKET_STATUS_SIZE-2] == 0x39)
+        valid = unpack_vlp16_packet<true, TRANSFORM, VIEW_WINDOW, Cloud>(
+                  scanMsg, packet, transform, out);
+      else
+        valid = unpack_vlp16_packet<false, TRANSFORM, VIEW_WINDOW, Cloud>(
+                  scanMsg, packet, transform, out);
+      if (!valid) {
+        stop = packet;
+        return;
+      }
+    }
+    stop = last;
+  }
 
-      // Read the factory bytes to find out whether the sensor is in dual return mode.
-      const bool dual_return = (raw->status[PACKET_STATUS_SIZE-2] == 0x39);
+  /** @brief convert one raw VLP16 packet into its point cloud columns
+   *
+   *  @param DUAL_RETURN packet holds dual returns
+   *  @param TRANSFORM transform points to config_.frame_id
+   *  @param VIEW_WINDOW only publish points inside the view window
+   *  @param scanMsg raw Velodyne scan message
+   *  @param packet index of the packet in scanMsg
+   *  @param transform sensor to target transform, if TRANSFORM
+   *  @param out writer of the organized point cloud, already sized
+   *  @returns false if the packet is invalid
+   */
+  template <bool DUAL_RETURN, bool TRANSFORM, bool VIEW_WINDOW, class Cloud>
+  bool RawData::unpack_vlp16_packet(const velodyne_msgs::VelodyneScan &scanMsg,
+                                    size_t packet,
+                                    const PacketTransform &transform,
+                                    CloudWriter<Cloud> &out)
+  {
+    float azimuth;
+    float azimuth_diff; // azimuth(N+2)-azimuth(N) with N ... number of firing in packet
+    float last_azimuth_diff = 0.0;
+    float azimuth_corrected_f;
+    int azimuth_corrected[VLP16_SCANS_PER_FIRING];
+    float cos_azimuth[VLP16_SCANS_PER_FIRING];
+    float sin_azimuth[VLP16_SCANS_PER_FIRING];
+    BlockPoints points;
+
+    const velodyne_pointcloud::CorrectionTable &table =
+      calibration_.correction_table;
+    const velodyne_msgs::VelodynePacket& pkt = scanMsg.packets[packet];
+    const raw_packet_t *raw = (const raw_packet_t *) &pkt.data[0];
+    const raw_packet_vlp16_t *raw_c = (const raw_packet_vlp16_t *) &pkt.data[0];
+
+    // Point times are relative to the cloud stamp.
+    const float packet_time = (pkt.stamp - scanMsg.header.stamp).toSec();
+
+    // Skip whole packets outside the view window.  The last firings
+    // extend past the last block azimuth, so allow a degree more.
+    if (VIEW_WINDOW
+        && !arcInViewWindow(raw->blocks[0].rotation,
+                            (raw->blocks[BLOCKS_PER_PACKET-1].rotation + 100)
+                            % ROTATION_MAX_UNITS)) {
+      const uint32_t first = packet * BLOCKS_PER_PACKET * VLP16_FIRINGS_PER_BLOCK;
+      emptyColumns(out, first, first + BLOCKS_PER_PACKET * VLP16_FIRINGS_PER_BLOCK);
+      return true;
+    }
 
-      // Calculate the index step to the next block with new azimuth value.
-      // The index step depends on whether the sensor runs in single or
-      // dual return mode.
-      int i_diff = 1 + (int)dual_return;
+    // Calculate the index step to the next block with new azimuth value.
+    // The index step depends on whether the sensor runs in single or
+    // dual return mode.
+    const int i_diff = 1 + (int)DUAL_RETURN;
+
+    // Process each block.
+    for (int block = 0; block < BLOCKS_PER_PACKET; block++) {
+      // Dual return blocks alternate the last and the strongest
+      // returns of the same firings.
+      const uint8_t return_index = !DUAL_RETURN? velodyne_pointcloud::RETURN_SINGLE:
+        (block % 2? velodyne_pointcloud::RETURN_STRONGEST:
+                    velodyne_pointcloud::RETURN_LAST);
+
+      // Sanity check: ignore packets with mangled or otherwise different contents.
+      if (UPPER_BANK != raw->blocks[block].header) {
+        // Do not flood the log with messages, only issue at most one
+        // of these warnings per second.
+        ROS_WARN_STREAM_THROTTLE(LOG_PERIOD_, "skipping invalid VLP-16 packet: block "
+                                 << block << " header value is "
+                                 << raw->blocks[block].header);
+        return false;
+      }
 
-      // Process each block.
-      for (int block = 0; block < BLOCKS_PER_PACKET; block++) {
-        // Sanity check: ignore packets with mangled or otherwise different contents.
-        if (UPPER_BANK != raw->blocks[block].header) {
-          // Do not flood the log with messages, only issue at most one
-          // of these warnings per second.
-          ROS_WARN_STREAM_THROTTLE(LOG_PERIOD_, "skipping invalid VLP-16 packet: block "
-                                   << block << " header value is "
-                                   << raw->blocks[block].header);
-          return;                         // bad packet: skip the rest
-        }
+      // Calculate difference between current and next block's azimuth angle.
+      azimuth = (float)(raw->blocks[block].rotation);
+      if (block < (BLOCKS_PER_PACKET-i_diff)){
+        azimuth_diff = (float)((36000 + raw->blocks[block+i_diff].rotation
+                               - raw->blocks[block].rotation)%36000);
+        last_azimuth_diff = azimuth_diff;
+      }else{
+        azimuth_diff = last_azimuth_diff;
+      }
 
-        // Calculate difference between current and next block's azimuth angle.
-        azimuth = (float)(raw->blocks[block].rotation);
-        if (block < (BLOCKS_PER_PACKET-i_diff)){
-          azimuth_diff = (float)((36000 + raw->blocks[block+i_diff].rotation
-                                 - raw->blocks[block].rotation)%36000);
-          last_azimuth_diff = azimuth_diff;
-        }else{
-          azimuth_diff = last_azimuth_diff;
+      // Process each firing.
+      for (int firing=0; firing < VLP16_FIRINGS_PER_BLOCK; firing++){
+        // Compute the column index of the points, and skip the firing
+        // if a decimated cloud drops it.
+        int col = vlp16_column(packet, block, firing, DUAL_RETURN);
+        if (!out.keepColumn(col))
+          continue;
+
+        // Time of firing w.r.t. the packet time in [µs].
+        const float t_firing = (block / i_diff) * VLP16_BLOCK_TDURATION
+          + firing * VLP16_FIRING_TOFFSET;
+
+        // Beams outside the view window, missing or out of range
+        // returns need no point math.
+        bool accepted[VLP16_SCANS_PER_FIRING];
+        int n_accepted = 0;
+        for (int dsr=0, k=firing*VLP16_SCANS_PER_FIRING*RAW_SCAN_SIZE;
+             dsr < VLP16_SCANS_PER_FIRING; dsr++, k+=RAW_SCAN_SIZE){
+          // Time of beam firing w.r.t. beginning of block in [µs].
+          float t_beam = dsr*VLP16_DSR_TOFFSET + firing*VLP16_FIRING_TOFFSET;
+
+          /** correct for the laser rotation as a function of timing during the firings **/
+          azimuth_corrected_f = azimuth + (azimuth_diff * t_beam / VLP16_BLOCK_TDURATION);
+          azimuth_corrected[dsr] = ((int)round(azimuth_corrected_f)) % 36000;
+          cos_azimuth[dsr] = cos_rot_table_[azimuth_corrected[dsr]];
+          sin_azimuth[dsr] = sin_rot_table_[azimuth_corrected[dsr]];
+
+          accepted[dsr] = ((!VIEW_WINDOW || inViewWindow(azimuth_corrected[dsr]))
+                           && out.keepRow(table.row[dsr])
+                           && rawInRange(dsr, raw->blocks[block].data[k]
+                                         | (raw->blocks[block].data[k+1] << 8)));
+          n_accepted += accepted[dsr];
         }
 
-        // Process each firing.
-        for (int firing=0, k=0; firing < VLP16_FIRINGS_PER_BLOCK; firing++){
-          for (int dsr=0; dsr < VLP16_SCANS_PER_FIRING; dsr++, k+=RAW_SCAN_SIZE){
-            // Time of beam firing w.r.t. beginning of block in [µs].
-            float t_beam = dsr*VLP16_DSR_TOFFSET + firing*VLP16_FIRING_TOFFSET;
-
-            velodyne_pointcloud::LaserCorrection &corrections =
-              calibration_.laser_corrections[dsr];
-
-            /** Position Calculation */
-            union two_bytes tmp;
-            tmp.bytes[0] = raw->blocks[block].data[k];
-            tmp.bytes[1] = raw->blocks[block].data[k+1];
-
-            /** correct for the laser rotation as a function of timing during the firings **/
-            azimuth_corrected_f = azimuth + (azimuth_diff * t_beam / VLP16_BLOCK_TDURATION);
-            azimuth_corrected = ((int)round(azimuth_corrected_f)) % 36000;
-
-            file_ << pkt.stamp + ros::Duration((block*VLP16_BLOCK_TDURATION+t_beam)*1.0e-6)  << " " << azimuth_corrected <<"\n";
-
-            /*condition added to avoid calculating points which are not
-              in the interesting defined area (min_angle < area < max_angle)*/
-            if ((azimuth_corrected >= config_.min_angle
-                 && azimuth_corrected <= config_.max_angle
-                 && config_.min_angle < config_.max_angle)
-                 ||(config_.min_angle > config_.max_angle
-                 && (azimuth_corrected <= config_.max_angle
-                 || azimuth_corrected >= config_.min_angle))){
-
-              // convert polar coordinates to Euclidean XYZ
-              float distance = tmp.uint * DISTANCE_RESOLUTION;
-              distance += corrections.dist_correction;
-
-              float cos_vert_angle = corrections.cos_vert_correction;
-              float sin_vert_angle = corrections.sin_vert_correction;
-              float cos_rot_correction = corrections.cos_rot_correction;
-              float sin_rot_correction = corrections.sin_rot_correction;
-
-              // cos(a-b) = cos(a)*cos(b) + sin(a)*sin(b)
-              // sin(a-b) = sin(a)*cos(b) - cos(a)*sin(b)
-              float cos_rot_angle =
-                cos_rot_table_[azimuth_corrected] * cos_rot_correction +
-                sin_rot_table_[azimuth_corrected] * sin_rot_correction;
-              float sin_rot_angle =
-                sin_rot_table_[azimuth_corrected] * cos_rot_correction -
-                cos_rot_table_[azimuth_corrected] * sin_rot_correction;
-
-              float horiz_offset = corrections.horiz_offset_correction;
-              float vert_offset = corrections.vert_offset_correction;
-
-              // Compute the distance in the xy plane (w/o accounting for rotation)
-              /**the new term of 'vert_offset * sin_vert_angle'
-               * was added to the expression due to the mathemathical
-               * model we used.
-               */
-              float xy_distance = distance * cos_vert_angle - vert_offset * sin_vert_angle;
-
-              // Calculate temporal X, use absolute value.
-              float xx = xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle;
-              // Calculate temporal Y, use absolute value
-              float yy = xy_distance * cos_rot_angle + horiz_offset * sin_rot_angle;
-              if (xx < 0) xx=-xx;
-              if (yy < 0) yy=-yy;
-
-              // Get 2points calibration values,Linear interpolation to get distance
-              // correction for X and Y, that means distance correction use
-              // different value at different distance
-              float distance_corr_x = 0;
-              float distance_corr_y = 0;
-              if (corrections.two_pt_correction_available) {
-                distance_corr_x =
-                  (corrections.dist_correction - corrections.dist_correction_x)
-                    * (xx - 2.4) / (25.04 - 2.4)
-                  + corrections.dist_correction_x;
-                distance_corr_x -= corrections.dist_correction;
-                distance_corr_y =
-                  (corrections.dist_correction - corrections.dist_correction_y)
-                    * (yy - 1.93) / (25.04 - 1.93)
-                  + corrections.dist_correction_y;
-                distance_corr_y -= corrections.dist_correction;
-              }
+        if (capture_)
+          {
+            CaptureRecord record;
+            record.stamp = pkt.stamp.toNSec() + (uint64_t) (t_firing * 1000);
+            record.device_time = packet_interp_time(raw_c->time);
+            record.azimuth = azimuth_corrected[0];
+            record.azimuth_diff = azimuth_diff;
+            record.return_type = raw_c->return_type;
+            record.data_source = raw_c->data_source;
+            record.block = block;
+            record.firing = firing;
+            capture_->push(record);
+          }
 
-              float distance_x = distance + distance_corr_x;
-              /**the new term of 'vert_offset * sin_vert_angle'
-               * was added to the expression due to the mathemathical
-               * model we used.
-               */
-              xy_distance = distance_x * cos_vert_angle - vert_offset * sin_vert_angle ;
-              x = xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle;
-
-              float distance_y = distance + distance_corr_y;
-              /**the new term of 'vert_offset * sin_vert_angle'
-               * was added to the expression due to the mathemathical
-               * model we used.
-               */
-              xy_distance = distance_y * cos_vert_angle - vert_offset * sin_vert_angle ;
-              y = xy_distance * cos_rot_angle + horiz_offset * sin_rot_angle;
-
-              // Using distance_y is not symmetric, but the velodyne manual
-              // does this.
-              /**the new term of 'vert_offset * cos_vert_angle'
-               * was added to the expression due to the mathemathical
-               * model we used.
-               */
-              z = distance_y * sin_vert_angle + vert_offset*cos_vert_angle;
-
-              /** Use standard ROS coordinate system (right-hand rule) */
-              float x_coord = y;
-              float y_coord = -x;
-              float z_coord = z;
-
-              /** Intensity Calculation */
-              float min_intensity = corrections.min_intensity;
-              float max_intensity = corrections.max_intensity;
-
-              intensity = raw->blocks[block].data[k+2];
-
-              float focal_offset = 256
-                                 * (1 - corrections.focal_distance / 13100)
-                                 * (1 - corrections.focal_distance / 13100);
-              float focal_slope = corrections.focal_slope;
-              intensity += focal_slope * (abs(focal_offset - 256 *
-                (1 - tmp.uint/65535)*(1 - tmp.uint/65535)));
-              intensity = (intensity < min_intensity) ? min_intensity : intensity;
-              intensity = (intensity > max_intensity) ? max_intensity : intensity;
-
-              // Insert this point into the cloud.
-              VPoint point;
-              point.x = point.y = point.z = std::numeric_limits<float>::quiet_NaN();
-              point.intensity = 0u;
-              point.ring = corrections.laser_ring;
-
-              // Compute the row and column index of the point.
-              int row = calibration_.num_lasers-1 - point.ring;
-              int col = 0;
-              if (dual_return)
-                  col = packet * BLOCKS_PER_PACKET * VLP16_FIRINGS_PER_BLOCK
-                          + (block/2) * 2 * VLP16_FIRINGS_PER_BLOCK
-                          + firing * 2
-                          + block % 2;
-              else
-                  col = packet * BLOCKS_PER_PACKET * VLP16_FIRINGS_PER_BLOCK
-                          + block * VLP16_FIRINGS_PER_BLOCK
-                          + firing;
-
-              pc.at(col, row) = point;
-
-              if (!pointInRange(distance))
-                continue;
+        // Compute the 16 points of this firing at once, and move them
+        // with the sensor pose at the firing time.
+        if (n_accepted > 0) {
+          const uint8_t *data =
+            &raw->blocks[block].data[firing * VLP16_SCANS_PER_FIRING
+                                     * RAW_SCAN_SIZE];
+          if (CloudWriter<Cloud>::DECIMATED)
+            unpackAccepted(unpack_block_, table, 0, VLP16_SCANS_PER_FIRING,
+                           data, cos_azimuth, sin_azimuth, accepted, points);
+          else
+            unpack_block_(table, 0, VLP16_SCANS_PER_FIRING, data,
+                          cos_azimuth, sin_azimuth, points);
+          if (TRANSFORM && transform.valid) {
+            float m[12];
+            toMatrix(transform.at(t_firing), m);
+            transformPoints(m, VLP16_SCANS_PER_FIRING, points);
+          }
+        }
 
-              if (tf_listener_ == NULL || config_.frame_id.empty()) {
-                pc.at(col, row).x         = x_coord;
-                pc.at(col, row).y         = y_coord;
-                pc.at(col, row).z         = z_coord;
-                pc.at(col, row).intensity = (uint8_t)intensity;
-                continue;
-              }
+        for (int dsr=0; dsr < VLP16_SCANS_PER_FIRING; dsr++){
+          int row = table.row[dsr];
 
-              // If given transform listener, transform every single point
-              // from sensor frame to target frame.
-              geometry_msgs::PointStamped t_point;
-              t_point.header.stamp    = pkt.stamp + ros::Duration((block*VLP16_BLOCK_TDURATION+t_beam)*1.0e-6);
-              t_point.header.frame_id = scanMsg->header.frame_id;
-              t_point.point.x         = x_coord;
-              t_point.point.y         = y_coord;
-              t_point.point.z         = z_coord;
-
-              try {
-                ROS_DEBUG_STREAM("transforming from " << t_point.header.frame_id
-                                 << " to " << config_.frame_id);
-                tf_listener_->transformPoint(config_.frame_id, scanMsg->header.stamp, t_point, config_.fixed_frame_id, t_point);
-              } catch (std::exception& ex) {
-                // only log tf error once every second
-                ROS_WARN_THROTTLE(LOG_PERIOD_, "%s", ex.what());
-                continue;                   // skip this point
-              }
+          /*condition added to avoid calculating points which are not
+            in the interesting defined area (min_angle < area < max_angle)*/
+          if (VIEW_WINDOW && !inViewWindow(azimuth_corrected[dsr])) {
+            out.set(col, row, emptyPoint(-1), 0.0f, return_index);
+            continue;
+          }
 
-              pc.at(col, row).x         = t_point.point.x;
-              pc.at(col, row).y         = t_point.point.y;
-              pc.at(col, row).z         = t_point.point.z;
-              pc.at(col, row).intensity = (uint8_t)intensity;
-            }
-          } // Iterate over beams
-        } // Iterate over firings
-      }
+          // Insert this point into the cloud, leaving it empty if out
+          // of range or the transform failed.
+          VPoint point = emptyPoint(table.laser_ring[dsr]);
+          if (accepted[dsr] && pointInRange(points.distance[dsr])
+              && (!TRANSFORM || transform.valid)) {
+            point.x         = points.x[dsr];
+            point.y         = points.y[dsr];
+            point.z         = points.z[dsr];
+            point.intensity = (uint8_t)points.intensity[dsr];
+          }
+          out.set(col, row, point, packet_time
+                  + (t_firing + dsr * VLP16_DSR_TOFFSET) * 1.0e-6f,
+                  return_index);
+        } // Iterate over beams
+      } // Iterate over firings
     }
+    return true;
   }
 
 } // namespace velodyne_rawdata
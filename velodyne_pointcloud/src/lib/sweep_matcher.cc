@@ -0,0 +1,112 @@
+/*
+ *  Copyright (C) 2012 Austin Robot Technology, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/**
+ *  @file
+ *
+ *  Matching the scans of several Velodynes by sweep time.
+ */
+
+#include <velodyne_driver/packet_monitor.h>
+#include <velodyne_pointcloud/rawdata.h>
+#include <velodyne_pointcloud/sweep_matcher.h>
+
+namespace velodyne_rawdata
+{
+  /** scans of a sensor kept waiting for the others to match */
+  static const size_t MAX_QUEUED_SCANS = 4;
+
+  SweepMatcher::SweepMatcher(size_t sensors, double max_skew):
+    max_skew_(max_skew),
+    sensors_(sensors)
+  {
+    for (size_t i = 0; i < sensors_.size(); ++i)
+      sensors_[i].azimuth = 0;
+  }
+
+  void SweepMatcher::setAzimuth(size_t sensor, int azimuth)
+  {
+    sensors_[sensor].azimuth = (azimuth % ROTATION_MAX_UNITS
+                                + ROTATION_MAX_UNITS) % ROTATION_MAX_UNITS;
+  }
+
+  ros::Time SweepMatcher::sweepTime(size_t sensor,
+                                    const velodyne_msgs::VelodyneScan &scan) const
+  {
+    const int units = ROTATION_MAX_UNITS;
+    const velodyne_msgs::VelodynePacket &first = scan.packets.front();
+    const velodyne_msgs::VelodynePacket &last = scan.packets.back();
+    const int first_azimuth = velodyne_driver::packetAzimuth(first);
+    const int span =
+      (velodyne_driver::packetAzimuth(last) - first_azimuth + units) % units;
+    const double duration = (last.stamp - first.stamp).toSec();
+    if (span == 0 || duration <= 0.0)
+      return first.stamp;
+
+    int offset = (sensors_[sensor].azimuth - first_azimuth + units) % units;
+    if (offset > span + (units - span) / 2)
+      offset -= units;                  // crossed just before the scan
+    return first.stamp + ros::Duration(duration * offset / span);
+  }
+
+  bool SweepMatcher::add(size_t sensor,
+                         const velodyne_msgs::VelodyneScan::ConstPtr &scan)
+  {
+    Sensor &queue = sensors_[sensor];
+    queue.scans.push_back(scan);
+    queue.sweeps.push_back(sweepTime(sensor, *scan));
+    if (queue.scans.size() <= MAX_QUEUED_SCANS)
+      return true;
+    queue.scans.pop_front();
+    queue.sweeps.pop_front();
+    return false;
+  }
+
+  int SweepMatcher::next(std::vector<velodyne_msgs::VelodyneScan::ConstPtr> &scans,
+                         std::vector<double> &skews)
+  {
+    int earliest = -1;
+    for (size_t i = 0; i < sensors_.size(); ++i)
+      if (!sensors_[i].scans.empty()
+          && (earliest < 0
+              || sensors_[i].sweeps.front() < sensors_[earliest].sweeps.front()))
+        earliest = i;
+    if (earliest < 0)
+      return -1;
+    const ros::Time sweep = sensors_[earliest].sweeps.front();
+
+    // A matching scan ends at most a revolution after its sweep, and
+    // has arrived once any sensor sent a packet later than that.
+    const velodyne_msgs::VelodyneScan &scan = *sensors_[earliest].scans.front();
+    const ros::Time deadline = sweep + max_skew_
+      + (scan.packets.back().stamp - scan.packets.front().stamp);
+    bool late = false;
+    for (size_t i = 0; i < sensors_.size(); ++i)
+      if (!sensors_[i].scans.empty()
+          && sensors_[i].scans.back()->packets.back().stamp > deadline)
+        late = true;
+    for (size_t i = 0; i < sensors_.size(); ++i)
+      if (sensors_[i].scans.empty() && !late)
+        return -1;                      // its match may still come
+
+    scans.assign(sensors_.size(), velodyne_msgs::VelodyneScan::ConstPtr());
+    skews.assign(sensors_.size(), 0.0);
+    for (size_t i = 0; i < sensors_.size(); ++i)
+      {
+        Sensor &sensor = sensors_[i];
+        if (sensor.scans.empty() || sensor.sweeps.front() > sweep + max_skew_)
+          continue;
+        scans[i] = sensor.scans.front();
+        skews[i] = (sensor.sweeps.front() - sweep).toSec();
+        sensor.scans.pop_front();
+        sensor.sweeps.pop_front();
+      }
+    return earliest;
+  }
+
+} // namespace velodyne_rawdata
@@ -0,0 +1,363 @@
+/*
+ *  Copyright (C) 2009, 2010, 2012 Austin Robot Technology, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/**
+ *  @file
+ *
+ *  CUDA unpacking backend, see cuda_unpack.h.
+ *
+ *  Compiled by nvcc with --fmad=false, so the device rounds each
+ *  multiplication and addition like the scalar CPU kernel, and the
+ *  points match those the CPU computes with it, see RawData::setup().
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <cuda_runtime.h>
+
+#include "cuda_unpack.h"
+#include "unpack_kernel.h"
+
+namespace velodyne_rawdata
+{
+  /** threads per CUDA block, a third of a packet */
+  static const int CUDA_THREADS = 128;
+
+  __device__ static inline uint16_t readUint16(const uint8_t *bytes)
+  {
+    return bytes[0] | (bytes[1] << 8);
+  }
+
+  /** @brief Compute the cell of one return.
+   *
+   *  Mirrors unpack_hdl_packets() and unpack_vlp16_packet() without a
+   *  view window, thread index by index: packet, block, return.
+   */
+  __global__ void unpackReturn(const uint8_t *packets, int n_packets,
+                               int num_lasers, uint32_t width,
+                               const velodyne_pointcloud::CorrectionTable *table,
+                               const float *cos_rot, const float *sin_rot,
+                               int rotation_units,
+                               double min_range, double max_range,
+                               const float *transforms,
+                               CudaPoint *points, int *stop)
+  {
+    const int index = blockIdx.x * blockDim.x + threadIdx.x;
+    if (index >= n_packets * KERNEL_PACKET_RETURNS)
+      return;
+    const int packet = index / KERNEL_PACKET_RETURNS;
+    const int r = index % KERNEL_PACKET_RETURNS;
+    const int block = r / KERNEL_BLOCK_RETURNS;
+    const int j = r % KERNEL_BLOCK_RETURNS;
+    const uint8_t *raw = packets + (size_t) packet * KERNEL_PACKET_SIZE;
+    const uint8_t *block_data = raw + block * KERNEL_BLOCK_SIZE;
+    const uint8_t *data = block_data + 4 + j * KERNEL_RETURN_SIZE;
+    const bool vlp16 = (num_lasers == 16);
+
+    int laser;                          // hardware laser number
+    int azimuth;
+    uint32_t col;
+    if (!vlp16)
+      {
+        // HDL blocks fire all their lasers at the block azimuth
+        laser = j + (readUint16(block_data) == KERNEL_LOWER_BANK? 32: 0);
+        azimuth = readUint16(block_data + 2) % rotation_units;
+        col = (packet * KERNEL_PACKET_RETURNS + r) / num_lasers;
+      }
+    else
+      {
+        // any invalid block header empties the packet's columns
+        if (readUint16(block_data) != KERNEL_UPPER_BANK)
+          atomicMin(stop, packet);
+
+        // VLP-16 beams fire in sequence while the sensor turns; the
+        // last blocks take the azimuth step of the ones before them
+        const bool dual = (raw[KERNEL_MODE_BYTE] == 0x39);
+        const int i_diff = dual? 2: 1;
+        const int firing = j / KERNEL_VLP16_SCANS_PER_FIRING;
+        laser = j % KERNEL_VLP16_SCANS_PER_FIRING;
+        const int b = (block < KERNEL_BLOCKS_PER_PACKET - i_diff)?
+          block: KERNEL_BLOCKS_PER_PACKET - 1 - i_diff;
+        const float azimuth_diff =
+          (float) ((36000 + readUint16(raw + (b + i_diff) * KERNEL_BLOCK_SIZE + 2)
+                    - readUint16(raw + b * KERNEL_BLOCK_SIZE + 2)) % 36000);
+        const float t_beam = laser * KERNEL_VLP16_DSR_TOFFSET
+          + firing * KERNEL_VLP16_FIRING_TOFFSET;
+        const float azimuth_f = (float) readUint16(block_data + 2)
+          + (azimuth_diff * t_beam / KERNEL_VLP16_BLOCK_TDURATION);
+        azimuth = ((int) roundf(azimuth_f)) % 36000;
+
+        // as vlp16_column()
+        const int firings = KERNEL_BLOCKS_PER_PACKET * KERNEL_VLP16_FIRINGS_PER_BLOCK;
+        if (dual)
+          col = packet * firings + (block / 2) * 2 * KERNEL_VLP16_FIRINGS_PER_BLOCK
+            + firing * 2 + block % 2;
+        else
+          col = packet * firings + block * KERNEL_VLP16_FIRINGS_PER_BLOCK + firing;
+      }
+
+    CudaPoint point;
+    point.x = point.y = point.z = nanf("");
+    point.pad = 1.0f;
+    point.intensity = 0.0f;
+    point.ring = table->laser_ring[laser];
+
+    const float *m = transforms? transforms + col * CUDA_TRANSFORM_SIZE: NULL;
+    const bool valid = (m == NULL || m[12] != 0.0f);
+    const int raw_distance = readUint16(data);
+    if (raw_distance != 0)
+      {
+        BlockPoints one;
+        unpackPoint(*table, laser, (float) raw_distance, (float) data[2],
+                    cos_rot[azimuth], sin_rot[azimuth], one, 0);
+        if (m != NULL && valid)
+          transformPoints(m, 1, one);
+
+        // HDL cells keep their intensity when the transform fails,
+        // VLP-16 ones do not
+        const float distance = one.distance[0];
+        if (distance >= min_range && distance <= max_range
+            && (!vlp16 || valid))
+          {
+            point.intensity = vlp16?
+              (float) (uint8_t) one.intensity[0]: one.intensity[0];
+            if (valid)
+              {
+                point.x = one.x[0];
+                point.y = one.y[0];
+                point.z = one.z[0];
+              }
+          }
+      }
+    points[table->row[laser] * width + col] = point;
+  }
+
+  /** Empty the VLP-16 columns from the first invalid packet on. */
+  __global__ void emptyColumns(CudaPoint *points, uint32_t width,
+                               uint32_t height, const int *stop)
+  {
+    const uint32_t index = blockIdx.x * blockDim.x + threadIdx.x;
+    if (index >= width * height)
+      return;
+    const uint32_t first = *stop * KERNEL_BLOCKS_PER_PACKET
+      * KERNEL_VLP16_FIRINGS_PER_BLOCK;
+    if (index % width < first)
+      return;
+    CudaPoint point;
+    point.x = point.y = point.z = nanf("");
+    point.pad = 1.0f;
+    point.intensity = 0.0f;
+    point.ring = (uint16_t) -1;
+    points[index] = point;
+  }
+
+  /** @returns true if successful, else sets the error */
+  static bool check(cudaError_t rc, const char *what, std::string *error)
+  {
+    if (rc == cudaSuccess)
+      return true;
+    *error = std::string(what) + ": " + cudaGetErrorString(rc);
+    return false;
+  }
+
+  /** @brief Grow a device buffer, and its pinned host copy if any.
+   *
+   *  @returns true if successful, else sets the error
+   */
+  template <class T>
+  static bool reserve(T **device, T **host, size_t *capacity, size_t bytes,
+                      std::string *error)
+  {
+    if (bytes <= *capacity)
+      return true;
+    cudaFree(*device);
+    *device = NULL;
+    if (host)
+      {
+        cudaFreeHost(*host);
+        *host = NULL;
+      }
+    *capacity = 0;
+    if (!check(cudaMalloc((void **) device, bytes), "cudaMalloc", error)
+        || (host && !check(cudaMallocHost((void **) host, bytes),
+                           "cudaMallocHost", error)))
+      return false;
+    *capacity = bytes;
+    return true;
+  }
+
+  CudaUnpacker::CudaUnpacker():
+    device_(-1),
+    stream_(NULL),
+    table_(NULL),
+    cos_rot_(NULL),
+    sin_rot_(NULL),
+    rotation_units_(0),
+    packets_(NULL),
+    host_packets_(NULL),
+    packet_capacity_(0),
+    points_(NULL),
+    host_points_(NULL),
+    point_capacity_(0),
+    transforms_(NULL),
+    transform_capacity_(0),
+    stop_(NULL),
+    host_stop_(NULL),
+    width_(0),
+    height_(0)
+  {}
+
+  CudaUnpacker::~CudaUnpacker()
+  {
+    if (device_ < 0)
+      return;
+    cudaSetDevice(device_);
+    if (stream_)
+      cudaStreamDestroy((cudaStream_t) stream_);
+    cudaFree(table_);
+    cudaFree(cos_rot_);
+    cudaFree(sin_rot_);
+    cudaFree(packets_);
+    cudaFreeHost(host_packets_);
+    cudaFree(points_);
+    cudaFreeHost(host_points_);
+    cudaFree(transforms_);
+    cudaFree(stop_);
+    cudaFreeHost(host_stop_);
+  }
+
+  bool CudaUnpacker::open(int device, std::string *error)
+  {
+    int count = 0;
+    if (!check(cudaGetDeviceCount(&count), "cudaGetDeviceCount", error))
+      return false;
+    if (device < 0 || device >= count)
+      {
+        char message[64];
+        snprintf(message, sizeof(message), "no CUDA device %d", device);
+        *error = message;
+        return false;
+      }
+    device_ = device;
+    cudaStream_t stream;
+    if (!check(cudaSetDevice(device_), "cudaSetDevice", error)
+        || !check(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking),
+                  "cudaStreamCreate", error))
+      return false;
+    stream_ = stream;
+    return (check(cudaMalloc((void **) &table_, sizeof(*table_)),
+                  "cudaMalloc", error)
+            && check(cudaMalloc((void **) &stop_, sizeof(int)),
+                     "cudaMalloc", error)
+            && check(cudaMallocHost((void **) &host_stop_, sizeof(int)),
+                     "cudaMallocHost", error));
+  }
+
+  bool CudaUnpacker::setCalibration(const velodyne_pointcloud::CorrectionTable &table,
+                                    const float *cos_rot_table,
+                                    const float *sin_rot_table,
+                                    int rotation_units, std::string *error)
+  {
+    if (!check(cudaSetDevice(device_), "cudaSetDevice", error))
+      return false;
+    size_t bytes = rotation_units * sizeof(float);
+    if (rotation_units != rotation_units_)
+      {
+        cudaFree(cos_rot_);
+        cudaFree(sin_rot_);
+        cos_rot_ = sin_rot_ = NULL;
+        rotation_units_ = 0;
+        if (!check(cudaMalloc((void **) &cos_rot_, bytes), "cudaMalloc", error)
+            || !check(cudaMalloc((void **) &sin_rot_, bytes), "cudaMalloc",
+                      error))
+          return false;
+        rotation_units_ = rotation_units;
+      }
+    return (check(cudaMemcpy(table_, &table, sizeof(table),
+                             cudaMemcpyHostToDevice), "cudaMemcpy", error)
+            && check(cudaMemcpy(cos_rot_, cos_rot_table, bytes,
+                                cudaMemcpyHostToDevice), "cudaMemcpy", error)
+            && check(cudaMemcpy(sin_rot_, sin_rot_table, bytes,
+                                cudaMemcpyHostToDevice), "cudaMemcpy", error));
+  }
+
+  bool CudaUnpacker::unpack(const CudaScan &scan, int *stop, std::string *error)
+  {
+    const bool vlp16 = (scan.num_lasers == 16);
+    const uint32_t width = vlp16?
+      scan.n_packets * KERNEL_BLOCKS_PER_PACKET * KERNEL_VLP16_FIRINGS_PER_BLOCK:
+      scan.n_packets * KERNEL_PACKET_RETURNS / scan.num_lasers;
+    const uint32_t height = scan.num_lasers;
+    const size_t packet_bytes = (size_t) scan.n_packets * KERNEL_PACKET_SIZE;
+    const size_t point_bytes = (size_t) width * height * sizeof(CudaPoint);
+    const size_t transform_bytes =
+      (size_t) width * CUDA_TRANSFORM_SIZE * sizeof(float);
+    if (rotation_units_ == 0)
+      {
+        *error = "no calibration";
+        return false;
+      }
+    if (!check(cudaSetDevice(device_), "cudaSetDevice", error)
+        || !reserve(&packets_, &host_packets_, &packet_capacity_,
+                    packet_bytes, error)
+        || !reserve(&points_, &host_points_, &point_capacity_,
+                    point_bytes, error)
+        || (scan.transforms
+            && !reserve(&transforms_, (float **) NULL, &transform_capacity_,
+                        transform_bytes, error)))
+      return false;
+    cudaStream_t stream = (cudaStream_t) stream_;
+
+    // one batch of packet data, without the message stamps
+    for (int p = 0; p < scan.n_packets; ++p)
+      memcpy(host_packets_ + p * KERNEL_PACKET_SIZE,
+             scan.packets + p * scan.packet_stride, KERNEL_PACKET_SIZE);
+    *host_stop_ = scan.n_packets;
+    if (!check(cudaMemcpyAsync(packets_, host_packets_, packet_bytes,
+                               cudaMemcpyHostToDevice, stream),
+               "cudaMemcpyAsync", error)
+        || !check(cudaMemcpyAsync(stop_, host_stop_, sizeof(int),
+                                  cudaMemcpyHostToDevice, stream),
+                  "cudaMemcpyAsync", error)
+        || (scan.transforms
+            && !check(cudaMemcpyAsync(transforms_, scan.transforms,
+                                      transform_bytes, cudaMemcpyHostToDevice,
+                                      stream),
+                      "cudaMemcpyAsync", error)))
+      return false;
+
+    const int returns = scan.n_packets * KERNEL_PACKET_RETURNS;
+    unpackReturn<<<(returns + CUDA_THREADS - 1) / CUDA_THREADS, CUDA_THREADS,
+                   0, stream>>>(packets_, scan.n_packets, scan.num_lasers,
+                                width, table_, cos_rot_, sin_rot_,
+                                rotation_units_, scan.min_range,
+                                scan.max_range,
+                                scan.transforms? transforms_: NULL,
+                                points_, stop_);
+    if (vlp16)
+      emptyColumns<<<(width * height + CUDA_THREADS - 1) / CUDA_THREADS,
+                     CUDA_THREADS, 0, stream>>>(points_, width, height, stop_);
+    if (!check(cudaGetLastError(), "unpack kernel", error)
+        || !check(cudaMemcpyAsync(host_points_, points_, point_bytes,
+                                  cudaMemcpyDeviceToHost, stream),
+                  "cudaMemcpyAsync", error)
+        || !check(cudaMemcpyAsync(host_stop_, stop_, sizeof(int),
+                                  cudaMemcpyDeviceToHost, stream),
+                  "cudaMemcpyAsync", error)
+        || !check(cudaStreamSynchronize(stream), "cudaStreamSynchronize",
+                  error))
+      return false;
+
+    width_ = width;
+    height_ = height;
+    *stop = *host_stop_;
+    return true;
+  }
+
+} // namespace velodyne_rawdata
@@ -0,0 +1,252 @@
+/*
+ *  Copyright (C) 2009, 2010, 2012 Austin Robot Technology, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/**
+ *  @file
+ *
+ *  Scalar, SSE2 and NEON block unpacking kernels, and run-time
+ *  kernel selection.  The AVX2 kernel lives in unpack_kernel_avx2.cc,
+ *  which is compiled with its own instruction set flags.
+ */
+
+#include "unpack_kernel.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+namespace velodyne_rawdata
+{
+  /** @brief Scalar reference kernel.
+   *
+   *  @param table correction table
+   *  @param laser hardware laser number of the first return
+   *  @param n number of returns from consecutive lasers
+   *  @param data first raw return of the block
+   *  @param cos_azimuth cosine of the azimuth of each return
+   *  @param sin_azimuth sine of the azimuth of each return
+   *  @param points returns the points, in order
+   */
+  void unpackBlockScalar(const velodyne_pointcloud::CorrectionTable &table,
+                         int laser, int n, const uint8_t *data,
+                         const float *cos_azimuth, const float *sin_azimuth,
+                         BlockPoints &points)
+  {
+    float raw[KERNEL_BLOCK_RETURNS];
+    float raw_intensity[KERNEL_BLOCK_RETURNS];
+    splitReturns(data, n, raw, raw_intensity);
+    for (int i = 0; i < n; ++i)
+      unpackPoint(table, laser + i, raw[i], raw_intensity[i],
+                  cos_azimuth[i], sin_azimuth[i], points, i);
+  }
+
+#if defined(__SSE2__)
+  /** @brief SSE2 kernel, four lasers at a time. */
+  void unpackBlockSSE2(const velodyne_pointcloud::CorrectionTable &table,
+                       int laser, int n, const uint8_t *data,
+                       const float *cos_azimuth, const float *sin_azimuth,
+                       BlockPoints &points)
+  {
+    float raw[KERNEL_BLOCK_RETURNS];
+    float raw_intensity[KERNEL_BLOCK_RETURNS];
+    splitReturns(data, n, raw, raw_intensity);
+
+    const __m128 resolution = _mm_set1_ps(KERNEL_DISTANCE_RESOLUTION);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 full_scale = _mm_set1_ps(65535.0f);
+    const __m128 focal_scale_256 = _mm_set1_ps(256.0f);
+
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+      {
+        const int l = laser + i;
+        __m128 r = _mm_loadu_ps(raw + i);
+        __m128 distance = _mm_add_ps(_mm_mul_ps(r, resolution),
+                                     _mm_loadu_ps(table.dist_correction + l));
+
+        __m128 cos_vert = _mm_loadu_ps(table.cos_vert_correction + l);
+        __m128 sin_vert = _mm_loadu_ps(table.sin_vert_correction + l);
+        __m128 cos_corr = _mm_loadu_ps(table.cos_rot_correction + l);
+        __m128 sin_corr = _mm_loadu_ps(table.sin_rot_correction + l);
+        __m128 cos_az = _mm_loadu_ps(cos_azimuth + i);
+        __m128 sin_az = _mm_loadu_ps(sin_azimuth + i);
+
+        __m128 cos_rot = _mm_add_ps(_mm_mul_ps(cos_az, cos_corr),
+                                    _mm_mul_ps(sin_az, sin_corr));
+        __m128 sin_rot = _mm_sub_ps(_mm_mul_ps(sin_az, cos_corr),
+                                    _mm_mul_ps(cos_az, sin_corr));
+
+        __m128 horiz = _mm_loadu_ps(table.horiz_offset_correction + l);
+        __m128 vert = _mm_loadu_ps(table.vert_offset_correction + l);
+        __m128 vert_sin = _mm_mul_ps(vert, sin_vert);
+
+        __m128 xy = _mm_sub_ps(_mm_mul_ps(distance, cos_vert), vert_sin);
+        __m128 xx = _mm_andnot_ps(sign,
+                                  _mm_sub_ps(_mm_mul_ps(xy, sin_rot),
+                                             _mm_mul_ps(horiz, cos_rot)));
+        __m128 yy = _mm_andnot_ps(sign,
+                                  _mm_add_ps(_mm_mul_ps(xy, cos_rot),
+                                             _mm_mul_ps(horiz, sin_rot)));
+
+        __m128 distance_x = _mm_add_ps(distance, _mm_add_ps(
+          _mm_mul_ps(_mm_loadu_ps(table.two_pt_slope_x + l), xx),
+          _mm_loadu_ps(table.two_pt_offset_x + l)));
+        __m128 distance_y = _mm_add_ps(distance, _mm_add_ps(
+          _mm_mul_ps(_mm_loadu_ps(table.two_pt_slope_y + l), yy),
+          _mm_loadu_ps(table.two_pt_offset_y + l)));
+
+        xy = _mm_sub_ps(_mm_mul_ps(distance_x, cos_vert), vert_sin);
+        __m128 x = _mm_sub_ps(_mm_mul_ps(xy, sin_rot),
+                              _mm_mul_ps(horiz, cos_rot));
+        xy = _mm_sub_ps(_mm_mul_ps(distance_y, cos_vert), vert_sin);
+        __m128 y = _mm_add_ps(_mm_mul_ps(xy, cos_rot),
+                              _mm_mul_ps(horiz, sin_rot));
+        __m128 z = _mm_add_ps(_mm_mul_ps(distance_y, sin_vert),
+                              _mm_mul_ps(vert, cos_vert));
+
+        // ROS coordinate system
+        _mm_storeu_ps(points.x + i, y);
+        _mm_storeu_ps(points.y + i, _mm_xor_ps(x, sign));
+        _mm_storeu_ps(points.z + i, z);
+        _mm_storeu_ps(points.distance + i, distance);
+
+        __m128 focal = _mm_sub_ps(one, _mm_div_ps(r, full_scale));
+        __m128 focal_term = _mm_sub_ps(
+          _mm_loadu_ps(table.focal_offset + l),
+          _mm_mul_ps(_mm_mul_ps(focal_scale_256, focal), focal));
+        __m128 intensity = _mm_add_ps(
+          _mm_loadu_ps(raw_intensity + i),
+          _mm_mul_ps(_mm_loadu_ps(table.focal_slope + l),
+                     _mm_andnot_ps(sign, focal_term)));
+        intensity = _mm_max_ps(intensity,
+                               _mm_loadu_ps(table.min_intensity + l));
+        intensity = _mm_min_ps(intensity,
+                               _mm_loadu_ps(table.max_intensity + l));
+        _mm_storeu_ps(points.intensity + i, intensity);
+      }
+
+    for (; i < n; ++i)
+      unpackPoint(table, laser + i, raw[i], raw_intensity[i],
+                  cos_azimuth[i], sin_azimuth[i], points, i);
+  }
+#endif // __SSE2__
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  /** @brief NEON kernel, four lasers at a time. */
+  void unpackBlockNEON(const velodyne_pointcloud::CorrectionTable &table,
+                       int laser, int n, const uint8_t *data,
+                       const float *cos_azimuth, const float *sin_azimuth,
+                       BlockPoints &points)
+  {
+    float raw[KERNEL_BLOCK_RETURNS];
+    float raw_intensity[KERNEL_BLOCK_RETURNS];
+    splitReturns(data, n, raw, raw_intensity);
+
+    const float32x4_t resolution = vdupq_n_f32(KERNEL_DISTANCE_RESOLUTION);
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    // ARMv7 NEON has no vector divide
+    const float32x4_t inv_full_scale = vdupq_n_f32(1.0f / 65535.0f);
+    const float32x4_t focal_scale_256 = vdupq_n_f32(256.0f);
+
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+      {
+        const int l = laser + i;
+        float32x4_t r = vld1q_f32(raw + i);
+        float32x4_t distance = vaddq_f32(vmulq_f32(r, resolution),
+                                         vld1q_f32(table.dist_correction + l));
+
+        float32x4_t cos_vert = vld1q_f32(table.cos_vert_correction + l);
+        float32x4_t sin_vert = vld1q_f32(table.sin_vert_correction + l);
+        float32x4_t cos_corr = vld1q_f32(table.cos_rot_correction + l);
+        float32x4_t sin_corr = vld1q_f32(table.sin_rot_correction + l);
+        float32x4_t cos_az = vld1q_f32(cos_azimuth + i);
+        float32x4_t sin_az = vld1q_f32(sin_azimuth + i);
+
+        float32x4_t cos_rot = vaddq_f32(vmulq_f32(cos_az, cos_corr),
+                                        vmulq_f32(sin_az, sin_corr));
+        float32x4_t sin_rot = vsubq_f32(vmulq_f32(sin_az, cos_corr),
+                                        vmulq_f32(cos_az, sin_corr));
+
+        float32x4_t horiz = vld1q_f32(table.horiz_offset_correction + l);
+        float32x4_t vert = vld1q_f32(table.vert_offset_correction + l);
+        float32x4_t vert_sin = vmulq_f32(vert, sin_vert);
+
+        float32x4_t xy = vsubq_f32(vmulq_f32(distance, cos_vert), vert_sin);
+        float32x4_t xx = vabsq_f32(vsubq_f32(vmulq_f32(xy, sin_rot),
+                                             vmulq_f32(horiz, cos_rot)));
+        float32x4_t yy = vabsq_f32(vaddq_f32(vmulq_f32(xy, cos_rot),
+                                             vmulq_f32(horiz, sin_rot)));
+
+        float32x4_t distance_x = vaddq_f32(distance, vaddq_f32(
+          vmulq_f32(vld1q_f32(table.two_pt_slope_x + l), xx),
+          vld1q_f32(table.two_pt_offset_x + l)));
+        float32x4_t distance_y = vaddq_f32(distance, vaddq_f32(
+          vmulq_f32(vld1q_f32(table.two_pt_slope_y + l), yy),
+          vld1q_f32(table.two_pt_offset_y + l)));
+
+        xy = vsubq_f32(vmulq_f32(distance_x, cos_vert), vert_sin);
+        float32x4_t x = vsubq_f32(vmulq_f32(xy, sin_rot),
+                                  vmulq_f32(horiz, cos_rot));
+        xy = vsubq_f32(vmulq_f32(distance_y, cos_vert), vert_sin);
+        float32x4_t y = vaddq_f32(vmulq_f32(xy, cos_rot),
+                                  vmulq_f32(horiz, sin_rot));
+        float32x4_t z = vaddq_f32(vmulq_f32(distance_y, sin_vert),
+                                  vmulq_f32(vert, cos_vert));
+
+        // ROS coordinate system
+        vst1q_f32(points.x + i, y);
+        vst1q_f32(points.y + i, vnegq_f32(x));
+        vst1q_f32(points.z + i, z);
+        vst1q_f32(points.distance + i, distance);
+
+        float32x4_t focal = vsubq_f32(one, vmulq_f32(r, inv_full_scale));
+        float32x4_t focal_term = vsubq_f32(
+          vld1q_f32(table.focal_offset + l),
+          vmulq_f32(vmulq_f32(focal_scale_256, focal), focal));
+        float32x4_t intensity = vaddq_f32(
+          vld1q_f32(raw_intensity + i),
+          vmulq_f32(vld1q_f32(table.focal_slope + l), vabsq_f32(focal_term)));
+        intensity = vmaxq_f32(intensity, vld1q_f32(table.min_intensity + l));
+        intensity = vminq_f32(intensity, vld1q_f32(table.max_intensity + l));
+        vst1q_f32(points.intensity + i, intensity);
+      }
+
+    for (; i < n; ++i)
+      unpackPoint(table, laser + i, raw[i], raw_intensity[i],
+                  cos_azimuth[i], sin_azimuth[i], points, i);
+  }
+#endif // __ARM_NEON
+
+  UnpackBlockFn selectUnpackBlock(const char **name)
+  {
+#if defined(HAVE_AVX2_KERNEL)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+      {
+        *name = "AVX2";
+        return unpackBlockAVX2;
+      }
+#endif
+#if defined(__SSE2__)
+    *name = "SSE2";
+    return unpackBlockSSE2;
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    *name = "NEON";
+    return unpackBlockNEON;
+#else
+    *name = "scalar";
+    return unpackBlockScalar;
+#endif
+  }
+
+} // namespace velodyne_rawdata
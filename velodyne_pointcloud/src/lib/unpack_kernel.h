@@ -0,0 +1,228 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (C) 2009, 2010, 2012 Austin Robot Technology, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  @brief Block unpacking kernels for the Velodyne 3D LIDAR.
+ *
+ *  Private to the velodyne_rawdata library.  Each kernel converts
+ *  the returns of consecutive lasers sharing one firing block into
+ *  points, using the flat CorrectionTable.  The scalar version is the
+ *  reference; the SIMD versions compute the same expressions several
+ *  lasers at a time.
+ */
+
+#ifndef __VELODYNE_UNPACK_KERNEL_H
+#define __VELODYNE_UNPACK_KERNEL_H
+
+#include <math.h>
+#include <stdint.h>
+
+#include <velodyne_pointcloud/calibration.h>
+
+namespace velodyne_rawdata
+{
+  /** Raw packet layout, distance unit and VLP-16 firing times: the
+   *  values in rawdata.h.  The kernels must not include ROS headers
+   *  (see unpack_kernel_avx2.cc), nor can nvcc read them, so they keep
+   *  their own copies here.  rawdata.cc checks the integers match,
+   *  test_rawdata the times. */
+  static const int KERNEL_BLOCK_RETURNS = 32;
+  static const int KERNEL_RETURN_SIZE = 3;
+  static const float KERNEL_DISTANCE_RESOLUTION = 0.002f; // [m]
+  static const int KERNEL_PACKET_SIZE = 1206;
+  static const int KERNEL_BLOCKS_PER_PACKET = 12;
+  static const int KERNEL_BLOCK_SIZE = 100;
+  static const int KERNEL_PACKET_RETURNS =
+    KERNEL_BLOCKS_PER_PACKET * KERNEL_BLOCK_RETURNS;
+  static const int KERNEL_MODE_BYTE = 1204; ///< status[PACKET_STATUS_SIZE-2]
+  static const uint16_t KERNEL_UPPER_BANK = 0xeeff;
+  static const uint16_t KERNEL_LOWER_BANK = 0xddff;
+  static const int KERNEL_VLP16_FIRINGS_PER_BLOCK = 2;
+  static const int KERNEL_VLP16_SCANS_PER_FIRING = 16;
+  static const float KERNEL_VLP16_BLOCK_TDURATION = 110.592f; // [µs]
+  static const float KERNEL_VLP16_DSR_TOFFSET = 2.304f;       // [µs]
+  static const float KERNEL_VLP16_FIRING_TOFFSET = 55.296f;   // [µs]
+
+  /** unpackPoint() is also the point math of the CUDA backend, see
+   *  cuda_unpack.h */
+#if defined(__CUDACC__)
+#define UNPACK_HOST_DEVICE __host__ __device__
+#else
+#define UNPACK_HOST_DEVICE
+#endif
+
+  /** \brief Points computed for one firing block, structure of arrays.
+   *
+   *  x, y and z are in the ROS coordinate system of the sensor frame.
+   *  distance is the corrected range used for range filtering.
+   */
+  struct BlockPoints
+  {
+    float x[KERNEL_BLOCK_RETURNS];
+    float y[KERNEL_BLOCK_RETURNS];
+    float z[KERNEL_BLOCK_RETURNS];
+    float intensity[KERNEL_BLOCK_RETURNS];
+    float distance[KERNEL_BLOCK_RETURNS];
+  };
+
+  /** block kernel type, also declared in rawdata.h */
+  typedef void (*UnpackBlockFn)(const velodyne_pointcloud::CorrectionTable &table,
+                                int laser, int n, const uint8_t *data,
+                                const float *cos_azimuth,
+                                const float *sin_azimuth,
+                                BlockPoints &points);
+
+  void unpackBlockScalar(const velodyne_pointcloud::CorrectionTable &table,
+                         int laser, int n, const uint8_t *data,
+                         const float *cos_azimuth, const float *sin_azimuth,
+                         BlockPoints &points);
+#if defined(__SSE2__)
+  void unpackBlockSSE2(const velodyne_pointcloud::CorrectionTable &table,
+                       int laser, int n, const uint8_t *data,
+                       const float *cos_azimuth, const float *sin_azimuth,
+                       BlockPoints &points);
+#endif
+#if defined(HAVE_AVX2_KERNEL)
+  void unpackBlockAVX2(const velodyne_pointcloud::CorrectionTable &table,
+                       int laser, int n, const uint8_t *data,
+                       const float *cos_azimuth, const float *sin_azimuth,
+                       BlockPoints &points);
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  void unpackBlockNEON(const velodyne_pointcloud::CorrectionTable &table,
+                       int laser, int n, const uint8_t *data,
+                       const float *cos_azimuth, const float *sin_azimuth,
+                       BlockPoints &points);
+#endif
+
+  /** @brief Choose the fastest kernel this CPU supports.
+   *
+   *  @param name returns the kernel name, for logging
+   *  @returns kernel function
+   */
+  UnpackBlockFn selectUnpackBlock(const char **name);
+
+  /** @brief Compute point i of a block; the scalar reference.
+   *
+   *  Static, so every translation unit, whatever its instruction set
+   *  flags, gets its own copy; CUDA device code gets one too.
+   *
+   *  @param table correction table
+   *  @param laser hardware laser number of this return
+   *  @param raw raw distance, in DISTANCE_RESOLUTION units
+   *  @param raw_intensity raw intensity
+   *  @param cos_azimuth cosine of the block azimuth
+   *  @param sin_azimuth sine of the block azimuth
+   *  @param points output points
+   *  @param i index of this point in points
+   */
+  UNPACK_HOST_DEVICE
+  static inline void unpackPoint(const velodyne_pointcloud::CorrectionTable &table,
+                                 int laser, float raw, float raw_intensity,
+                                 float cos_azimuth, float sin_azimuth,
+                                 BlockPoints &points, int i)
+  {
+    float distance = raw * KERNEL_DISTANCE_RESOLUTION + table.dist_correction[laser];
+
+    float cos_vert_angle = table.cos_vert_correction[laser];
+    float sin_vert_angle = table.sin_vert_correction[laser];
+    float cos_rot_correction = table.cos_rot_correction[laser];
+    float sin_rot_correction = table.sin_rot_correction[laser];
+
+    // cos(a-b) = cos(a)*cos(b) + sin(a)*sin(b)
+    // sin(a-b) = sin(a)*cos(b) - cos(a)*sin(b)
+    float cos_rot_angle =
+      cos_azimuth * cos_rot_correction + sin_azimuth * sin_rot_correction;
+    float sin_rot_angle =
+      sin_azimuth * cos_rot_correction - cos_azimuth * sin_rot_correction;
+
+    float horiz_offset = table.horiz_offset_correction[laser];
+    float vert_offset = table.vert_offset_correction[laser];
+
+    // Compute the distance in the xy plane (w/o accounting for rotation)
+    float xy_distance = distance * cos_vert_angle - vert_offset * sin_vert_angle;
+
+    // Calculate temporal X and Y, use absolute values.
+    float xx = fabsf(xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle);
+    float yy = fabsf(xy_distance * cos_rot_angle + horiz_offset * sin_rot_angle);
+
+    // Two point distance corrections, zero for lasers without them.
+    float distance_x = distance
+      + table.two_pt_slope_x[laser] * xx + table.two_pt_offset_x[laser];
+    float distance_y = distance
+      + table.two_pt_slope_y[laser] * yy + table.two_pt_offset_y[laser];
+
+    xy_distance = distance_x * cos_vert_angle - vert_offset * sin_vert_angle;
+    float x = xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle;
+
+    // Using distance_y is not symmetric, but the velodyne manual
+    // does this.
+    xy_distance = distance_y * cos_vert_angle - vert_offset * sin_vert_angle;
+    float y = xy_distance * cos_rot_angle + horiz_offset * sin_rot_angle;
+    float z = distance_y * sin_vert_angle + vert_offset * cos_vert_angle;
+
+    /** Use standard ROS coordinate system (right-hand rule) */
+    points.x[i] = y;
+    points.y[i] = -x;
+    points.z[i] = z;
+    points.distance[i] = distance;
+
+    /** Intensity Calculation */
+    float focal_scale = 1 - raw/65535;
+    float intensity = raw_intensity + table.focal_slope[laser] *
+      fabsf(table.focal_offset[laser] - 256 * focal_scale * focal_scale);
+    intensity = (intensity < table.min_intensity[laser])?
+      table.min_intensity[laser]: intensity;
+    intensity = (intensity > table.max_intensity[laser])?
+      table.max_intensity[laser]: intensity;
+    points.intensity[i] = intensity;
+  }
+
+  /** @brief Split raw returns into distance and intensity arrays.
+   *
+   *  @param data first raw return, KERNEL_RETURN_SIZE bytes each
+   *  @param n number of returns
+   *  @param raw returns raw distances
+   *  @param raw_intensity returns raw intensities
+   */
+  static inline void splitReturns(const uint8_t *data, int n,
+                                  float *raw, float *raw_intensity)
+  {
+    for (int i = 0, k = 0; i < n; ++i, k += KERNEL_RETURN_SIZE)
+      {
+        raw[i] = (float) (data[k] | (data[k+1] << 8));
+        raw_intensity[i] = (float) data[k+2];
+      }
+  }
+
+  /** @brief Apply a rigid transform to the points of a block.
+   *
+   *  @param m row-major 3x4 matrix [R | t]
+   *  @param n number of points
+   *  @param points points to transform in place
+   */
+  UNPACK_HOST_DEVICE
+  static inline void transformPoints(const float *m, int n,
+                                     BlockPoints &points)
+  {
+    for (int i = 0; i < n; ++i)
+      {
+        float x = points.x[i];
+        float y = points.y[i];
+        float z = points.z[i];
+        points.x[i] = m[0] * x + m[1] * y + m[2]  * z + m[3];
+        points.y[i] = m[4] * x + m[5] * y + m[6]  * z + m[7];
+        points.z[i] = m[8] * x + m[9] * y + m[10] * z + m[11];
+      }
+  }
+
+} // namespace velodyne_rawdata
+
+#endif // __VELODYNE_UNPACK_KERNEL_H
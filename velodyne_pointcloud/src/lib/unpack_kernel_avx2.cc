@@ -0,0 +1,115 @@
+/*
+ *  Copyright (C) 2009, 2010, 2012 Austin Robot Technology, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/**
+ *  @file
+ *
+ *  AVX2 block unpacking kernel.
+ *
+ *  This file is compiled with -mavx2 -mfma.  Its kernel is only
+ *  called after selectUnpackBlock() has checked the CPU, so nothing
+ *  else may be defined here: the compiler could use AVX2 instructions
+ *  anywhere in this translation unit.
+ */
+
+#include <immintrin.h>
+
+#include "unpack_kernel.h"
+
+namespace velodyne_rawdata
+{
+  /** @brief AVX2 kernel, eight lasers at a time. */
+  void unpackBlockAVX2(const velodyne_pointcloud::CorrectionTable &table,
+                       int laser, int n, const uint8_t *data,
+                       const float *cos_azimuth, const float *sin_azimuth,
+                       BlockPoints &points)
+  {
+    float raw[KERNEL_BLOCK_RETURNS];
+    float raw_intensity[KERNEL_BLOCK_RETURNS];
+    splitReturns(data, n, raw, raw_intensity);
+
+    const __m256 resolution = _mm256_set1_ps(KERNEL_DISTANCE_RESOLUTION);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 full_scale = _mm256_set1_ps(65535.0f);
+    const __m256 focal_scale_256 = _mm256_set1_ps(256.0f);
+
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+      {
+        const int l = laser + i;
+        __m256 r = _mm256_loadu_ps(raw + i);
+        __m256 distance =
+          _mm256_fmadd_ps(r, resolution,
+                          _mm256_loadu_ps(table.dist_correction + l));
+
+        __m256 cos_vert = _mm256_loadu_ps(table.cos_vert_correction + l);
+        __m256 sin_vert = _mm256_loadu_ps(table.sin_vert_correction + l);
+        __m256 cos_corr = _mm256_loadu_ps(table.cos_rot_correction + l);
+        __m256 sin_corr = _mm256_loadu_ps(table.sin_rot_correction + l);
+        __m256 cos_az = _mm256_loadu_ps(cos_azimuth + i);
+        __m256 sin_az = _mm256_loadu_ps(sin_azimuth + i);
+
+        __m256 cos_rot = _mm256_fmadd_ps(cos_az, cos_corr,
+                                         _mm256_mul_ps(sin_az, sin_corr));
+        __m256 sin_rot = _mm256_fmsub_ps(sin_az, cos_corr,
+                                         _mm256_mul_ps(cos_az, sin_corr));
+
+        __m256 horiz = _mm256_loadu_ps(table.horiz_offset_correction + l);
+        __m256 vert = _mm256_loadu_ps(table.vert_offset_correction + l);
+        __m256 vert_sin = _mm256_mul_ps(vert, sin_vert);
+
+        __m256 xy = _mm256_fmsub_ps(distance, cos_vert, vert_sin);
+        __m256 xx = _mm256_andnot_ps(sign,
+          _mm256_fmsub_ps(xy, sin_rot, _mm256_mul_ps(horiz, cos_rot)));
+        __m256 yy = _mm256_andnot_ps(sign,
+          _mm256_fmadd_ps(xy, cos_rot, _mm256_mul_ps(horiz, sin_rot)));
+
+        __m256 distance_x = _mm256_add_ps(distance,
+          _mm256_fmadd_ps(_mm256_loadu_ps(table.two_pt_slope_x + l), xx,
+                          _mm256_loadu_ps(table.two_pt_offset_x + l)));
+        __m256 distance_y = _mm256_add_ps(distance,
+          _mm256_fmadd_ps(_mm256_loadu_ps(table.two_pt_slope_y + l), yy,
+                          _mm256_loadu_ps(table.two_pt_offset_y + l)));
+
+        xy = _mm256_fmsub_ps(distance_x, cos_vert, vert_sin);
+        __m256 x = _mm256_fmsub_ps(xy, sin_rot,
+                                   _mm256_mul_ps(horiz, cos_rot));
+        xy = _mm256_fmsub_ps(distance_y, cos_vert, vert_sin);
+        __m256 y = _mm256_fmadd_ps(xy, cos_rot,
+                                   _mm256_mul_ps(horiz, sin_rot));
+        __m256 z = _mm256_fmadd_ps(distance_y, sin_vert,
+                                   _mm256_mul_ps(vert, cos_vert));
+
+        // ROS coordinate system
+        _mm256_storeu_ps(points.x + i, y);
+        _mm256_storeu_ps(points.y + i, _mm256_xor_ps(x, sign));
+        _mm256_storeu_ps(points.z + i, z);
+        _mm256_storeu_ps(points.distance + i, distance);
+
+        __m256 focal = _mm256_sub_ps(one, _mm256_div_ps(r, full_scale));
+        __m256 focal_term = _mm256_sub_ps(
+          _mm256_loadu_ps(table.focal_offset + l),
+          _mm256_mul_ps(_mm256_mul_ps(focal_scale_256, focal), focal));
+        __m256 intensity = _mm256_fmadd_ps(
+          _mm256_loadu_ps(table.focal_slope + l),
+          _mm256_andnot_ps(sign, focal_term),
+          _mm256_loadu_ps(raw_intensity + i));
+        intensity = _mm256_max_ps(intensity,
+                                  _mm256_loadu_ps(table.min_intensity + l));
+        intensity = _mm256_min_ps(intensity,
+                                  _mm256_loadu_ps(table.max_intensity + l));
+        _mm256_storeu_ps(points.intensity + i, intensity);
+      }
+
+    for (; i < n; ++i)
+      unpackPoint(table, laser + i, raw[i], raw_intensity[i],
+                  cos_azimuth[i], sin_azimuth[i], points, i);
+  }
+
+} // namespace velodyne_rawdata
@@ -0,0 +1,92 @@
+/*
+ *  Copyright (C) 2009, 2010, 2012 Austin Robot Technology, Jack O'Quin
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/**
+ *  @file
+ *
+ *  Worker threads for converting Velodyne scans.
+ */
+
+#include <boost/bind.hpp>
+
+#include <velodyne_pointcloud/worker_pool.h>
+
+namespace velodyne_rawdata
+{
+  WorkerPool::WorkerPool(int threads):
+    stopping_(false)
+  {
+    for (int i = 0; i < threads; ++i)
+      threads_.push_back(boost::shared_ptr<boost::thread>
+                         (new boost::thread(boost::bind(&WorkerPool::work,
+                                                        this))));
+  }
+
+  WorkerPool::~WorkerPool()
+  {
+    {
+      boost::mutex::scoped_lock lock(lock_);
+      stopping_ = true;
+    }
+    ready_.notify_all();
+    for (size_t i = 0; i < threads_.size(); ++i)
+      threads_[i]->join();
+  }
+
+  void WorkerPool::post(const Task &task, TaskGroup &group)
+  {
+    if (threads_.empty())
+      {
+        task();                         // nobody else would run it
+        return;
+      }
+
+    group.add();
+    Entry entry;
+    entry.task = task;
+    entry.group = &group;
+    {
+      boost::mutex::scoped_lock lock(lock_);
+      queue_.push_back(entry);
+    }
+    ready_.notify_one();
+  }
+
+  void WorkerPool::run(const std::vector<Task> &tasks)
+  {
+    if (tasks.empty())
+      return;
+
+    TaskGroup group;
+    for (size_t i = 0; i + 1 < tasks.size(); ++i)
+      post(tasks[i], group);
+    tasks.back()();
+    group.wait();
+  }
+
+  /** Worker thread: run queued tasks until stopping with none left. */
+  void WorkerPool::work()
+  {
+    for (;;)
+      {
+        Entry entry;
+        {
+          boost::mutex::scoped_lock lock(lock_);
+          while (queue_.empty() && !stopping_)
+            ready_.wait(lock);
+          if (queue_.empty())
+            return;
+          entry = queue_.front();
+          queue_.pop_front();
+        }
+        entry.task();
+        entry.group->done();
+      }
+  }
+
+} // namespace velodyne_rawdata
@@ -5,7 +5,13 @@
 #include <gtest/gtest.h>
 
 #include <ros/package.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <velodyne_pointcloud/calibration.h>
+#include <velodyne_pointcloud/calibration_cache.h>
 using namespace velodyne_pointcloud;
 
 // global test data
@@ -154,6 +160,131 @@ TEST(Calibration, hdl64e_s2_float_intensities)
   EXPECT_EQ(laser.min_intensity, 0);
 }
 
+TEST(Calibration, correction_table)
+{
+  Calibration calibration(g_package_path + "/params/64e_s2.1-sztaki.yaml",
+                          false);
+  EXPECT_TRUE(calibration.initialized);
+  ASSERT_EQ(calibration.num_lasers, 64);
+  const CorrectionTable &table = calibration.correction_table;
+
+  // every laser's table entry matches its map entry
+  for (int laser = 0; laser < calibration.num_lasers; ++laser) {
+    const LaserCorrection &corrections =
+      calibration.laser_corrections[laser];
+    EXPECT_FLOAT_EQ(table.dist_correction[laser],
+                    corrections.dist_correction);
+    EXPECT_FLOAT_EQ(table.sin_vert_correction[laser],
+                    corrections.sin_vert_correction);
+    EXPECT_FLOAT_EQ(table.horiz_offset_correction[laser],
+                    corrections.horiz_offset_correction);
+    EXPECT_EQ(table.laser_ring[laser], corrections.laser_ring);
+    EXPECT_EQ(table.row[laser], 63 - corrections.laser_ring);
+    EXPECT_FLOAT_EQ(table.two_pt_slope_x[laser], 0.0);
+    EXPECT_FLOAT_EQ(table.two_pt_offset_y[laser], 0.0);
+  }
+
+  // focal_distance 12.0: 256 * (1 - 12/13100)^2
+  EXPECT_NEAR(table.focal_offset[0], 255.53121, 1e-3);
+  EXPECT_FLOAT_EQ(table.focal_slope[0], 1.4);
+  EXPECT_FLOAT_EQ(table.min_intensity[0], 30.0);
+  EXPECT_FLOAT_EQ(table.max_intensity[0], 235.0);
+}
+
+TEST(Calibration, correction_table_two_point)
+{
+  Calibration calibration(false);
+  LaserCorrection corrections = LaserCorrection();
+  corrections.dist_correction = 1.0;
+  corrections.two_pt_correction_available = true;
+  corrections.dist_correction_x = 1.2;
+  corrections.dist_correction_y = 0.9;
+  calibration.laser_corrections[0] = corrections;
+  calibration.num_lasers = 1;
+  calibration.buildCorrectionTable();
+  const CorrectionTable &table = calibration.correction_table;
+
+  // the linear terms give the corrections at both calibration distances
+  EXPECT_NEAR(table.two_pt_slope_x[0] * 2.4 + table.two_pt_offset_x[0],
+              0.2, 1e-6);
+  EXPECT_NEAR(table.two_pt_slope_x[0] * 25.04 + table.two_pt_offset_x[0],
+              0.0, 1e-6);
+  EXPECT_NEAR(table.two_pt_slope_y[0] * 1.93 + table.two_pt_offset_y[0],
+              -0.1, 1e-6);
+  EXPECT_NEAR(table.two_pt_slope_y[0] * 25.04 + table.two_pt_offset_y[0],
+              0.0, 1e-6);
+
+  // lasers missing from the calibration have no ring
+  EXPECT_EQ(table.laser_ring[1], -1);
+}
+
+// A new file in /tmp, removed when the test ends, failed or not.
+class TempFile
+{
+public:
+  TempFile()
+  {
+    char name[] = "/tmp/test_calibration_XXXXXX";
+    int fd = mkstemp(name);
+    if (fd != -1)
+      {
+        name_ = name;
+        close(fd);
+      }
+  }
+  ~TempFile()
+  {
+    if (!name_.empty())
+      unlink(name_.c_str());
+  }
+  const std::string &name() const { return name_; }
+
+private:
+  std::string name_;
+};
+
+TEST(CompiledCalibration, round_trip)
+{
+  std::string yaml_file = g_package_path + "/params/32db.yaml";
+  TempFile temp;
+  ASSERT_FALSE(temp.name().empty());
+  const std::string &compiled_file = temp.name();
+  ASSERT_TRUE(CompiledCalibration::compile(yaml_file, compiled_file));
+
+  Calibration parsed(yaml_file, false);
+  Calibration calibration(false);
+  {
+    CompiledCalibration::ConstPtr compiled =
+      CompiledCalibration::load(compiled_file);
+    ASSERT_TRUE(compiled);
+    compiled->apply(calibration);
+    EXPECT_TRUE(calibration.initialized);
+    EXPECT_EQ(calibration.num_lasers, 32);
+    EXPECT_EQ(calibration.id, parsed.id);
+    EXPECT_EQ(memcmp(&calibration.correction_table, &parsed.correction_table,
+                     sizeof(CorrectionTable)), 0);
+
+    // loaded once per process
+    EXPECT_EQ(CompiledCalibration::load(compiled_file), compiled);
+    CompiledCalibration::ConstPtr from_yaml =
+      CompiledCalibration::load(yaml_file);
+    ASSERT_TRUE(from_yaml);
+    EXPECT_EQ(CompiledCalibration::load(yaml_file), from_yaml);
+    EXPECT_EQ(memcmp(&from_yaml->image(), &compiled->image(),
+                     sizeof(CalibrationImage)), 0);
+  }
+
+  // a corrupt file is refused
+  FILE *file = fopen(compiled_file.c_str(), "r+b");
+  ASSERT_TRUE(file != NULL);
+  fseek(file, offsetof(CalibrationImage, table), SEEK_SET);
+  int byte = fgetc(file);
+  fseek(file, offsetof(CalibrationImage, table), SEEK_SET);
+  fputc(byte ^ 0xff, file);
+  fclose(file);
+  EXPECT_FALSE(CompiledCalibration::load(compiled_file));
+}
+
 // Run all the tests that were declared with TEST()
 int main(int argc, char **argv)
 {
@@ -0,0 +1,889 @@
+//
+// C++ unit tests for unpacking raw packets.
+//
+
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+#include <gtest/gtest.h>
+
+#include <ros/package.h>
+#include <velodyne_pointcloud/compact_scan.h>
+#include <velodyne_pointcloud/rawdata.h>
+#include <velodyne_pointcloud/worker_pool.h>
+
+#include "unpack_kernel.h"
+using namespace velodyne_pointcloud;
+using namespace velodyne_rawdata;
+
+// global test data
+std::string g_package_name("velodyne_pointcloud");
+std::string g_package_path;
+
+void init_global_data(void)
+{
+  g_package_path = ros::package::getPath(g_package_name);
+}
+
+// A VLP-16 scan with distinct returns in every cell.  In dual return
+// mode the last returns are twice as far as the strongest ones.
+velodyne_msgs::VelodyneScanPtr vlp16Scan(uint8_t return_mode, int packets)
+{
+  velodyne_msgs::VelodyneScanPtr scan(new velodyne_msgs::VelodyneScan);
+  scan->header.stamp = ros::Time(100.0);
+  scan->header.frame_id = "velodyne";
+  for (int p = 0; p < packets; ++p)
+    {
+      velodyne_msgs::VelodynePacket pkt;
+      pkt.data.assign(0);
+      pkt.stamp = scan->header.stamp + ros::Duration(p * 0.001327);
+      raw_packet_t *raw = (raw_packet_t *) &pkt.data[0];
+      for (int block = 0; block < BLOCKS_PER_PACKET; ++block)
+        {
+          int step = (return_mode == 0x39)? block / 2: block;
+          raw->blocks[block].header = UPPER_BANK;
+          raw->blocks[block].rotation = (p * BLOCKS_PER_PACKET + step) * 40;
+          for (int k = 0; k < SCANS_PER_BLOCK; ++k)
+            {
+              int distance = 2000 + 10 * k;
+              if (return_mode == 0x39 && block % 2 == 0)
+                distance *= 2;
+              raw->blocks[block].data[k * RAW_SCAN_SIZE] = distance & 0xff;
+              raw->blocks[block].data[k * RAW_SCAN_SIZE + 1] = distance >> 8;
+              raw->blocks[block].data[k * RAW_SCAN_SIZE + 2] = 100;
+            }
+        }
+      raw->status[PACKET_STATUS_SIZE-2] = return_mode;
+      raw->status[PACKET_STATUS_SIZE-1] = 0x22;
+      scan->packets.push_back(pkt);
+    }
+  return scan;
+}
+
+// An HDL-32E scan, every block of the upper bank, with distances
+// varying from return to return.
+velodyne_msgs::VelodyneScanPtr hdl32Scan(int packets)
+{
+  velodyne_msgs::VelodyneScanPtr scan(new velodyne_msgs::VelodyneScan);
+  scan->header.stamp = ros::Time(100.0);
+  scan->header.frame_id = "velodyne";
+  for (int p = 0; p < packets; ++p)
+    {
+      velodyne_msgs::VelodynePacket pkt;
+      pkt.data.assign(0);
+      pkt.stamp = scan->header.stamp + ros::Duration(p * 0.000553);
+      raw_packet_t *raw = (raw_packet_t *) &pkt.data[0];
+      for (int block = 0; block < BLOCKS_PER_PACKET; ++block)
+        {
+          raw->blocks[block].header = UPPER_BANK;
+          raw->blocks[block].rotation =
+            ((p * BLOCKS_PER_PACKET + block) * 40) % ROTATION_MAX_UNITS;
+          for (int k = 0; k < SCANS_PER_BLOCK; ++k)
+            {
+              int distance = 1000 + 37 * ((p + block + k) % 50);
+              raw->blocks[block].data[k * RAW_SCAN_SIZE] = distance & 0xff;
+              raw->blocks[block].data[k * RAW_SCAN_SIZE + 1] = distance >> 8;
+              raw->blocks[block].data[k * RAW_SCAN_SIZE + 2] = k;
+            }
+        }
+      scan->packets.push_back(pkt);
+    }
+  return scan;
+}
+
+// Expect two organized clouds to have the same cells, empty ones
+// included.
+void expect_same_cells(const VPointCloud &expected, const VPointCloud &actual)
+{
+  ASSERT_EQ(actual.width, expected.width);
+  ASSERT_EQ(actual.height, expected.height);
+  for (uint32_t col = 0; col < expected.width; ++col)
+    for (uint32_t row = 0; row < expected.height; ++row)
+      {
+        const VPoint &e = expected.at(col, row);
+        const VPoint &a = actual.at(col, row);
+        if (isnan(e.x))
+          EXPECT_TRUE(isnan(a.x)) << "column " << col << ", row " << row;
+        else
+          {
+            EXPECT_EQ(a.x, e.x) << "column " << col << ", row " << row;
+            EXPECT_EQ(a.y, e.y) << "column " << col << ", row " << row;
+            EXPECT_EQ(a.z, e.z) << "column " << col << ", row " << row;
+          }
+        EXPECT_EQ(a.intensity, e.intensity) << "column " << col << ", row " << row;
+        EXPECT_EQ(a.ring, e.ring) << "column " << col << ", row " << row;
+      }
+}
+
+// Expect a scan unpacked on a pool of worker threads to be the same
+// as unpacked on the calling thread alone.
+void expect_pool_unpack(const std::string &calibration,
+                        const velodyne_msgs::VelodyneScanPtr &scan,
+                        double view_width, VPointCloud &serial)
+{
+  RawData data;
+  ASSERT_EQ(data.setCalibration(g_package_path + calibration), 0);
+  data.setParameters(0.0, 1000.0, 0.0, view_width);
+  data.unpack(scan, serial);
+
+  // three threads and the calling one: four ranges of packets
+  VPointCloud parallel;
+  data.setWorkerPool(boost::shared_ptr<WorkerPool>(new WorkerPool(3)));
+  data.unpack(scan, parallel);
+  expect_same_cells(serial, parallel);
+
+  // again, into a recycled cloud
+  data.unpack(scan, parallel);
+  expect_same_cells(serial, parallel);
+}
+
+///////////////////////////////////////////////////////////////
+// Test cases
+///////////////////////////////////////////////////////////////
+
+TEST(RawData, vlp16_times)
+{
+  RawData data;
+  ASSERT_EQ(data.setCalibration(g_package_path + "/params/VLP16db.yaml"), 0);
+  velodyne_msgs::VelodyneScanPtr scan = vlp16Scan(0x37, 2);
+  VTPointCloud cloud;
+  data.unpack(scan, cloud);
+  ASSERT_EQ(cloud.width, 2u * BLOCKS_PER_PACKET * VLP16_FIRINGS_PER_BLOCK);
+  ASSERT_EQ(cloud.height, 16u);
+
+  // firings are VLP16_FIRING_TOFFSET apart, starting at each packet,
+  // and their lasers VLP16_DSR_TOFFSET apart
+  for (uint32_t col = 0; col < cloud.width; ++col)
+    {
+      uint32_t packet = col / (BLOCKS_PER_PACKET * VLP16_FIRINGS_PER_BLOCK);
+      uint32_t firing = col % (BLOCKS_PER_PACKET * VLP16_FIRINGS_PER_BLOCK);
+      float start = (scan->packets[packet].stamp - scan->header.stamp).toSec()
+        + firing * VLP16_FIRING_TOFFSET * 1.0e-6f;
+      float first = cloud.at(col, 0).time;
+      float end = first;
+      for (uint32_t row = 0; row < cloud.height; ++row)
+        {
+          const VTPoint &point = cloud.at(col, row);
+          first = std::min(first, point.time);
+          end = std::max(end, point.time);
+          EXPECT_EQ(point.return_index, RETURN_SINGLE);
+          EXPECT_FALSE(isnan(point.x));
+        }
+      EXPECT_NEAR(first, start, 1.0e-7) << "column " << col;
+      EXPECT_NEAR(end - first, 15 * VLP16_DSR_TOFFSET * 1.0e-6f, 1.0e-7)
+        << "column " << col;
+    }
+}
+
+TEST(RawData, vlp16_dual_returns)
+{
+  RawData data;
+  ASSERT_EQ(data.setCalibration(g_package_path + "/params/VLP16db.yaml"), 0);
+  velodyne_msgs::VelodyneScanPtr scan = vlp16Scan(0x39, 3);
+  VTPointCloud combined, strongest, last;
+  data.unpack(scan, combined);
+  data.unpackReturns(scan, strongest, last);
+  ASSERT_EQ(strongest.width * 2, combined.width);
+  ASSERT_EQ(last.width * 2, combined.width);
+  ASSERT_EQ(strongest.height, combined.height);
+  ASSERT_EQ(last.height, combined.height);
+
+  // each split cell is the combined one
+  for (size_t p = 0; p < scan->packets.size(); ++p)
+    for (int block = 0; block < BLOCKS_PER_PACKET; ++block)
+      for (int firing = 0; firing < VLP16_FIRINGS_PER_BLOCK; ++firing)
+        for (uint32_t row = 0; row < combined.height; ++row)
+          {
+            int col = vlp16_column(p, block, firing, true);
+            const VTPoint &expected = combined.at(col, row);
+            const VTPoint &actual =
+              (block % 2? strongest: last).at(col / 2, row);
+            EXPECT_EQ(expected.return_index,
+                      block % 2? RETURN_STRONGEST: RETURN_LAST);
+            EXPECT_EQ(actual.return_index, expected.return_index);
+            EXPECT_FLOAT_EQ(actual.x, expected.x);
+            EXPECT_FLOAT_EQ(actual.y, expected.y);
+            EXPECT_FLOAT_EQ(actual.z, expected.z);
+            EXPECT_FLOAT_EQ(actual.time, expected.time);
+            EXPECT_EQ(actual.ring, expected.ring);
+          }
+
+  // the last returns are farther, at the same firing times
+  const VTPoint &s = strongest.at(5, 3);
+  const VTPoint &l = last.at(5, 3);
+  EXPECT_GT(l.x * l.x + l.y * l.y, s.x * s.x + s.y * s.y);
+  EXPECT_FLOAT_EQ(l.time, s.time);
+}
+
+TEST(RawData, vlp16_single_return_split)
+{
+  RawData data;
+  ASSERT_EQ(data.setCalibration(g_package_path + "/params/VLP16db.yaml"), 0);
+  VTPointCloud strongest, last;
+  data.unpackReturns(vlp16Scan(0x38, 2), strongest, last);
+  EXPECT_EQ(strongest.width, 0u);
+  EXPECT_TRUE(strongest.points.empty());
+  ASSERT_EQ(last.width, 2u * BLOCKS_PER_PACKET * VLP16_FIRINGS_PER_BLOCK);
+  EXPECT_EQ(last.at(0, 0).return_index, RETURN_SINGLE);
+}
+
+// Expect a decimated cloud to hold every stride-th cell of the full
+// resolution one, with the columns of each firing in groups.
+void expect_decimated(uint8_t return_mode, int group)
+{
+  RawData data;
+  ASSERT_EQ(data.setCalibration(g_package_path + "/params/VLP16db.yaml"), 0);
+  velodyne_msgs::VelodyneScanPtr scan = vlp16Scan(return_mode, 3);
+  VPointCloud full, decimated;
+  data.unpack(scan, full);
+  data.setDecimation(2, 5);
+  data.unpackDecimated(scan, decimated);
+
+  uint32_t firings = full.width / group;
+  ASSERT_EQ(decimated.width, (firings + 4) / 5 * group);
+  ASSERT_EQ(decimated.height, 8u);
+  for (uint32_t col = 0; col < decimated.width; ++col)
+    for (uint32_t row = 0; row < decimated.height; ++row)
+      {
+        const VPoint &expected =
+          full.at((col / group) * 5 * group + col % group, row * 2);
+        const VPoint &actual = decimated.at(col, row);
+        EXPECT_FLOAT_EQ(actual.x, expected.x);
+        EXPECT_FLOAT_EQ(actual.y, expected.y);
+        EXPECT_FLOAT_EQ(actual.z, expected.z);
+        EXPECT_FLOAT_EQ(actual.intensity, expected.intensity);
+        EXPECT_EQ(actual.ring, expected.ring);
+      }
+}
+
+TEST(RawData, vlp16_decimated)
+{
+  expect_decimated(0x37, 1);
+}
+
+TEST(RawData, vlp16_dual_return_decimated)
+{
+  expect_decimated(0x39, 2);
+}
+
+// Two sensors fused side by side in a cloud taller than either: the
+// second one transformed by its extrinsic, the rows past its lasers
+// empty.
+TEST(RawData, vlp16_fused)
+{
+  RawData data;
+  ASSERT_EQ(data.setCalibration(g_package_path + "/params/VLP16db.yaml"), 0);
+  velodyne_msgs::VelodyneScanPtr scan = vlp16Scan(0x37, 2);
+  VPointCloud single;
+  data.unpack(scan, single);
+
+  RawData moved;
+  ASSERT_EQ(moved.setCalibration(g_package_path + "/params/VLP16db.yaml"), 0);
+  moved.setParameters(0.0, 1000.0, 0.0, 2 * M_PI, "base_link");
+  moved.setExtrinsic(tf::Transform(tf::Quaternion(0.0, 0.0, 0.0, 1.0),
+                                   tf::Vector3(1.0, 2.0, 3.0)));
+
+  const uint32_t width = data.scanColumns(*scan);
+  ASSERT_EQ(width, single.width);
+  ASSERT_EQ(data.scanRows(), 16u);
+  VSPointCloud fused;
+  fused.width = 2 * width;
+  fused.height = 20;
+  fused.points.resize(fused.width * fused.height);
+  ASSERT_TRUE(data.unpackFused(scan, fused, 0, 0));
+  ASSERT_TRUE(moved.unpackFused(scan, fused, width, 1));
+  EXPECT_FALSE(data.unpackFused(scan, fused, width + 1, 0));
+
+  for (uint32_t col = 0; col < width; ++col)
+    {
+      for (uint32_t row = 0; row < single.height; ++row)
+        {
+          const VPoint &expected = single.at(col, row);
+          const VSPoint &first = fused.at(col, row);
+          const VSPoint &second = fused.at(width + col, row);
+          EXPECT_FLOAT_EQ(first.x, expected.x);
+          EXPECT_FLOAT_EQ(first.z, expected.z);
+          EXPECT_EQ(first.ring, expected.ring);
+          EXPECT_EQ(first.sensor, 0u);
+          EXPECT_NEAR(second.x, expected.x + 1.0f, 1.0e-5);
+          EXPECT_NEAR(second.y, expected.y + 2.0f, 1.0e-5);
+          EXPECT_NEAR(second.z, expected.z + 3.0f, 1.0e-5);
+          EXPECT_FLOAT_EQ(second.intensity, expected.intensity);
+          EXPECT_EQ(second.sensor, 1u);
+        }
+      for (uint32_t row = single.height; row < fused.height; ++row)
+        {
+          EXPECT_TRUE(isnan(fused.at(col, row).x));
+          EXPECT_EQ(fused.at(width + col, row).sensor, 1u);
+        }
+    }
+}
+
+TEST(RawData, vlp16_worker_pool)
+{
+  VPointCloud serial;
+  expect_pool_unpack("/params/VLP16db.yaml", vlp16Scan(0x37, 64), 2 * M_PI,
+                     serial);
+}
+
+TEST(RawData, vlp16_dual_return_worker_pool)
+{
+  VPointCloud serial;
+  expect_pool_unpack("/params/VLP16db.yaml", vlp16Scan(0x39, 64), 2 * M_PI,
+                     serial);
+}
+
+// Each range continues the column order after the points the view
+// window kept in the ranges before it.
+TEST(RawData, hdl32_view_window_worker_pool)
+{
+  VPointCloud serial;
+  expect_pool_unpack("/params/32db.yaml", hdl32Scan(64), M_PI, serial);
+  int empty = 0;
+  for (size_t i = 0; i < serial.points.size(); ++i)
+    empty += isnan(serial.points[i].x);
+  EXPECT_GT(empty, 0);
+  EXPECT_LT(empty, (int) serial.points.size());
+}
+
+// An invalid block header in the last range empties the rest of the
+// scan there too.
+TEST(RawData, vlp16_invalid_header_worker_pool)
+{
+  velodyne_msgs::VelodyneScanPtr scan = vlp16Scan(0x37, 64);
+  const size_t bad = 50;
+  ((raw_packet_t *) &scan->packets[bad].data[0])->blocks[3].header = 0;
+  VPointCloud serial;
+  expect_pool_unpack("/params/VLP16db.yaml", scan, 2 * M_PI, serial);
+  const uint32_t firings = BLOCKS_PER_PACKET * VLP16_FIRINGS_PER_BLOCK;
+  for (uint32_t col = 0; col < serial.width; ++col)
+    EXPECT_EQ(isnan(serial.at(col, 0).x), col >= bad * firings)
+      << "column " << col;
+}
+
+// Expect a compact scan to decode to the cloud RawData::unpack()
+// computes.
+void expect_compact_round_trip(const std::string &calibration,
+                               const velodyne_msgs::VelodyneScanPtr &scan)
+{
+  RawData data;
+  ASSERT_EQ(data.setCalibration(g_package_path + calibration), 0);
+  data.setParameters(0.0, 1000.0, 0.0, 2 * M_PI);
+  VPointCloud expected;
+  data.unpack(scan, expected);
+
+  velodyne_msgs::VelodyneCompactScan compact;
+  data.unpackCompact(scan, compact);
+  Calibration parsed(g_package_path + calibration, false);
+  CompactDecoder decoder(parsed);
+  ASSERT_TRUE(decoder.matches(compact));
+  VPointCloud decoded;
+  ASSERT_EQ(decoder.decode(compact, decoded), 0);
+
+  ASSERT_EQ(decoded.width, expected.width);
+  ASSERT_EQ(decoded.height, expected.height);
+  for (uint32_t col = 0; col < expected.width; ++col)
+    for (uint32_t row = 0; row < expected.height; ++row)
+      {
+        const VPoint &e = expected.at(col, row);
+        const VPoint &d = decoded.at(col, row);
+        EXPECT_EQ(d.ring, e.ring) << "column " << col << ", row " << row;
+        if (isnan(e.x))
+          {
+            EXPECT_TRUE(isnan(d.x)) << "column " << col << ", row " << row;
+            continue;
+          }
+        EXPECT_FLOAT_EQ(d.x, e.x) << "column " << col << ", row " << row;
+        EXPECT_FLOAT_EQ(d.y, e.y) << "column " << col << ", row " << row;
+        EXPECT_FLOAT_EQ(d.z, e.z) << "column " << col << ", row " << row;
+        EXPECT_EQ(d.intensity, e.intensity);
+        EXPECT_EQ(compact.intensity[row * compact.width + col], e.intensity)
+          << "column " << col << ", row " << row;
+      }
+
+  // a single point, by its cloud row
+  VPoint point;
+  ASSERT_TRUE(decoder.point(compact, 3, 7, point));
+  EXPECT_FLOAT_EQ(point.x, expected.at(7, 3).x);
+  EXPECT_EQ(point.ring, expected.at(7, 3).ring);
+}
+
+// VLP-16 beams interpolate the azimuth steps of the blocks; 48 per
+// block makes them whole, as the decoder rounds them from columns.
+TEST(RawData, vlp16_compact_round_trip)
+{
+  for (int dual = 0; dual < 2; ++dual)
+    {
+      velodyne_msgs::VelodyneScanPtr scan = vlp16Scan(dual? 0x39: 0x37, 32);
+      for (size_t p = 0; p < scan->packets.size(); ++p)
+        {
+          raw_packet_t *raw = (raw_packet_t *) &scan->packets[p].data[0];
+          for (int block = 0; block < BLOCKS_PER_PACKET; ++block)
+            raw->blocks[block].rotation = raw->blocks[block].rotation / 40 * 48;
+        }
+      expect_compact_round_trip("/params/VLP16db.yaml", scan);
+    }
+}
+
+TEST(RawData, hdl32_compact_round_trip)
+{
+  expect_compact_round_trip("/params/32db.yaml", hdl32Scan(32));
+}
+
+// Range image columns are 20 rotation units wide; the last one ends
+// at the 36000 wrap.
+TEST(RawData, hdl32_range_image)
+{
+  RawData data;
+  ASSERT_EQ(data.setCalibration(g_package_path + "/params/32db.yaml"), 0);
+  data.setParameters(0.0, 1000.0, 0.0, 2 * M_PI);
+  velodyne_msgs::VelodyneScanPtr scan = hdl32Scan(1);
+  const uint16_t rotation[BLOCKS_PER_PACKET] =
+    {35940, 35960, 35980, 35999, 0, 1, 19, 20, 40, 60, 80, 18000};
+  const int column[BLOCKS_PER_PACKET] =
+    {1797, 1798, 1799, 1799, 0, 0, 0, 1, 2, 3, 4, 900};
+  raw_packet_t *raw = (raw_packet_t *) &scan->packets[0].data[0];
+  for (int block = 0; block < BLOCKS_PER_PACKET; ++block)
+    raw->blocks[block].rotation = rotation[block];
+
+  velodyne_msgs::VelodyneRangeImage image;
+  data.unpackRangeImage(scan, image);
+  ASSERT_EQ(image.width, 1800u);
+  ASSERT_EQ(image.height, 32u);
+  ASSERT_EQ(image.range.size(), 1800u * 32u);
+  ASSERT_EQ(image.azimuth.size(), 1800u);
+  ASSERT_EQ(image.time.size(), 1800u);
+  VPointCloud cloud;
+  data.unpack(scan, cloud);
+  ASSERT_EQ(cloud.width, (uint32_t) BLOCKS_PER_PACKET);
+  ASSERT_EQ(cloud.height, image.height);
+
+  // the first firing in a column gives its azimuth and time
+  std::vector<bool> fired(image.width, false);
+  for (int block = BLOCKS_PER_PACKET - 1; block >= 0; --block)
+    {
+      const int col = column[block];
+      fired[col] = true;
+      if (block > 0 && column[block - 1] == col)
+        continue;
+      EXPECT_NEAR(image.azimuth[col], rotation[block] * M_PI / 18000.0,
+                  1.0e-6) << "block " << block;
+      EXPECT_NEAR(image.time[col], block * HDL32_BLOCK_TDURATION * 1.0e-6,
+                  1.0e-9) << "block " << block;
+    }
+
+  // each cell keeps the nearest return, in the row of the organized
+  // cloud; hdl32Scan() intensities are laser numbers
+  Calibration calibration(g_package_path + "/params/32db.yaml", false);
+  const CorrectionTable &table = calibration.correction_table;
+  for (int block = 0; block < BLOCKS_PER_PACKET; ++block)
+    for (int laser = 0; laser < SCANS_PER_BLOCK; ++laser)
+      {
+        const int row = table.row[laser];
+        EXPECT_EQ(cloud.at(block, row).intensity, laser);
+        EXPECT_EQ(cloud.at(block, row).ring, table.laser_ring[laser]);
+
+        float nearest = 1000.0f;
+        for (int other = 0; other < BLOCKS_PER_PACKET; ++other)
+          if (column[other] == column[block])
+            nearest = std::min(nearest, (1000 + 37 * ((other + laser) % 50))
+                               * DISTANCE_RESOLUTION
+                               + table.dist_correction[laser]);
+        const size_t cell = row * image.width + column[block];
+        EXPECT_FLOAT_EQ(image.range[cell], nearest)
+          << "block " << block << ", laser " << laser;
+        EXPECT_EQ(image.intensity[cell], laser);
+      }
+
+  // columns without firings stay empty
+  for (uint32_t col = 0; col < image.width; ++col)
+    {
+      if (fired[col])
+        continue;
+      EXPECT_TRUE(isnan(image.azimuth[col])) << "column " << col;
+      EXPECT_TRUE(isnan(image.time[col])) << "column " << col;
+      for (uint32_t row = 0; row < image.height; ++row)
+        {
+          EXPECT_TRUE(isnan(image.range[row * image.width + col]));
+          EXPECT_EQ(image.intensity[row * image.width + col], 0);
+        }
+    }
+}
+
+// Offset of a packed cloud field, expected to have a type.
+uint32_t packed_field(const sensor_msgs::PointCloud2 &cloud,
+                      const std::string &name, uint8_t datatype)
+{
+  for (size_t i = 0; i < cloud.fields.size(); ++i)
+    if (cloud.fields[i].name == name)
+      {
+        EXPECT_EQ(cloud.fields[i].datatype, datatype) << name;
+        EXPECT_EQ(cloud.fields[i].count, 1u) << name;
+        return cloud.fields[i].offset;
+      }
+  ADD_FAILURE() << "no field " << name;
+  return 0;
+}
+
+// Value of FLOAT16 bits, infinity decoded as NaN.
+float half_value(uint16_t half)
+{
+  int exponent = (half >> 10) & 0x1f;
+  if (exponent == 0x1f)
+    return NAN;
+  float value = (half & 0x3ff) / 1024.0f;
+  if (exponent == 0)                    // subnormal or zero
+    value *= ldexpf(1.0f, -14);
+  else
+    value = (1.0f + value) * ldexpf(1.0f, exponent - 15);
+  return (half & 0x8000)? -value: value;
+}
+
+// Expect a packed cloud to hold the cells of the PCL cloud of a scan,
+// its coordinates decoded from the layout.
+void expect_packed_cloud(const std::string &format, bool time,
+                         const velodyne_msgs::VelodyneScanPtr &scan)
+{
+  RawData data;
+  ASSERT_EQ(data.setCalibration(g_package_path + "/params/VLP16db.yaml"), 0);
+  VTPointCloud expected;
+  data.unpack(scan, expected);
+  const double resolution = 0.004;
+  ASSERT_TRUE(data.setCloudFormat(format, time, resolution));
+  ASSERT_TRUE(data.packedOutput());
+  sensor_msgs::PointCloud2 cloud;
+  data.unpack(scan, cloud);
+
+  ASSERT_EQ(cloud.width, expected.width);
+  ASSERT_EQ(cloud.height, expected.height);
+  EXPECT_EQ(cloud.header.frame_id, "velodyne");
+  ASSERT_EQ(cloud.row_step, cloud.width * cloud.point_step);
+  ASSERT_EQ(cloud.data.size(), cloud.row_step * cloud.height);
+  EXPECT_EQ(cloud.fields.size(), time? 6u: 5u);
+
+  // quantized coordinates are not named x, y and z
+  static const char *axes[3] = {"x", "y", "z"};
+  std::string suffix;
+  uint8_t datatype = sensor_msgs::PointField::FLOAT32;
+  uint32_t size = 4;
+  if (format == "float16")
+    {
+      suffix = "_float16";
+      datatype = sensor_msgs::PointField::UINT16;
+      size = 2;
+    }
+  else if (format == "int16")
+    {
+      suffix = "_int16_4000um";
+      datatype = sensor_msgs::PointField::INT16;
+      size = 2;
+    }
+  uint32_t axis_offset[3];
+  for (int axis = 0; axis < 3; ++axis)
+    axis_offset[axis] = packed_field(cloud, axes[axis] + suffix, datatype);
+  const uint32_t intensity_offset =
+    packed_field(cloud, "intensity", sensor_msgs::PointField::FLOAT32);
+  const uint32_t ring_offset =
+    packed_field(cloud, "ring", sensor_msgs::PointField::UINT16);
+  uint32_t time_offset = 0;
+  if (time)
+    time_offset = packed_field(cloud, "time", sensor_msgs::PointField::FLOAT32);
+  EXPECT_EQ(cloud.point_step, 3 * size + 4 + 2 + (time? 4: 0));
+
+  for (uint32_t col = 0; col < expected.width; ++col)
+    for (uint32_t row = 0; row < expected.height; ++row)
+      {
+        const VTPoint &e = expected.at(col, row);
+        const uint8_t *cell =
+          &cloud.data[row * cloud.row_step + col * cloud.point_step];
+        const float coordinate[3] = {e.x, e.y, e.z};
+        for (int axis = 0; axis < 3; ++axis)
+          {
+            const uint8_t *field = cell + axis_offset[axis];
+            float value;
+            float tolerance = 0.0f;
+            if (format == "float32")
+              memcpy(&value, field, sizeof(value));
+            else if (format == "float16")
+              {
+                uint16_t half;
+                memcpy(&half, field, sizeof(half));
+                value = half_value(half);
+                tolerance = fabsf(coordinate[axis]) / 2048.0f;
+              }
+            else
+              {
+                int16_t units;
+                memcpy(&units, field, sizeof(units));
+                if (isnan(coordinate[axis]))
+                  {
+                    EXPECT_EQ(units, -32768);
+                    continue;
+                  }
+                value = units * resolution;
+                tolerance = resolution / 2 + 1.0e-6;
+              }
+            if (isnan(coordinate[axis]))
+              EXPECT_TRUE(isnan(value)) << "column " << col << ", row " << row;
+            else
+              EXPECT_NEAR(value, coordinate[axis], tolerance)
+                << axes[axis] << ", column " << col << ", row " << row;
+          }
+        // the layout reads it back to meters
+        float read[3];
+        uint16_t read_ring;
+        data.packedLayout().readPoint(cell, read[0], read[1], read[2],
+                                      read_ring);
+        for (int axis = 0; axis < 3; ++axis)
+          {
+            float tolerance = 0.0f;
+            if (format == "float16")
+              tolerance = fabsf(coordinate[axis]) / 2048.0f;
+            else if (format == "int16")
+              tolerance = resolution / 2 + 1.0e-6;
+            if (isnan(coordinate[axis]))
+              EXPECT_TRUE(isnan(read[axis]))
+                << "column " << col << ", row " << row;
+            else
+              EXPECT_NEAR(read[axis], coordinate[axis], tolerance)
+                << axes[axis] << ", column " << col << ", row " << row;
+          }
+        EXPECT_EQ(read_ring, e.ring) << "column " << col << ", row " << row;
+
+        float intensity;
+        uint16_t ring;
+        memcpy(&intensity, cell + intensity_offset, sizeof(intensity));
+        memcpy(&ring, cell + ring_offset, sizeof(ring));
+        EXPECT_EQ(intensity, e.intensity) << "column " << col << ", row " << row;
+        EXPECT_EQ(ring, e.ring) << "column " << col << ", row " << row;
+        if (time)
+          {
+            float t;
+            memcpy(&t, cell + time_offset, sizeof(t));
+            EXPECT_EQ(t, e.time) << "column " << col << ", row " << row;
+          }
+      }
+}
+
+TEST(RawData, packed_float32)
+{
+  expect_packed_cloud("float32", true, vlp16Scan(0x37, 3));
+}
+
+TEST(RawData, packed_float16)
+{
+  expect_packed_cloud("float16", false, vlp16Scan(0x37, 3));
+}
+
+// Dual return mode has empty cells, where INT16 coordinates are -32768.
+TEST(RawData, packed_int16)
+{
+  expect_packed_cloud("int16", true, vlp16Scan(0x39, 3));
+}
+
+// A consumer decodes int16 coordinates to meters from the cloud alone,
+// the resolution taken from the field names.
+TEST(RawData, packed_int16_decode)
+{
+  RawData data;
+  ASSERT_EQ(data.setCalibration(g_package_path + "/params/VLP16db.yaml"), 0);
+  velodyne_msgs::VelodyneScanPtr scan = vlp16Scan(0x37, 2);
+  VPointCloud expected;
+  data.unpack(scan, expected);
+  ASSERT_TRUE(data.setCloudFormat("int16", false, 0.0025));
+  sensor_msgs::PointCloud2 cloud;
+  data.unpack(scan, cloud);
+
+  const char axes[3] = {'x', 'y', 'z'};
+  uint32_t offset[3];
+  double scale[3];
+  for (int axis = 0; axis < 3; ++axis)
+    {
+      offset[axis] = 0;
+      scale[axis] = 0.0;
+      for (size_t i = 0; i < cloud.fields.size(); ++i)
+        {
+          long micrometers;
+          char name, end;
+          if (sscanf(cloud.fields[i].name.c_str(), "%c_int16_%ldu%c",
+                     &name, &micrometers, &end) == 3
+              && name == axes[axis] && end == 'm')
+            {
+              EXPECT_EQ(cloud.fields[i].datatype,
+                        sensor_msgs::PointField::INT16);
+              offset[axis] = cloud.fields[i].offset;
+              scale[axis] = micrometers * 1.0e-6;
+            }
+        }
+      ASSERT_EQ(scale[axis], 0.0025) << axes[axis];
+    }
+
+  for (uint32_t col = 0; col < expected.width; ++col)
+    for (uint32_t row = 0; row < expected.height; ++row)
+      {
+        const VPoint &e = expected.at(col, row);
+        const float coordinate[3] = {e.x, e.y, e.z};
+        const uint8_t *cell =
+          &cloud.data[row * cloud.row_step + col * cloud.point_step];
+        for (int axis = 0; axis < 3; ++axis)
+          {
+            int16_t units;
+            memcpy(&units, cell + offset[axis], sizeof(units));
+            EXPECT_NEAR(units * scale[axis], coordinate[axis],
+                        scale[axis] / 2 + 1.0e-6)
+              << axes[axis] << ", column " << col << ", row " << row;
+          }
+      }
+}
+
+// Without a positive resolution int16 coordinates fall back to float32.
+TEST(RawData, packed_int16_bad_resolution)
+{
+  RawData data;
+  for (int i = 0; i < 2; ++i)
+    {
+      ASSERT_TRUE(data.setCloudFormat("int16", false, i? -0.005: 0.0));
+      ASSERT_TRUE(data.packedOutput());
+      velodyne_msgs::VelodyneScanPtr scan = vlp16Scan(0x37, 1);
+      ASSERT_EQ(data.setCalibration(g_package_path + "/params/VLP16db.yaml"),
+                0);
+      sensor_msgs::PointCloud2 cloud;
+      data.unpack(scan, cloud);
+      ASSERT_FALSE(cloud.fields.empty());
+      EXPECT_EQ(cloud.fields[0].name, "x");
+      EXPECT_EQ(cloud.fields[0].datatype, sensor_msgs::PointField::FLOAT32);
+      EXPECT_EQ(cloud.point_step, 18u);
+    }
+}
+
+TEST(RawData, packed_unknown_format)
+{
+  RawData data;
+  EXPECT_FALSE(data.setCloudFormat("float64", false, 0.005));
+  EXPECT_FALSE(data.packedOutput());
+  EXPECT_TRUE(data.setCloudFormat("pcl", false, 0.005));
+  EXPECT_FALSE(data.packedOutput());
+}
+
+// The kernels keep their own copy of the VLP-16 firing times.
+TEST(RawData, kernel_firing_times)
+{
+  EXPECT_EQ(KERNEL_VLP16_BLOCK_TDURATION, VLP16_BLOCK_TDURATION);
+  EXPECT_EQ(KERNEL_VLP16_DSR_TOFFSET, VLP16_DSR_TOFFSET);
+  EXPECT_EQ(KERNEL_VLP16_FIRING_TOFFSET, VLP16_FIRING_TOFFSET);
+  EXPECT_EQ(KERNEL_DISTANCE_RESOLUTION, DISTANCE_RESOLUTION);
+}
+
+#ifdef HAVE_CUDA
+// Expect a scan unpacked on CUDA device 0 to have the same cells as
+// unpacked by the scalar CPU kernel.
+void expect_cuda_unpack(const std::string &calibration,
+                        const velodyne_msgs::VelodyneScanPtr &scan,
+                        bool transform)
+{
+  RawData cpu, gpu;
+  ASSERT_EQ(cpu.setCalibration(g_package_path + calibration), 0);
+  ASSERT_EQ(gpu.setCalibration(g_package_path + calibration), 0);
+  if (transform)
+    {
+      tf::Transform extrinsic(tf::Quaternion(0.0, 0.0, 0.3894, 0.9211),
+                              tf::Vector3(1.0, -2.0, 0.5));
+      cpu.setParameters(0.0, 1000.0, 0.0, 2 * M_PI, "base_link");
+      cpu.setExtrinsic(extrinsic);
+      gpu.setParameters(0.0, 1000.0, 0.0, 2 * M_PI, "base_link");
+      gpu.setExtrinsic(extrinsic);
+    }
+  if (!gpu.setCudaDevice(0))
+    {
+      std::cout << "no CUDA device, skipping" << std::endl;
+      return;
+    }
+
+  VPointCloud expected, actual;
+  cpu.unpack(scan, expected);
+  gpu.unpack(scan, actual);
+  RawData::DeviceCloud device;
+  EXPECT_FALSE(cpu.deviceCloud(device));
+  ASSERT_TRUE(gpu.deviceCloud(device));
+  EXPECT_EQ(device.width, expected.width);
+  EXPECT_EQ(device.height, expected.height);
+  EXPECT_EQ(actual.header.frame_id, expected.header.frame_id);
+  expect_same_cells(expected, actual);
+  EXPECT_EQ(memcmp(device.host, &actual.points[0],
+                   actual.points.size() * sizeof(VPoint)), 0);
+}
+
+TEST(RawData, vlp16_cuda)
+{
+  expect_cuda_unpack("/params/VLP16db.yaml", vlp16Scan(0x37, 64), false);
+}
+
+TEST(RawData, vlp16_dual_return_cuda)
+{
+  expect_cuda_unpack("/params/VLP16db.yaml", vlp16Scan(0x39, 64), false);
+}
+
+TEST(RawData, hdl32_cuda)
+{
+  expect_cuda_unpack("/params/32db.yaml", hdl32Scan(64), false);
+}
+
+TEST(RawData, vlp16_transformed_cuda)
+{
+  expect_cuda_unpack("/params/VLP16db.yaml", vlp16Scan(0x37, 64), true);
+}
+
+TEST(RawData, vlp16_invalid_header_cuda)
+{
+  velodyne_msgs::VelodyneScanPtr scan = vlp16Scan(0x37, 64);
+  ((raw_packet_t *) &scan->packets[50].data[0])->blocks[3].header = 0;
+  expect_cuda_unpack("/params/VLP16db.yaml", scan, false);
+}
+#endif // HAVE_CUDA
+
+static void countRun(std::vector<int> *runs, size_t i)
+{
+  ++(*runs)[i];
+}
+
+TEST(WorkerPool, run)
+{
+  WorkerPool workers(3);
+  EXPECT_EQ(workers.threads(), 3);
+  std::vector<int> runs(16, 0);
+  std::vector<WorkerPool::Task> tasks;
+  for (size_t i = 0; i < runs.size(); ++i)
+    tasks.push_back(boost::bind(countRun, &runs, i));
+  workers.run(tasks);
+  for (size_t i = 0; i < runs.size(); ++i)
+    EXPECT_EQ(runs[i], 1) << "task " << i;
+}
+
+static void appendTask(std::vector<int> *order, boost::mutex *lock, int i)
+{
+  boost::mutex::scoped_lock locked(*lock);
+  order->push_back(i);
+}
+
+// One worker thread runs the posted tasks in order.
+TEST(WorkerPool, post_in_order)
+{
+  WorkerPool workers(1);
+  TaskGroup group;
+  std::vector<int> order;
+  boost::mutex lock;
+  for (int i = 0; i < 100; ++i)
+    workers.post(boost::bind(appendTask, &order, &lock, i), group);
+  group.wait();
+  ASSERT_EQ(order.size(), 100u);
+  for (int i = 0; i < 100; ++i)
+    EXPECT_EQ(order[i], i);
+}
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  init_global_data();
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,178 @@
+//
+// C++ unit tests for matching the scans of several sensors.
+//
+
+#include <gtest/gtest.h>
+
+#include <velodyne_pointcloud/sweep_matcher.h>
+using namespace velodyne_rawdata;
+
+typedef velodyne_msgs::VelodyneScan::ConstPtr ScanPtr;
+
+// global test data: sensors turning at 600 RPM, 80 packets a scan
+static const int PACKETS = 80;
+static const double PACKET_INTERVAL = 0.00125;  // [s]
+static const int PACKET_AZIMUTH_STEP = 450;     // [deg/100]
+static const double T0 = 1000.0;                // [s]
+
+// A scan starting at start_azimuth [deg/100] at time start [s].
+velodyne_msgs::VelodyneScanPtr rotatingScan(double start, int start_azimuth)
+{
+  velodyne_msgs::VelodyneScanPtr scan(new velodyne_msgs::VelodyneScan);
+  scan->header.stamp = ros::Time(start);
+  for (int p = 0; p < PACKETS; ++p)
+    {
+      velodyne_msgs::VelodynePacket pkt;
+      pkt.data.assign(0);
+      pkt.stamp = ros::Time(start + p * PACKET_INTERVAL);
+      int azimuth = (start_azimuth + p * PACKET_AZIMUTH_STEP) % 36000;
+      pkt.data[2] = azimuth & 0xff;
+      pkt.data[3] = azimuth >> 8;
+      scan->packets.push_back(pkt);
+    }
+  return scan;
+}
+
+// Scan k of a sensor mounted at yaw [deg/100] whose beams sweep the
+// target x axis at T0 + k/10 + delay [s].  It starts half a turn
+// before that.
+velodyne_msgs::VelodyneScanPtr sweepingScan(int yaw, int k, double delay)
+{
+  return rotatingScan(T0 + 0.1 * k + delay - 0.05, (yaw + 18000) % 36000);
+}
+
+///////////////////////////////////////////////////////////////
+// Test cases
+///////////////////////////////////////////////////////////////
+
+TEST(SweepMatcher, sweep_time)
+{
+  SweepMatcher matcher(3, 0.05);
+  matcher.setAzimuth(0, 9000);
+  matcher.setAzimuth(1, -9000);                 // 27000
+  matcher.setAzimuth(2, 100);
+  velodyne_msgs::VelodyneScanPtr scan = rotatingScan(T0, 0);
+
+  // within the scan
+  EXPECT_NEAR((matcher.sweepTime(0, *scan) - ros::Time(T0)).toSec(), 0.025,
+              1.0e-6);
+  EXPECT_NEAR((matcher.sweepTime(1, *scan) - ros::Time(T0)).toSec(), 0.075,
+              1.0e-6);
+
+  // in the gap between scans, just before the first packet
+  scan = rotatingScan(T0, 200);
+  EXPECT_NEAR((matcher.sweepTime(2, *scan) - ros::Time(T0)).toSec(),
+              -100 / 360000.0, 1.0e-6);
+
+  // and just after the last one
+  scan = rotatingScan(T0, 400);
+  EXPECT_NEAR((matcher.sweepTime(2, *scan) - ros::Time(T0)).toSec(),
+              (36000 - 300) / 360000.0, 1.0e-6);
+}
+
+// Sensors at different headings, not phase locked, cut their scans at
+// different azimuths and stamps; the same sweep times match them.
+TEST(SweepMatcher, mounting_yaws)
+{
+  const int yaw[3] = {0, 9000, 24000};
+  const double delay[3] = {0.0, 0.015, -0.03};
+  SweepMatcher matcher(3, 0.05);
+  for (int i = 0; i < 3; ++i)
+    matcher.setAzimuth(i, yaw[i]);
+
+  std::vector<ScanPtr> scans;
+  std::vector<double> skews;
+  for (int k = 0; k < 5; ++k)
+    {
+      ScanPtr expected[3];
+      for (int i = 0; i < 3; ++i)
+        {
+          EXPECT_EQ(matcher.next(scans, skews), -1);
+          expected[i] = sweepingScan(yaw[i], k, delay[i]);
+          ASSERT_TRUE(matcher.add(i, expected[i]));
+        }
+      ASSERT_EQ(matcher.next(scans, skews), 2) << "scan " << k;
+      ASSERT_EQ(scans.size(), 3u);
+      for (int i = 0; i < 3; ++i)
+        {
+          EXPECT_EQ(scans[i], expected[i]) << "scan " << k << ", sensor " << i;
+          EXPECT_NEAR(skews[i], delay[i] - delay[2], 1.0e-6);
+        }
+      EXPECT_EQ(matcher.next(scans, skews), -1);
+    }
+}
+
+// Sweeps more than max_skew apart are not fused.
+TEST(SweepMatcher, skew)
+{
+  SweepMatcher matcher(2, 0.05);
+  matcher.setAzimuth(1, 18000);
+  std::vector<ScanPtr> scans;
+  std::vector<double> skews;
+
+  ScanPtr a0 = sweepingScan(0, 0, 0.0);
+  ScanPtr b0 = sweepingScan(18000, 0, 0.07);
+  ScanPtr a1 = sweepingScan(0, 1, 0.0);
+  ScanPtr b1 = sweepingScan(18000, 1, 0.07);
+  matcher.add(0, a0);
+  matcher.add(1, b0);
+  ASSERT_EQ(matcher.next(scans, skews), 0);
+  EXPECT_EQ(scans[0], a0);
+  EXPECT_FALSE(scans[1]);
+
+  // b0 swept 0.03 s before a1
+  EXPECT_EQ(matcher.next(scans, skews), -1);
+  matcher.add(0, a1);
+  ASSERT_EQ(matcher.next(scans, skews), 1);
+  EXPECT_EQ(scans[0], a1);
+  EXPECT_EQ(scans[1], b0);
+  EXPECT_NEAR(skews[0], 0.03, 1.0e-6);
+  matcher.add(1, b1);
+  EXPECT_EQ(matcher.next(scans, skews), -1);
+}
+
+// When a sensor stops, the others are fused without it once their
+// next revolution ends more than max_skew after the sweep, whichever
+// sensor it is.
+TEST(SweepMatcher, stopped_sensor)
+{
+  for (int stopped = 0; stopped < 2; ++stopped)
+    {
+      const int running = 1 - stopped;
+      SweepMatcher matcher(2, 0.04);
+      std::vector<ScanPtr> scans;
+      std::vector<double> skews;
+      ScanPtr previous;
+      for (int k = 0; k < 5; ++k)
+        {
+          ScanPtr scan = sweepingScan(0, k, 0.0);
+          ASSERT_TRUE(matcher.add(running, scan));
+          if (k == 0)
+            EXPECT_EQ(matcher.next(scans, skews), -1);
+          else
+            {
+              ASSERT_EQ(matcher.next(scans, skews), running) << "scan " << k;
+              EXPECT_EQ(scans[running], previous);
+              EXPECT_FALSE(scans[stopped]);
+              EXPECT_EQ(matcher.next(scans, skews), -1);
+            }
+          previous = scan;
+        }
+    }
+}
+
+// A sensor far ahead of the others keeps only its latest scans.
+TEST(SweepMatcher, queue_limit)
+{
+  SweepMatcher matcher(2, 0.05);
+  for (int k = 0; k < 4; ++k)
+    EXPECT_TRUE(matcher.add(0, sweepingScan(0, 0, 0.0)));
+  EXPECT_FALSE(matcher.add(0, sweepingScan(0, 0, 0.0)));
+}
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,136 @@
+//
+// C++ unit tests for the block unpacking kernels.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gtest/gtest.h>
+
+#include "unpack_kernel.h"
+using namespace velodyne_pointcloud;
+using namespace velodyne_rawdata;
+
+// global test data
+CorrectionTable g_table;
+uint8_t g_data[KERNEL_BLOCK_RETURNS * KERNEL_RETURN_SIZE];
+float g_cos_azimuth[KERNEL_BLOCK_RETURNS];
+float g_sin_azimuth[KERNEL_BLOCK_RETURNS];
+
+static float uniform(float lo, float hi)
+{
+  return lo + (hi - lo) * (rand() / (float) RAND_MAX);
+}
+
+// Fill a correction table and one block with plausible random values.
+void init_global_data(void)
+{
+  srand(42);
+  memset(&g_table, 0, sizeof(g_table));
+  for (int laser = 0; laser < CorrectionTable::MAX_LASERS; ++laser) {
+    float vert = uniform(-0.5, 0.2);
+    float rot = uniform(-0.1, 0.1);
+    g_table.dist_correction[laser] = uniform(1.0, 1.6);
+    g_table.cos_vert_correction[laser] = cosf(vert);
+    g_table.sin_vert_correction[laser] = sinf(vert);
+    g_table.cos_rot_correction[laser] = cosf(rot);
+    g_table.sin_rot_correction[laser] = sinf(rot);
+    g_table.vert_offset_correction[laser] = uniform(0.1, 0.3);
+    g_table.horiz_offset_correction[laser] = uniform(-0.03, 0.03);
+    if (laser % 2) {                    // every other laser has two points
+      g_table.two_pt_slope_x[laser] = uniform(-0.01, 0.01);
+      g_table.two_pt_offset_x[laser] = uniform(-0.1, 0.1);
+      g_table.two_pt_slope_y[laser] = uniform(-0.01, 0.01);
+      g_table.two_pt_offset_y[laser] = uniform(-0.1, 0.1);
+    }
+    g_table.focal_slope[laser] = uniform(0.0, 1.5);
+    g_table.focal_offset[laser] = uniform(200.0, 256.0);
+    g_table.min_intensity[laser] = 10;
+    g_table.max_intensity[laser] = 235;
+  }
+
+  for (int i = 0; i < KERNEL_BLOCK_RETURNS; ++i) {
+    int raw = rand() % 65536;
+    g_data[i * KERNEL_RETURN_SIZE] = raw & 0xff;
+    g_data[i * KERNEL_RETURN_SIZE + 1] = raw >> 8;
+    g_data[i * KERNEL_RETURN_SIZE + 2] = rand() % 256;
+    float azimuth = uniform(0.0, 2 * M_PI);
+    g_cos_azimuth[i] = cosf(azimuth);
+    g_sin_azimuth[i] = sinf(azimuth);
+  }
+}
+
+// Compare a kernel with the scalar reference.
+void expect_same_points(UnpackBlockFn kernel, int laser, int n)
+{
+  BlockPoints expected, actual;
+  unpackBlockScalar(g_table, laser, n, g_data,
+                    g_cos_azimuth, g_sin_azimuth, expected);
+  kernel(g_table, laser, n, g_data, g_cos_azimuth, g_sin_azimuth, actual);
+
+  for (int i = 0; i < n; ++i) {
+    // fused multiply-add rounds differently, allow a few float ulps
+    float tolerance = 1e-5 * (1 + fabsf(expected.distance[i]));
+    EXPECT_NEAR(actual.x[i], expected.x[i], tolerance) << "point " << i;
+    EXPECT_NEAR(actual.y[i], expected.y[i], tolerance) << "point " << i;
+    EXPECT_NEAR(actual.z[i], expected.z[i], tolerance) << "point " << i;
+    EXPECT_NEAR(actual.distance[i], expected.distance[i], tolerance)
+      << "point " << i;
+    EXPECT_NEAR(actual.intensity[i], expected.intensity[i], 1e-3)
+      << "point " << i;
+  }
+}
+
+///////////////////////////////////////////////////////////////
+// Test cases
+///////////////////////////////////////////////////////////////
+
+TEST(UnpackKernel, scalar_point)
+{
+  // a laser without any offsets or corrections, looking level at
+  // azimuth zero, sees a point straight ahead in the ROS frame
+  CorrectionTable table;
+  memset(&table, 0, sizeof(table));
+  table.cos_vert_correction[0] = 1.0;
+  table.cos_rot_correction[0] = 1.0;
+  table.max_intensity[0] = 255;
+  uint8_t data[KERNEL_RETURN_SIZE] = {0xe8, 0x03, 100}; // 1000 * 2 mm
+  float cos_azimuth = 1.0;
+  float sin_azimuth = 0.0;
+
+  BlockPoints points;
+  unpackBlockScalar(table, 0, 1, data, &cos_azimuth, &sin_azimuth, points);
+  EXPECT_FLOAT_EQ(points.distance[0], 2.0);
+  EXPECT_FLOAT_EQ(points.x[0], 2.0);
+  EXPECT_NEAR(points.y[0], 0.0, 1e-6);
+  EXPECT_NEAR(points.z[0], 0.0, 1e-6);
+  EXPECT_FLOAT_EQ(points.intensity[0], 100.0);
+}
+
+TEST(UnpackKernel, selected)
+{
+  const char *name = NULL;
+  UnpackBlockFn kernel = selectUnpackBlock(&name);
+  ASSERT_TRUE(name != NULL);
+  expect_same_points(kernel, 0, KERNEL_BLOCK_RETURNS);  // HDL upper bank
+  expect_same_points(kernel, 32, KERNEL_BLOCK_RETURNS); // HDL lower bank
+  expect_same_points(kernel, 0, 16);                    // VLP-16 firing
+  expect_same_points(kernel, 3, 13);                    // partial vectors
+}
+
+#if defined(__SSE2__)
+TEST(UnpackKernel, sse2)
+{
+  expect_same_points(unpackBlockSSE2, 0, KERNEL_BLOCK_RETURNS);
+  expect_same_points(unpackBlockSSE2, 32, KERNEL_BLOCK_RETURNS);
+  expect_same_points(unpackBlockSSE2, 3, 13);
+}
+#endif
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  init_global_data();
+  return RUN_ALL_TESTS();
+}
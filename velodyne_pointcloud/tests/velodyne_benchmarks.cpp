@@ -0,0 +1,329 @@
+//
+// C++ benchmarks of the PCAP input and point cloud unpacking.
+//
+// Run with a ROS master, after building the tests:
+//
+//   rosrun velodyne_pointcloud velodyne_benchmarks _output:=results.json
+//
+// Each case converts every scan of a downloaded test capture again
+// and again for at least ~min_time seconds, then reports ns/point and
+// points/s (ns/packet and packets/s for the PCAP input).  ~output
+// names a JSON file of the results, for comparing versions; ~filter
+// runs only the cases whose names contain it.
+//
+
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <ros/ros.h>
+#include <ros/package.h>
+#include <tf/transform_listener.h>
+#include <velodyne_driver/input.h>
+#include <velodyne_driver/pcap_file.h>
+#include <velodyne_pointcloud/rawdata.h>
+
+using velodyne_msgs::VelodyneScan;
+
+// test capture of each model, with its calibration
+struct Model
+{
+  const char *name;
+  const char *pcap;                     // in tests/
+  const char *calibration;              // in params/
+  bool vlp16;
+};
+
+const Model g_models[] =
+  {
+    {"hdl64e", "class.pcap", "64e_utexas.yaml", false},
+    {"hdl32e", "32e.pcap", "32db.yaml", false},
+    {"hdl64e_s2.1", "64e_s2.1-300-sztaki.pcap", "64e_s2.1-sztaki.yaml", false},
+    {"vlp16", "vlp16.pcap", "VLP16db.yaml", true},
+  };
+
+const std::string g_sensor_frame("velodyne");
+const std::string g_target_frame("odom");
+
+// one benchmark case result
+struct Result
+{
+  std::string name;
+  std::string unit;                     // "point" or "packet"
+  size_t iterations;                    // passes over the capture
+  double items;                         // units converted in all passes
+  double seconds;
+};
+
+// global test data
+std::string g_package_path;
+std::vector<Result> g_results;
+double g_min_time;
+std::string g_filter;
+
+bool selected(const std::string &name)
+{
+  return name.find(g_filter) != std::string::npos;
+}
+
+void report(const std::string &name, const std::string &unit,
+            size_t iterations, double items, double seconds)
+{
+  Result result;
+  result.name = name;
+  result.unit = unit;
+  result.iterations = iterations;
+  result.items = items;
+  result.seconds = seconds;
+  g_results.push_back(result);
+  printf("%-36s %10.2f ns/%-6s %14.0f %ss/s\n", name.c_str(),
+         seconds * 1.0e9 / items, unit.c_str(), items / seconds,
+         unit.c_str());
+  fflush(stdout);
+}
+
+/** @brief Read a capture into one scan per revolution.
+ *
+ *  @param dual mark every packet as dual return (VLP-16)
+ *  @returns false if unreadable
+ */
+bool readScans(const std::string &filename, bool dual,
+               std::vector<VelodyneScan::ConstPtr> &scans)
+{
+  velodyne_driver::PcapFile file;
+  std::string error;
+  if (!file.open(filename, velodyne_driver::DATA_PORT_NUMBER, 0,
+                 velodyne_rawdata::PACKET_SIZE, &error))
+    {
+      ROS_ERROR("Unable to open %s: %s", filename.c_str(), error.c_str());
+      return false;
+    }
+
+  // find the first packet of each revolution after the first one
+  std::vector<const uint8_t *> starts;
+  velodyne_driver::PcapPacket packet;
+  for (size_t i = 1; i < file.revolutions(); ++i)
+    {
+      velodyne_driver::PcapFile::Position position = file.revolution(i);
+      if (file.read(position, &packet))
+        starts.push_back(packet.data);
+    }
+
+  const size_t mode_byte = offsetof(velodyne_rawdata::raw_packet_t, status)
+    + velodyne_rawdata::PACKET_STATUS_SIZE - 2;
+  size_t next = 0;
+  velodyne_msgs::VelodyneScanPtr scan(new VelodyneScan);
+  while (file.next(&packet))
+    {
+      if (next < starts.size() && packet.data == starts[next])
+        {
+          ++next;
+          if (!scan->packets.empty())
+            scans.push_back(scan);
+          scan.reset(new VelodyneScan);
+        }
+      scan->packets.push_back(velodyne_msgs::VelodynePacket());
+      velodyne_msgs::VelodynePacket &pkt = scan->packets.back();
+      pkt.stamp.fromNSec(packet.stamp);
+      memcpy(&pkt.data[0], packet.data, packet.len);
+      if (dual)
+        pkt.data[mode_byte] = 0x39;
+      scan->header.stamp = scan->packets[0].stamp;
+      scan->header.frame_id = g_sensor_frame;
+    }
+  if (!scan->packets.empty())
+    scans.push_back(scan);
+  return !scans.empty();
+}
+
+/** @returns number of valid points in an organized cloud */
+size_t countPoints(const velodyne_rawdata::VPointCloud &cloud)
+{
+  size_t points = 0;
+  for (size_t i = 0; i < cloud.points.size(); ++i)
+    if (!isnan(cloud.points[i].x))
+      ++points;
+  return points;
+}
+
+/** Time the conversion of every scan to a point cloud. */
+void benchmarkUnpack(ros::NodeHandle private_nh, const Model &model,
+                     const std::string &name,
+                     const std::vector<VelodyneScan::ConstPtr> &scans,
+                     tf::TransformListener *listener)
+{
+  ros::NodeHandle case_nh(private_nh, model.name);
+  case_nh.setParam("calibration", g_package_path + "/params/"
+                   + model.calibration);
+  velodyne_rawdata::RawData data;
+  if (data.setup(case_nh, listener) != 0)
+    return;
+  data.setParameters(0.9, 130.0, 0.0, 2.0 * M_PI,
+                     listener? g_target_frame: std::string(""));
+
+  // count the points, warming up the caches
+  velodyne_rawdata::VPointCloud cloud;
+  double points = 0;
+  for (size_t i = 0; i < scans.size(); ++i)
+    {
+      data.unpack(scans[i], cloud);
+      points += countPoints(cloud);
+    }
+  if (points == 0)
+    {
+      ROS_ERROR_STREAM(name << ": no points");
+      return;
+    }
+
+  size_t iterations = 0;
+  double elapsed;
+  ros::WallTime start = ros::WallTime::now();
+  do
+    {
+      for (size_t i = 0; i < scans.size(); ++i)
+        data.unpack(scans[i], cloud);
+      ++iterations;
+      elapsed = (ros::WallTime::now() - start).toSec();
+    }
+  while (elapsed < g_min_time);
+  report(name, "point", iterations, iterations * points, elapsed);
+}
+
+/** Time reading packets through the driver's InputPCAP. */
+void benchmarkInput(ros::NodeHandle private_nh, const Model &model,
+                    const std::string &name, const std::string &filename,
+                    size_t packets)
+{
+  ros::NodeHandle input_nh(private_nh, std::string(model.name) + "_input");
+  input_nh.setParam("read_fast", true);
+  velodyne_driver::InputPCAP input(input_nh,
+                                   velodyne_driver::DATA_PORT_NUMBER,
+                                   filename);
+  velodyne_msgs::VelodynePacket packet;
+
+  size_t iterations = 0;
+  double elapsed;
+  ros::WallTime start = ros::WallTime::now();
+  do
+    {
+      // the input starts over at the end of the file
+      for (size_t i = 0; i < packets; ++i)
+        if (input.getPacket(&packet, 0.0) != 0)
+          return;
+      ++iterations;
+      elapsed = (ros::WallTime::now() - start).toSec();
+    }
+  while (elapsed < g_min_time);
+  report(name, "packet", iterations, (double) iterations * packets, elapsed);
+}
+
+/** Run all the cases of one model. */
+void benchmarkModel(ros::NodeHandle private_nh, const Model &model)
+{
+  std::string filename = g_package_path + "/tests/" + model.pcap;
+  std::string prefix = std::string(model.name) + "/";
+  const char *unpack = model.vlp16? "unpack_vlp16/": "unpack/";
+
+  for (int dual = 0; dual <= (model.vlp16? 1: 0); ++dual)
+    {
+      std::string mode = dual? "dual/": "";
+      std::string sensor = prefix + unpack + mode + "sensor";
+      std::string target = prefix + unpack + mode + "target";
+      if (!selected(sensor) && !selected(target))
+        continue;
+
+      std::vector<VelodyneScan::ConstPtr> scans;
+      if (!readScans(filename, dual, scans))
+        return;
+
+      if (selected(sensor))
+        benchmarkUnpack(private_nh, model, sensor, scans, NULL);
+
+      if (selected(target))
+        {
+          // a fixed sensor pose, from before to after the capture
+          ros::Time first = scans.front()->packets.front().stamp;
+          ros::Time last = scans.back()->packets.back().stamp;
+          tf::TransformListener listener(last - first + ros::Duration(10.0));
+          tf::Transform pose(tf::Quaternion(0.0, 0.0, sin(0.25), cos(0.25)),
+                             tf::Vector3(1.0, 2.0, 0.5));
+          listener.setTransform(tf::StampedTransform(pose,
+                                                     first - ros::Duration(1.0),
+                                                     g_target_frame,
+                                                     g_sensor_frame),
+                                "velodyne_benchmarks");
+          listener.setTransform(tf::StampedTransform(pose,
+                                                     last + ros::Duration(1.0),
+                                                     g_target_frame,
+                                                     g_sensor_frame),
+                                "velodyne_benchmarks");
+          benchmarkUnpack(private_nh, model, target, scans, &listener);
+        }
+    }
+
+  std::string input = prefix + "pcap_input";
+  if (selected(input))
+    {
+      velodyne_driver::PcapFile file;
+      std::string error;
+      if (!file.open(filename, velodyne_driver::DATA_PORT_NUMBER, 0,
+                     velodyne_rawdata::PACKET_SIZE, &error))
+        {
+          ROS_ERROR("Unable to open %s: %s", filename.c_str(), error.c_str());
+          return;
+        }
+      size_t packets = file.packets();
+      file.close();
+      if (packets > 0)
+        benchmarkInput(private_nh, model, input, filename, packets);
+    }
+}
+
+/** @brief Write the results as JSON.
+ *
+ *  @returns true if successful
+ */
+bool writeResults(const std::string &filename)
+{
+  FILE *file = fopen(filename.c_str(), "w");
+  if (file == NULL)
+    return false;
+  fprintf(file, "{\n  \"min_time\": %.3f,\n  \"benchmarks\": [", g_min_time);
+  for (size_t i = 0; i < g_results.size(); ++i)
+    {
+      const Result &result = g_results[i];
+      fprintf(file, "%s\n    {\"name\": \"%s\", \"unit\": \"%s\", "
+              "\"iterations\": %zu, \"items\": %.0f, \"seconds\": %.6f, "
+              "\"ns_per_item\": %.3f, \"items_per_second\": %.1f}",
+              i == 0? "": ",", result.name.c_str(), result.unit.c_str(),
+              result.iterations, result.items, result.seconds,
+              result.seconds * 1.0e9 / result.items,
+              result.items / result.seconds);
+    }
+  fprintf(file, "\n  ]\n}\n");
+  return fclose(file) == 0;
+}
+
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "velodyne_benchmarks");
+  ros::NodeHandle private_nh("~");
+  std::string output;
+  private_nh.param("min_time", g_min_time, 1.0);
+  private_nh.param("filter", g_filter, std::string(""));
+  private_nh.param("output", output, std::string(""));
+  g_package_path = ros::package::getPath("velodyne_pointcloud");
+
+  for (size_t i = 0; i < sizeof(g_models) / sizeof(g_models[0]); ++i)
+    benchmarkModel(private_nh, g_models[i]);
+
+  if (!output.empty() && !writeResults(output))
+    {
+      ROS_ERROR("Unable to write %s", output.c_str());
+      return 1;
+    }
+  return g_results.empty()? 1: 0;
+}